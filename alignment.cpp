@@ -63,6 +63,7 @@ Alignment::Alignment()
     seq_type = SEQ_UNKNOWN;
     STATE_UNKNOWN = 126;
     pars_lower_bound = NULL;
+    packed_seqs = NULL;
 }
 
 string &Alignment::getSeqName(int i) {
@@ -336,6 +337,7 @@ Alignment::Alignment(char *filename, char *sequence_type, InputType &intype) : v
     seq_type = SEQ_UNKNOWN;
     STATE_UNKNOWN = 126;
     pars_lower_bound = NULL;
+    packed_seqs = NULL;
     cout << "Reading alignment file " << filename << " ... ";
     intype = detectInputFile(filename);
 
@@ -2420,6 +2422,29 @@ void Alignment::createBootstrapAlignment(IntVector &pattern_freq, const char *sp
     delete [] internal_freq;
 }
 
+void Alignment::createBootstrapAlignments(BootSampleMatrix &samples, const char *spec, int seed) {
+    size_t nsamples = samples.size();
+    // for a SuperAlignment the replicate packs the patterns of all partitions one after the other
+    assert(samples.getNPattern() == getNBootPattern());
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+        int *pattern_freq = new int[samples.getNPattern()];
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 16)
+#endif
+        for (size_t sample = 0; sample < nsamples; sample++) {
+            int *rstream;
+            init_random_task(seed, sample, &rstream);
+            createBootstrapAlignment(pattern_freq, spec, rstream);
+            samples.setSample(sample, pattern_freq);
+            finish_random(rstream);
+        }
+        delete [] pattern_freq;
+    }
+}
+
 void Alignment::createBootstrapAlignment(int *pattern_freq, const char *spec, int *rstream) {
     int site, nsite = getNSite();
     memset(pattern_freq, 0, getNPattern()*sizeof(int));
@@ -2651,6 +2676,7 @@ Alignment::~Alignment()
 //		delete [] non_stop_codon;
 //		non_stop_codon = NULL;
 //	}
+    clearPackedSeqs();
     if (pars_lower_bound) {
         delete [] pars_lower_bound;
         pars_lower_bound = NULL;
@@ -2661,8 +2687,13 @@ Alignment::~Alignment()
     site_model.clear();
 }
 
-double Alignment::computeObsDist(int seq1, int seq2) {
-    int diff_pos = 0, total_pos = 0;
+void Alignment::countObsDiff(int seq1, int seq2, int &diff_pos, int &total_pos) {
+    if (packed_seqs) {
+        packed_seqs->countDiff(seq1, seq2, diff_pos, total_pos);
+        return;
+    }
+    diff_pos = 0;
+    total_pos = 0;
     for (iterator it = begin(); it != end(); it++)
         if  ((*it)[seq1] < num_states && (*it)[seq2] < num_states) {
             //if ((*it)[seq1] != STATE_UNKNOWN && (*it)[seq2] != STATE_UNKNOWN) {
@@ -2670,6 +2701,24 @@ double Alignment::computeObsDist(int seq1, int seq2) {
             if ((*it)[seq1] != (*it)[seq2] )
                 diff_pos += (*it).frequency;
         }
+}
+
+void Alignment::buildPackedSeqs() {
+    if (packed_seqs)
+        return;
+    packed_seqs = new PackedSeqs;
+    packed_seqs->init(this);
+}
+
+void Alignment::clearPackedSeqs() {
+    if (packed_seqs)
+        delete packed_seqs;
+    packed_seqs = NULL;
+}
+
+double Alignment::computeObsDist(int seq1, int seq2) {
+    int diff_pos, total_pos;
+    countObsDiff(seq1, seq2, diff_pos, total_pos);
     if (!total_pos) {
         if (verbose_mode >= VB_MED)
             outWarning("No overlapping characters between " + getSeqName(seq1) + " and " + getSeqName(seq2));
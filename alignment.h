@@ -17,6 +17,8 @@
 #include "pattern.h"
 #include "ncl/ncl.h"
 #include "tools.h"
+#include "bootsample.h"
+#include "packedseqs.h"
 
 // IMPORTANT: refactor STATE_UNKNOWN
 //const char STATE_UNKNOWN = 126;
@@ -161,6 +163,9 @@ public:
     /** lower bound of sum parsimony scores for remaining pattern in ordered_pattern */
     UINT *pars_lower_bound;
 
+    /** bit-packed sequences for computeObsDist(), NULL if not built */
+    PackedSeqs *packed_seqs;
+
     /** order pattern by number of character states and return in ptn_order
     */
     virtual void orderPatternByNumChars();
@@ -405,6 +410,23 @@ public:
      */
     virtual void createBootstrapAlignment(int *pattern_freq, const char *spec = NULL, int *rstream = NULL);
 
+    /**
+            resampling pattern frequencies of many bootstrap replicates at once, in parallel.
+            Replicate i draws from its own random stream initialized by init_random_task(seed, i),
+            thus the replicates do not depend on the number of threads
+            @param samples (OUT) replicates, initialized with the number of replicates and patterns
+            @param spec bootstrap specification, see above
+            @param seed random seed
+     */
+    void createBootstrapAlignments(BootSampleMatrix &samples, const char *spec, int seed);
+
+    /**
+            @return number of pattern frequencies of a bootstrap replicate, see createBootstrapAlignment(int*)
+     */
+    virtual size_t getNBootPattern() {
+        return getNPattern();
+    }
+
     /**
             create a gap masked alignment from an input alignment. Gap patterns of masked_aln 
                     will be superimposed into aln to create the current alignment object.
@@ -463,6 +485,25 @@ public:
      */
     virtual double computeObsDist(int seq1, int seq2);
 
+    /**
+            count the sites compared by computeObsDist(), using the bit-packed sequences if built
+            @param seq1 index of sequence 1
+            @param seq2 index of sequence 2
+            @param diff_pos (OUT) number of sites with different unambiguous states
+            @param total_pos (OUT) number of sites where both sequences have an unambiguous state
+     */
+    void countObsDiff(int seq1, int seq2, int &diff_pos, int &total_pos);
+
+    /**
+            build the bit-packed sequences to speed up computeObsDist() for all pairs of sequences
+     */
+    virtual void buildPackedSeqs();
+
+    /**
+            free the bit-packed sequences
+     */
+    virtual void clearPackedSeqs();
+
     /**
             @param seq1 index of sequence 1
             @param seq2 index of sequence 2
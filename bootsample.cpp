@@ -0,0 +1,71 @@
+//
+// C++ Implementation: bootsample.cpp
+//
+// Description: BootSampleMatrix, compact storage of bootstrap pattern counts
+//
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+
+#include "bootsample.h"
+
+BootSampleMatrix::BootSampleMatrix() {
+    nsamples = 0;
+    nptn = 0;
+    counts = NULL;
+}
+
+BootSampleMatrix::~BootSampleMatrix() {
+    clear();
+}
+
+void BootSampleMatrix::init(size_t nsamples, size_t nptn) {
+    clear();
+    this->nsamples = nsamples;
+    this->nptn = nptn;
+    if (nsamples == 0)
+        return;
+    counts = new unsigned char[nsamples*nptn];
+    memset(counts, 0, nsamples*nptn);
+    overflow.resize(nsamples);
+}
+
+void BootSampleMatrix::clear() {
+    if (counts)
+        delete [] counts;
+    counts = NULL;
+    overflow.clear();
+    nsamples = 0;
+    nptn = 0;
+}
+
+void BootSampleMatrix::setSample(size_t sample, int *pattern_freq) {
+    assert(sample < nsamples);
+    unsigned char *this_counts = counts + sample*nptn;
+    overflow[sample].clear();
+    for (size_t ptn = 0; ptn < nptn; ptn++) {
+        if (pattern_freq[ptn] < BOOT_COUNT_OVERFLOW) {
+            this_counts[ptn] = pattern_freq[ptn];
+        } else {
+            this_counts[ptn] = BOOT_COUNT_OVERFLOW;
+            overflow[sample].push_back(make_pair((int)ptn, pattern_freq[ptn]));
+        }
+    }
+}
+
+int BootSampleMatrix::getCount(size_t sample, size_t ptn) {
+    unsigned char count = counts[sample*nptn + ptn];
+    if (count < BOOT_COUNT_OVERFLOW)
+        return count;
+    vector<pair<int, int> >::iterator it = lower_bound(overflow[sample].begin(), overflow[sample].end(), make_pair((int)ptn, 0));
+    assert(it != overflow[sample].end() && (size_t)it->first == ptn);
+    return it->second;
+}
+
+size_t BootSampleMatrix::getMemorySize() {
+    size_t mem = nsamples*nptn;
+    for (size_t i = 0; i < overflow.size(); i++)
+        mem += overflow[i].capacity() * sizeof(pair<int, int>);
+    return mem;
+}
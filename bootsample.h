@@ -0,0 +1,133 @@
+//
+// C++ Interface: bootsample.h
+//
+// Description: compact storage of bootstrap pattern counts
+//
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+
+#ifndef BOOTSAMPLE_H
+#define BOOTSAMPLE_H
+
+#include "tools.h"
+
+/** pattern count stored in BootSampleMatrix meaning that the real count is in the overflow list */
+const unsigned char BOOT_COUNT_OVERFLOW = 255;
+
+/**
+    Pattern counts of many bootstrap replicates, one byte per pattern and replicate.
+    Counts that do not fit into a byte (e.g. constant patterns of phylogenomic alignments)
+    are kept in a sparse overflow list of the replicate.
+    Compared with one int or double per pattern, this needs 4 to 8 times less memory.
+*/
+class BootSampleMatrix {
+public:
+
+    BootSampleMatrix();
+
+    ~BootSampleMatrix();
+
+    /**
+        allocate memory for the given number of replicates, all counts zero
+        @param nsamples number of bootstrap replicates
+        @param nptn number of patterns
+    */
+    void init(size_t nsamples, size_t nptn);
+
+    /**
+        free all memory
+    */
+    void clear();
+
+    /** @return number of bootstrap replicates */
+    size_t size() {
+        return nsamples;
+    }
+
+    /** @return TRUE if there is no replicate */
+    bool empty() {
+        return nsamples == 0;
+    }
+
+    /** @return number of patterns */
+    size_t getNPattern() {
+        return nptn;
+    }
+
+    /**
+        store the pattern counts of one replicate, different replicates can be set in parallel
+        @param sample replicate ID
+        @param pattern_freq nptn pattern counts, e.g. from Alignment::createBootstrapAlignment()
+    */
+    void setSample(size_t sample, int *pattern_freq);
+
+    /**
+        @param sample replicate ID
+        @param ptn pattern ID
+        @return count of the pattern in the replicate
+    */
+    int getCount(size_t sample, size_t ptn);
+
+    /**
+        copy counts of consecutive patterns into a dense vector
+        @param sample replicate ID
+        @param start first pattern
+        @param len number of patterns
+        @param[out] counts len pattern counts
+    */
+    template <class Numeric>
+    void getCounts(size_t sample, size_t start, size_t len, Numeric *counts);
+
+    /**
+        @param sample replicate ID
+        @param pattern_lh pattern log-likelihoods of a tree
+        @return RELL log-likelihood of the tree on the replicate, i.e. the sum of pattern_lh weighted by the counts
+    */
+    template <class Numeric>
+    double dotProduct(size_t sample, Numeric *pattern_lh);
+
+    /** @return number of bytes used */
+    size_t getMemorySize();
+
+protected:
+
+    /** number of replicates */
+    size_t nsamples;
+
+    /** number of patterns */
+    size_t nptn;
+
+    /** nsamples x nptn counts, BOOT_COUNT_OVERFLOW if the count is in the overflow list */
+    unsigned char *counts;
+
+    /** for each replicate, the patterns and counts that do not fit into a byte, sorted by pattern */
+    vector<vector<pair<int, int> > > overflow;
+
+};
+
+template <class Numeric>
+void BootSampleMatrix::getCounts(size_t sample, size_t start, size_t len, Numeric *out) {
+    unsigned char *this_counts = counts + sample*nptn + start;
+    for (size_t i = 0; i < len; i++)
+        out[i] = this_counts[i];
+    for (vector<pair<int, int> >::iterator it = overflow[sample].begin(); it != overflow[sample].end(); it++)
+        if ((size_t)it->first >= start && (size_t)it->first < start + len)
+            out[it->first - start] = it->second;
+}
+
+template <class Numeric>
+double BootSampleMatrix::dotProduct(size_t sample, Numeric *pattern_lh) {
+    unsigned char *this_counts = counts + sample*nptn;
+    Numeric res = 0.0;
+    for (size_t ptn = 0; ptn < nptn; ptn++)
+        res += pattern_lh[ptn] * this_counts[ptn];
+    double lh = res;
+    // correct the overflowed counts
+    for (vector<pair<int, int> >::iterator it = overflow[sample].begin(); it != overflow[sample].end(); it++)
+        lh += (double)pattern_lh[it->first] * (it->second - BOOT_COUNT_OVERFLOW);
+    return lh;
+}
+
+#endif
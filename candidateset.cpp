@@ -159,12 +159,12 @@ bool CandidateSet::update(string tree, double score, bool localOpt) {
 	bool newTree = true;
 	CandidateTree candidate;
 	candidate.score = score;
-	candidate.topology = getTopology(tree);
+	candidate.topology = topology_table.addTopology(getTopology(tree));
 	candidate.localOpt = localOpt;
 //	cout << "Updating candidate tree " << tree << endl;
 	candidate.tree = tree;
 
-	if (treeTopologyExist(candidate.topology)) {
+	if (topologies.find(candidate.topology) != topologies.end()) {
 		newTree = false;
 	    /* If tree topology already exist but the score is better, we replace the old one
 	    by the new one (with new branch lengths) and update the score */
@@ -197,9 +197,25 @@ bool CandidateSet::update(string tree, double score, bool localOpt) {
 		}
 	}
 	assert(topologies.size() == size());
+	compactTopologies();
 	return newTree;
 }
 
+void CandidateSet::compactTopologies() {
+	if (topology_table.size() <= 2*size())
+		return;
+	IntVector ids;
+	for (iterator it = begin(); it != end(); it++)
+		ids.push_back(it->second.topology);
+	topology_table.compact(ids);
+	topologies.clear();
+	IntVector::iterator id = ids.begin();
+	for (iterator it = begin(); it != end(); it++, id++) {
+		it->second.topology = *id;
+		topologies[*id] = it->first;
+	}
+}
+
 vector<double> CandidateSet::getBestScores(int numBestScore) {
 	if (numBestScore == 0)
 		numBestScore = size();
@@ -222,6 +238,8 @@ double CandidateSet::getWorstScore() {
 }
 
 string CandidateSet::getTopology(string tree) {
+    if (tree == last_tree)
+        return last_topology;
 //	PhyloTree mtree;
 //	mtree.rooted = params->is_rooted;
 //	mtree.aln = this->aln;
@@ -244,17 +262,21 @@ string CandidateSet::getTopology(string tree) {
 
 	ostringstream ostr;
 	mtree.printTree(ostr, WT_TAXON_ID | WT_SORT_TAXA);
-	return ostr.str();
+	last_tree = tree;
+	last_topology = ostr.str();
+	return last_topology;
 }
 
 double CandidateSet::getTopologyScore(string topology) {
-	assert(topologies.find(topology) != topologies.end());
-	return topologies[topology];
+	int id = topology_table.findTopology(topology);
+	assert(topologies.find(id) != topologies.end());
+	return topologies[id];
 }
 
 void CandidateSet::clear() {
 	multimap<double, CandidateTree>::clear();
 	clearTopologies();
+	topology_table.clear();
 }
 
 void CandidateSet::clearTopologies() {
@@ -267,20 +289,24 @@ CandidateSet CandidateSet::getBestCandidateTrees(int numTrees) {
 	if (numTrees >= size())
 		numTrees = size();
 	for (reverse_iterator rit = rbegin(); rit != rend() && numTrees > 0; rit++, numTrees--) {
-		res.insert(*rit);
+		CandidateTree candidate = rit->second;
+		candidate.topology = res.topology_table.addTopology(topology_table.getTopology(candidate.topology));
+		res.insert(CandidateSet::value_type(rit->first, candidate));
+		res.topologies[candidate.topology] = rit->first;
 	}
 	return res;
 }
 
 bool CandidateSet::treeTopologyExist(string topo) {
-	return (topologies.find(topo) != topologies.end());
+	int id = topology_table.findTopology(topo);
+	return (id >= 0 && topologies.find(id) != topologies.end());
 }
 
 bool CandidateSet::treeExist(string tree) {
 	return treeTopologyExist(getTopology(tree));
 }
 
-CandidateSet::iterator CandidateSet::getCandidateTree(string topology) {
+CandidateSet::iterator CandidateSet::getCandidateTree(int topology) {
 	for (CandidateSet::reverse_iterator rit = rbegin(); rit != rend(); rit++) {
 		if (rit->second.topology == topology)
 			return --(rit.base());
@@ -288,7 +314,7 @@ CandidateSet::iterator CandidateSet::getCandidateTree(string topology) {
 	return end();
 }
 
-void CandidateSet::removeCandidateTree(string topology) {
+void CandidateSet::removeCandidateTree(int topology) {
 	bool removed = false;
 	for (CandidateSet::reverse_iterator rit = rbegin(); rit != rend(); rit++) {
 			if (rit->second.topology == topology) {
@@ -12,6 +12,7 @@
 #include "mtreeset.h"
 #include <stack>
 #include "checkpoint.h"
+#include "topologytable.h"
 
 struct CandidateTree {
 
@@ -23,11 +24,10 @@ struct CandidateTree {
 
 
 	/**
-	 * tree topology WITHOUT branch lengths
-	 * and WITH TAXON ID (instead of taxon names)
-	 * for sorting purpose
+	 * ID in the topology table of the CandidateSet of the tree topology
+	 * (WITHOUT branch lengths and WITH TAXON ID instead of taxon names)
 	 */
-	string topology;
+	int topology;
 
 	/**
 	 * log-likelihood or parsimony score
@@ -227,16 +227,16 @@ public:
 
     /**
      * Return a pointer to the \a CandidateTree that has topology equal to \a topology
-     * @param topology
+     * @param topology topology ID
      * @return
      */
-    iterator getCandidateTree(string topology);
+    iterator getCandidateTree(int topology);
 
     /**
      * Remove the \a CandidateTree with topology equal to \a topology
-     * @param topology
+     * @param topology topology ID
      */
-    void removeCandidateTree(string topology);
+    void removeCandidateTree(int topology);
 
     /* Getter and Setter function */
 	void setAln(Alignment* aln);
@@ -245,7 +245,7 @@ public:
 	int getPopSize() const;
 	void setPopSize(int popSize);
 	void setIsRooted(bool isRooted);
-	const StringDoubleHashMap& getTopologies() const {
+	const unordered_map<int, double>& getTopologies() const {
 		return topologies;
 	}
 
@@ -279,15 +279,33 @@ private:
     Params* params;
 
     /**
-     *  Map data structure storing <topology_string, score>
+     *  Map data structure storing <topology ID, score> of the trees in the set
+     */
+    unordered_map<int, double> topologies;
+
+    /**
+     *  Topologies of the trees in the set, each string stored once; also of trees
+     *  removed from the set until the next compactTopologies()
      */
-    StringDoubleHashMap topologies;
+    TopologyTable topology_table;
+
+    /**
+     *  Drop the topologies of removed trees from topology_table once they are
+     *  the majority, and renumber the topology IDs of the trees in the set
+     */
+    void compactTopologies();
 
     /**
      *  Trees used for reproduction
      */
     stack<string> parentTrees;
 
+    /**
+     *  Last tree converted by getTopology() and its topology, as the same tree
+     *  is often checked by treeExist() right before update()
+     */
+    string last_tree, last_topology;
+
     /**
      * pointer to alignment, just to assign correct IDs for taxa
      */
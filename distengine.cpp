@@ -0,0 +1,295 @@
+//
+// C++ Implementation: distengine.cpp
+//
+// Description: DistEngine, tiled, multithreaded engine for ML pairwise distances
+//
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+
+#include "distengine.h"
+#include "phylotree.h"
+#include "model/modelgtr.h"
+
+/** number of grid distances, log-spaced between DIST_GRID_MIN and MAX_GENETIC_DIST */
+const int DIST_GRID_SIZE = 32;
+const double DIST_GRID_MIN = 0.001;
+
+/** bytes of the pair frequency tables of one tile */
+const int DIST_TILE_BYTES = 256*1024;
+
+DistEngine::DistEngine(PhyloTree *tree) {
+    this->tree = tree;
+    eigenvalues = NULL;
+    coeff = NULL;
+    grid_logtrans = NULL;
+    init();
+}
+
+DistEngine::~DistEngine() {
+    if (grid_logtrans)
+        delete [] grid_logtrans;
+    if (coeff)
+        delete [] coeff;
+    if (eigenvalues)
+        delete [] eigenvalues;
+}
+
+bool DistEngine::isSupported(PhyloTree *tree) {
+    if (!tree->getModelFactory() || !tree->getRate())
+        return false;
+    ModelSubst *model = tree->getModel();
+    if (model->isSiteSpecificModel() || model->isMixture() || !model->isReversible())
+        return false;
+    if (tree->getRate()->isSiteSpecificRate())
+        return false;
+    return model->getEigenvalues() && dynamic_cast<ModelGTR*>(model);
+}
+
+void DistEngine::init() {
+    ModelGTR *model = (ModelGTR*)tree->getModel();
+    RateHeterogeneity *site_rate = tree->getRate();
+    Alignment *aln = tree->aln;
+    int nptn = aln->getNPattern();
+    int ncat = site_rate->getNDiscreteRate();
+    int i, j, k, c;
+    num_states = aln->num_states;
+    trans_size = num_states * num_states;
+
+    // same rates as AlignmentPairwise
+    table_rates.clear();
+    ptn_table.assign(nptn, 0);
+    if (nptn > 0 && site_rate->getPtnCat(0) >= 0) {
+        ntables = ncat;
+        for (c = 0; c < ncat; c++)
+            table_rates.push_back(DoubleVector(1, site_rate->getRate(c)));
+        for (i = 0; i < nptn; i++)
+            ptn_table[i] = site_rate->getPtnCat(i);
+    } else {
+        ntables = 1;
+        table_rates.push_back(DoubleVector());
+        if (site_rate->getGammaShape() == 0.0)
+            table_rates[0].push_back(1.0);
+        else
+            for (c = 0; c < ncat; c++)
+                table_rates[0].push_back(site_rate->getRate(c));
+    }
+
+    double *evals = model->getEigenvalues();
+    double *evec = model->getEigenvectors();
+    double *inv_evec = model->getInverseEigenvectors();
+    eigenvalues = new double[num_states];
+    for (k = 0; k < num_states; k++)
+        eigenvalues[k] = evals[k] / model->total_num_subst;
+    coeff = new double[trans_size*num_states];
+    for (i = 0; i < num_states; i++)
+        for (j = 0; j < num_states; j++)
+            for (k = 0; k < num_states; k++)
+                coeff[(i*num_states+j)*num_states+k] = evec[i*num_states+k] * inv_evec[k*num_states+j];
+
+    // transition matrices of the grid, once for all pairs
+    int ngrid = DIST_GRID_SIZE;
+    grid.resize(ngrid);
+    for (int g = 0; g < ngrid; g++)
+        grid[g] = DIST_GRID_MIN * pow(MAX_GENETIC_DIST / DIST_GRID_MIN, (double)g / (ngrid-1));
+    grid_logtrans = new double[ntables*trans_size*ngrid];
+    memset(grid_logtrans, 0, sizeof(double)*ntables*trans_size*ngrid);
+    double *exptime = new double[num_states];
+    for (c = 0; c < ntables; c++)
+        for (DoubleVector::iterator rate = table_rates[c].begin(); rate != table_rates[c].end(); rate++)
+            for (int g = 0; g < ngrid; g++) {
+                for (k = 0; k < num_states; k++)
+                    exptime[k] = exp(eigenvalues[k] * (*rate) * grid[g]);
+                for (i = 0; i < trans_size; i++) {
+                    double *coeff_entry = coeff + i*num_states;
+                    double trans = 0.0;
+                    for (k = 0; k < num_states; k++)
+                        trans += coeff_entry[k] * exptime[k];
+                    if (trans > 0.0)
+                        grid_logtrans[(c*trans_size+i)*ngrid+g] += trans;
+                }
+            }
+    delete [] exptime;
+    for (i = 0; i < ntables*trans_size*ngrid; i++)
+        grid_logtrans[i] = log(max(grid_logtrans[i], 1e-300));
+}
+
+void DistEngine::computeDist(double *dist_mat, double *d2l_mat) {
+    Alignment *aln = tree->aln;
+    int nseqs = aln->getNSeq();
+    int nptn = aln->getNPattern();
+    int table_size = ntables * trans_size;
+
+    // square tiles of sequences whose pair frequency tables fit into the cache
+    int tile = (int)sqrt((double)DIST_TILE_BYTES / (sizeof(int)*table_size));
+    tile = max(4, min(tile, 64));
+    int nblocks = (nseqs + tile - 1) / tile;
+    vector<pair<int,int> > tiles;
+    for (int row = 0; row < nblocks; row++)
+        for (int col = row; col < nblocks; col++)
+            tiles.push_back(make_pair(row, col));
+    int ntiles = tiles.size();
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+        int *tables = new int[tile*tile*table_size];
+        DistEnginePair pair(this);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (int t = 0; t < ntiles; t++) {
+            int row_start = tiles[t].first * tile, row_end = min(row_start + tile, nseqs);
+            int col_start = tiles[t].second * tile, col_end = min(col_start + tile, nseqs);
+            memset(tables, 0, sizeof(int)*tile*tile*table_size);
+            // one pass over the patterns for all pairs of the tile
+            for (int ptn = 0; ptn < nptn; ptn++) {
+                Pattern &pat = aln->at(ptn);
+                int freq = pat.frequency;
+                int *ptn_tables = tables + ptn_table[ptn]*trans_size;
+                for (int seq1 = row_start; seq1 < row_end; seq1++) {
+                    int state1 = (unsigned char)pat[seq1];
+                    if (state1 >= num_states)
+                        continue;
+                    int *row_tables = ptn_tables + (seq1-row_start)*tile*table_size + state1*num_states;
+                    for (int seq2 = max(col_start, seq1+1); seq2 < col_end; seq2++) {
+                        int state2 = (unsigned char)pat[seq2];
+                        if (state2 < num_states)
+                            row_tables[(seq2-col_start)*table_size + state2] += freq;
+                    }
+                }
+            }
+            for (int seq1 = row_start; seq1 < row_end; seq1++)
+                for (int seq2 = max(col_start, seq1+1); seq2 < col_end; seq2++) {
+                    int pos = seq1 * nseqs + seq2;
+                    pair.setFreq(tables + ((seq1-row_start)*tile + seq2-col_start)*table_size);
+                    if (pair.isEmpty()) {
+                        // no common site: JC distance as AlignmentPairwise
+                        dist_mat[pos] = min(max(aln->computeDist(seq1, seq2), Params::getInstance().min_branch_length), MAX_GENETIC_DIST);
+                        d2l_mat[pos] = 0.0;
+                    } else
+                        dist_mat[pos] = pair.optimizeDist(d2l_mat[pos]);
+                }
+        }
+        delete [] tables;
+    }
+}
+
+/****************************************************************************
+        DistEnginePair
+ ****************************************************************************/
+
+DistEnginePair::DistEnginePair(DistEngine *aengine) : Optimization() {
+    engine = aengine;
+    exptime.resize(engine->num_states);
+    exptime1.resize(engine->num_states);
+    exptime2.resize(engine->num_states);
+}
+
+void DistEnginePair::setFreq(int *table) {
+    int trans_size = engine->trans_size;
+    table_begin.clear();
+    freq_index.clear();
+    freq.clear();
+    for (int c = 0; c < engine->ntables; c++) {
+        table_begin.push_back(freq.size());
+        int *freq_table = table + c*trans_size;
+        for (int i = 0; i < trans_size; i++)
+            if (freq_table[i] > 0) {
+                freq_index.push_back(i);
+                freq.push_back(freq_table[i]);
+            }
+    }
+    table_begin.push_back(freq.size());
+}
+
+double DistEnginePair::optimizeDist(double &d2l) {
+    // best distance of the grid as initial guess
+    int ngrid = engine->grid.size();
+    double *score = new double[ngrid];
+    memset(score, 0, sizeof(double)*ngrid);
+    for (int c = 0; c < engine->ntables; c++)
+        for (int e = table_begin[c]; e < table_begin[c+1]; e++) {
+            double *logtrans = engine->grid_logtrans + (c*engine->trans_size + freq_index[e])*ngrid;
+            double f = freq[e];
+            for (int g = 0; g < ngrid; g++)
+                score[g] += f * logtrans[g];
+        }
+    int best = 0;
+    for (int g = 1; g < ngrid; g++)
+        if (score[g] > score[best])
+            best = g;
+    delete [] score;
+
+    double dist = engine->grid[best];
+    double min_dist = Params::getInstance().min_branch_length;
+    d2l = -1.0;
+    if (engine->tree->optimize_by_newton)
+        dist = minimizeNewton(min_dist, dist, MAX_GENETIC_DIST, min_dist, d2l);
+    else {
+        double negative_lh, ferror;
+        dist = minimizeOneDimen(min_dist, dist, MAX_GENETIC_DIST, min_dist, &negative_lh, &ferror);
+    }
+    return dist;
+}
+
+void DistEnginePair::computeTrans(double value, bool derv) {
+    int num_states = engine->num_states;
+    size_t nfreq = freq.size();
+    trans.assign(nfreq, 0.0);
+    if (derv) {
+        trans1.assign(nfreq, 0.0);
+        trans2.assign(nfreq, 0.0);
+    }
+    for (int c = 0; c < engine->ntables; c++) {
+        if (table_begin[c] == table_begin[c+1])
+            continue;
+        DoubleVector &rates = engine->table_rates[c];
+        for (DoubleVector::iterator rate = rates.begin(); rate != rates.end(); rate++) {
+            for (int k = 0; k < num_states; k++) {
+                double eval = engine->eigenvalues[k] * (*rate);
+                exptime[k] = exp(eval * value);
+                exptime1[k] = exptime[k] * eval;
+                exptime2[k] = exptime1[k] * eval;
+            }
+            for (int e = table_begin[c]; e < table_begin[c+1]; e++) {
+                double *coeff_entry = engine->coeff + freq_index[e]*num_states;
+                double p = 0.0;
+                for (int k = 0; k < num_states; k++)
+                    p += coeff_entry[k] * exptime[k];
+                if (p > 0.0)
+                    trans[e] += p;
+                if (!derv)
+                    continue;
+                double p1 = 0.0, p2 = 0.0;
+                for (int k = 0; k < num_states; k++) {
+                    p1 += coeff_entry[k] * exptime1[k];
+                    p2 += coeff_entry[k] * exptime2[k];
+                }
+                trans1[e] += p1;
+                trans2[e] += p2;
+            }
+        }
+    }
+}
+
+double DistEnginePair::computeFunction(double value) {
+    computeTrans(value, false);
+    double lh = 0.0;
+    for (size_t e = 0; e < freq.size(); e++)
+        lh -= freq[e] * log(trans[e]);
+    return lh;
+}
+
+void DistEnginePair::computeFuncDerv(double value, double &df, double &ddf) {
+    computeTrans(value, true);
+    df = ddf = 0.0;
+    for (size_t e = 0; e < freq.size(); e++)
+        if (trans[e] > 0.0) {
+            double d1 = trans1[e] / trans[e];
+            df -= freq[e] * d1;
+            ddf -= freq[e] * (trans2[e] / trans[e] - d1 * d1);
+        }
+}
@@ -0,0 +1,158 @@
+//
+// C++ Interface: distengine.h
+//
+// Description: tiled, multithreaded engine for ML pairwise distances
+//
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+
+#ifndef DISTENGINE_H
+#define DISTENGINE_H
+
+#include "optimization.h"
+#include "tools.h"
+
+class PhyloTree;
+
+/**
+    ML distances between all pairs of sequences under the model and rates of a tree,
+    a replacement for one AlignmentPairwise per pair. The pair space is cut into tiles of sequences:
+    the patterns are read once per tile to fill the pair frequency tables of all pairs in the tile,
+    which are reused by the thread from tile to tile. The transition matrices are computed once
+    for a shared grid of distances from the eigen decomposition of the model, giving for every pair
+    the grid log-likelihoods in one pass over its frequency table. The best grid point is then
+    refined by Newton-Raphson, with P(t) and its derivatives taken directly from the eigen decomposition.
+*/
+class DistEngine {
+public:
+
+    /**
+        @param tree tree with alignment, model and site rates, see isSupported()
+    */
+    DistEngine(PhyloTree *tree);
+
+    ~DistEngine();
+
+    /**
+        @param tree tree with alignment, model and site rates
+        @return TRUE if the model is a reversible, non-mixture model with eigen decomposition
+            and the rates are not site-specific
+    */
+    static bool isSupported(PhyloTree *tree);
+
+    /**
+        compute the ML distances of all pairs
+        @param[out] dist_mat distance matrix, only the upper triangle is set
+        @param[out] d2l_mat second derivative of the negative log-likelihood at the ML distance, upper triangle
+    */
+    void computeDist(double *dist_mat, double *d2l_mat);
+
+    /** tree */
+    PhyloTree *tree;
+
+    /** number of states */
+    int num_states;
+
+    /** num_states^2 */
+    int trans_size;
+
+    /** number of pair frequency tables per pair: the number of rate categories for categorized rates, otherwise 1 */
+    int ntables;
+
+    /** for each table, the rates whose transition matrices are summed */
+    vector<DoubleVector> table_rates;
+
+    /** for each pattern, its table (rate category) */
+    IntVector ptn_table;
+
+    /** eigenvalues divided by the total number of substitutions */
+    double *eigenvalues;
+
+    /** trans_size x num_states coefficients, P(t)[i,j] = sum_k coeff[(i*num_states+j)*num_states+k] * exp(eigenvalues[k]*t) */
+    double *coeff;
+
+    /** the distances of the grid */
+    DoubleVector grid;
+
+    /** ntables x trans_size x grid.size() log transition probabilities */
+    double *grid_logtrans;
+
+protected:
+
+    /** compute coeff and the grid log transition probabilities */
+    void init();
+
+};
+
+/**
+    ML distance of one pair of sequences from its sparse pair frequency table, used by DistEngine
+*/
+class DistEnginePair : public Optimization {
+public:
+
+    /**
+        @param aengine engine with model coefficients
+    */
+    DistEnginePair(DistEngine *aengine);
+
+    /**
+        set the pair frequencies
+        @param table ntables x trans_size pair frequencies
+    */
+    void setFreq(int *table);
+
+    /** @return TRUE if the two sequences share no unambiguous site */
+    bool isEmpty() {
+        return freq.empty();
+    }
+
+    /**
+        @param[out] d2l second derivative of the negative log-likelihood at the ML distance
+        @return ML distance, starting from the best distance of the grid
+    */
+    double optimizeDist(double &d2l);
+
+    /**
+        @param value distance
+        @return negative log-likelihood
+    */
+    virtual double computeFunction(double value);
+
+    /**
+        @param value distance
+        @param[out] df first derivative
+        @param[out] ddf second derivative
+    */
+    virtual void computeFuncDerv(double value, double &df, double &ddf);
+
+protected:
+
+    DistEngine *engine;
+
+    /** the non-zero pair frequencies of table c are at positions table_begin[c] to table_begin[c+1]-1 */
+    IntVector table_begin;
+
+    /** index into the transition matrix of the non-zero pair frequencies */
+    IntVector freq_index;
+
+    /** non-zero pair frequencies */
+    DoubleVector freq;
+
+    /** exp(eigenvalue*rate*value), multiplied once and twice by eigenvalue*rate */
+    DoubleVector exptime, exptime1, exptime2;
+
+    /**
+        compute P(value) summed over the rates of each table and its derivatives
+        @param value distance
+        @param derv TRUE to also compute the derivatives
+    */
+    void computeTrans(double value, bool derv);
+
+    /** per non-zero pair frequency, P(value) and its first and second derivatives */
+    DoubleVector trans, trans1, trans2;
+
+};
+
+#endif
@@ -0,0 +1,214 @@
+//
+// C++ Implementation: fastbionj.cpp
+//
+// Description: FastBioNj, BIONJ for large numbers of taxa with RapidNJ-style bounds
+//
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+
+#include "fastbionj.h"
+
+FastBioNj::FastBioNj() {
+    n = 0;
+    delta = NULL;
+}
+
+FastBioNj::~FastBioNj() {
+    if (delta)
+        delete [] delta;
+}
+
+void FastBioNj::buildRow(int i) {
+    vector<BioNjEntry> &row = rows[i];
+    row.clear();
+    for (int j = 0; j < n; j++)
+        if (j != i && active[j] && stamp[j] < stamp[i]) {
+            BioNjEntry entry;
+            entry.dist = dist(i, j);
+            entry.col = j;
+            row.push_back(entry);
+        }
+    sort(row.begin(), row.end());
+}
+
+void FastBioNj::findBestPair(int r, int &a, int &b) {
+    double max_sum = -DBL_MAX;
+    for (int i = 0; i < n; i++)
+        if (active[i] && sums[i] > max_sum)
+            max_sum = sums[i];
+    double best_q = DBL_MAX;
+    a = b = -1;
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+        double thread_q = DBL_MAX;
+        int thread_a = -1, thread_b = -1;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 16) nowait
+#endif
+        for (int i = 0; i < n; i++) {
+            if (!active[i])
+                continue;
+            vector<BioNjEntry> &row = rows[i];
+            if (row.size() > 2*(size_t)r + 16) {
+                // drop the entries of removed or re-created subtrees
+                size_t k = 0;
+                for (size_t e = 0; e < row.size(); e++)
+                    if (active[row[e].col] && stamp[row[e].col] < stamp[i])
+                        row[k++] = row[e];
+                row.resize(k);
+            }
+            double sum_i = sums[i];
+            for (vector<BioNjEntry>::iterator it = row.begin(); it != row.end(); it++) {
+                // Q is at least this bound for the rest of the sorted row
+                if ((r-2)*(double)it->dist - sum_i - max_sum > thread_q)
+                    break;
+                int j = it->col;
+                if (!active[j] || stamp[j] > stamp[i])
+                    continue;
+                double q = (r-2)*(double)it->dist - sum_i - sums[j];
+                int x = max(i, j), y = min(i, j);
+                // ties are broken by the pair order of BioNj
+                if (q < thread_q || (q == thread_q && (x < thread_a || (x == thread_a && y < thread_b)))) {
+                    thread_q = q;
+                    thread_a = x;
+                    thread_b = y;
+                }
+            }
+        }
+#ifdef _OPENMP
+#pragma omp critical(bionj_best_pair)
+#endif
+        if (thread_a >= 0 && (thread_q < best_q || (thread_q == best_q && (thread_a < a || (thread_a == a && thread_b < b))))) {
+            best_q = thread_q;
+            a = thread_a;
+            b = thread_b;
+        }
+    }
+}
+
+void FastBioNj::create(StrVector &names, double *dist_mat, ostream &out) {
+    n = names.size();
+    if (n < 3)
+        outError("BIONJ needs at least 3 taxa");
+    int i, j;
+
+    // symmetrized distances, variances initialized with the distances as BioNj reading a distance file
+    delta = new float[(size_t)n*n];
+    for (i = 0; i < n; i++) {
+        delta[(size_t)i*n+i] = 0.0;
+        for (j = 0; j < i; j++)
+            delta[(size_t)i*n+j] = delta[(size_t)j*n+i] = (dist_mat[(size_t)i*n+j] + dist_mat[(size_t)j*n+i]) / 2;
+    }
+    active.assign(n, true);
+    stamp.resize(n);
+    slot_node.resize(n);
+    sums.assign(n, 0.0);
+    for (i = 0; i < n; i++) {
+        stamp[i] = i;
+        slot_node[i] = i;
+    }
+    rows.resize(n);
+#ifdef _OPENMP
+#pragma omp parallel for private(j) schedule(dynamic, 16)
+#endif
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++)
+            if (j != i)
+                sums[i] += dist(i, j);
+        buildRow(i);
+    }
+    int next_stamp = n;
+    left.clear();
+    right.clear();
+    left_len.clear();
+    right_len.clear();
+
+    for (int r = n; r > 3; r--) {
+        int a, b;
+        findBestPair(r, a, b);
+        // same formulae as BioNj
+        double vab = var(a, b);
+        double dab = dist(a, b);
+        double la = 0.5*(dab + (sums[a] - sums[b])/(r-2));
+        double lb = 0.5*(dab + (sums[b] - sums[a])/(r-2));
+        double lamda = 0.5;
+        if (vab != 0.0) {
+            double var_diff = 0.0;
+            for (i = 0; i < n; i++)
+                if (active[i] && i != a && i != b)
+                    var_diff += var(b, i) - var(a, i);
+            lamda = 0.5 + var_diff/(2*(r-2)*vab);
+        }
+        if (lamda > 1.0)
+            lamda = 1.0;
+        if (lamda < 0.0)
+            lamda = 0.0;
+
+        // the new subtree replaces a
+        double sum_new = 0.0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+: sum_new) schedule(static)
+#endif
+        for (i = 0; i < n; i++) {
+            if (!active[i] || i == a || i == b)
+                continue;
+            double dai = dist(a, i), dbi = dist(b, i);
+            double dci = lamda*(dai - la) + (1-lamda)*(dbi - lb);
+            var(a, i) = lamda*var(a, i) + (1-lamda)*var(b, i) - lamda*(1-lamda)*vab;
+            dist(a, i) = dci;
+            sums[i] += dist(a, i) - dai - dbi;
+            sum_new += dist(a, i);
+        }
+        left.push_back(slot_node[a]);
+        right.push_back(slot_node[b]);
+        left_len.push_back(la);
+        right_len.push_back(lb);
+        slot_node[a] = n + left.size() - 1;
+        active[b] = false;
+        vector<BioNjEntry>().swap(rows[b]);
+        sums[a] = sum_new;
+        stamp[a] = next_stamp++;
+        buildRow(a);
+    }
+
+    // the last three subtrees
+    int last[3], k = 0;
+    for (i = 0; i < n; i++)
+        if (active[i])
+            last[k++] = i;
+    double len[3];
+    len[0] = 0.5*(dist(last[0], last[1]) + dist(last[0], last[2]) - dist(last[1], last[2]));
+    len[1] = 0.5*(dist(last[1], last[0]) + dist(last[1], last[2]) - dist(last[0], last[2]));
+    len[2] = 0.5*(dist(last[2], last[1]) + dist(last[2], last[0]) - dist(last[1], last[0]));
+    out.setf(ios::fixed);
+    out.precision(8);
+    out << "(";
+    for (k = 0; k < 3; k++) {
+        if (k > 0)
+            out << ",";
+        printNode(out, names, slot_node[last[k]]);
+        out << ":" << (float)len[k];
+    }
+    out << ");" << endl;
+
+    delete [] delta;
+    delta = NULL;
+    vector<vector<BioNjEntry> >().swap(rows);
+}
+
+void FastBioNj::printNode(ostream &out, StrVector &names, int node) {
+    if (node < n) {
+        out << names[node];
+        return;
+    }
+    out << "(";
+    printNode(out, names, left[node-n]);
+    out << ":" << (float)left_len[node-n] << ",";
+    printNode(out, names, right[node-n]);
+    out << ":" << (float)right_len[node-n] << ")";
+}
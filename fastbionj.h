@@ -0,0 +1,110 @@
+//
+// C++ Interface: fastbionj.h
+//
+// Description: BIONJ for large numbers of taxa with RapidNJ-style bounds
+//
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+
+#ifndef FASTBIONJ_H
+#define FASTBIONJ_H
+
+#include "tools.h"
+
+/**
+    entry of a sorted row: distance to a column
+*/
+struct BioNjEntry {
+    float dist;
+    int col;
+
+    bool operator<(const BioNjEntry &other) const {
+        return dist < other.dist || (dist == other.dist && col < other.col);
+    }
+};
+
+/**
+    BIONJ (Gascuel 1997) with the same formulae as BioNj, working on an in-memory distance matrix.
+    The matrix is stored as floats, distances in the lower and variances in the upper triangle.
+    As in RapidNJ (Simonsen et al. 2008), every row keeps its distances sorted, thus the search for
+    the pair minimizing Q(i,j) = (r-2)*D(i,j) - S(i) - S(j) stops scanning a row once
+    (r-2)*D(i,j) - S(i) - max S exceeds the current minimum. A new subtree takes the slot of its first child
+    and gets a new sorted row, holding all other subtrees; older rows only hold the subtrees created before them,
+    so each pair is in exactly one row. Row search and row updates are multithreaded.
+*/
+class FastBioNj {
+public:
+
+    FastBioNj();
+
+    ~FastBioNj();
+
+    /**
+        build the BIONJ tree
+        @param names taxon names
+        @param dist_mat names.size() x names.size() distance matrix
+        @param out output stream for the NEWICK tree
+    */
+    void create(StrVector &names, double *dist_mat, ostream &out);
+
+protected:
+
+    /** number of taxa */
+    int n;
+
+    /** n x n matrix, D(i,j) at [max(i,j)*n+min(i,j)], variance V(i,j) at [min(i,j)*n+max(i,j)] */
+    float *delta;
+
+    /** TRUE for the slots holding a subtree */
+    vector<bool> active;
+
+    /** creation time of the subtree of each slot */
+    IntVector stamp;
+
+    /** sum S(i) of the distances from slot i to all other subtrees */
+    DoubleVector sums;
+
+    /** for each slot, the distances to the subtrees created before it, sorted */
+    vector<vector<BioNjEntry> > rows;
+
+    /** tree node of each slot, taxa are nodes 0..n-1 */
+    IntVector slot_node;
+
+    /** children and their branch lengths of the internal nodes n, n+1, ... */
+    IntVector left, right;
+    DoubleVector left_len, right_len;
+
+    float &dist(int i, int j) {
+        return (i > j) ? delta[(size_t)i*n+j] : delta[(size_t)j*n+i];
+    }
+
+    float &var(int i, int j) {
+        return (i > j) ? delta[(size_t)j*n+i] : delta[(size_t)i*n+j];
+    }
+
+    /**
+        build the sorted row of a slot from all active slots created before it
+        @param i slot
+    */
+    void buildRow(int i);
+
+    /**
+        find the pair minimizing Q
+        @param r number of subtrees
+        @param[out] a, b the pair
+    */
+    void findBestPair(int r, int &a, int &b);
+
+    /**
+        print the subtree of a node in NEWICK format
+        @param out output stream
+        @param names taxon names
+        @param node tree node
+    */
+    void printNode(ostream &out, StrVector &names, int node);
+
+};
+
+#endif
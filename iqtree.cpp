@@ -59,12 +59,14 @@ void IQTree::init() {
     write_intermediate_trees = 0;
 //    max_candidate_trees = 0;
     logl_cutoff = 0.0;
+    search_master = NULL;
     len_scale = 10000;
 //    save_all_br_lens = false;
     duplication_counter = 0;
     //boot_splits = new SplitGraph;
     pll2iqtree_pattern_index = NULL;
     fastNNI = true;
+    rell_buffer_lh = NULL;
 }
 
 IQTree::IQTree(Alignment *aln) : PhyloTree(aln) {
@@ -78,22 +80,25 @@ void IQTree::setCheckpoint(Checkpoint *checkpoint) {
 }
 
 void IQTree::saveCheckpoint() {
+    flushRELLBuffer();
     stop_rule.saveCheckpoint();
     candidateTrees.saveCheckpoint();
     
-    if (boot_samples.size() > 0 && !boot_trees.front().empty()) {
+    if (boot_samples.size() > 0 && boot_trees.front() >= 0) {
         checkpoint->startStruct("UFBoot");
 //        CKP_SAVE(max_candidate_trees);
         CKP_SAVE(logl_cutoff);
         // save boot_samples and boot_trees
-        int id = 0;
+        int id;
         checkpoint->startList(boot_samples.size());
         // TODO: save boot_trees_brlen
-        for (vector<BootValType* >::iterator it = boot_samples.begin(); it != boot_samples.end(); it++, id++) {
+        for (id = 0; id < boot_samples.size(); id++) {
             checkpoint->addListElement();
             stringstream ss;
             ss.precision(10);
-            ss << boot_counts[id] << " " << boot_logl[id] << " " << boot_orig_logl[id] << " " << boot_trees[id];
+            ss << boot_counts[id] << " " << boot_logl[id] << " " << boot_orig_logl[id] << " ";
+            if (boot_trees[id] >= 0)
+                ss << boot_topologies.getTopology(boot_trees[id]);
             checkpoint->put("", ss.str());
 //            string &bt = boot_trees[id];
 //            CKP_SAVE(bt);
@@ -135,6 +140,7 @@ void IQTree::restoreCheckpoint() {
         int id = 0;
         checkpoint->startList(params->gbo_replicates);
         boot_trees.resize(params->gbo_replicates);
+        boot_topologies.clear();
         boot_logl.resize(params->gbo_replicates);
         boot_orig_logl.resize(params->gbo_replicates);
         boot_counts.resize(params->gbo_replicates);
@@ -143,7 +149,9 @@ void IQTree::restoreCheckpoint() {
             string str;
             checkpoint->getString("", str);
             stringstream ss(str);
-            ss >> boot_counts[id] >> boot_logl[id] >> boot_orig_logl[id] >> boot_trees[id];
+            string tree_str;
+            ss >> boot_counts[id] >> boot_logl[id] >> boot_orig_logl[id] >> tree_str;
+            boot_trees[id] = (tree_str.empty()) ? -1 : boot_topologies.addTopology(tree_str);
 //            string bt;
 //            CKP_RESTORE(bt);
 //            boot_trees[id] = bt;
@@ -293,22 +301,13 @@ void IQTree::initSettings(Params &params) {
         
         cout << "Generating " << params.gbo_replicates << " samples for ultrafast bootstrap (seed: " << params.ran_seed << ")..." << endl;
         // allocate memory for boot_samples
-        boot_samples.resize(params.gbo_replicates);
         size_t orig_nptn = getAlnNPattern();
-#ifdef BOOT_VAL_FLOAT
-        size_t nptn = get_safe_upper_limit_float(orig_nptn);
-#else
-        size_t nptn = get_safe_upper_limit(orig_nptn);
-#endif
-        BootValType *mem = aligned_alloc<BootValType>(nptn * (size_t)(params.gbo_replicates));
-        memset(mem, 0, nptn * (size_t)(params.gbo_replicates) * sizeof(BootValType));
-        for (i = 0; i < params.gbo_replicates; i++)
-        	boot_samples[i] = mem + i*nptn;
+        boot_samples.init(params.gbo_replicates, orig_nptn);
 
         if (boot_trees.empty()) {
             boot_logl.resize(params.gbo_replicates, -DBL_MAX);
             boot_orig_logl.resize(params.gbo_replicates, -DBL_MAX);
-            boot_trees.resize(params.gbo_replicates, "");
+            boot_trees.resize(params.gbo_replicates, -1);
             boot_counts.resize(params.gbo_replicates, 0);
             if (params.print_ufboot_trees == 2)
                 boot_trees_brlen.resize(params.gbo_replicates);
@@ -330,8 +329,8 @@ void IQTree::initSettings(Params &params) {
         }
         VerboseMode saved_mode = verbose_mode;
         verbose_mode = VB_QUIET;
-        for (i = 0; i < params.gbo_replicates; i++) {
-        	if (params.print_bootaln) {
+        if (params.print_bootaln) {
+            for (i = 0; i < params.gbo_replicates; i++) {
     			Alignment* bootstrap_alignment;
     			if (aln->isSuperAlignment())
     				bootstrap_alignment = new SuperAlignment;
@@ -339,16 +338,13 @@ void IQTree::initSettings(Params &params) {
     				bootstrap_alignment = new Alignment;
     			IntVector this_sample;
     			bootstrap_alignment->createBootstrapAlignment(aln, &this_sample, params.bootstrap_spec);
-    			for (size_t j = 0; j < orig_nptn; j++)
-    				boot_samples[i][j] = this_sample[j];
+    			boot_samples.setSample(i, &this_sample[0]);
 				bootstrap_alignment->printPhylip(bootaln_name.c_str(), true);
 				delete bootstrap_alignment;
-        	} else {
-    			IntVector this_sample;
-        		aln->createBootstrapAlignment(this_sample, params.bootstrap_spec);
-    			for (size_t j = 0; j < orig_nptn; j++)
-    				boot_samples[i][j] = this_sample[j];
-        	}
+            }
+        } else {
+            // all replicates at once, one random stream per replicate
+            aln->createBootstrapAlignments(boot_samples, params.bootstrap_spec, params.ran_seed);
         }
         verbose_mode = saved_mode;
         if (params.print_bootaln) {
@@ -372,6 +368,7 @@ void IQTree::initSettings(Params &params) {
 }
 
 IQTree::~IQTree() {
+    deleteNNIWorkers();
     //if (bonus_values)
     //delete bonus_values;
     //bonus_values = NULL;
@@ -381,10 +378,8 @@ IQTree::~IQTree() {
     boot_splits.clear();
     //if (boot_splits) delete boot_splits;
 
-    if (!boot_samples.empty()) {
-    	aligned_free(boot_samples[0]); // free memory
-        boot_samples.clear();
-    }
+    if (rell_buffer_lh)
+        aligned_free(rell_buffer_lh);
 }
 
 extern const char *aa_model_names_rax[];
@@ -1131,7 +1126,8 @@ void IQTree::raiseBonus(Neighbor *nei, Node *dad, double bonus) {
 
 double IQTree::computePartialBonus(Node *node, Node* dad) {
     PhyloNeighbor *node_nei = (PhyloNeighbor*) node->findNeighbor(dad);
-    if (node_nei->partial_lh_computed)
+    // test bit 1 only: MemSlots may have left its eviction flag (LH_EVICTED) set
+    if (node_nei->partial_lh_computed & 1)
         return node_nei->lh_scale_factor;
 
     FOR_NEIGHBOR_IT(node, dad, it){
@@ -1891,6 +1887,10 @@ double IQTree::doTreeSearch() {
 
 	double cur_correlation = 0.0;
 
+    // -sw: runs until the stop rule is met, thus the main loop below is skipped
+    if (canUseSearchWorkers())
+        doParallelTreeSearch(cur_correlation);
+
 	/*====================================================
 	 * MAIN LOOP OF THE IQ-TREE ALGORITHM
 	 *====================================================*/
@@ -1898,6 +1898,7 @@ double IQTree::doTreeSearch() {
         stop_rule.setCurIt(stop_rule.getCurIt() + 1);
         searchinfo.curIter = stop_rule.getCurIt();
         // estimate logl_cutoff for bootstrap
+        flushRELLBuffer();
         if (!boot_orig_logl.empty())
             logl_cutoff = *min_element(boot_orig_logl.begin(), boot_orig_logl.end());
 
@@ -2061,37 +2062,7 @@ double IQTree::doTreeSearch() {
     	/*----------------------------------------
     	 * convergence criterion for ultrafast bootstrap
     	 *---------------------------------------*/
-        if ((stop_rule.getCurIt()) % (params->step_iterations / 2) == 0 && params->stop_condition == SC_BOOTSTRAP_CORRELATION) {
-        	// compute split support every half step
-            SplitGraph *sg = new SplitGraph;
-            summarizeBootstrap(*sg);
-            sg->removeTrivialSplits();
-            sg->setCheckpoint(checkpoint);
-            boot_splits.push_back(sg);
-//            if (params->max_candidate_trees == 0)
-//                max_candidate_trees = treels_logl.size() * (stop_rule.getCurIt() + (params->step_iterations / 2)) /
-//                                                           stop_rule.getCurIt();
-//			cout << "NOTE: " << treels_logl.size() << " bootstrap candidate trees evaluated (logl-cutoff: " << logl_cutoff << ")" << endl;
-			cout << "Log-likelihood cutoff on original alignment: " << logl_cutoff << endl;
-
-			// check convergence every full step
-			if (stop_rule.getCurIt() % params->step_iterations == 0) {
-	        	cur_correlation = computeBootstrapCorrelation();
-	            cout << "NOTE: Bootstrap correlation coefficient of split occurrence frequencies: " << cur_correlation << endl;
-	            if (!stop_rule.meetStopCondition(stop_rule.getCurIt(), cur_correlation)) {
-//	                if (params->max_candidate_trees == 0) {
-//	                    max_candidate_trees = treels_logl.size() * (stop_rule.getCurIt() + params->step_iterations) /
-//                                                                   stop_rule.getCurIt();
-//	                }
-//	                cout << "INFO: UFBoot does not converge, continue " << params->step_iterations << " more iterations" << endl;
-	            }
-	        }
-        } // end of bootstrap convergence test
-
-        // print UFBoot trees every 10 iterations
-		if (params->gbo_replicates && params->online_bootstrap && params->print_ufboot_trees &&
-                                                                  stop_rule.getCurIt() % 10 == 0)
-				writeUFBootTrees(*params);
+        checkBootstrapConvergence(stop_rule.getCurIt(), cur_correlation);
 
         saveCheckpoint();
         checkpoint->dump();
@@ -2100,6 +2071,7 @@ double IQTree::doTreeSearch() {
        // 	((PhyloSuperTreePlen*)this)->printNNIcasesNUM();
        
     }
+    flushRELLBuffer();
 
     readTreeString(candidateTrees.getTopTrees()[0]);
 
@@ -2120,6 +2092,172 @@ double IQTree::doTreeSearch() {
     return candidateTrees.getBestScore();
 }
 
+bool IQTree::canUseSearchWorkers() {
+#ifdef _OPENMP
+    // a descent of a worker must not depend on anything outside its own tree, except for the
+    // candidate trees and the UFBoot trees of this tree, which are accessed under a lock.
+    // The candidate set of a worker stays empty, thus stable splits (-fss) and -reduction are excluded
+    return params->search_workers > 1 && params->snni && !params->iqp && iqp_assess_quartet != IQP_BOOTSTRAP &&
+            !isSuperTree() && !params->pll && (params->gbo_replicates == 0 || params->online_bootstrap) &&
+            constraintTree.empty() && !params->reduction && params->lh_mem_save != LM_MEM_SAVE &&
+            !params->fix_stable_splits && !params->count_trees && !params->write_intermediate_trees &&
+            !params->print_tree_lh && !params->print_trees_site_posterior && !testNNI;
+#else
+    return false;
+#endif
+}
+
+void IQTree::doParallelTreeSearch(double &cur_correlation) {
+#ifdef _OPENMP
+    // every worker holds a full set of partial likelihoods: only start as many as fit into memory
+    int nworkers = params->search_workers;
+    uint64_t worker_mem = getMemoryRequired();
+    uint64_t total_mem = getMemorySize();
+    int max_workers = (total_mem > worker_mem) ? (total_mem - worker_mem) / worker_mem : 0;
+    if (nworkers > max_workers) {
+        outWarning("Memory only suffices for " + convertIntToString(max_workers) + " search workers (" +
+                convertInt64ToString(worker_mem / 1048576) + " MB each)");
+        nworkers = max_workers;
+    }
+    if (nworkers < 2)
+        return;
+    int worker_threads = max(1, omp_get_max_threads() / nworkers);
+    cout << "Running " << nworkers << " search workers with " << worker_threads << " thread(s) each" << endl;
+    vector<IQTree*> workers;
+    for (int t = 0; t < nworkers; t++) {
+        IQTree *worker = new IQTree(aln);
+        worker->setParams(params);
+        worker->setModel(model);
+        worker->setRate(site_rate);
+        worker->setModelFactory(model_factory);
+        worker->setLikelihoodKernel(sse);
+        worker->optimize_by_newton = optimize_by_newton;
+        worker->searchinfo = searchinfo;
+        worker->worker_threads = worker_threads;
+        worker->save_all_trees = save_all_trees;
+        worker->search_master = this;
+        // all memory is allocated here, the workers only reassign it to the nodes of their trees
+        worker->readTreeString(candidateTrees.getBestTrees()[0]);
+        worker->initializeAllPartialLh();
+        workers.push_back(worker);
+    }
+    // the likelihood kernels of the workers open nested parallel regions
+    int saved_active_levels = omp_get_max_active_levels();
+    omp_set_max_active_levels(2);
+
+    bool model_changed = true;
+    while (model_changed) {
+        model_changed = false;
+        // the workers run descents until the stop rule is met, or until one of them found a better tree.
+        // Then the others finish their descents and the shared model is re-optimized
+#pragma omp parallel num_threads(nworkers)
+        {
+            IQTree *worker = workers[omp_get_thread_num()];
+            omp_set_num_threads(worker_threads);
+            while (true) {
+                int iteration = 0;
+#pragma omp critical(search_candidates)
+                {
+                    if (!model_changed && !stop_rule.meetStopCondition(stop_rule.getCurIt(), cur_correlation)) {
+                        iteration = stop_rule.getCurIt() + 1;
+                        stop_rule.setCurIt(iteration);
+                        worker->searchinfo.curIter = iteration;
+                        // estimate logl_cutoff for bootstrap
+                        flushRELLBuffer();
+                        if (!boot_orig_logl.empty())
+                            logl_cutoff = *min_element(boot_orig_logl.begin(), boot_orig_logl.end());
+                        worker->logl_cutoff = logl_cutoff;
+                        int numStableBranches = aln->getNSeq() - 3 - candidateTrees.getStableSplits().size();
+                        int numPerturb = ceil(searchinfo.curPerStrength * numStableBranches);
+                        // the perturbation draws from the global random number generator
+                        worker->readTreeString(candidateTrees.getRandCandTree());
+                        worker->doRandomNNIs(numPerturb);
+                    }
+                }
+                if (iteration == 0)
+                    break;
+                int index, indexlh;
+                worker->initializeAllPartialLh(index, indexlh);
+                worker->clearAllPartialLH();
+                worker->computeLogL();
+                double perturb_score = worker->getCurScore();
+                int nni_count, nni_steps;
+                string imd_tree = worker->doNNISearch(nni_count, nni_steps);
+                double score = worker->getCurScore();
+#pragma omp critical(search_candidates)
+                {
+                    if (score > candidateTrees.getBestScore() + params->modeps) {
+                        model_changed = true;
+                        if (!candidateTrees.treeExist(imd_tree)) {
+                            stop_rule.addImprovedIteration(iteration);
+                            cout << "BETTER TREE FOUND at iteration " << iteration << ": " << score << endl;
+                        } else {
+                            cout << "UPDATE BEST LOG-LIKELIHOOD: " << score << endl;
+                        }
+                    }
+                    candidateTrees.update(imd_tree, score);
+                    if (iteration % 10 == 0 || verbose_mode >= VB_MED) {
+                        cout.setf(ios::fixed, ios::floatfield);
+                        cout << "Iteration " << iteration << " / LogL: ";
+                        if (verbose_mode >= VB_MED)
+                            cout << perturb_score << " -> ";
+                        cout << score;
+                        if (verbose_mode >= VB_MED)
+                            cout << " / (NNIs, Steps): (" << nni_count << "," << nni_steps << ")";
+                        cout << " / Time: " << convert_time(getRealTime() - params->start_real_time) << endl;
+                    }
+                    checkBootstrapConvergence(iteration, cur_correlation);
+                    saveCheckpoint();
+                    checkpoint->dump();
+                }
+            }
+        }
+
+        if (model_changed) {
+            readTreeString(candidateTrees.getBestTrees()[0]);
+            curScore = candidateTrees.getBestScore();
+            string imd_tree = optimizeModelParameters();
+            getModelFactory()->saveCheckpoint();
+            candidateTrees.update(imd_tree, curScore);
+            printResultTree();
+            saveCheckpoint();
+            checkpoint->dump();
+        }
+    }
+
+    omp_set_max_active_levels(saved_active_levels);
+    for (vector<IQTree*>::iterator it = workers.begin(); it != workers.end(); it++) {
+        // alignment and model belong to this tree
+        (*it)->setModelFactory(NULL);
+        (*it)->setModel(NULL);
+        (*it)->setRate(NULL);
+        delete (*it);
+    }
+#endif
+}
+
+void IQTree::checkBootstrapConvergence(int iteration, double &cur_correlation) {
+    if (iteration % (params->step_iterations / 2) == 0 && params->stop_condition == SC_BOOTSTRAP_CORRELATION) {
+        // compute split support every half step
+        SplitGraph *sg = new SplitGraph;
+        summarizeBootstrap(*sg);
+        sg->removeTrivialSplits();
+        sg->setCheckpoint(checkpoint);
+        boot_splits.push_back(sg);
+        cout << "Log-likelihood cutoff on original alignment: " << logl_cutoff << endl;
+
+        // check convergence every full step
+        if (iteration % params->step_iterations == 0) {
+            cur_correlation = computeBootstrapCorrelation();
+            cout << "NOTE: Bootstrap correlation coefficient of split occurrence frequencies: " << cur_correlation << endl;
+        }
+    } // end of bootstrap convergence test
+
+    // print UFBoot trees every 10 iterations
+    if (params->gbo_replicates && params->online_bootstrap && params->print_ufboot_trees && iteration % 10 == 0)
+        writeUFBootTrees(*params);
+}
+
 /****************************************************************************
  Fast Nearest Neighbor Interchange by maximum likelihood
  ****************************************************************************/
@@ -2272,17 +2410,26 @@ double IQTree::optimizeNNI(int &nni_count, int &nni_steps) {
             }
 
             // restore the tree by reverting all NNIs
-            for (int i = 0; i < numNNIs; i++)
-                doNNI(nonConfNNIs.at(i));
+            bool dirty_path = !isSuperTree();
+            for (int i = 0; i < numNNIs; i++) {
+                doNNI(nonConfNNIs.at(i), !dirty_path);
+                if (dirty_path)
+                    markDirtyNNI(nonConfNNIs.at(i));
+            }
             // restore the branch lengths
 //            restoreAllBrans();
+            if (dirty_path)
+                markDirtyBranchLengths(lenvec);
             restoreBranchLengths(lenvec);
-            // This is important because after restoring the branch lengths, all partial
-            // likelihood need to be cleared.
+            // This is important because after restoring the branch lengths, the partial
+            // likelihoods of all changed subtrees need to be cleared.
 //            if (params->lh_mem_save == LM_PER_NODE) {
 //                initializeAllPartialLh();
 //            } else
-            clearAllPartialLH();
+            if (dirty_path)
+                clearDirtyPartialLh();
+            else
+                clearAllPartialLH();
             
             // UPDATE: the following is not needed as clearAllPartialLH() is now also defined for SuperTree
             // BQM: This was missing: one should also clear all subtrees of a supertree
@@ -2417,7 +2564,7 @@ void IQTree::pllInitUFBootData(){
                 if(!pllUFBootDataPtr->boot_samples[i]) outError("Not enough dynamic memory!");
                 for(int j = 0; j < pllAlignment->sequenceLength; j++){
                     pllUFBootDataPtr->boot_samples[i][j] =
-                        boot_samples[i][pll2iqtree_pattern_index[j]];
+                        boot_samples.getCount(i, pll2iqtree_pattern_index[j]);
                 }
             }
 
@@ -2475,14 +2622,20 @@ void IQTree::pllDestroyUFBootData(){
 
 
 void IQTree::doNNIs(int nni2apply, bool changeBran) {
+    // super trees clear the partial likelihoods of their partition trees in doNNI()
+    bool dirty_path = !isSuperTree();
     for (int i = 0; i < nni2apply; i++) {
-        doNNI(nonConfNNIs.at(i));
+        doNNI(nonConfNNIs.at(i), !dirty_path);
+        if (dirty_path)
+            markDirtyNNI(nonConfNNIs.at(i));
         appliedNNIs.push_back(nonConfNNIs.at(i));
         if (!params->leastSquareNNI && changeBran) {
             // apply new branch lengths
             changeNNIBrans(nonConfNNIs.at(i));
         }
     }
+    if (dirty_path)
+        clearDirtyPartialLh();
     // 2015-10-14: has to reset this pointer when read in
     current_it = current_it_back = NULL;
     
@@ -2587,6 +2740,14 @@ void IQTree::evalNNIs(NodeVector& nodes1, NodeVector& nodes2) {
 	if (!nodes1.empty()) {
 		assert(!nodes2.empty());
 		assert(nodes1.size() == nodes2.size());
+#ifdef _OPENMP
+		// the NNI evaluation of a tree copy must not depend on anything outside the tree
+		if (params->parallel_nni && nodes1.size() > 1 && omp_get_max_threads() > 1 && !isSuperTree() &&
+				save_all_trees != 2 && constraintTree.empty() && !params->upper_bound_NNI && !params->pll) {
+			evalNNIsParallel(nodes1, nodes2);
+			return;
+		}
+#endif
 		NodeVector::iterator it1;
 		NodeVector::iterator it2;
 		for (it1 = nodes1.begin(), it2 = nodes2.begin(); it1 != nodes1.end() && it2 != nodes2.end(); it1++, it2++) {
@@ -2601,6 +2762,71 @@ void IQTree::evalNNIs(NodeVector& nodes1, NodeVector& nodes2) {
     }
 }
 
+void IQTree::evalNNIsParallel(NodeVector &nodes1, NodeVector &nodes2) {
+    int nthreads = 1;
+#ifdef _OPENMP
+    nthreads = min(omp_get_max_threads(), (int)nodes1.size());
+#endif
+    // (re)create the workers if the alignment or model was replaced in the meantime
+    for (int t = 0; t < nni_workers.size(); t++)
+        if (nni_workers[t]->aln != aln || nni_workers[t]->getModelFactory() != model_factory ||
+                nni_workers[t]->getModel() != model || nni_workers[t]->getRate() != site_rate ||
+                nni_workers[t]->sse != sse || nni_workers[t]->partial_lh_float != partial_lh_float) {
+            deleteNNIWorkers();
+            break;
+        }
+    while (nni_workers.size() < nthreads) {
+        PhyloTree *worker = new PhyloTree;
+        worker->initializeNNIWorker(this);
+        nni_workers.push_back(worker);
+    }
+
+    vector<NNIMove> moves(nodes1.size());
+    // one branch per thread at a time: the four subtrees of its NNIs are computed in this tree and copied
+    // to the worker before the next branch is prepared, as this tree may reuse their memory (LM_PER_NODE, -mem)
+    for (int first = 0; first < nodes1.size(); first += nthreads) {
+        int nbranches = min(nthreads, (int)nodes1.size() - first);
+        vector<PhyloNode*> copies1(nbranches), copies2(nbranches);
+        for (int t = 0; t < nbranches; t++) {
+            PhyloNode *node1 = (PhyloNode*)nodes1[first+t], *node2 = (PhyloNode*)nodes2[first+t];
+            assert(isInnerBranch(node1, node2));
+            copies1[t] = nni_workers[t]->copyNNIBranches(this, node1, node2);
+            copies2[t] = (PhyloNode*)copies1[t]->neighbors[node1->findNeighborIt(node2) - node1->neighbors.begin()]->node;
+        }
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nbranches) schedule(static, 1)
+#endif
+        for (int t = 0; t < nbranches; t++) {
+            NNIMove move = nni_workers[t]->getBestNNIForBran(copies1[t], copies2[t], NULL);
+            // the neighbor order is the same in the worker
+            NNIMove &res = moves[first+t];
+            res = move;
+            res.node1 = (PhyloNode*)nodes1[first+t];
+            res.node2 = (PhyloNode*)nodes2[first+t];
+            res.node1Nei_it = res.node1->neighbors.begin() + (move.node1Nei_it - copies1[t]->neighbors.begin());
+            res.node2Nei_it = res.node2->neighbors.begin() + (move.node2Nei_it - copies2[t]->neighbors.begin());
+        }
+    }
+    for (int t = 0; t < nni_workers.size(); t++)
+        nni_workers[t]->deleteNNIBranches();
+
+    for (int i = 0; i < moves.size(); i++)
+        if (moves[i].newloglh > curScore + params->loglh_epsilon)
+            addPositiveNNIMove(moves[i]);
+}
+
+void IQTree::deleteNNIWorkers() {
+    for (vector<PhyloTree*>::iterator it = nni_workers.begin(); it != nni_workers.end(); it++) {
+        // alignment and model belong to this tree
+        (*it)->deleteNNIBranches();
+        (*it)->setModelFactory(NULL);
+        (*it)->setModel(NULL);
+        (*it)->setRate(NULL);
+        delete (*it);
+    }
+    nni_workers.clear();
+}
+
 /**
  *  Currently not used, commented out to simplify the interface of getBestNNIForBran
 void IQTree::evalNNIsSort(bool approx_nni) {
@@ -2725,13 +2951,14 @@ void IQTree::saveCurrentTree(double cur_logl) {
 #endif
 
 
-    if (boot_samples.empty()) {
+    // -sw: a worker adds its trees to the UFBoot trees of the search
+    IQTree *boot_tree = (search_master) ? search_master : this;
+    if (boot_tree->boot_samples.empty()) {
         // for runGuidedBootstrap
     } else {
         // online bootstrap
 //        int ptn;
 //        int updated = 0;
-        int nsamples = boot_samples.size();
         ostringstream ostr;
         string tree_str, tree_str_brlen;
         setRootNode(params->root);
@@ -2742,41 +2969,10 @@ void IQTree::saveCurrentTree(double cur_logl) {
 			printTree(ostr_brlen, WT_BR_LEN);
 			tree_str_brlen = ostr_brlen.str();
         }
-        double rand_double = random_double();
-
-        #ifdef _OPENMP
-        #pragma omp parallel for
-        #endif
-        for (int sample = 0; sample < nsamples; sample++) {
-            double rell = 0.0;
-
-            {
-            	// SSE optimized version of the above loop
-				BootValType *boot_sample = boot_samples[sample];
-
-				BootValType res = (this->*dotProduct)(pattern_lh, boot_sample, nptn);
-
-				rell = res;
-            }
-
-            bool better = rell > boot_logl[sample] + params->ufboot_epsilon;
-            if (!better && rell > boot_logl[sample] - params->ufboot_epsilon) {
-                better = (rand_double <= 1.0 / (boot_counts[sample] + 1));
-            }
-            if (better) {
-                if (rell <= boot_logl[sample] + params->ufboot_epsilon) {
-                    boot_counts[sample]++;
-                } else {
-                    boot_counts[sample] = 1;
-                }
-                boot_logl[sample] = max(boot_logl[sample], rell);
-                boot_orig_logl[sample] = cur_logl;
-                boot_trees[sample] = tree_str;
-                if (params->print_ufboot_trees == 2) {
-                	boot_trees_brlen[sample] = tree_str_brlen;
-                }
-            }
-        }
+#ifdef _OPENMP
+#pragma omp critical(search_candidates)
+#endif
+        boot_tree->bufferRELLTree(pattern_lh, cur_logl, tree_str, tree_str_brlen);
     }
     if (print_tree_lh) {
         out_treelh << cur_logl;
@@ -2796,7 +2992,7 @@ void IQTree::saveCurrentTree(double cur_logl) {
         out_sitelh << endl;
     }
 
-    if (!boot_samples.empty()) {
+    if (!boot_tree->boot_samples.empty()) {
 #ifdef BOOT_VAL_FLOAT
     	aligned_free(pattern_lh_orig);
 #endif
@@ -2809,6 +3005,114 @@ void IQTree::saveCurrentTree(double cur_logl) {
 
 }
 
+void IQTree::bufferRELLTree(BootValType *pattern_lh, double cur_logl, string &tree_str, string &tree_str_brlen) {
+#ifdef BOOT_VAL_FLOAT
+    size_t maxnptn = get_safe_upper_limit_float(getAlnNPattern());
+#else
+    size_t maxnptn = get_safe_upper_limit(getAlnNPattern());
+#endif
+    if (!rell_buffer_lh)
+        rell_buffer_lh = aligned_alloc<BootValType>(maxnptn * (size_t)params->ufboot_rell_batch);
+    memcpy(rell_buffer_lh + rell_buffer_logl.size() * maxnptn, pattern_lh, maxnptn * sizeof(BootValType));
+    rell_buffer_logl.push_back(cur_logl);
+    rell_buffer_trees.push_back(boot_topologies.addTopology(tree_str));
+    if (params->print_ufboot_trees == 2)
+        rell_buffer_trees_brlen.push_back(tree_str_brlen);
+    rell_buffer_rand.push_back(random_double());
+    if (rell_buffer_logl.size() >= (size_t)params->ufboot_rell_batch)
+        flushRELLBuffer();
+}
+
+void IQTree::flushRELLBuffer() {
+    int ntrees = rell_buffer_logl.size();
+    if (ntrees == 0)
+        return;
+    int nptn = getAlnNPattern();
+#ifdef BOOT_VAL_FLOAT
+    size_t maxnptn = get_safe_upper_limit_float(nptn);
+#else
+    size_t maxnptn = get_safe_upper_limit(nptn);
+#endif
+    int nsamples = boot_samples.size();
+    // pattern blocks are the outer loop: the block of all buffered trees stays in cache (~256 KB) while the
+    // counts of every sample are streamed over it. Blocks start at multiples of the vector size.
+    int block_size = 256 * 1024 / (ntrees * sizeof(BootValType));
+    block_size = max(64, block_size - block_size % 64);
+    // RELL score per (sample, tree)
+    double *rell = new double[(size_t)nsamples * ntrees];
+    memset(rell, 0, sizeof(double) * nsamples * ntrees);
+
+    #ifdef _OPENMP
+    #pragma omp parallel
+    #endif
+    {
+        // pattern counts of the current block, padded with zeros for the vectorized dot product
+        BootValType *boot_block = aligned_alloc<BootValType>(block_size);
+        int sample, t;
+
+        for (int start = 0; start < nptn; start += block_size) {
+            int len = min(block_size, nptn - start);
+            #ifdef _OPENMP
+            #pragma omp for schedule(static)
+            #endif
+            for (sample = 0; sample < nsamples; sample++) {
+                if (len < block_size)
+                    memset(boot_block, 0, block_size*sizeof(BootValType));
+                boot_samples.getCounts(sample, start, len, boot_block);
+                double *rell_sample = rell + (size_t)sample * ntrees;
+                for (t = 0; t < ntrees; t++)
+                    rell_sample[t] += (this->*dotProduct)(rell_buffer_lh + t*maxnptn + start, boot_block, len);
+            }
+        }
+
+        #ifdef _OPENMP
+        #pragma omp for schedule(static)
+        #endif
+        for (sample = 0; sample < nsamples; sample++) {
+            double *rell_sample = rell + (size_t)sample * ntrees;
+            // same order as if the trees were scored one by one
+            for (t = 0; t < ntrees; t++) {
+                bool better = rell_sample[t] > boot_logl[sample] + params->ufboot_epsilon;
+                if (!better && rell_sample[t] > boot_logl[sample] - params->ufboot_epsilon) {
+                    better = (rell_buffer_rand[t] <= 1.0 / (boot_counts[sample] + 1));
+                }
+                if (better) {
+                    if (rell_sample[t] <= boot_logl[sample] + params->ufboot_epsilon) {
+                        boot_counts[sample]++;
+                    } else {
+                        boot_counts[sample] = 1;
+                    }
+                    boot_logl[sample] = max(boot_logl[sample], rell_sample[t]);
+                    boot_orig_logl[sample] = rell_buffer_logl[t];
+                    boot_trees[sample] = rell_buffer_trees[t];
+                    if (params->print_ufboot_trees == 2) {
+                        boot_trees_brlen[sample] = rell_buffer_trees_brlen[t];
+                    }
+                }
+            }
+        }
+        aligned_free(boot_block);
+    }
+    delete [] rell;
+
+    rell_buffer_logl.clear();
+    rell_buffer_trees.clear();
+    rell_buffer_trees_brlen.clear();
+    rell_buffer_rand.clear();
+
+    // forget the topologies that lost all their samples, the table thus holds at most
+    // one string per bootstrap sample plus one batch
+    boot_topologies.compact(boot_trees);
+}
+
+void IQTree::getBootTrees(MTreeSet &trees, IntVector &index) {
+    StrVector tree_strs;
+    IntVector weights;
+    boot_topologies.getDistinctTopologies(boot_trees, tree_strs, weights, index);
+    trees.init(tree_strs, rooted);
+    trees.tree_weights = weights;
+}
+
 void IQTree::saveNNITrees(PhyloNode *node, PhyloNode *dad) {
     if (!node) {
         node = (PhyloNode*) root;
@@ -2934,10 +3238,12 @@ void IQTree::writeUFBootTrees(Params &params) {
 	string filename = params.out_prefix;
 	filename += ".ufboot";
 	ofstream out(filename.c_str());
+	flushRELLBuffer();
 
 	if (params.print_ufboot_trees == 1) {
 		// print trees without branch lengths
-        trees.init(boot_trees, rooted);
+        IntVector index;
+        getBootTrees(trees, index);
 		for (i = 0; i < trees.size(); i++) {
 			NodeVector taxa;
 			// change the taxa name from ID to real name
@@ -2948,13 +3254,11 @@ void IQTree::writeUFBootTrees(Params &params) {
 				// reinsert removed seqs into each tree
 				trees[i]->insertTaxa(removed_seqs, twin_seqs);
 			}
-			// now print to file
-			for (j = 0; j < trees.tree_weights[i]; j++)
-				if (params.print_ufboot_trees == 1)
-					trees[i]->printTree(out, WT_NEWLINE);
-				else
-					trees[i]->printTree(out, WT_NEWLINE + WT_BR_LEN);
 		}
+		// now print to file in the order of the samples
+		for (sample = 0; sample < index.size(); sample++)
+			if (index[sample] >= 0)
+				trees[index[sample]]->printTree(out, WT_NEWLINE);
 		cout << "UFBoot trees printed to " << filename << endl;
 	} else {
 		// with branch lengths
@@ -2966,16 +3270,20 @@ void IQTree::writeUFBootTrees(Params &params) {
 }
 
 void IQTree::summarizeBootstrap(Params &params) {
+    flushRELLBuffer();
 	setRootNode(params.root);
     MTreeSet trees;
-    trees.init(boot_trees, rooted);
+    IntVector index;
+    getBootTrees(trees, index);
     summarizeBootstrap(params, trees);
 }
 
 void IQTree::summarizeBootstrap(SplitGraph &sg) {
     MTreeSet trees;
     //SplitGraph sg;
-    trees.init(boot_trees, rooted);
+    flushRELLBuffer();
+    IntVector index;
+    getBootTrees(trees, index);
     SplitIntMap hash_ss;
     // make the taxa name
     vector<string> taxname;
@@ -3000,8 +3308,9 @@ void IQTree::pllConvertUFBootData2IQTree(){
 
     //boot_trees
     boot_trees.clear();
+    boot_topologies.clear();
     for(int i = 0; i < params->gbo_replicates; i++)
-        boot_trees.push_back(pllUFBootDataPtr->boot_trees[i]);
+        boot_trees.push_back(boot_topologies.addTopology(pllUFBootDataPtr->boot_trees[i]));
 
 }
 
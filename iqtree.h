@@ -31,6 +31,8 @@
 #include "node.h"
 #include "candidateset.h"
 #include "pllnni.h"
+#include "bootsample.h"
+#include "topologytable.h"
 
 typedef std::map< string, double > mapString2Double;
 typedef std::multiset< double, std::less< double > > multiSetDB;
@@ -277,6 +279,30 @@ public:
      */
     double doTreeSearch();
 
+    /**
+            @return TRUE if the tree search can run several descents concurrently (-sw)
+     */
+    bool canUseSearchWorkers();
+
+    /**
+            -sw: run up to params->search_workers concurrent perturbation + NNI descents until the
+            stop rule is met, as many as fit into memory. Each worker has its own copy of the tree and
+            partial likelihoods, shares alignment and model with this tree, takes its start tree from
+            candidateTrees and puts its result and its UFBoot trees back into this tree under a lock.
+            When a better tree is found, the other workers finish their descents and the model is
+            re-optimized by this tree.
+            @param[in,out] cur_correlation UFBoot convergence, see checkBootstrapConvergence()
+     */
+    void doParallelTreeSearch(double &cur_correlation);
+
+    /**
+            UFBoot: summarize the split supports every half step of params->step_iterations and
+            compute their correlation every full step, print the UFBoot trees every 10 iterations
+            @param iteration the search iteration that just finished
+            @param[out] cur_correlation the correlation, only updated at a full step
+     */
+    void checkBootstrapConvergence(int iteration, double &cur_correlation);
+
     /**
      *  Wrapper function that uses either PLL or IQ-TREE to optimize the branch length
      *  @param maxTraversal
@@ -345,6 +371,21 @@ public:
      */
     void evalNNIs(NodeVector &nodes1, NodeVector &nodes2);
 
+    /**
+     * @brief Evaluate the NNIs on branches nodes1/nodes2 in parallel (-pnni). Each thread
+     * evaluates one branch at a time on a copy of its five branches, see PhyloTree::copyNNIBranches().
+     * The positive NNIs are added in the same order as by evalNNIs().
+     *
+     * @param[in] nodes1 contains one ends of the branches for NNI evaluation
+     * @param[in] nodes2 contains the other ends of the branches for NNI evaluation
+     */
+    void evalNNIsParallel(NodeVector &nodes1, NodeVector &nodes2);
+
+    /**
+     * delete the workers of evalNNIsParallel()
+     */
+    void deleteNNIWorkers();
+
     /**
             search all positive NNI move on the current tree and save them
             on the possilbleNNIMoves list
@@ -566,6 +607,11 @@ protected:
      */
     vector<NNIMove> nonConfNNIs;
 
+    /**
+        -pnni: one worker per thread for evalNNIsParallel(), holding the five branches of one NNI
+     */
+    vector<PhyloTree*> nni_workers;
+
     /**
      *  NNIs that have been applied in the previous step
      */
@@ -666,11 +712,19 @@ public:
     /** log-likelihood threshold (l_min) */
     double logl_cutoff;
 
-    /** vector of bootstrap alignments generated */
-    vector<BootValType* > boot_samples;
+    /**
+        -sw: the tree running the search if this tree is one of its workers, NULL otherwise
+    */
+    IQTree *search_master;
+
+    /** pattern counts of the bootstrap alignments generated */
+    BootSampleMatrix boot_samples;
+
+    /** ID in boot_topologies of the tree of each bootstrap sample, -1 if none */
+    IntVector boot_trees;
 
-    /** newick string of corresponding bootstrap trees */
-    StrVector boot_trees;
+    /** distinct topologies of the bootstrap trees */
+    TopologyTable boot_topologies;
 
     /** bootstrap tree strings with branch lengths, for -wbtl option */
     StrVector boot_trees_brlen;
@@ -684,6 +738,22 @@ public:
     /** corresponding log-likelihood on original alignment */
     DoubleVector boot_orig_logl;
 
+    /** pattern log-likelihoods of the candidate trees not yet scored against boot_samples,
+        params->ufboot_rell_batch vectors of the padded number of patterns */
+    BootValType *rell_buffer_lh;
+
+    /** log-likelihood on original alignment of the buffered trees */
+    DoubleVector rell_buffer_logl;
+
+    /** IDs in boot_topologies of the buffered trees */
+    IntVector rell_buffer_trees;
+
+    /** newick strings with branch lengths of the buffered trees, for -wbtl option */
+    StrVector rell_buffer_trees_brlen;
+
+    /** random numbers to break RELL ties, drawn when the buffered trees were saved */
+    DoubleVector rell_buffer_rand;
+
     /** Set of splits occurring in bootstrap trees */
     vector<SplitGraph*> boot_splits;
 
@@ -737,6 +807,29 @@ protected:
 
     virtual void saveCurrentTree(double logl); // save current tree
 
+    /**
+        add a tree to the trees scored by the next flushRELLBuffer()
+        @param pattern_lh pattern log-likelihoods of the tree, padded to the SIMD vector size
+        @param cur_logl log-likelihood of the tree
+        @param tree_str topology of the tree with taxon IDs
+        @param tree_str_brlen tree with branch lengths, only used for -wbtl
+    */
+    void bufferRELLTree(BootValType *pattern_lh, double cur_logl, string &tree_str, string &tree_str_brlen);
+
+    /**
+        compute the RELL scores of all trees buffered by saveCurrentTree() against all
+        bootstrap samples and update boot_logl, boot_counts, boot_trees accordingly.
+        Must be called before any of these vectors is read.
+    */
+    void flushRELLBuffer();
+
+    /**
+        convert the distinct topologies of the bootstrap trees into a tree set
+        @param[out] trees distinct bootstrap trees, weighted by their number of samples
+        @param[out] index position in trees of the tree of each bootstrap sample, -1 if none
+    */
+    void getBootTrees(MTreeSet &trees, IntVector &index);
+
     void saveNNITrees(PhyloNode *node = NULL, PhyloNode *dad = NULL);
 
     int duplication_counter;
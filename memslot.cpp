@@ -0,0 +1,178 @@
+//
+// C++ Implementation: memslot.cpp
+//
+// Description: MemSlotVector, a bounded pool of partial likelihood vectors (-mem)
+//
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+
+#include "memslot.h"
+#include "phylotree.h"
+
+/** bit of partial_lh_computed telling that the vector was evicted while still valid */
+const int LH_EVICTED = 4;
+
+MemSlotVector::MemSlotVector() : vector<MemSlot>() {
+    hits = misses = evictions = recomputations = 0;
+    clock = 0;
+    lh_block = 0;
+    scale_block = 0;
+}
+
+MemSlotVector::~MemSlotVector() {
+    clear();
+}
+
+void MemSlotVector::init(double *partial_lh, UBYTE *scale_num, size_t nslots, size_t lh_block, size_t scale_block) {
+    clear();
+    this->lh_block = lh_block;
+    this->scale_block = scale_block;
+    chunk_lh.push_back(partial_lh);
+    chunk_scale.push_back(scale_num);
+    chunk_first.push_back(0);
+    resize(nslots);
+    for (size_t i = 0; i < nslots; i++) {
+        MemSlot &slot = at(i);
+        slot.nei = NULL;
+        slot.partial_lh = partial_lh + i*lh_block;
+        slot.scale_num = scale_num + i*scale_block;
+        slot.last_used = 0;
+        slot.locks = 0;
+        slot.cherry = false;
+        slot.fresh = false;
+    }
+    // the first slots are taken first
+    for (size_t i = nslots; i > 0; i--)
+        free_slots.push_back(i-1);
+}
+
+void MemSlotVector::clear() {
+    // the first chunk belongs to central_partial_lh
+    for (size_t c = 1; c < chunk_lh.size(); c++) {
+        aligned_free(chunk_lh[c]);
+        aligned_free(chunk_scale[c]);
+    }
+    chunk_lh.clear();
+    chunk_scale.clear();
+    chunk_first.clear();
+    free_slots.clear();
+    lru_cherry.clear();
+    lru_other.clear();
+    vector<MemSlot>::clear();
+}
+
+void MemSlotVector::grow(size_t nslots) {
+    size_t first = size();
+    double *partial_lh = aligned_alloc<double>(nslots*lh_block);
+    UBYTE *scale_num = aligned_alloc<UBYTE>(nslots*scale_block);
+    chunk_lh.push_back(partial_lh);
+    chunk_scale.push_back(scale_num);
+    chunk_first.push_back(first);
+    resize(first + nslots);
+    for (size_t i = 0; i < nslots; i++) {
+        MemSlot &slot = at(first + i);
+        slot.nei = NULL;
+        slot.partial_lh = partial_lh + i*lh_block;
+        slot.scale_num = scale_num + i*scale_block;
+        slot.last_used = 0;
+        slot.locks = 0;
+        slot.cherry = false;
+        slot.fresh = false;
+    }
+    for (size_t i = nslots; i > 0; i--)
+        free_slots.push_back(first + i-1);
+}
+
+int MemSlotVector::findNei(PhyloNeighbor *nei) {
+    if (empty() || !nei->partial_lh)
+        return -1;
+    // partial_lh may also point to buffers outside the pool, e.g. during NNI evaluation
+    for (size_t c = 0; c < chunk_lh.size(); c++) {
+        size_t nslots = ((c+1 < chunk_first.size()) ? chunk_first[c+1] : size()) - chunk_first[c];
+        if (nei->partial_lh < chunk_lh[c] || nei->partial_lh >= chunk_lh[c] + nslots*lh_block)
+            continue;
+        size_t id = chunk_first[c] + (nei->partial_lh - chunk_lh[c]) / lh_block;
+        return (at(id).nei == nei) ? id : -1;
+    }
+    return -1;
+}
+
+void MemSlotVector::lock(PhyloNeighbor *nei) {
+    int id = findNei(nei);
+    if (id < 0)
+        return;
+    MemSlot &slot = at(id);
+    if (slot.fresh)
+        slot.fresh = false;
+    else
+        hits++;
+    // locked slots cannot be evicted
+    if (slot.locks == 0)
+        getLRU(id).erase(make_pair(slot.last_used, id));
+    slot.locks++;
+    slot.last_used = ++clock;
+}
+
+void MemSlotVector::unlock(PhyloNeighbor *nei) {
+    int id = findNei(nei);
+    if (id < 0)
+        return;
+    MemSlot &slot = at(id);
+    assert(slot.locks > 0);
+    slot.locks--;
+    if (slot.locks == 0)
+        getLRU(id).insert(make_pair(slot.last_used, id));
+}
+
+void MemSlotVector::acquire(PhyloNeighbor *nei, bool cherry) {
+    assert(!nei->partial_lh);
+    misses++;
+    if (nei->partial_lh_computed & LH_EVICTED) {
+        recomputations++;
+        nei->partial_lh_computed &= ~LH_EVICTED;
+    }
+    // pick a free slot, otherwise the least recently used cherry, otherwise the least recently used slot
+    if (free_slots.empty() && lru_cherry.empty() && lru_other.empty()) {
+        // the traversal is deeper than the current topology needed when the pool was created
+        size_t nslots = max(size()/4, (size_t)1);
+        outWarning("Memory limit (-mem) exceeded, adding " + convertIntToString(nslots) + " partial likelihood vectors");
+        grow(nslots);
+    }
+    int victim;
+    if (!free_slots.empty()) {
+        victim = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        set<pair<uint64_t, int> > &lru = lru_cherry.empty() ? lru_other : lru_cherry;
+        victim = lru.begin()->second;
+        lru.erase(lru.begin());
+    }
+
+    MemSlot &slot = at(victim);
+    PhyloNeighbor *old_nei = slot.nei;
+    // the old owner may have dropped this vector already (e.g. clearAllPartialLH(true))
+    if (old_nei && old_nei->partial_lh == slot.partial_lh) {
+        if (old_nei->partial_lh_computed & 1) {
+            evictions++;
+            old_nei->partial_lh_computed |= LH_EVICTED;
+        }
+        old_nei->partial_lh_computed &= ~1;
+        old_nei->partial_lh = NULL;
+        old_nei->scale_num = NULL;
+    }
+    slot.nei = nei;
+    slot.cherry = cherry;
+    slot.fresh = true;
+    slot.locks = 0;
+    slot.last_used = ++clock;
+    getLRU(victim).insert(make_pair(slot.last_used, victim));
+    nei->partial_lh = slot.partial_lh;
+    nei->scale_num = slot.scale_num;
+}
+
+void MemSlotVector::report(ostream &out) {
+    out << "Partial likelihood memory slots: " << size() << ", hits: " << hits << ", misses: " << misses
+        << ", evictions: " << evictions << ", recomputations: " << recomputations << endl;
+}
@@ -0,0 +1,167 @@
+//
+// C++ Interface: memslot.h
+//
+// Description: memory slots of partial likelihood vectors under a memory budget (-mem)
+//
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+
+#ifndef MEMSLOT_H
+#define MEMSLOT_H
+
+#include "phylonode.h"
+
+/**
+    one partial likelihood vector (and its scale numbers) in central_partial_lh
+*/
+struct MemSlot {
+    /** neighbor that currently stores its partial likelihoods here, NULL if free */
+    PhyloNeighbor *nei;
+
+    /** address of the partial likelihood vector */
+    double *partial_lh;
+
+    /** address of the scale num vector */
+    UBYTE *scale_num;
+
+    /** time stamp of the last access, for least-recently-used eviction */
+    uint64_t last_used;
+
+    /** number of ongoing computations that still need this vector */
+    int locks;
+
+    /** TRUE if the vector was computed from two tips, thus cheap to recompute */
+    bool cherry;
+
+    /** TRUE until the vector is used for the first time after being computed */
+    bool fresh;
+};
+
+/**
+    Pool of partial likelihood vectors for LM_MEM_SAVE (-mem). Vectors are assigned
+    to neighbors on demand; when the pool is full, the least recently used unlocked vector
+    is evicted, preferring cherries that do not need any recursion to be recomputed.
+    Free slots are kept in a stack and the unlocked used slots in two sets ordered by last use,
+    one for cherries and one for the others, thus acquire() takes O(log nslots) time.
+    An evicted neighbor loses its partial_lh and gets recomputed at the next traversal.
+    If all vectors are locked, the pool grows beyond the budget by a separately allocated chunk.
+    All functions are no-ops for neighbors not stored in the pool, and when the pool is empty.
+*/
+class MemSlotVector : public vector<MemSlot> {
+public:
+
+    MemSlotVector();
+
+    ~MemSlotVector();
+
+    /**
+        split the memory into slots, all of them free
+        @param partial_lh start of the partial likelihood vectors
+        @param scale_num start of the scale num vectors
+        @param nslots number of slots
+        @param lh_block size of one partial likelihood vector (in doubles)
+        @param scale_block size of one scale num vector
+    */
+    void init(double *partial_lh, UBYTE *scale_num, size_t nslots, size_t lh_block, size_t scale_block);
+
+    /**
+        remove all slots and free the memory allocated by grow()
+    */
+    void clear();
+
+    /**
+        add new free slots in a newly allocated chunk of memory
+        @param nslots number of slots to add
+    */
+    void grow(size_t nslots);
+
+    /**
+        @return number of slots in the first chunk, i.e. in the memory given to init()
+    */
+    size_t getInitSize() {
+        return (chunk_first.size() > 1) ? chunk_first[1] : size();
+    }
+
+    /**
+        @return slot index of the vector of nei, -1 if it is not stored in the pool
+    */
+    int findNei(PhyloNeighbor *nei);
+
+    /**
+        protect the vector of nei from eviction while it is needed by a computation,
+        counts a hit if the vector was computed by an earlier traversal
+    */
+    void lock(PhyloNeighbor *nei);
+
+    /**
+        undo lock()
+    */
+    void unlock(PhyloNeighbor *nei);
+
+    /**
+        give nei a vector of the pool, evicting the least recently used one if necessary,
+        or growing the pool if all vectors are locked
+        @param nei neighbor without partial_lh
+        @param cherry TRUE if nei will be computed from two tips
+    */
+    void acquire(PhyloNeighbor *nei, bool cherry);
+
+    /**
+        print the hit/miss statistics
+    */
+    void report(ostream &out);
+
+    /** number of reuses of vectors computed by an earlier traversal */
+    uint64_t hits;
+
+    /** number of vectors that had to be (re)assigned a slot */
+    uint64_t misses;
+
+    /** number of computed vectors that were evicted */
+    uint64_t evictions;
+
+    /** number of evicted vectors that had to be recomputed */
+    uint64_t recomputations;
+
+protected:
+
+    /**
+        @param id slot index
+        @return the eviction set of the slot
+    */
+    set<pair<uint64_t, int> > &getLRU(int id) {
+        return at(id).cherry ? lru_cherry : lru_other;
+    }
+
+    /** logical clock for last_used */
+    uint64_t clock;
+
+    /** indices of free slots */
+    vector<int> free_slots;
+
+    /** (last_used, index) of the unlocked cherry slots */
+    set<pair<uint64_t, int> > lru_cherry;
+
+    /** (last_used, index) of the other unlocked used slots */
+    set<pair<uint64_t, int> > lru_other;
+
+    /** start of the partial likelihood memory of each chunk */
+    vector<double*> chunk_lh;
+
+    /** start of the scale num memory of each chunk */
+    vector<UBYTE*> chunk_scale;
+
+    /** index of the first slot of each chunk */
+    vector<size_t> chunk_first;
+
+    /** size of one partial likelihood vector (in doubles) */
+    size_t lh_block;
+
+    /** size of one scale num vector */
+    size_t scale_block;
+
+};
+
+#endif
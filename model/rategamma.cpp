@@ -267,7 +267,7 @@ int RateGamma::computePatternRates(DoubleVector &pattern_rates, IntVector &patte
 		for (int c = 0; c < ncategory; c++) {
 			sum_rate += rates[c] * lh_cat[c];
 			sum_lh += lh_cat[c];
-			if (lh_cat[c] > lh_cat[best] || (lh_cat[c] == lh_cat[best] && random_double()<0.5))  // break tie at random
+			if (lh_cat[c] > lh_cat[best] || (lh_cat[c] == lh_cat[best] && random_double(rstream)<0.5))  // break tie at random
                 best = c;
 		}
 		pattern_rates[i] = sum_rate / sum_lh;
@@ -198,7 +198,7 @@ int RateGammaInvar::computePatternRates(DoubleVector &pattern_rates, IntVector &
 		for (int c = 0; c < ncategory; c++) {
 			sum_rate += rates[c] * lh_cat[c];
 			sum_lh += lh_cat[c];
-			if (lh_cat[c] > best_lh || (lh_cat[c] == best_lh && random_double()<0.5)) { // break tie at random
+			if (lh_cat[c] > best_lh || (lh_cat[c] == best_lh && random_double(rstream)<0.5)) { // break tie at random
                 best = c+1;
                 best_lh = lh_cat[c];
             }
@@ -0,0 +1,194 @@
+//
+// C++ Implementation: modelcache.cpp
+//
+// Description: ModelCache, persistent cache of model test results
+//
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+
+#include "modelcache.h"
+#include "phylotree.h"
+#include "phylotesting.h"
+#if !defined WIN32 && !defined _WIN32 && !defined __WIN32__
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/** FNV-1a hash of len bytes, continuing from hash */
+static void hashBytes(uint64_t &hash, const void *data, size_t len) {
+    const unsigned char *bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+}
+
+ModelCache::ModelCache() {
+}
+
+ModelCache::~ModelCache() {
+}
+
+ModelCache &ModelCache::getInstance() {
+    static ModelCache instance;
+    return instance;
+}
+
+void ModelCache::open(const char *file_name) {
+#ifdef _OPENMP
+#pragma omp critical(model_cache)
+#endif
+    if (cache_file.empty()) {
+        bool exists = fileExists(file_name);
+        int num_malformed = 0;
+        if (exists) {
+            ifstream in(file_name);
+            string str;
+            ModelInfo info;
+            while (getline(in, str)) {
+                if (str.empty() || str[0] == '#')
+                    continue;
+                // e.g. a line truncated by a crash or written by another version
+                size_t pos = str.find('\t');
+                string line = (pos == string::npos) ? "" : str.substr(pos+1);
+                if (pos == string::npos || str.find(':') > pos || !parseLine(line, info)) {
+                    num_malformed++;
+                    continue;
+                }
+                string key = str.substr(0, pos);
+                if (line_ids.find(key) != line_ids.end())
+                    continue;
+                line_ids[key] = lines.size();
+                lines.push_back(line);
+            }
+            in.close();
+        }
+        ofstream out(file_name, ios::app);
+        if (!out.is_open())
+            outError("Cannot write to file ", file_name);
+        out.close();
+        cache_file = file_name;
+        if (!exists)
+            appendFile("# IQ-TREE model cache: key<TAB>Model df LnL TreeLen ... Tree\n");
+        if (num_malformed)
+            outWarning(convertIntToString(num_malformed) + " malformed lines in model cache " + cache_file + " ignored");
+        cout << "Model cache " << file_name << " contains " << lines.size() << " models" << endl;
+    }
+}
+
+string ModelCache::getDataKey(PhyloTree *tree) {
+    Alignment *aln = tree->aln;
+    uint64_t hash = 14695981039346656037ULL;
+    int value = aln->seq_type;
+    hashBytes(hash, &value, sizeof(value));
+    value = aln->num_states;
+    hashBytes(hash, &value, sizeof(value));
+    for (int seq = 0; seq < aln->getNSeq(); seq++) {
+        string &name = aln->getSeqName(seq);
+        hashBytes(hash, name.c_str(), name.length()+1);
+    }
+    for (Alignment::iterator it = aln->begin(); it != aln->end(); it++) {
+        hashBytes(hash, it->data(), it->length());
+        hashBytes(hash, &it->frequency, sizeof(it->frequency));
+    }
+    if (aln->genetic_code)
+        hashBytes(hash, aln->genetic_code, strlen(aln->genetic_code));
+    Params *params = tree->params;
+    // branch lengths are part of the data if they are not (only) optimized
+    string tree_str = (params->fixed_branch_length != BRLEN_OPTIMIZE || params->user_file) ?
+            tree->getTreeString() : tree->getTopology();
+    hashBytes(hash, tree_str.c_str(), tree_str.length());
+    // options of the model optimization
+    hashBytes(hash, &params->fixed_branch_length, sizeof(params->fixed_branch_length));
+    hashBytes(hash, &params->modeps, sizeof(params->modeps));
+    hashBytes(hash, &params->min_branch_length, sizeof(params->min_branch_length));
+    hashBytes(hash, &params->max_branch_length, sizeof(params->max_branch_length));
+    hashBytes(hash, &params->optimize_model_rate_joint, sizeof(params->optimize_model_rate_joint));
+    hashBytes(hash, &params->optimize_by_newton, sizeof(params->optimize_by_newton));
+    hashBytes(hash, &params->optimize_rate_matrix, sizeof(params->optimize_rate_matrix));
+    hashBytes(hash, &params->optimize_mixmodel_weight, sizeof(params->optimize_mixmodel_weight));
+    hashBytes(hash, params->optimize_alg.c_str(), params->optimize_alg.length()+1);
+    hashBytes(hash, params->optimize_alg_gammai.c_str(), params->optimize_alg_gammai.length()+1);
+    stringstream key;
+    key << hex << setw(16) << setfill('0') << hash;
+    return key.str();
+}
+
+string ModelCache::getKey(string &data_key, string &model_name) {
+    return data_key + ":" + model_name;
+}
+
+bool ModelCache::find(string &key, ModelInfo &info, string &line) {
+    bool found = false;
+#ifdef _OPENMP
+#pragma omp critical(model_cache)
+#endif
+    {
+        StringIntMap::iterator it = line_ids.find(key);
+        if (it != line_ids.end()) {
+            line = lines[it->second];
+            found = true;
+        }
+    }
+    return found && parseLine(line, info);
+}
+
+bool ModelCache::parseLine(string &line, ModelInfo &info) {
+    // same fields as read by checkModelFile()
+    istringstream in(line);
+    in >> info.name >> info.df >> info.logl >> info.tree_len;
+    info.tree = "";
+    if (!line.empty() && *line.rbegin() == ';') {
+        size_t pos = line.rfind('\t');
+        if (pos != string::npos)
+            info.tree = line.substr(pos+1);
+    }
+    return !in.fail();
+}
+
+void ModelCache::add(string &key, string &line) {
+#ifdef _OPENMP
+#pragma omp critical(model_cache)
+#endif
+    if (!cache_file.empty() && line_ids.find(key) == line_ids.end()) {
+        line_ids[key] = lines.size();
+        lines.push_back(line);
+        appendFile(key + "\t" + line + "\n");
+    }
+}
+
+void ModelCache::appendFile(const string &str) {
+#if !defined WIN32 && !defined _WIN32 && !defined __WIN32__
+    int fd = ::open(cache_file.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0) {
+        outWarning("Cannot write to model cache " + cache_file);
+        return;
+    }
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET; // l_start = l_len = 0: the whole file
+    while (fcntl(fd, F_SETLKW, &lock) < 0 && errno == EINTR);
+    size_t done = 0;
+    while (done < str.length()) {
+        ssize_t n = write(fd, str.c_str() + done, str.length() - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            outWarning("Cannot write to model cache " + cache_file);
+            break;
+        }
+        done += n;
+    }
+    lock.l_type = F_UNLCK;
+    fcntl(fd, F_SETLK, &lock);
+    close(fd);
+#else
+    ofstream out(cache_file.c_str(), ios::app);
+    out << str;
+    out.close();
+#endif
+}
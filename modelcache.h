@@ -0,0 +1,109 @@
+//
+// C++ Interface: modelcache.h
+//
+// Description: persistent cache of model test results shared across runs (-mcache)
+//
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+
+#ifndef MODELCACHE_H
+#define MODELCACHE_H
+
+#include "alignment.h"
+
+class PhyloTree;
+struct ModelInfo;
+
+/**
+    Model test results (.model file lines) keyed by a hash of the data type, alignment patterns,
+    tree, options of the model optimization and model name. The cache file is a text file with one
+    "key<TAB>line" entry per line, loaded into a hash table at start, and new results are appended
+    to it under an advisory lock. Thus any run, e.g. with another partition scheme or prefix,
+    reuses the models already fitted to the same data.
+*/
+class ModelCache {
+public:
+
+    ModelCache();
+
+    ~ModelCache();
+
+    /** @return the cache shared by all model tests of this process */
+    static ModelCache &getInstance();
+
+    /**
+        load the entries of a cache file (if it exists), skipping malformed lines, and check that
+        new entries can be appended, does nothing if the cache is already open
+        @param file_name cache file name
+    */
+    void open(const char *file_name);
+
+    /** @return TRUE if the cache is open */
+    bool isOpen() {
+        return !cache_file.empty();
+    }
+
+    /**
+        @param tree tree with alignment, its topology is used, and its branch lengths if they are
+        fixed, scaled or given by the user
+        @return key of the alignment patterns, the tree and the options of the model optimization,
+        to be completed by getKey()
+    */
+    static string getDataKey(PhyloTree *tree);
+
+    /**
+        @param data_key key returned by getDataKey()
+        @param model_name full model name, e.g. from PhyloTree::getModelName()
+        @return key of the model fitted to the data
+    */
+    static string getKey(string &data_key, string &model_name);
+
+    /**
+        @param key key returned by getKey()
+        @param[out] info name, df, logl, tree_len and tree of the model
+        @param[out] line the .model file line of the model (without set name)
+        @return TRUE if the model was found
+    */
+    bool find(string &key, ModelInfo &info, string &line);
+
+    /**
+        add a model and append it to the cache file
+        @param key key returned by getKey()
+        @param line the .model file line of the model (without set name)
+    */
+    void add(string &key, string &line);
+
+    /** @return number of entries */
+    size_t size() {
+        return lines.size();
+    }
+
+protected:
+
+    /**
+        @param line a .model file line
+        @param[out] info name, df, logl, tree_len and tree of the model
+        @return FALSE if the line is malformed
+    */
+    static bool parseLine(string &line, ModelInfo &info);
+
+    /**
+        append to the cache file while holding a lock on it, as other runs may append at the same time
+        @param str complete lines to append
+    */
+    void appendFile(const string &str);
+
+    /** .model file lines */
+    StrVector lines;
+
+    /** map from key to index in lines */
+    StringIntMap line_ids;
+
+    /** cache file name, empty if the cache is not open */
+    string cache_file;
+
+};
+
+#endif
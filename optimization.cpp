@@ -159,6 +159,7 @@ void fixBound(double x[], double lower[], double upper[], int n) {
 **********************************************/
 Optimization::Optimization()
 {
+	rstream = NULL;
 }
 
 
@@ -477,9 +478,11 @@ double Optimization::minimizeNewton(double x1, double xguess, double x2, double
 
 #define ALF 1.0e-4
 #define TOLX 1.0e-7
-static double maxarg1,maxarg2;
-#define FMAX(a,b) (maxarg1=(a),maxarg2=(b),(maxarg1) > (maxarg2) ?\
-        (maxarg1) : (maxarg2))
+// functions instead of global temporaries, as models of different trees can be optimized concurrently
+static inline double fmax_bfgs(double a, double b) {
+    return (a > b) ? a : b;
+}
+#define FMAX(a,b) fmax_bfgs(a,b)
 
 void Optimization::lnsrch(int n, double xold[], double fold, double g[], double p[], double x[],
                    double *f, double stpmax, int *check, double lower[], double upper[]) {
@@ -591,7 +594,7 @@ double Optimization::minimizeMultiDimen(double guess[], int ndim, double lower[]
 			
 		do {
 			for (i = 1; i <= ndim; i++) {
-				guess[i] = random_double() * (upper[i] - lower[i])/3 + lower[i];
+				guess[i] = random_double(rstream) * (upper[i] - lower[i])/3 + lower[i];
 			}
 		} while (false);
 		cout << "Restart estimation at the boundary... " << std::endl;
@@ -608,8 +611,10 @@ double Optimization::minimizeMultiDimen(double guess[], int ndim, double lower[]
 
 
 #define ITMAX 200
-static double sqrarg;
-#define SQR(a) ((sqrarg=(a)) == 0.0 ? 0.0 : sqrarg*sqrarg)
+static inline double sqr_bfgs(double a) {
+    return (a == 0.0) ? 0.0 : a*a;
+}
+#define SQR(a) sqr_bfgs(a)
 #define EPS 3.0e-8
 #define TOLX (4*EPS)
 #define STPMX 100.0
@@ -168,6 +168,9 @@ public:
 	*/
 	double brent(double ax, double bx, double cx, double tol, double *xmin);
 
+	/** random stream for the restarts of minimizeMultiDimen() and other random choices, NULL (default) for the global stream */
+	int *rstream;
+
 private:
 
 
@@ -0,0 +1,120 @@
+//
+// C++ Implementation: packedseqs.cpp
+//
+// Description: PackedSeqs, bit-packed sequences for fast pairwise distances
+//
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+
+#include "packedseqs.h"
+#include "alignment.h"
+#include "vectorclass/vectorclass.h"
+
+const int UINT_BITS = sizeof(UINT)*8;
+
+PackedSeqs::PackedSeqs() {
+    nwords = 0;
+    nplanes = 0;
+    one_hot = false;
+    bits = NULL;
+    nweights = 0;
+    weights = NULL;
+}
+
+PackedSeqs::~PackedSeqs() {
+    if (weights)
+        delete [] weights;
+    if (bits)
+        delete [] bits;
+}
+
+void PackedSeqs::init(Alignment *aln) {
+    size_t nptn = aln->getNPattern();
+    int nseq = aln->getNSeq();
+    int num_states = aln->num_states;
+    nwords = (nptn + UINT_BITS - 1) / UINT_BITS;
+    one_hot = (aln->seq_type == SEQ_DNA && num_states == 4);
+    if (one_hot) {
+        nplanes = 4;
+    } else {
+        int code_bits = 0;
+        while ((1 << code_bits) < num_states)
+            code_bits++;
+        nplanes = code_bits + 1;
+    }
+
+    // patterns by decreasing frequency
+    vector<pair<int,int> > freq_ptn(nptn);
+    for (size_t ptn = 0; ptn < nptn; ptn++)
+        freq_ptn[ptn] = make_pair(-aln->at(ptn).frequency, (int)ptn);
+    sort(freq_ptn.begin(), freq_ptn.end());
+    int max_freq = (nptn > 0) ? -freq_ptn[0].first : 0;
+    nweights = 0;
+    while ((max_freq >> nweights) > 0)
+        nweights++;
+
+    weights = new UINT[nweights*nwords];
+    memset(weights, 0, sizeof(UINT)*nweights*nwords);
+    weight_words.assign(nweights, 0);
+    for (size_t col = 0; col < nptn; col++) {
+        int freq = -freq_ptn[col].first;
+        for (int b = 0; b < nweights && (freq >> b) > 0; b++) {
+            if (freq & (1 << b))
+                weights[b*nwords + col/UINT_BITS] |= (UINT)1 << (col % UINT_BITS);
+            weight_words[b] = col/UINT_BITS + 1;
+        }
+    }
+
+    bits = new UINT[(size_t)nseq*nplanes*nwords];
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int seq = 0; seq < nseq; seq++) {
+        UINT *seq_bits = bits + (size_t)seq*nplanes*nwords;
+        memset(seq_bits, 0, sizeof(UINT)*nplanes*nwords);
+        for (size_t col = 0; col < nptn; col++) {
+            int state = aln->at(freq_ptn[col].second)[seq];
+            if (state >= num_states)
+                continue;
+            UINT mask = (UINT)1 << (col % UINT_BITS);
+            size_t word = col / UINT_BITS;
+            if (one_hot) {
+                seq_bits[state*nwords + word] |= mask;
+            } else {
+                seq_bits[word] |= mask;
+                for (int p = 1; p < nplanes; p++)
+                    if (state & (1 << (p-1)))
+                        seq_bits[p*nwords + word] |= mask;
+            }
+        }
+    }
+}
+
+void PackedSeqs::countDiff(int seq1, int seq2, int &diff_pos, int &total_pos) {
+    UINT *x = bits + (size_t)seq1*nplanes*nwords;
+    UINT *y = bits + (size_t)seq2*nplanes*nwords;
+    diff_pos = total_pos = 0;
+    for (size_t w = 0; w < nwords; w++) {
+        UINT both, differ;
+        if (one_hot) {
+            UINT a1 = x[w], c1 = x[nwords+w], g1 = x[2*nwords+w], t1 = x[3*nwords+w];
+            UINT a2 = y[w], c2 = y[nwords+w], g2 = y[2*nwords+w], t2 = y[3*nwords+w];
+            both = (a1 | c1 | g1 | t1) & (a2 | c2 | g2 | t2);
+            differ = both & ~((a1 & a2) | (c1 & c2) | (g1 & g2) | (t1 & t2));
+        } else {
+            both = x[w] & y[w];
+            UINT code_diff = 0;
+            for (int p = 1; p < nplanes; p++)
+                code_diff |= x[p*nwords+w] ^ y[p*nwords+w];
+            differ = both & code_diff;
+        }
+        // weight plane b covers the patterns with frequency >= 2^b, thus it is not longer than plane b-1
+        for (int b = 0; b < nweights && w < weight_words[b]; b++) {
+            UINT weight = weights[b*nwords + w];
+            total_pos += vml_popcnt(both & weight) << b;
+            diff_pos += vml_popcnt(differ & weight) << b;
+        }
+    }
+}
@@ -0,0 +1,72 @@
+//
+// C++ Interface: packedseqs.h
+//
+// Description: bit-packed sequences for fast pairwise distances
+//
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+
+#ifndef PACKEDSEQS_H
+#define PACKEDSEQS_H
+
+#include "tools.h"
+
+class Alignment;
+
+/**
+    Transposed, bit-packed copy of an alignment: for every sequence, bit planes over the patterns.
+    DNA is stored as 4 one-hot planes (A, C, G, T), other data as a plane of unambiguous states plus
+    ceil(log2(num_states)) planes of the state code, e.g. 5 for protein. Ambiguous and unknown states have no bit set.
+    The patterns are ordered by decreasing frequency and the frequencies are split into binary weight planes,
+    thus the number of sites that differ between two sequences is a sum of popcounts, weight plane b
+    covering only the patterns with frequency >= 2^b.
+*/
+class PackedSeqs {
+public:
+
+    PackedSeqs();
+
+    ~PackedSeqs();
+
+    /**
+        build the bit planes of all sequences
+        @param aln alignment
+    */
+    void init(Alignment *aln);
+
+    /**
+        @param seq1 first sequence
+        @param seq2 second sequence
+        @param[out] diff_pos number of sites with different unambiguous states
+        @param[out] total_pos number of sites where both sequences have an unambiguous state
+    */
+    void countDiff(int seq1, int seq2, int &diff_pos, int &total_pos);
+
+protected:
+
+    /** number of UINT words per plane */
+    size_t nwords;
+
+    /** number of planes per sequence */
+    int nplanes;
+
+    /** TRUE for the one-hot DNA planes */
+    bool one_hot;
+
+    /** nseq x nplanes x nwords bits */
+    UINT *bits;
+
+    /** number of weight planes */
+    int nweights;
+
+    /** nweights x nwords bits, bit b of the pattern frequencies */
+    UINT *weights;
+
+    /** for each weight plane b, number of words of the patterns with frequency >= 2^b */
+    vector<size_t> weight_words;
+
+};
+
+#endif
@@ -2298,6 +2298,9 @@ int main(int argc, char *argv[])
 	instruction_set = instrset_detect();
 #if defined(BINARY32) || defined(__NOAVX__)
     instruction_set = min(instruction_set, 6);
+#endif
+#ifdef __NOAVX512__
+    instruction_set = min(instruction_set, 8);
 #endif
 	if (instruction_set < 3) outError("Your CPU does not support SSE3!");
 	bool has_fma3 = (instruction_set >= 7) && hasFMA3();
@@ -2344,6 +2347,8 @@ int main(int argc, char *argv[])
 
 	if (Params::getInstance().lk_no_avx)
 		instruction_set = min(instruction_set, 6);
+	if (Params::getInstance().lk_no_avx512)
+		instruction_set = min(instruction_set, 8);
 
 	cout << "Kernel:  ";
 	if (Params::getInstance().pll) {
@@ -2356,7 +2361,9 @@ int main(int argc, char *argv[])
 		switch (Params::getInstance().SSE) {
 		case LK_EIGEN: cout << "No SSE"; break;
 		case LK_EIGEN_SSE:
-			if (instruction_set >= 7) {
+			if (instruction_set >= 9) {
+				cout << "AVX-512";
+			} else if (instruction_set >= 7) {
 				cout << "AVX";
 			} else {
 				cout << "SSE3";
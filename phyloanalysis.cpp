@@ -52,6 +52,13 @@
 #include "model/modelset.h"
 #include "timeutil.h"
 #include "upperbounds.h"
+#if !defined WIN32 && !defined _WIN32 && !defined __WIN32__
+#include <fcntl.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#endif
 
 
 void reportReferences(Params &params, ofstream &out, string &original_model) {
@@ -143,6 +150,20 @@ void reportModelSelection(ofstream &out, Params &params, vector<ModelInfo> &mode
 	*/
 	int setid = 1;
 	for (it = model_info.begin(); it != model_info.end(); it++) {
+		if (!is_partitioned && it->IC_estimate != 0.0) {
+			// -mprune: not fully optimized, thus without scores
+			out.width(15);
+			out << left << it->name << " ";
+			out.width(11);
+			out << right << it->logl << " ";
+			out.width(11);
+			out << "pruned" << "          ";
+			out.width(11);
+			out << "pruned" << "          ";
+			out.width(11);
+			out << "pruned" << endl;
+			continue;
+		}
 		if (it->AIC_score == DBL_MAX) continue;
 		if (it != model_info.begin() && it->set_name != (it-1)->set_name)
 			setid++;
@@ -172,6 +193,30 @@ void reportModelSelection(ofstream &out, Params &params, vector<ModelInfo> &mode
 		 << "Plus signs denote the 95% confidence sets." << endl
 		 << "Minus signs denote significant exclusion." <<endl;
 	out << endl;
+
+	// models pruned by staged evaluation (-mprune)
+	bool pruned = false;
+	for (it = model_info.begin(); it != model_info.end(); it++) {
+		if (is_partitioned || it->IC_estimate == 0.0) continue;
+		if (!pruned) {
+			out << "Models pruned after three rounds of optimization, as the estimate of their "
+				<< ((params.model_test_criterion == MTC_BIC) ? "BIC" :
+					((params.model_test_criterion == MTC_AIC) ? "AIC" : "AICc"))
+				<< " score" << endl << "was worse than the best model found so far (-mprune):" << endl << endl;
+			out << "Model             LogL     Estimate" << endl;
+			pruned = true;
+		}
+		out.width(15);
+		out << left << it->name << " ";
+		out.width(11);
+		out << right << it->logl << " ";
+		out.width(11);
+		out << it->IC_estimate << endl;
+	}
+	if (pruned)
+		out << endl << "LogL     : log-likelihood after three rounds of optimization." << endl
+			<< "Estimate : score with full optimization if it gained as much log-likelihood as the" << endl
+			<< "           other models so far (at least the -mprune margin). A heuristic, not a bound." << endl << endl;
 }
 
 void reportModel(ofstream &out, Alignment *aln, ModelSubst *m) {
@@ -800,6 +845,12 @@ void reportPhyloAnalysis(Params &params, string &original_model,
 					out << left << (*it)->getModelName() << " " << (*it)->treeLength() << "  " << (*it)->getModelNameParams() << endl;
 			}
 			out << endl;
+			out << "  ID  Likelihood kernel" << endl;
+			for (it = stree->begin(), part = 0; it != stree->end(); it++, part++) {
+				out.width(4);
+				out << right << (part+1) << "  " << (*it)->getLikelihoodKernelName() << endl;
+			}
+			out << endl;
 			/*
 			for (it = stree->begin(), part = 0; it != stree->end(); it++, part++) {
 				reportModel(out, *(*it));
@@ -808,6 +859,7 @@ void reportPhyloAnalysis(Params &params, string &original_model,
 		} else {
 			reportModel(out, tree);
 			reportRate(out, tree);
+			out << "Likelihood kernel: " << tree.getLikelihoodKernelName() << endl << endl;
 		}
 
     		if (params.lmap_num_quartets >= 0) {
@@ -1658,7 +1710,11 @@ void printFinalSearchInfo(Params &params, IQTree &iqtree, double search_cpu_time
 	params.run_time = (getCPUTime() - params.startCPUTime);
 	cout << endl;
 	cout << "Total number of iterations: " << iqtree.stop_rule.getCurIt() << endl;
-//    cout << "Total number of partial likelihood vector computations: " << iqtree.num_partial_lh_computations << endl;
+	if (verbose_mode >= VB_MED)
+		cout << "Total number of partial likelihood vector computations: " << iqtree.num_partial_lh_computations
+			<< ", invalidations by tree changes: " << iqtree.num_partial_lh_invalidated << endl;
+	if (!iqtree.mem_slots.empty())
+		iqtree.mem_slots.report(cout);
 	cout << "CPU time used for tree search: " << search_cpu_time
 			<< " sec (" << convert_time(search_cpu_time) << ")" << endl;
 	cout << "Wall-clock time used for tree search: " << search_real_time
@@ -1769,6 +1825,11 @@ void runTreeReconstruction(Params &params, string &original_model, IQTree &iqtre
     	printAnalysisInfo(model_df, iqtree, params);
     }
 
+    if (params.lh_mem_save == LM_MEM_SAVE && !iqtree.isMemSaveSupported()) {
+        outWarning("Memory limit (-mem) is only supported for the Eigen kernels of non-partition, non-mixture models, storing one partial likelihood vector per node");
+        params.lh_mem_save = LM_PER_NODE;
+    }
+
     if (!params.pll) {
         uint64_t mem_size = iqtree.getMemoryRequired();
         uint64_t total_mem = getMemorySize();
@@ -2289,6 +2350,129 @@ void exhaustiveSearchGAMMAInvar(Params &params, IQTree &iqtree) {
 /**********************************************************
  * STANDARD NON-PARAMETRIC BOOTSTRAP
  ***********************************************************/
+
+/**
+ * @return TRUE if the standard bootstrap replicates can be run by worker processes (-bw)
+ */
+bool canRunBootstrapWorkers(Params &params, IQTree *tree) {
+#if !defined WIN32 && !defined _WIN32 && !defined __WIN32__
+    return params.boot_workers > 1 && params.boot_worker_sample < 0 && params.num_bootstrap_samples > 1 &&
+        params.argv != NULL && !params.print_bootaln && !params.print_tree_lh;
+#else
+    return false;
+#endif
+}
+
+/**
+ * run the standard bootstrap replicates from bootSample on, params.boot_workers of them at the same time.
+ * Each replicate is run by a new process with the command line of this run plus "-bwsample <replicate>",
+ * its own prefix <prefix>.boot<replicate> and random seed, so that the trees do not depend on the scheduling.
+ * The trees are appended to the .boottrees file in the order of the replicates. Trees of replicates
+ * finished out of order are kept in the checkpoint, thus no finished replicate is run again after a restart.
+ */
+void runBootstrapWorkers(Params &params, IQTree *tree, int bootSample, string &boottrees_name) {
+#if !defined WIN32 && !defined _WIN32 && !defined __WIN32__
+    Checkpoint *checkpoint = tree->getCheckpoint();
+    int nworkers = min(params.boot_workers, params.num_bootstrap_samples - bootSample);
+    int worker_threads = max(1, params.num_threads / nworkers);
+    cout << "Running " << nworkers << " bootstrap replicates at the same time with "
+        << worker_threads << " thread(s) each" << endl;
+
+    string seed_str = convertIntToString(params.ran_seed);
+    string threads_str = convertIntToString(worker_threads);
+    map<pid_t, int> running; // worker process -> replicate
+    int next_sample = bootSample; // next replicate to start
+    int next_tree = bootSample; // next replicate to write into .boottrees
+    double start_time = getRealTime();
+
+    while (next_tree < params.num_bootstrap_samples) {
+        // start workers for the next replicates not yet finished
+        while ((int)running.size() < nworkers && next_sample < params.num_bootstrap_samples) {
+            int sample = next_sample++;
+            if (checkpoint->hasKey("bootTree" + convertIntToString(sample)))
+                continue;
+            string sample_str = convertIntToString(sample);
+            string prefix = string(params.out_prefix) + ".boot" + sample_str;
+            vector<char*> worker_argv(params.argv, params.argv + params.argc);
+            const char *extra_args[] = {"-bwsample", sample_str.c_str(), "-pre", prefix.c_str(),
+                "-nt", threads_str.c_str(), "-seed", seed_str.c_str(), "-redo"};
+            for (int i = 0; i < 9; i++)
+                worker_argv.push_back((char*)extra_args[i]);
+            worker_argv.push_back(NULL);
+            pid_t pid = fork();
+            if (pid == 0) {
+#ifdef __linux__
+                // do not leave a worker running if this run is killed
+                prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+                // the worker writes its own log file
+                int null_fd = open("/dev/null", O_WRONLY);
+                dup2(null_fd, STDOUT_FILENO);
+                dup2(null_fd, STDERR_FILENO);
+                execvp(params.argv[0], &worker_argv[0]);
+                _exit(127);
+            }
+            if (pid < 0)
+                outError("Cannot start bootstrap worker ", params.argv[0]);
+            running[pid] = sample;
+        }
+
+        // write the finished replicates in order
+        bool written = false;
+        string tree_str;
+        while (next_tree < params.num_bootstrap_samples &&
+            checkpoint->getString("bootTree" + convertIntToString(next_tree), tree_str)) {
+            try {
+                ofstream tree_out;
+                tree_out.exceptions(ios::failbit | ios::badbit);
+                tree_out.open(boottrees_name.c_str(), ios_base::out | ios_base::app);
+                tree_out << tree_str << endl;
+                tree_out.close();
+            } catch (ios::failure) {
+                outError(ERR_WRITE_OUTPUT, boottrees_name);
+            }
+            checkpoint->erase("bootTree" + convertIntToString(next_tree));
+            next_tree++;
+            written = true;
+        }
+        if (written) {
+            checkpoint->put("bootSample", next_tree);
+            checkpoint->putBool("finished", false);
+            checkpoint->dump(true);
+        }
+        if (running.empty())
+            continue;
+
+        // wait for any worker
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0 || running.find(pid) == running.end())
+            continue;
+        int sample = running[pid];
+        running.erase(pid);
+        string prefix = string(params.out_prefix) + ".boot" + convertIntToString(sample);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            outError("Bootstrap replicate " + convertIntToString(sample+1) + " failed, see log file " + prefix + ".log");
+        try {
+            ifstream tree_in;
+            tree_in.exceptions(ios::failbit | ios::badbit);
+            tree_in.open((prefix + ".boottrees").c_str());
+            getline(tree_in, tree_str);
+            tree_in.close();
+        } catch (ios::failure) {
+            outError(ERR_READ_INPUT, prefix + ".boottrees");
+        }
+        checkpoint->put("bootTree" + convertIntToString(sample), tree_str);
+        checkpoint->dump(true);
+        cout << "Bootstrap replicate " << sample+1 << " finished (" << getRealTime() - start_time << " sec)" << endl;
+        const char *worker_files[] = {".boottrees", ".treefile", ".log", ".ckp.gz", ".bionj", ".mldist",
+            ".model", ".uniqueseq.phy", ".iqtree", ".best_scheme", ".best_scheme.nex"};
+        for (int i = 0; i < 11; i++)
+            remove((prefix + worker_files[i]).c_str());
+    }
+#endif
+}
+
 void runStandardBootstrap(Params &params, string &original_model, Alignment *alignment, IQTree *tree) {
 	vector<ModelInfo> *model_info = new vector<ModelInfo>;
 	StrVector removed_seqs, twin_seqs;
@@ -2314,7 +2498,14 @@ void runStandardBootstrap(Params &params, string &original_model, Alignment *ali
 	string bootlh_name = params.out_prefix;
 	bootlh_name += ".bootlh";
     int bootSample = 0;
-    if (tree->getCheckpoint()->get("bootSample", bootSample)) {
+    int endSample = params.num_bootstrap_samples;
+    if (params.boot_worker_sample >= 0) {
+        // worker process of runBootstrapWorkers()
+        bootSample = params.boot_worker_sample;
+        endSample = bootSample + 1;
+        ofstream tree_out(boottrees_name.c_str());
+        tree_out.close();
+    } else if (tree->getCheckpoint()->get("bootSample", bootSample)) {
         cout << "CHECKPOINT: " << bootSample << " bootstrap analyses restored" << endl;
     } else {
         // first empty the boottrees file
@@ -2343,8 +2534,13 @@ void runStandardBootstrap(Params &params, string &original_model, Alignment *ali
 
     
     
+	if (canRunBootstrapWorkers(params, tree)) {
+		runBootstrapWorkers(params, tree, bootSample, boottrees_name);
+		bootSample = params.num_bootstrap_samples;
+	}
+
 	// do bootstrap analysis
-	for (int sample = bootSample; sample < params.num_bootstrap_samples; sample++) {
+	for (int sample = bootSample; sample < endSample; sample++) {
 		cout << endl << "===> START BOOTSTRAP REPLICATE NUMBER "
 				<< sample + 1 << endl << endl;
 
@@ -2364,6 +2560,11 @@ void runStandardBootstrap(Params &params, string &original_model, Alignment *ali
         // restore randstream
         finish_random();
         randstream = saved_randstream;
+        if (params.boot_worker_sample >= 0) {
+            // own random stream of the tree search, not shared with the other workers
+            finish_random();
+            init_random(params.ran_seed + params.num_bootstrap_samples + sample);
+        }
 
 		if (params.print_tree_lh) {
 			double prob;
@@ -2442,6 +2643,11 @@ void runStandardBootstrap(Params &params, string &original_model, Alignment *ali
         
 	}
 
+	if (params.boot_worker_sample >= 0) {
+		delete model_info;
+		return;
+	}
+
 
 	if (params.consensus_type == CT_CONSENSUS_TREE) {
 
@@ -12,6 +12,9 @@
 #include "vectorclass/vectorclass.h"
 #include "vectorclass/vectormath_exp.h"
 #include "superalignment.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 inline Vec2d horizontal_add(Vec2d x[2]) {
 #if  INSTRSET >= 3  // SSE3
@@ -57,6 +60,125 @@ inline double horizontal_max(Vec4d const &a) {
 
 #endif // __AVX__
 
+#if defined(__AVX512F__) && MAX_VECTOR_SIZE >= 512
+
+inline Vec8d horizontal_add(Vec8d x[8]) {
+	// fold upper into lower half, then reuse the AVX 4x4 transpose-add
+	Vec4d low[4], high[4];
+	for (int i = 0; i < 4; i++) {
+		low[i] = x[i].get_low() + x[i].get_high();
+		high[i] = x[i+4].get_low() + x[i+4].get_high();
+	}
+	return Vec8d(horizontal_add(low), horizontal_add(high));
+}
+
+inline double horizontal_max(Vec8d const &a) {
+	return horizontal_max(max(a.get_low(), a.get_high()));
+}
+
+#endif // __AVX512F__
+
+/*
+ * load/store partial likelihoods stored either in double or in single precision (-lhfloat).
+ * Arithmetic is always done in double, only the storage is narrowed.
+ */
+
+template <class VectorClass>
+inline VectorClass load_partial_lh(const double *p) {
+	return VectorClass().load_a(p);
+}
+
+template <class VectorClass>
+inline VectorClass load_partial_lh(const float *p);
+
+template <>
+inline Vec2d load_partial_lh<Vec2d>(const float *p) {
+	return extend_low(Vec4f().load_partial(2, p));
+}
+
+template <>
+inline Vec4d load_partial_lh<Vec4d>(const float *p) {
+	Vec4f x = Vec4f().load_a(p);
+	return Vec4d(extend_low(x), extend_high(x));
+}
+
+inline void store_partial_lh(Vec2d const &a, double *p) {
+	a.store_a(p);
+}
+
+inline void store_partial_lh(Vec2d const &a, float *p) {
+	compress(a, Vec2d(0.0)).store_partial(2, p);
+}
+
+inline void store_partial_lh(Vec4d const &a, double *p) {
+	a.store_a(p);
+}
+
+inline void store_partial_lh(Vec4d const &a, float *p) {
+	compress(a.get_low(), a.get_high()).store_a(p);
+}
+
+#if defined(__AVX512F__) && MAX_VECTOR_SIZE >= 512
+
+template <>
+inline Vec8d load_partial_lh<Vec8d>(const float *p) {
+	Vec8f x = Vec8f().load_a(p);
+	return Vec8d(extend_low(x), extend_high(x));
+}
+
+inline void store_partial_lh(Vec8d const &a, double *p) {
+	a.store_a(p);
+}
+
+inline void store_partial_lh(Vec8d const &a, float *p) {
+	compress(a.get_low(), a.get_high()).store_a(p);
+}
+
+#endif // __AVX512F__
+
+/**
+ * allocate one double buffer per thread to compute partial likelihoods before narrowing them
+ * @return NULL if partial likelihoods are stored in double (computed in place)
+ */
+inline double *newPartialLhScratch(bool lh_float, size_t block) {
+	if (!lh_float)
+		return NULL;
+#ifdef _OPENMP
+	return aligned_alloc<double>(block*omp_get_max_threads());
+#else
+	return aligned_alloc<double>(block);
+#endif
+}
+
+/** @return the buffer of the calling thread, or partial_lh itself if there is no scratch */
+inline double *getPartialLhScratch(double *lh_scratch, size_t block, double *partial_lh) {
+	if (!lh_scratch)
+		return partial_lh;
+#ifdef _OPENMP
+	return lh_scratch + block*omp_get_thread_num();
+#else
+	return lh_scratch;
+#endif
+}
+
+/**
+ * update scaling counters of a pattern whose maximal partial likelihood lh_max underflows.
+ * Double storage scales once; single precision repeats until lh_max is back in float range.
+ * @return factor to multiply the partial likelihoods with
+ */
+inline double getScalingFactor(double lh_max, double scaling_threshold, bool lh_float, double log_scale,
+		double &sum_scale, UBYTE &scale_num) {
+	double scale_factor = 1.0;
+	do {
+		scale_factor /= scaling_threshold;
+		lh_max /= scaling_threshold;
+		// unobserved const pattern will never have underflow
+		sum_scale += log_scale;
+		scale_num += 1;
+	} while (lh_float && lh_max < scaling_threshold);
+	return scale_factor;
+}
+
 template <class Numeric, class VectorClass, const int VCSIZE>
 Numeric PhyloTree::dotProductSIMD(Numeric *x, Numeric *y, int size) {
 	VectorClass res = VectorClass().load_a(x) * VectorClass().load_a(y);
@@ -72,12 +194,15 @@ Numeric PhyloTree::dotProductSIMD(Numeric *x, Numeric *y, int size) {
  *************************************************************************************************/
 
 
-template <class VectorClass, const int VCSIZE, const int nstates>
+template <class VectorClass, const int VCSIZE, const int nstates, class LhType>
 void PhyloTree::computePartialLikelihoodEigenSIMD(PhyloNeighbor *dad_branch, PhyloNode *dad) {
 
     if (dad_branch->node->degree() > 3) {
         // TODO: SIMD version for multifurcating node
+        assert(sizeof(LhType) == sizeof(double) && "single-precision partial likelihoods need a bifurcating tree");
         computePartialLikelihoodEigen(dad_branch, dad);
+        if (params->site_repeats)
+            computeSiteRepeats(dad_branch, dad); // not used here, but by the parent
         return;
     }
 
@@ -110,6 +235,13 @@ void PhyloTree::computePartialLikelihoodEigenSIMD(PhyloNeighbor *dad_branch, Phy
     const size_t nstatesqr=nstates*nstates;
     size_t i, x, j;
     size_t block = nstates * ncat;
+    // each thread owns the same pattern block in every kernel; unobserved patterns go to the last block
+    int nblocks = computePatternBlocks(nstatesqr * ncat);
+
+    // single-precision storage uses a smaller scaling unit to stay within the float range
+    const bool lh_float = (sizeof(LhType) != sizeof(double));
+    const double scaling_threshold = lh_float ? SCALING_THRESHOLD_FLOAT : SCALING_THRESHOLD;
+    const double log_scaling_threshold = lh_float ? LOG_SCALING_THRESHOLD_FLOAT : LOG_SCALING_THRESHOLD;
 
 	// internal node
 	assert(node->degree() == 3); // it works only for strictly bifurcating tree
@@ -125,11 +257,15 @@ void PhyloTree::computePartialLikelihoodEigenSIMD(PhyloNeighbor *dad_branch, Phy
 		right = tmp;
 	}
 	if ((left->partial_lh_computed & 1) == 0)
-		computePartialLikelihoodEigenSIMD<VectorClass, VCSIZE, nstates>(left, node);
+		computePartialLikelihoodEigenSIMD<VectorClass, VCSIZE, nstates, LhType>(left, node);
+	mem_slots.lock(left);
 	if ((right->partial_lh_computed & 1) == 0)
-		computePartialLikelihoodEigenSIMD<VectorClass, VCSIZE, nstates>(right, node);
+		computePartialLikelihoodEigenSIMD<VectorClass, VCSIZE, nstates, LhType>(right, node);
+	mem_slots.lock(right);
 
-    if (params->lh_mem_save == LM_PER_NODE && !dad_branch->partial_lh) {
+    if (!mem_slots.empty() && !dad_branch->partial_lh) {
+        mem_slots.acquire(dad_branch, left->node->isLeaf() && right->node->isLeaf());
+    } else if (params->lh_mem_save == LM_PER_NODE && !dad_branch->partial_lh) {
         // re-orient partial_lh
         bool done = false;
         FOR_NEIGHBOR_IT(node, dad, it2) {
@@ -147,6 +283,16 @@ void PhyloTree::computePartialLikelihoodEigenSIMD(PhyloNeighbor *dad_branch, Phy
         assert(done && "partial_lh is not re-oriented");
     }
 
+    // -srep: only compute the first pattern of each site-repeat class, then copy it
+    int *ptn_class = NULL, *class_ptn = NULL;
+    if (params->site_repeats) {
+        computeSiteRepeats(dad_branch, dad);
+        if (!dad_branch->site_repeats->ptn_class.empty()) {
+            ptn_class = &dad_branch->site_repeats->ptn_class[0];
+            class_ptn = &dad_branch->site_repeats->class_ptn[0];
+        }
+    }
+
 	double *evec = model->getEigenvectors();
 	double *inv_evec = model->getInverseEigenvectors();
 
@@ -254,10 +400,13 @@ void PhyloTree::computePartialLikelihoodEigenSIMD(PhyloNeighbor *dad_branch, Phy
 		VectorClass res[VCSIZE];
 
 #ifdef _OPENMP
-#pragma omp parallel for private(ptn, c, x, i, j, vc_partial_lh_tmp, res)
+#pragma omp parallel for schedule(static, 1) num_threads(nblocks) if(nblocks > 1) private(ptn, c, x, i, j, vc_partial_lh_tmp, res)
 #endif
-		for (ptn = 0; ptn < nptn; ptn++) {
-	        double *partial_lh = dad_branch->partial_lh + ptn*block;
+		for (int b = 0; b < nblocks; b++)
+		for (ptn = ptn_limits[b]; ptn < ((b+1 < nblocks) ? ptn_limits[b+1] : nptn); ptn++) {
+	        if (ptn_class && ptn < orig_ntn && class_ptn[ptn_class[ptn]] != ptn)
+	        	continue;
+	        LhType *partial_lh = (LhType*)dad_branch->partial_lh + ptn*block;
 
 	        double *lh_left = lh_left_ptr[ptn];
 	        double *lh_right = lh_right_ptr[ptn];
@@ -276,7 +425,7 @@ void PhyloTree::computePartialLikelihoodEigenSIMD(PhyloNeighbor *dad_branch, Phy
 						for (j = 0; j < VCSIZE; j++) {
 							res[j] = mul_add(vc_partial_lh_tmp[x], vc_inv_evec[(i+j)*nstates/VCSIZE+x], res[j]);
 						}
-					horizontal_add(res).store_a(&partial_lh[i]);
+					store_partial_lh(horizontal_add(res), &partial_lh[i]);
 				}
 
 				lh_left += nstates;
@@ -336,20 +485,26 @@ void PhyloTree::computePartialLikelihoodEigenSIMD(PhyloNeighbor *dad_branch, Phy
 		VectorClass res[VCSIZE];
 		VectorClass vc_max; // maximum of partial likelihood, for scaling check
 		VectorClass vright[VCSIZE];
+		double *lh_scratch = newPartialLhScratch(lh_float, block);
 
 #ifdef _OPENMP
-#pragma omp parallel for reduction(+: sum_scale) private (ptn, c, x, i, j, vc_lh_right, vc_partial_lh_tmp, res, vc_max, vright)
+#pragma omp parallel for schedule(static, 1) num_threads(nblocks) if(nblocks > 1) reduction(+: sum_scale) private (ptn, c, x, i, j, vc_lh_right, vc_partial_lh_tmp, res, vc_max, vright)
 #endif
-		for (ptn = 0; ptn < nptn; ptn++) {
-	        double *partial_lh = dad_branch->partial_lh + ptn*block;
-	        double *partial_lh_right = right->partial_lh + ptn*block;
+		for (int b = 0; b < nblocks; b++)
+		for (ptn = ptn_limits[b]; ptn < ((b+1 < nblocks) ? ptn_limits[b+1] : nptn); ptn++) {
+	        if (ptn_class && ptn < orig_ntn && class_ptn[ptn_class[ptn]] != ptn)
+	        	continue;
+	        LhType *partial_lh = (LhType*)dad_branch->partial_lh + ptn*block;
+	        LhType *partial_lh_right = (LhType*)right->partial_lh + ptn*block;
+	        // results are first written in double, in place unless storage is single precision
+	        double *lh_buf = getPartialLhScratch(lh_scratch, block, (double*)partial_lh);
 
 	        double *lh_left = lh_left_ptr[ptn];
 			vc_max = 0.0;
 			for (c = 0; c < ncat; c++) {
 				// compute real partial likelihood vector
 				for (i = 0; i < nstates/VCSIZE; i++)
-					vc_lh_right[i].load_a(&partial_lh_right[i*VCSIZE]);
+					vc_lh_right[i] = load_partial_lh<VectorClass>(&partial_lh_right[i*VCSIZE]);
 
 				for (x = 0; x < nstates/VCSIZE; x++) {
 					size_t addr = c*nstatesqr/VCSIZE+x*nstates;
@@ -374,30 +529,36 @@ void PhyloTree::computePartialLikelihoodEigenSIMD(PhyloNeighbor *dad_branch, Phy
 						}
 					}
 					VectorClass sum_res = horizontal_add(res);
-					sum_res.store_a(&partial_lh[i]);
+					sum_res.store_a(&lh_buf[i]);
 					vc_max = max(vc_max, abs(sum_res)); // take the maximum for scaling check
 				}
 				lh_left += nstates;
 				partial_lh_right += nstates;
-				partial_lh += nstates;
+				lh_buf += nstates;
 			}
+        	lh_buf -= block; // revert its pointer
             // check if one should scale partial likelihoods
 			double lh_max = horizontal_max(vc_max);
-            if (lh_max < SCALING_THRESHOLD && ptn_invar[ptn] == 0.0) {
+			VectorClass scale_thres(1.0);
+            if (lh_max < scaling_threshold && ptn_invar[ptn] == 0.0) {
             	// now do the likelihood scaling
-            	partial_lh -= block; // revert its pointer
-            	VectorClass scale_thres(SCALING_THRESHOLD_INVER);
-				for (i = 0; i < block; i+=VCSIZE) {
-					(VectorClass().load_a(&partial_lh[i]) * scale_thres).store_a(&partial_lh[i]);
-				}
-				// unobserved const pattern will never have underflow
-				sum_scale += LOG_SCALING_THRESHOLD * ptn_freq[ptn];
-				dad_branch->scale_num[ptn] += 1;
-				partial_lh += block; // increase the pointer again
+            	scale_thres = getScalingFactor(lh_max, scaling_threshold, lh_float, log_scaling_threshold * ptn_freq[ptn],
+            			sum_scale, dad_branch->scale_num[ptn]);
+            	if (!lh_float)
+					for (i = 0; i < block; i+=VCSIZE) {
+						(VectorClass().load_a(&lh_buf[i]) * scale_thres).store_a(&lh_buf[i]);
+					}
+            }
+            if (lh_float) {
+            	// narrow into single-precision storage
+				for (i = 0; i < block; i+=VCSIZE)
+					store_partial_lh(VectorClass().load_a(&lh_buf[i]) * scale_thres, &partial_lh[i]);
             }
 
 		}
 		dad_branch->lh_scale_factor += sum_scale;
+		if (lh_scratch)
+			aligned_free(lh_scratch);
 
 	    aligned_free(lh_left_ptr);
 		aligned_free(partial_lh_left);
@@ -411,22 +572,27 @@ void PhyloTree::computePartialLikelihoodEigenSIMD(PhyloNeighbor *dad_branch, Phy
 		VectorClass vc_lh_left[nstates/VCSIZE], vc_lh_right[nstates/VCSIZE];
 		VectorClass res[VCSIZE];
 		VectorClass vleft[VCSIZE], vright[VCSIZE];
+		double *lh_scratch = newPartialLhScratch(lh_float, block);
 
 #ifdef _OPENMP
-#pragma omp parallel for reduction (+: sum_scale) private(ptn, c, x, i, j, vc_max, vc_partial_lh_tmp, vc_lh_left, vc_lh_right, res, vleft, vright)
+#pragma omp parallel for schedule(static, 1) num_threads(nblocks) if(nblocks > 1) reduction (+: sum_scale) private(ptn, c, x, i, j, vc_max, vc_partial_lh_tmp, vc_lh_left, vc_lh_right, res, vleft, vright)
 #endif
-		for (ptn = 0; ptn < nptn; ptn++) {
-	        double *partial_lh = dad_branch->partial_lh + ptn*block;
-			double *partial_lh_left = left->partial_lh + ptn*block;
-			double *partial_lh_right = right->partial_lh + ptn*block;
+		for (int b = 0; b < nblocks; b++)
+		for (ptn = ptn_limits[b]; ptn < ((b+1 < nblocks) ? ptn_limits[b+1] : nptn); ptn++) {
+	        if (ptn_class && ptn < orig_ntn && class_ptn[ptn_class[ptn]] != ptn)
+	        	continue;
+	        LhType *partial_lh = (LhType*)dad_branch->partial_lh + ptn*block;
+	        LhType *partial_lh_left = (LhType*)left->partial_lh + ptn*block;
+	        LhType *partial_lh_right = (LhType*)right->partial_lh + ptn*block;
+	        double *lh_buf = getPartialLhScratch(lh_scratch, block, (double*)partial_lh);
 
 			dad_branch->scale_num[ptn] = left->scale_num[ptn] + right->scale_num[ptn];
 			vc_max = 0.0;
 			for (c = 0; c < ncat; c++) {
 				// compute real partial likelihood vector
 				for (i = 0; i < nstates/VCSIZE; i++) {
-					vc_lh_left[i].load_a(&partial_lh_left[i*VCSIZE]);
-					vc_lh_right[i].load_a(&partial_lh_right[i*VCSIZE]);
+					vc_lh_left[i] = load_partial_lh<VectorClass>(&partial_lh_left[i*VCSIZE]);
+					vc_lh_right[i] = load_partial_lh<VectorClass>(&partial_lh_right[i*VCSIZE]);
 				}
 
 				for (x = 0; x < nstates/VCSIZE; x++) {
@@ -455,39 +621,82 @@ void PhyloTree::computePartialLikelihoodEigenSIMD(PhyloNeighbor *dad_branch, Phy
 							res[j] = mul_add(vc_partial_lh_tmp[x], vc_inv_evec[(i+j)*nstates/VCSIZE+x], res[j]);
 
 					VectorClass sum_res = horizontal_add(res);
-					sum_res.store_a(&partial_lh[i]);
+					sum_res.store_a(&lh_buf[i]);
 					vc_max = max(vc_max, abs(sum_res)); // take the maximum for scaling check
 				}
-				partial_lh += nstates;
+				lh_buf += nstates;
 				partial_lh_left += nstates;
 				partial_lh_right += nstates;
 			}
+        	lh_buf -= block; // revert its pointer
 
             // check if one should scale partial likelihoods
 			double lh_max = horizontal_max(vc_max);
-            if (lh_max < SCALING_THRESHOLD && ptn_invar[ptn] == 0.0) {
+			VectorClass scale_thres(1.0);
+            if (lh_max < scaling_threshold && ptn_invar[ptn] == 0.0) {
 				// now do the likelihood scaling
-            	partial_lh -= block; // revert its pointer
-            	VectorClass scale_thres(SCALING_THRESHOLD_INVER);
-				for (i = 0; i < block; i+=VCSIZE) {
-					(VectorClass().load_a(&partial_lh[i]) * scale_thres).store_a(&partial_lh[i]);
-				}
-				// unobserved const pattern will never have underflow
-				sum_scale += LOG_SCALING_THRESHOLD * ptn_freq[ptn];
-				dad_branch->scale_num[ptn] += 1;
-				partial_lh += block; // increase the pointer again
+            	scale_thres = getScalingFactor(lh_max, scaling_threshold, lh_float, log_scaling_threshold * ptn_freq[ptn],
+            			sum_scale, dad_branch->scale_num[ptn]);
+            	if (!lh_float)
+					for (i = 0; i < block; i+=VCSIZE) {
+						(VectorClass().load_a(&lh_buf[i]) * scale_thres).store_a(&lh_buf[i]);
+					}
+            }
+            if (lh_float) {
+            	// narrow into single-precision storage
+				for (i = 0; i < block; i+=VCSIZE)
+					store_partial_lh(VectorClass().load_a(&lh_buf[i]) * scale_thres, &partial_lh[i]);
             }
 
 		}
 		dad_branch->lh_scale_factor += sum_scale;
+		if (lh_scratch)
+			aligned_free(lh_scratch);
 
 	}
 
+	if (ptn_class)
+		dad_branch->lh_scale_factor += copySiteRepeats<LhType>(dad_branch, dad, nblocks);
+
+	mem_slots.unlock(right);
+	mem_slots.unlock(left);
 	aligned_free(eright);
 	aligned_free(eleft);
 }
 
-template <class VectorClass, const int VCSIZE, const int nstates>
+template <class LhType>
+double PhyloTree::copySiteRepeats(PhyloNeighbor *dad_branch, PhyloNode *dad, int nblocks) {
+    PhyloNode *node = (PhyloNode*)dad_branch->node;
+    size_t block = aln->num_states * site_rate->getNRate();
+    int *ptn_class = &dad_branch->site_repeats->ptn_class[0];
+    int *class_ptn = &dad_branch->site_repeats->class_ptn[0];
+    const double log_scaling_threshold = (sizeof(LhType) != sizeof(double)) ? LOG_SCALING_THRESHOLD_FLOAT : LOG_SCALING_THRESHOLD;
+    // scale numbers of the children are equal for all patterns of a class
+    vector<UBYTE*> child_scale_num;
+    FOR_NEIGHBOR_IT(node, dad, it)
+        if (!(*it)->node->isLeaf())
+            child_scale_num.push_back(((PhyloNeighbor*)(*it))->scale_num);
+    double sum_scale = 0.0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1) num_threads(nblocks) if(nblocks > 1) reduction(+: sum_scale)
+#endif
+    for (int b = 0; b < nblocks; b++)
+    for (size_t ptn = ptn_limits[b]; ptn < ptn_limits[b+1]; ptn++) {
+        size_t first = class_ptn[ptn_class[ptn]];
+        if (first == ptn)
+            continue;
+        memcpy((LhType*)dad_branch->partial_lh + ptn*block, (LhType*)dad_branch->partial_lh + first*block, block*sizeof(LhType));
+        dad_branch->scale_num[ptn] = dad_branch->scale_num[first];
+        // number of scalings done at this node
+        int scale_num = dad_branch->scale_num[first];
+        for (int i = 0; i < child_scale_num.size(); i++)
+            scale_num -= child_scale_num[i][first];
+        sum_scale += log_scaling_threshold * scale_num * ptn_freq[ptn];
+    }
+    return sum_scale;
+}
+
+template <class VectorClass, const int VCSIZE, const int nstates, class LhType>
 void PhyloTree::computeLikelihoodDervEigenSIMD(PhyloNeighbor *dad_branch, PhyloNode *dad, double &df, double &ddf) {
     PhyloNode *node = (PhyloNode*) dad_branch->node;
     PhyloNeighbor *node_branch = (PhyloNeighbor*) node->findNeighbor(dad);
@@ -502,9 +711,11 @@ void PhyloTree::computeLikelihoodDervEigenSIMD(PhyloNeighbor *dad_branch, PhyloN
     	node_branch = tmp_nei;
     }
     if ((dad_branch->partial_lh_computed & 1) == 0)
-        computePartialLikelihoodEigenSIMD<VectorClass, VCSIZE, nstates>(dad_branch, dad);
+        computePartialLikelihoodEigenSIMD<VectorClass, VCSIZE, nstates, LhType>(dad_branch, dad);
+    mem_slots.lock(dad_branch);
     if ((node_branch->partial_lh_computed & 1) == 0)
-        computePartialLikelihoodEigenSIMD<VectorClass, VCSIZE, nstates>(node_branch, node);
+        computePartialLikelihoodEigenSIMD<VectorClass, VCSIZE, nstates, LhType>(node_branch, node);
+    mem_slots.lock(node_branch);
     df = ddf = 0.0;
     size_t ncat = site_rate->getNRate();
 
@@ -515,6 +726,7 @@ void PhyloTree::computeLikelihoodDervEigenSIMD(PhyloNeighbor *dad_branch, PhyloN
     size_t nptn = aln->size()+model_factory->unobserved_ptns.size();
     size_t maxptn = ((nptn+VCSIZE-1)/VCSIZE)*VCSIZE;
     maxptn = max(maxptn, aln->size()+((model_factory->unobserved_ptns.size()+VCSIZE-1)/VCSIZE)*VCSIZE);
+    int nblocks = computePatternBlocks(nstates * block);
     double *eval = model->getEigenvalues();
     assert(eval);
 
@@ -544,35 +756,36 @@ void PhyloTree::computeLikelihoodDervEigenSIMD(PhyloNeighbor *dad_branch, PhyloN
 		if (dad->isLeaf()) {
 	    	// special treatment for TIP-INTERNAL NODE case
 #ifdef _OPENMP
-#pragma omp parallel for private(ptn, i)
+#pragma omp parallel for schedule(static, 1) num_threads(nblocks) if(nblocks > 1) private(ptn, i)
 #endif
-			for (ptn = 0; ptn < orig_nptn; ptn++) {
-			    double *partial_lh_dad = dad_branch->partial_lh + ptn*block;
+			for (int b = 0; b < nblocks; b++)
+			for (ptn = ptn_limits[b]; ptn < ptn_limits[b+1]; ptn++) {
+			    LhType *partial_lh_dad = (LhType*)dad_branch->partial_lh + ptn*block;
 				double *theta = theta_all + ptn*block;
 				double *lh_dad = &tip_partial_lh[(aln->at(ptn))[dad->id] * nstates];
 				for (i = 0; i < block; i+=VCSIZE) {
-					(VectorClass().load_a(&lh_dad[i%nstates]) * VectorClass().load_a(&partial_lh_dad[i])).store_a(&theta[i]);
+					(VectorClass().load_a(&lh_dad[i%nstates]) * load_partial_lh<VectorClass>(&partial_lh_dad[i])).store_a(&theta[i]);
 				}
 			}
 			// ascertainment bias correction
 			for (ptn = orig_nptn; ptn < nptn; ptn++) {
-			    double *partial_lh_dad = dad_branch->partial_lh + ptn*block;
+			    LhType *partial_lh_dad = (LhType*)dad_branch->partial_lh + ptn*block;
 				double *theta = theta_all + ptn*block;
 				double *lh_dad = &tip_partial_lh[model_factory->unobserved_ptns[ptn-orig_nptn] * nstates];
 				for (i = 0; i < block; i+=VCSIZE) {
-					(VectorClass().load_a(&lh_dad[i%nstates]) * VectorClass().load_a(&partial_lh_dad[i])).store_a(&theta[i]);
+					(VectorClass().load_a(&lh_dad[i%nstates]) * load_partial_lh<VectorClass>(&partial_lh_dad[i])).store_a(&theta[i]);
 				}
 			}
 	    } else {
 	    	// both dad and node are internal nodes
-		    double *partial_lh_node = node_branch->partial_lh;
-		    double *partial_lh_dad = dad_branch->partial_lh;
-	    	size_t all_entries = nptn*block;
+		    LhType *partial_lh_node = (LhType*)node_branch->partial_lh;
+		    LhType *partial_lh_dad = (LhType*)dad_branch->partial_lh;
 #ifdef _OPENMP
-#pragma omp parallel for private(i)
+#pragma omp parallel for schedule(static, 1) num_threads(nblocks) if(nblocks > 1) private(i)
 #endif
-	    	for (i = 0; i < all_entries; i+=VCSIZE) {
-				(VectorClass().load_a(&partial_lh_node[i]) * VectorClass().load_a(&partial_lh_dad[i]))
+	    	for (int b = 0; b < nblocks; b++)
+	    	for (i = ptn_limits[b]*block; i < ((b+1 < nblocks) ? ptn_limits[b+1] : nptn)*block; i+=VCSIZE) {
+				(load_partial_lh<VectorClass>(&partial_lh_node[i]) * load_partial_lh<VectorClass>(&partial_lh_dad[i]))
 						.store_a(&theta_all[i]);
 			}
 	    }
@@ -595,13 +808,14 @@ void PhyloTree::computeLikelihoodDervEigenSIMD(PhyloNeighbor *dad_branch, PhyloN
 	// perform 2 sites at the same time for SSE/AVX efficiency
 
 #ifdef _OPENMP
-#pragma omp parallel private (ptn, i, j, vc_freq, vc_ptn, vc_df, vc_ddf, vc_theta, inv_lh_ptn, lh_ptn, df_ptn, ddf_ptn)
+#pragma omp parallel num_threads(nblocks) if(nblocks > 1) private (ptn, i, j, vc_freq, vc_ptn, vc_df, vc_ddf, vc_theta, inv_lh_ptn, lh_ptn, df_ptn, ddf_ptn)
 	{
 	VectorClass df_final_th = 0.0;
 	VectorClass ddf_final_th = 0.0;
-#pragma omp for nowait
+#pragma omp for schedule(static, 1) nowait
 #endif
-	for (ptn = 0; ptn < orig_nptn; ptn+=VCSIZE) {
+	for (int b = 0; b < nblocks; b++)
+	for (ptn = ptn_limits[b]; ptn < ptn_limits[b+1]; ptn+=VCSIZE) {
 		double *theta = theta_all + ptn*block;
 		// initialization
 		for (i = 0; i < VCSIZE; i++) {
@@ -718,7 +932,15 @@ void PhyloTree::computeLikelihoodDervEigenSIMD(PhyloNeighbor *dad_branch, PhyloN
 			ddf_const = horizontal_add(ddf_final)+ddf_ptn[0]+ddf_ptn[1]+ddf_ptn[2];
 			break;
 		default:
-			assert(0);
+			// AVX-512: up to VCSIZE-1 remaining patterns
+			prob_const = horizontal_add(lh_final);
+			df_const = horizontal_add(df_final);
+			ddf_const = horizontal_add(ddf_final);
+			for (int k = 0; k < (nptn-orig_nptn)%VCSIZE; k++) {
+				prob_const += lh_ptn[k];
+				df_const += df_ptn[k];
+				ddf_const += ddf_ptn[k];
+			}
 			break;
 		}
     	prob_const = 1.0 - prob_const;
@@ -729,13 +951,15 @@ void PhyloTree::computeLikelihoodDervEigenSIMD(PhyloNeighbor *dad_branch, PhyloN
     	ddf += nsites *(ddf_frac + df_frac*df_frac);
 	}
     assert(!isnan(df));
+    mem_slots.unlock(node_branch);
+    mem_slots.unlock(dad_branch);
     aligned_free(vc_val2);
     aligned_free(vc_val1);
     aligned_free(vc_val0);
 }
 
 
-template <class VectorClass, const int VCSIZE, const int nstates>
+template <class VectorClass, const int VCSIZE, const int nstates, class LhType>
 double PhyloTree::computeLikelihoodBranchEigenSIMD(PhyloNeighbor *dad_branch, PhyloNode *dad) {
     PhyloNode *node = (PhyloNode*) dad_branch->node;
     PhyloNeighbor *node_branch = (PhyloNeighbor*) node->findNeighbor(dad);
@@ -750,9 +974,11 @@ double PhyloTree::computeLikelihoodBranchEigenSIMD(PhyloNeighbor *dad_branch, Ph
     	node_branch = tmp_nei;
     }
     if ((dad_branch->partial_lh_computed & 1) == 0)
-        computePartialLikelihoodEigenSIMD<VectorClass, VCSIZE, nstates>(dad_branch, dad);
+        computePartialLikelihoodEigenSIMD<VectorClass, VCSIZE, nstates, LhType>(dad_branch, dad);
+    mem_slots.lock(dad_branch);
     if ((node_branch->partial_lh_computed & 1) == 0)
-        computePartialLikelihoodEigenSIMD<VectorClass, VCSIZE, nstates>(node_branch, node);
+        computePartialLikelihoodEigenSIMD<VectorClass, VCSIZE, nstates, LhType>(node_branch, node);
+    mem_slots.lock(node_branch);
     double tree_lh = node_branch->lh_scale_factor + dad_branch->lh_scale_factor;
     size_t ncat = site_rate->getNRate();
 
@@ -763,6 +989,7 @@ double PhyloTree::computeLikelihoodBranchEigenSIMD(PhyloNeighbor *dad_branch, Ph
     size_t nptn = aln->size()+model_factory->unobserved_ptns.size();
     size_t maxptn = ((nptn+VCSIZE-1)/VCSIZE)*VCSIZE;
     maxptn = max(maxptn, aln->size()+((model_factory->unobserved_ptns.size()+VCSIZE-1)/VCSIZE)*VCSIZE);
+    int nblocks = computePatternBlocks(nstates * block);
     double *eval = model->getEigenvalues();
     assert(eval);
 
@@ -799,17 +1026,18 @@ double PhyloTree::computeLikelihoodBranchEigenSIMD(PhyloNeighbor *dad_branch, Ph
 
 		// copy dummy values because VectorClass will access beyond nptn
 		for (ptn = nptn; ptn < maxptn; ptn++)
-			memcpy(&dad_branch->partial_lh[ptn*block], dad_branch->partial_lh, block*sizeof(double));
+			memcpy((LhType*)dad_branch->partial_lh + ptn*block, dad_branch->partial_lh, block*sizeof(LhType));
 
 #ifdef _OPENMP
-#pragma omp parallel private(ptn, i, j, vc_tip_partial_lh, vc_partial_lh_dad, vc_ptn, vc_freq, lh_ptn)
+#pragma omp parallel num_threads(nblocks) if(nblocks > 1) private(ptn, i, j, vc_tip_partial_lh, vc_partial_lh_dad, vc_ptn, vc_freq, lh_ptn)
     {
     	VectorClass lh_final_th = 0.0;
-#pragma omp for nowait
+#pragma omp for schedule(static, 1) nowait
 #endif
    		// main loop over all patterns with a step size of VCSIZE
-		for (ptn = 0; ptn < orig_nptn; ptn+=VCSIZE) {
-			double *partial_lh_dad = dad_branch->partial_lh + ptn*block;
+		for (int b = 0; b < nblocks; b++)
+		for (ptn = ptn_limits[b]; ptn < ptn_limits[b+1]; ptn+=VCSIZE) {
+			LhType *partial_lh_dad = (LhType*)dad_branch->partial_lh + ptn*block;
 
 			// initialize vc_tip_partial_lh
 			for (j = 0; j < VCSIZE; j++) {
@@ -817,14 +1045,14 @@ double PhyloTree::computeLikelihoodBranchEigenSIMD(PhyloNeighbor *dad_branch, Ph
 				for (i = 0; i < nstates/VCSIZE; i++) {
 					vc_tip_partial_lh[j*(nstates/VCSIZE)+i].load_a(&lh_dad[i*VCSIZE]);
 				}
-				vc_partial_lh_dad[j].load_a(&partial_lh_dad[j*block]);
+				vc_partial_lh_dad[j] = load_partial_lh<VectorClass>(&partial_lh_dad[j*block]);
 				vc_ptn[j] = vc_val[0] * vc_tip_partial_lh[j*(nstates/VCSIZE)] * vc_partial_lh_dad[j];
 			}
 
 			// compute vc_ptn
 			for (i = 1; i < block/VCSIZE; i++)
 				for (j = 0; j < VCSIZE; j++) {
-					vc_partial_lh_dad[j].load_a(&partial_lh_dad[j*block+i*VCSIZE]);
+					vc_partial_lh_dad[j] = load_partial_lh<VectorClass>(&partial_lh_dad[j*block+i*VCSIZE]);
 					vc_ptn[j] = mul_add(vc_val[i] * vc_tip_partial_lh[j*(nstates/VCSIZE)+i%(nstates/VCSIZE)],
 							vc_partial_lh_dad[j], vc_ptn[j]);
 				}
@@ -875,7 +1103,7 @@ double PhyloTree::computeLikelihoodBranchEigenSIMD(PhyloNeighbor *dad_branch, Ph
 			lh_final = 0.0;
 			lh_ptn = 0.0;
 			for (ptn = orig_nptn; ptn < nptn; ptn+=VCSIZE) {
-				double *partial_lh_dad = &dad_branch->partial_lh[ptn*block];
+				LhType *partial_lh_dad = &((LhType*)dad_branch->partial_lh)[ptn*block];
 				lh_final += lh_ptn;
 
 				// initialize vc_tip_partial_lh
@@ -884,14 +1112,14 @@ double PhyloTree::computeLikelihoodBranchEigenSIMD(PhyloNeighbor *dad_branch, Ph
 					for (i = 0; i < nstates/VCSIZE; i++) {
 						vc_tip_partial_lh[j*(nstates/VCSIZE)+i].load(&lh_dad[i*VCSIZE]); // lh_dad is not aligned!
 					}
-					vc_partial_lh_dad[j].load_a(&partial_lh_dad[j*block]);
+					vc_partial_lh_dad[j] = load_partial_lh<VectorClass>(&partial_lh_dad[j*block]);
 					vc_ptn[j] = vc_val[0] * vc_tip_partial_lh[j*(nstates/VCSIZE)] * vc_partial_lh_dad[j];
 				}
 
 				// compute vc_ptn
 				for (i = 1; i < block/VCSIZE; i++)
 					for (j = 0; j < VCSIZE; j++) {
-						vc_partial_lh_dad[j].load_a(&partial_lh_dad[j*block+i*VCSIZE]);
+						vc_partial_lh_dad[j] = load_partial_lh<VectorClass>(&partial_lh_dad[j*block+i*VCSIZE]);
 						vc_ptn[j] = mul_add(vc_val[i] * vc_tip_partial_lh[j*(nstates/VCSIZE)+i%(nstates/VCSIZE)],
 								vc_partial_lh_dad[j], vc_ptn[j]);
 					}
@@ -909,7 +1137,12 @@ double PhyloTree::computeLikelihoodBranchEigenSIMD(PhyloNeighbor *dad_branch, Ph
 			case 1: prob_const = horizontal_add(lh_final)+lh_ptn[0]; break;
 			case 2: prob_const = horizontal_add(lh_final)+lh_ptn[0]+lh_ptn[1]; break;
 			case 3: prob_const = horizontal_add(lh_final)+lh_ptn[0]+lh_ptn[1]+lh_ptn[2]; break;
-			default: assert(0); break;
+			default:
+				// AVX-512: up to VCSIZE-1 remaining patterns
+				prob_const = horizontal_add(lh_final);
+				for (int k = 0; k < (nptn-orig_nptn)%VCSIZE; k++)
+					prob_const += lh_ptn[k];
+				break;
 			}
 		}
 		aligned_free(lh_states_dad);
@@ -922,27 +1155,28 @@ double PhyloTree::computeLikelihoodBranchEigenSIMD(PhyloNeighbor *dad_branch, Ph
 
 		// copy dummy values because VectorClass will access beyond nptn
 		for (ptn = nptn; ptn < maxptn; ptn++) {
-			memcpy(&dad_branch->partial_lh[ptn*block], dad_branch->partial_lh, block*sizeof(double));
-			memcpy(&node_branch->partial_lh[ptn*block], node_branch->partial_lh, block*sizeof(double));
+			memcpy((LhType*)dad_branch->partial_lh + ptn*block, dad_branch->partial_lh, block*sizeof(LhType));
+			memcpy((LhType*)node_branch->partial_lh + ptn*block, node_branch->partial_lh, block*sizeof(LhType));
 		}
 
 #ifdef _OPENMP
-#pragma omp parallel private(ptn, i, j, vc_partial_lh_node, vc_partial_lh_dad, vc_ptn, vc_freq, lh_ptn)
+#pragma omp parallel num_threads(nblocks) if(nblocks > 1) private(ptn, i, j, vc_partial_lh_node, vc_partial_lh_dad, vc_ptn, vc_freq, lh_ptn)
 		{
 		VectorClass lh_final_th = 0.0;
-#pragma omp for nowait
+#pragma omp for schedule(static, 1) nowait
 #endif
-		for (ptn = 0; ptn < orig_nptn; ptn+=VCSIZE) {
-			double *partial_lh_dad = dad_branch->partial_lh + ptn*block;
-			double *partial_lh_node = node_branch->partial_lh + ptn*block;
+		for (int b = 0; b < nblocks; b++)
+		for (ptn = ptn_limits[b]; ptn < ptn_limits[b+1]; ptn+=VCSIZE) {
+			LhType *partial_lh_dad = (LhType*)dad_branch->partial_lh + ptn*block;
+			LhType *partial_lh_node = (LhType*)node_branch->partial_lh + ptn*block;
 
 			for (j = 0; j < VCSIZE; j++)
 				vc_ptn[j] = 0.0;
 
 			for (i = 0; i < block; i+=VCSIZE) {
 				for (j = 0; j < VCSIZE; j++) {
-					vc_partial_lh_node[j].load_a(&partial_lh_node[i+j*block]);
-					vc_partial_lh_dad[j].load_a(&partial_lh_dad[i+j*block]);
+					vc_partial_lh_node[j] = load_partial_lh<VectorClass>(&partial_lh_node[i+j*block]);
+					vc_partial_lh_dad[j] = load_partial_lh<VectorClass>(&partial_lh_dad[i+j*block]);
 					vc_ptn[j] = mul_add(vc_val[i/VCSIZE] * vc_partial_lh_node[j], vc_partial_lh_dad[j], vc_ptn[j]);
 				}
 			}
@@ -974,8 +1208,8 @@ double PhyloTree::computeLikelihoodBranchEigenSIMD(PhyloNeighbor *dad_branch, Ph
 			// ascertainment bias correction
 			lh_final = 0.0;
 			lh_ptn = 0.0;
-			double *partial_lh_node = &node_branch->partial_lh[orig_nptn*block];
-			double *partial_lh_dad = &dad_branch->partial_lh[orig_nptn*block];
+			LhType *partial_lh_node = &((LhType*)node_branch->partial_lh)[orig_nptn*block];
+			LhType *partial_lh_dad = &((LhType*)dad_branch->partial_lh)[orig_nptn*block];
 
 			for (ptn = orig_nptn; ptn < nptn; ptn+=VCSIZE) {
 				lh_final += lh_ptn;
@@ -985,8 +1219,8 @@ double PhyloTree::computeLikelihoodBranchEigenSIMD(PhyloNeighbor *dad_branch, Ph
 
 				for (i = 0; i < block; i+=VCSIZE) {
 					for (j = 0; j < VCSIZE; j++) {
-						vc_partial_lh_node[j].load_a(&partial_lh_node[i+j*block]);
-						vc_partial_lh_dad[j].load_a(&partial_lh_dad[i+j*block]);
+						vc_partial_lh_node[j] = load_partial_lh<VectorClass>(&partial_lh_node[i+j*block]);
+						vc_partial_lh_dad[j] = load_partial_lh<VectorClass>(&partial_lh_dad[i+j*block]);
 						vc_ptn[j] = mul_add(vc_val[i/VCSIZE] * vc_partial_lh_node[j], vc_partial_lh_dad[j], vc_ptn[j]);
 					}
 				}
@@ -1006,7 +1240,12 @@ double PhyloTree::computeLikelihoodBranchEigenSIMD(PhyloNeighbor *dad_branch, Ph
 			case 1: prob_const = horizontal_add(lh_final)+lh_ptn[0]; break;
 			case 2: prob_const = horizontal_add(lh_final)+lh_ptn[0]+lh_ptn[1]; break;
 			case 3: prob_const = horizontal_add(lh_final)+lh_ptn[0]+lh_ptn[1]+lh_ptn[2]; break;
-			default: assert(0); break;
+			default:
+				// AVX-512: up to VCSIZE-1 remaining patterns
+				prob_const = horizontal_add(lh_final);
+				for (int k = 0; k < (nptn-orig_nptn)%VCSIZE; k++)
+					prob_const += lh_ptn[k];
+				break;
 			}
 		}
     }
@@ -1020,6 +1259,8 @@ double PhyloTree::computeLikelihoodBranchEigenSIMD(PhyloNeighbor *dad_branch, Ph
     	tree_lh -= aln->getNSite()*prob_const;
     }
 
+    mem_slots.unlock(node_branch);
+    mem_slots.unlock(dad_branch);
     aligned_free(vc_val);
     return tree_lh;
 }
@@ -1039,6 +1280,7 @@ double PhyloTree::computeLikelihoodFromBufferEigenSIMD() {
     size_t orig_nptn = aln->size();
     size_t nptn = aln->size()+model_factory->unobserved_ptns.size();
 //    size_t maxptn = ((nptn+VCSIZE-1)/VCSIZE)*VCSIZE;
+    int nblocks = computePatternBlocks(nstates * block);
     double *eval = model->getEigenvalues();
     assert(eval);
 
@@ -1064,12 +1306,13 @@ double PhyloTree::computeLikelihoodFromBufferEigenSIMD() {
 	// perform 2 sites at the same time for SSE/AVX efficiency
 
 #ifdef _OPENMP
-#pragma omp parallel private (ptn, i, j, vc_freq, vc_ptn, lh_ptn)
+#pragma omp parallel num_threads(nblocks) if(nblocks > 1) private (ptn, i, j, vc_freq, vc_ptn, lh_ptn)
 	{
 	VectorClass lh_final_th = 0.0;
-#pragma omp for nowait
+#pragma omp for schedule(static, 1) nowait
 #endif
-	for (ptn = 0; ptn < orig_nptn; ptn+=VCSIZE) {
+	for (int b = 0; b < nblocks; b++)
+	for (ptn = ptn_limits[b]; ptn < ptn_limits[b+1]; ptn+=VCSIZE) {
 		double *theta = theta_all + ptn*block;
 		// initialization
 		for (i = 0; i < VCSIZE; i++) {
@@ -1182,7 +1425,10 @@ double PhyloTree::computeLikelihoodFromBufferEigenSIMD() {
 			prob_const = horizontal_add(lh_final)+lh_ptn[0]+lh_ptn[1]+lh_ptn[2];
 			break;
 		default:
-			assert(0);
+			// AVX-512: up to VCSIZE-1 remaining patterns
+			prob_const = horizontal_add(lh_final);
+			for (int k = 0; k < (nptn-orig_nptn)%VCSIZE; k++)
+				prob_const += lh_ptn[k];
 			break;
 		}
     	prob_const = log(1.0 - prob_const);
@@ -1242,6 +1488,25 @@ inline UINT fast_popcount(Vec8ui &x) {
 }
 
 
+#if MAX_VECTOR_SIZE >= 512
+inline UINT fast_popcount(Vec16ui &x) {
+    MEM_ALIGN_BEGIN uint64_t vec[8] MEM_ALIGN_END;
+    uint64_t res = 0;
+    x.store(vec);
+#if defined (__GNUC__) || defined(__clang__)
+    for (int i = 0; i < 8; i++) {
+        uint64_t cnt;
+        __asm("popcntq %1, %0" : "=r"(cnt) : "r"(vec[i]) : );
+        res += cnt;
+    }
+#else
+    for (int i = 0; i < 8; i++)
+        res += _mm_popcnt_u64(vec[i]);
+#endif
+    return res;
+}
+#endif
+
 inline void horizontal_popcount(Vec4ui &x) {
     MEM_ALIGN_BEGIN UINT vec[4] MEM_ALIGN_END;
     x.store_a(vec);
@@ -1592,5 +1857,122 @@ int PhyloTree::computeParsimonyBranchFastSIMD(PhyloNeighbor *dad_branch, PhyloNo
     return score;
 }
 
+template<class VectorClass>
+int PhyloTree::computeParsimonyInsertFastSIMD(UINT *node_pars, UINT *dad_pars, UINT *insert_pars, UINT *new_pars, int upper_bound) {
+    int site;
+    int nstates = aln->getMaxNumStates();
+    const int NUM_BITS = VectorClass::size() * UINT_BITS;
+    int nsites = (aln->num_informative_sites + NUM_BITS - 1)/NUM_BITS;
+    int entry_size = nstates * VectorClass::size();
+
+    int scoreid = nsites*entry_size;
+    UINT join_score = node_pars[scoreid] + dad_pars[scoreid];
+    UINT score = join_score + insert_pars[scoreid];
+
+    switch (nstates) {
+    case 4:
+		for (site = 0; site < nsites; site++) {
+            size_t offset = entry_size*site;
+            VectorClass *x = (VectorClass*)(node_pars + offset);
+            VectorClass *y = (VectorClass*)(dad_pars + offset);
+            VectorClass *t = (VectorClass*)(insert_pars + offset);
+            VectorClass z0 = x[0] & y[0];
+            VectorClass z1 = x[1] & y[1];
+            VectorClass z2 = x[2] & y[2];
+            VectorClass z3 = x[3] & y[3];
+            VectorClass w = ~(z0 | z1 | z2 | z3);
+            z0 |= w & (x[0] | y[0]);
+            z1 |= w & (x[1] | y[1]);
+            z2 |= w & (x[2] | y[2]);
+            z3 |= w & (x[3] | y[3]);
+            VectorClass v = ~((z0 & t[0]) | (z1 & t[1]) | (z2 & t[2]) | (z3 & t[3]));
+            if (new_pars) {
+                VectorClass *z = (VectorClass*)(new_pars + offset);
+                z[0] = z0;
+                z[1] = z1;
+                z[2] = z2;
+                z[3] = z3;
+            }
+            UINT join_subst = fast_popcount(w);
+            join_score += join_subst;
+            score += join_subst + fast_popcount(v);
+            if (!new_pars && score >= (UINT)upper_bound)
+                break;
+		}
+		break;
+    default:
+		for (site = 0; site < nsites; site++) {
+            size_t offset = entry_size*site;
+            VectorClass *x = (VectorClass*)(node_pars + offset);
+            VectorClass *y = (VectorClass*)(dad_pars + offset);
+            VectorClass *t = (VectorClass*)(insert_pars + offset);
+            int i;
+            VectorClass w = x[0] & y[0];
+            for (i = 1; i < nstates; i++)
+                w |= x[i] & y[i];
+            w = ~w;
+            VectorClass v = 0;
+            for (i = 0; i < nstates; i++) {
+                VectorClass z = (x[i] & y[i]) | (w & (x[i] | y[i]));
+                if (new_pars)
+                    ((VectorClass*)(new_pars + offset))[i] = z;
+                v |= z & t[i];
+            }
+            v = ~v;
+            UINT join_subst = fast_popcount(w);
+            join_score += join_subst;
+            score += join_subst + fast_popcount(v);
+            if (!new_pars && score >= (UINT)upper_bound)
+                break;
+		}
+		break;
+    }
+    if (new_pars)
+        new_pars[scoreid] = join_score;
+    return score;
+}
+
+/************************************************************************************************
+ *
+ *   assign SIMD likelihood kernels for a given vector class and number of states
+ *
+ *************************************************************************************************/
+
+template <class VectorClass, const int VCSIZE, const int nstates>
+void PhyloTree::setLikelihoodKernelSIMD() {
+    lk_vector_size = VCSIZE;
+    if (model_factory && model_factory->model->isSiteSpecificModel()) {
+        computeLikelihoodBranchPointer = &PhyloTree::computeSitemodelLikelihoodBranchEigenSIMD<VectorClass, VCSIZE, nstates>;
+        computeLikelihoodDervPointer = &PhyloTree::computeSitemodelLikelihoodDervEigenSIMD<VectorClass, VCSIZE, nstates>;
+        computePartialLikelihoodPointer = &PhyloTree::computeSitemodelPartialLikelihoodEigenSIMD<VectorClass, VCSIZE, nstates>;
+        computeLikelihoodFromBufferPointer = &PhyloTree::computeSitemodelLikelihoodFromBufferEigenSIMD<VectorClass, VCSIZE, nstates>;
+        return;
+    }
+    if (model_factory && model_factory->model->isMixture()) {
+        if (model_factory->fused_mix_rate) {
+            computeLikelihoodBranchPointer = &PhyloTree::computeMixrateLikelihoodBranchEigenSIMD<VectorClass, VCSIZE, nstates>;
+            computeLikelihoodDervPointer = &PhyloTree::computeMixrateLikelihoodDervEigenSIMD<VectorClass, VCSIZE, nstates>;
+            computePartialLikelihoodPointer = &PhyloTree::computeMixratePartialLikelihoodEigenSIMD<VectorClass, VCSIZE, nstates>;
+            computeLikelihoodFromBufferPointer = &PhyloTree::computeMixrateLikelihoodFromBufferEigenSIMD<VectorClass, VCSIZE, nstates>;
+        } else {
+            computeLikelihoodBranchPointer = &PhyloTree::computeMixtureLikelihoodBranchEigenSIMD<VectorClass, VCSIZE, nstates>;
+            computeLikelihoodDervPointer = &PhyloTree::computeMixtureLikelihoodDervEigenSIMD<VectorClass, VCSIZE, nstates>;
+            computePartialLikelihoodPointer = &PhyloTree::computeMixturePartialLikelihoodEigenSIMD<VectorClass, VCSIZE, nstates>;
+            computeLikelihoodFromBufferPointer = &PhyloTree::computeMixtureLikelihoodFromBufferEigenSIMD<VectorClass, VCSIZE, nstates>;
+        }
+    } else if (params && params->lh_float && isPartialLhFloatSupported()) {
+        // partial likelihoods stored in single precision
+        partial_lh_float = true;
+        computeLikelihoodBranchPointer = &PhyloTree::computeLikelihoodBranchEigenSIMD<VectorClass, VCSIZE, nstates, float>;
+        computeLikelihoodDervPointer = &PhyloTree::computeLikelihoodDervEigenSIMD<VectorClass, VCSIZE, nstates, float>;
+        computePartialLikelihoodPointer = &PhyloTree::computePartialLikelihoodEigenSIMD<VectorClass, VCSIZE, nstates, float>;
+        computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferEigenSIMD<VectorClass, VCSIZE, nstates>;
+    } else {
+        computeLikelihoodBranchPointer = &PhyloTree::computeLikelihoodBranchEigenSIMD<VectorClass, VCSIZE, nstates, double>;
+        computeLikelihoodDervPointer = &PhyloTree::computeLikelihoodDervEigenSIMD<VectorClass, VCSIZE, nstates, double>;
+        computePartialLikelihoodPointer = &PhyloTree::computePartialLikelihoodEigenSIMD<VectorClass, VCSIZE, nstates, double>;
+        computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferEigenSIMD<VectorClass, VCSIZE, nstates>;
+    }
+}
 
 #endif /* PHYLOKERNEL_H_ */
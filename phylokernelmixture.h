@@ -707,7 +707,15 @@ void PhyloTree::computeMixtureLikelihoodDervEigenSIMD(PhyloNeighbor *dad_branch,
 			ddf_const = horizontal_add(ddf_final)+ddf_ptn[0]+ddf_ptn[1]+ddf_ptn[2];
 			break;
 		default:
-			assert(0);
+			// AVX-512: up to VCSIZE-1 remaining patterns
+			prob_const = horizontal_add(lh_final);
+			df_const = horizontal_add(df_final);
+			ddf_const = horizontal_add(ddf_final);
+			for (int k = 0; k < (nptn-orig_nptn)%VCSIZE; k++) {
+				prob_const += lh_ptn[k];
+				df_const += df_ptn[k];
+				ddf_const += ddf_ptn[k];
+			}
 			break;
 		}
     	prob_const = 1.0 - prob_const;
@@ -937,7 +945,12 @@ double PhyloTree::computeMixtureLikelihoodBranchEigenSIMD(PhyloNeighbor *dad_bra
 			case 1: prob_const = horizontal_add(lh_final)+lh_ptn[0]; break;
 			case 2: prob_const = horizontal_add(lh_final)+lh_ptn[0]+lh_ptn[1]; break;
 			case 3: prob_const = horizontal_add(lh_final)+lh_ptn[0]+lh_ptn[1]+lh_ptn[2]; break;
-			default: assert(0); break;
+			default:
+				// AVX-512: up to VCSIZE-1 remaining patterns
+				prob_const = horizontal_add(lh_final);
+				for (int k = 0; k < (nptn-orig_nptn)%VCSIZE; k++)
+					prob_const += lh_ptn[k];
+				break;
 			}
 		}
 		aligned_free(ptn_states_dad);
@@ -1035,7 +1048,12 @@ double PhyloTree::computeMixtureLikelihoodBranchEigenSIMD(PhyloNeighbor *dad_bra
 			case 1: prob_const = horizontal_add(lh_final)+lh_ptn[0]; break;
 			case 2: prob_const = horizontal_add(lh_final)+lh_ptn[0]+lh_ptn[1]; break;
 			case 3: prob_const = horizontal_add(lh_final)+lh_ptn[0]+lh_ptn[1]+lh_ptn[2]; break;
-			default: assert(0); break;
+			default:
+				// AVX-512: up to VCSIZE-1 remaining patterns
+				prob_const = horizontal_add(lh_final);
+				for (int k = 0; k < (nptn-orig_nptn)%VCSIZE; k++)
+					prob_const += lh_ptn[k];
+				break;
 			}
 		}
     }
@@ -1213,7 +1231,10 @@ double PhyloTree::computeMixtureLikelihoodFromBufferEigenSIMD() {
 			prob_const = horizontal_add(lh_final)+lh_ptn[0]+lh_ptn[1]+lh_ptn[2];
 			break;
 		default:
-			assert(0);
+			// AVX-512: up to VCSIZE-1 remaining patterns
+			prob_const = horizontal_add(lh_final);
+			for (int k = 0; k < (nptn-orig_nptn)%VCSIZE; k++)
+				prob_const += lh_ptn[k];
 			break;
 		}
     	prob_const = log(1.0 - prob_const);
@@ -22,7 +22,7 @@ void PhyloTree::computeSitemodelPartialLikelihoodEigen(PhyloNeighbor *dad_branch
 
 
     size_t nstates = aln->num_states;
-    size_t nptn = aln->size(), tip_block_size = get_safe_upper_limit(nptn)*nstates;
+    size_t nptn = aln->size(), tip_block_size = getSafeUpperLimit(nptn)*nstates;
     size_t ptn, c;
     size_t ncat = site_rate->getNRate();
     size_t i, x;
@@ -473,7 +473,7 @@ void PhyloTree::computeSitemodelLikelihoodDervEigen(PhyloNeighbor *dad_branch, P
 	    if (dad->isLeaf()) {
 	    	// special treatment for TIP-INTERNAL NODE case
             
-            double *tip_partial_lh_node = tip_partial_lh + (dad->id * get_safe_upper_limit(nptn)*nstates);
+            double *tip_partial_lh_node = tip_partial_lh + (dad->id * getSafeUpperLimit(nptn)*nstates);
             
 #ifdef _OPENMP
 #pragma omp parallel for private(ptn, i, c) schedule(static)
@@ -595,7 +595,7 @@ double PhyloTree::computeSitemodelLikelihoodBranchEigen(PhyloNeighbor *dad_branc
 
     if (dad->isLeaf()) {
     	// special treatment for TIP-INTERNAL NODE case
-        double *tip_partial_lh_node = tip_partial_lh + (dad->id * get_safe_upper_limit(nptn)*nstates);
+        double *tip_partial_lh_node = tip_partial_lh + (dad->id * getSafeUpperLimit(nptn)*nstates);
 #ifdef _OPENMP
 #pragma omp parallel for reduction(+: tree_lh) private(ptn, i, c) schedule(static)
 #endif
@@ -31,7 +31,7 @@ void PhyloTree::computeSitemodelPartialLikelihoodEigenSIMD(PhyloNeighbor *dad_br
     dad_branch->partial_lh_computed |= 1;
     PhyloNode *node = (PhyloNode*)(dad_branch->node);
 
-    size_t nptn = aln->size(), tip_block_size = get_safe_upper_limit(nptn)*nstates;
+    size_t nptn = aln->size(), tip_block_size = getSafeUpperLimit(nptn)*nstates;
     size_t ptn, c;
     size_t ncat = site_rate->getNRate();
     size_t i, x, j;
@@ -406,7 +406,7 @@ void PhyloTree::computeSitemodelLikelihoodDervEigenSIMD(PhyloNeighbor *dad_branc
 	    if (dad->isLeaf()) {
 	    	// special treatment for TIP-INTERNAL NODE case
             
-            double *tip_partial_lh_node = tip_partial_lh + (dad->id * get_safe_upper_limit(nptn)*nstates);
+            double *tip_partial_lh_node = tip_partial_lh + (dad->id * getSafeUpperLimit(nptn)*nstates);
             
 #ifdef _OPENMP
 #pragma omp parallel for private(ptn, i, c) schedule(static)
@@ -559,7 +559,7 @@ double PhyloTree::computeSitemodelLikelihoodBranchEigenSIMD(PhyloNeighbor *dad_b
     size_t ptn; // for big data size > 4GB memory required
     size_t c, i, j;
     size_t nptn = aln->size();
-    size_t maxptn = get_safe_upper_limit(nptn);
+    size_t maxptn = getSafeUpperLimit(nptn);
 
     ModelSet *models = (ModelSet*)model;
     VectorClass tree_lh = 0.0;
@@ -576,7 +576,7 @@ double PhyloTree::computeSitemodelLikelihoodBranchEigenSIMD(PhyloNeighbor *dad_b
 			memcpy(&dad_branch->partial_lh[ptn*block], &dad_branch->partial_lh[(ptn-1)*block], block*sizeof(double));
 
     	// special treatment for TIP-INTERNAL NODE case
-        double *tip_partial_lh_node = tip_partial_lh + (dad->id * get_safe_upper_limit(nptn)*nstates);
+        double *tip_partial_lh_node = tip_partial_lh + (dad->id * getSafeUpperLimit(nptn)*nstates);
 #ifdef _OPENMP
 #pragma omp parallel private(ptn, i, c, j)
 {
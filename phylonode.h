@@ -16,6 +16,37 @@
 
 typedef short int UBYTE;
 
+class PhyloNeighbor;
+
+/**
+    site repeats of the subtree below a PhyloNeighbor: patterns with the same states at all
+    leaves of the subtree share one partial likelihood vector, see PhyloTree::computeSiteRepeats()
+ */
+struct SiteRepeats {
+    /** class of each pattern, empty if all patterns are distinct */
+    vector<int> ptn_class;
+
+    /** first pattern of each class, where the partial likelihoods are computed */
+    vector<int> class_ptn;
+
+    /** time stamp of the classes, 0 if not computed yet */
+    uint64_t version;
+
+    /** children the classes were computed from */
+    vector<PhyloNeighbor*> child;
+
+    /** time stamps of the classes of the children */
+    vector<uint64_t> child_version;
+
+    /** PhyloTree::ptn_invar_version the classes were computed for */
+    uint64_t invar_version;
+
+    SiteRepeats() {
+        version = 0;
+        invar_version = 0;
+    }
+};
+
 /**
 A neighbor in a phylogenetic tree
 
@@ -30,6 +61,7 @@ class PhyloNeighbor : public Neighbor {
 public:
     friend class TinaTree;
     friend class PhyloSuperTreePlen;
+    friend class MemSlotVector;
 
     /**
         construct class with a node and length		@param anode the other end of the branch
@@ -42,6 +74,7 @@ public:
         partial_lh_computed = 0;
         lh_scale_factor = 0.0;
         partial_pars = NULL;
+        site_repeats = NULL;
     }
 
     /**
@@ -56,6 +89,15 @@ public:
         partial_lh_computed = 0;
         lh_scale_factor = 0.0;
         partial_pars = NULL;
+        site_repeats = NULL;
+    }
+
+    /**
+        destructor
+     */
+    virtual ~PhyloNeighbor() {
+        if (site_repeats)
+            delete site_repeats;
     }
 
     /**
@@ -126,6 +168,11 @@ private:
      */
     UINT *partial_pars;
 
+    /**
+        site-repeat classes of the subtree (-srep), NULL if not computed
+     */
+    SiteRepeats *site_repeats;
+
 };
 
 /**
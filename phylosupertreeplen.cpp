@@ -1794,10 +1794,8 @@ void PhyloSuperTreePlen::initializeAllPartialLh() {
 		part = part_order[partid];
         it = begin() + part;
 		size_t nptn = (*it)->getAlnNPattern() + (*it)->aln->num_states; // extra #numStates for ascertainment bias correction
-		if (instruction_set >= 7)
-			mem_size[part] = ((nptn +3)/4)*4;
-		else
-			mem_size[part] = ((nptn % 2) == 0) ? nptn : (nptn + 1);
+		// block size must be divisible by the SIMD vector size
+		mem_size[part] = get_safe_upper_limit(nptn);
 		scale_block_size[part] = nptn;
 		block_size[part] = mem_size[part] * (*it)->aln->num_states * (*it)->getRate()->getNRate() *
 				(((*it)->model_factory->fused_mix_rate)? 1 : (*it)->getModel()->getNMixtures());
@@ -1900,7 +1898,7 @@ void PhyloSuperTreePlen::initializeAllPartialLh() {
     for (it = begin(), part = 0; it != end(); it++, part++) {
         (*it)->tip_partial_lh = lh_addr;
         uint64_t tip_partial_lh_size = (*it)->aln->num_states * ((*it)->aln->STATE_UNKNOWN+1) * (*it)->model->getNMixtures();
-        tip_partial_lh_size = ((tip_partial_lh_size+3)/4)*4;
+        tip_partial_lh_size = get_safe_upper_limit(tip_partial_lh_size);
         lh_addr += tip_partial_lh_size;
     }
 
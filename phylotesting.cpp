@@ -32,6 +32,8 @@
 #include "model/modelmorphology.h"
 #include "model/modelmixture.h"
 #include "timeutil.h"
+#include "modelcache.h"
+#include <queue>
 
 #include "phyloanalysis.h"
 #include "gsl/mygsl.h"
@@ -526,6 +528,7 @@ bool checkModelFile(ifstream &in, bool is_partitioned, vector<ModelInfo> &infos)
 		if (in.eof())
 			break;
 		ModelInfo info;
+		info.IC_estimate = 0.0;
 		if (is_partitioned) {
 			info.set_name = str;
 			in >> str;
@@ -964,6 +967,20 @@ void printModelFile(ostream &fmodel, Params &params, PhyloTree *tree, ModelInfo
     }
 }
 
+/**
+ * merge of two sets of partitions evaluated by the greedy algorithm of testPartitionModel()
+ */
+struct MergeCandidate {
+    int set1, set2; // IDs of the merged sets
+    IntVector merged_set; // partition IDs of the union
+    string set_name; // name of the union
+    string model; // best model of the union
+    double logl; // log-likelihood of the union
+    int df; // #parameters of the union
+    double tree_len; // tree length of the union
+    double score_change; // criterion score change by the merge, for criteria linear in logl and df
+};
+
 /**
  * select models for all partitions
  * @param model_info (IN/OUT) all model information
@@ -1095,159 +1112,186 @@ void testPartitionModel(Params &params, PhyloSuperTree* in_tree, vector<ModelInf
 	}
 	cout << "Merging models to increase model fit (about " << total_num_model << " total partition schemes)..." << endl;
 	int prev_part = -1;
+	// ID of the set at each position of gene_sets, a merged set gets a new ID
+	IntVector set_ids;
+	vector<bool> set_alive;
+	for (i = 0; i < gene_sets.size(); i++) {
+		set_ids.push_back(i);
+		set_alive.push_back(true);
+	}
+	// all merges evaluated so far, never re-evaluated as the sets of an ID do not change
+	vector<MergeCandidate> merges;
+	map<pair<int,int>, int> merge_index;
+	// with all pairs as candidates and a criterion linear in logl and df, the score change of a merge
+	// does not depend on the other sets, thus the best merge is found by a priority queue.
+	// queue entries of sets that were merged in the meantime are skipped when they come to the top.
+	bool use_queue = (params.partfinder_rcluster >= 100 && params.model_test_criterion != MTC_AICC);
+	priority_queue<pair<double,int>, vector<pair<double,int> >, greater<pair<double,int> > > merge_queue;
 	while (gene_sets.size() >= 2) {
 		// stepwise merging charsets
 		double new_score = DBL_MAX;
-		double opt_lh = 0.0;
-		int opt_df = 0;
-        double opt_treelen = 0.0;
 		int opt_part1 = 0, opt_part2 = 1;
-		IntVector opt_merged_set;
-		string opt_set_name = "";
-		string opt_model_name = "";
+		int opt_merge = -1;
         int num_pairs = 0;
-        // 2015-06-24: begin rcluster algorithm
-        // compute distance between gene_sets
 		for (int part1 = 0; part1 < gene_sets.size()-1; part1++)
 			for (int part2 = part1+1; part2 < gene_sets.size(); part2++)
-			if (super_aln->partitions[gene_sets[part1][0]]->seq_type == super_aln->partitions[gene_sets[part2][0]]->seq_type)
+			if (super_aln->partitions[gene_sets[part1][0]]->seq_type == super_aln->partitions[gene_sets[part2][0]]->seq_type &&
+                (!use_queue || prev_part < 0 || part1 == prev_part || part2 == prev_part))
             {
-				// only merge partitions of the same data type
+				// only merge partitions of the same data type; with the queue, only pairs with the new set are new
                 dist[num_pairs] = fabs(lenvec[part1] - lenvec[part2]);
                 distID[num_pairs] = (part1 << 16) | part2;
                 num_pairs++;
             }
+        // 2015-06-24: begin rcluster algorithm
         if (num_pairs > 0 && params.partfinder_rcluster < 100) {
             // sort distance
             quicksort(dist, 0, num_pairs-1, distID);
             num_pairs = (int)round(num_pairs * (params.partfinder_rcluster/100.0));
             if (num_pairs <= 0) num_pairs = 1;
         }
-        // sort partition by computational cost for OpenMP effciency
+        IntVector cand_pairs(distID, distID + num_pairs);
+        // candidate pairs not evaluated before
+        IntVector new_pairs;
+        int first_merge = merges.size();
         for (i = 0; i < num_pairs; i++) {
+            int part1 = cand_pairs[i] >> 16;
+            int part2 = cand_pairs[i] & ((1<<16)-1);
+            if (merge_index.find(make_pair(set_ids[part1], set_ids[part2])) != merge_index.end())
+                continue;
+            MergeCandidate merge;
+            merge.set1 = set_ids[part1];
+            merge.set2 = set_ids[part2];
+            merge.merged_set = gene_sets[part1];
+            merge.merged_set.insert(merge.merged_set.end(), gene_sets[part2].begin(), gene_sets[part2].end());
+            merge.set_name = "";
+            for (int j = 0; j < merge.merged_set.size(); j++) {
+                if (j > 0)
+                    merge.set_name += "+";
+                merge.set_name += in_tree->part_info[merge.merged_set[j]].name;
+            }
+            merge.score_change = 0.0;
+            merge_index[make_pair(merge.set1, merge.set2)] = merges.size();
+            merges.push_back(merge);
+            new_pairs.push_back(cand_pairs[i]);
+        }
+        int num_new = new_pairs.size();
+        // sort partition by computational cost for OpenMP effciency
+        for (i = 0; i < num_new; i++) {
             // computation cost is proportional to #sequences, #patterns, and #states
-            Alignment *this_aln = in_tree->at(distID[i] >> 16)->aln;
+            Alignment *this_aln = in_tree->at(new_pairs[i] >> 16)->aln;
             dist[i] = -((double)this_aln->getNSeq())*this_aln->getNPattern()*this_aln->num_states;
-            this_aln = in_tree->at(distID[i] & ((1<<16)-1))->aln;
+            this_aln = in_tree->at(new_pairs[i] & ((1<<16)-1))->aln;
             dist[i] -= ((double)this_aln->getNSeq())*this_aln->getNPattern()*this_aln->num_states;
+            distID[i] = first_merge + i;
         }
-        if (params.num_threads > 1 && num_pairs >= 1)
-            quicksort(dist, 0, num_pairs-1, distID);
+        if (params.num_threads > 1 && num_new >= 1)
+            quicksort(dist, 0, num_new-1, distID);
 
 #ifdef _OPENMP
 #pragma omp parallel for private(i) schedule(dynamic) if(!params.model_test_and_tree)
 #endif
-        for (int pair = 0; pair < num_pairs; pair++) {
-            int part1 = distID[pair] >> 16;
-            int part2 = distID[pair] & ((1<<16)-1);
+        for (int pair = 0; pair < num_new; pair++) {
+            MergeCandidate &merge = merges[distID[pair]];
+            int part1 = new_pairs[distID[pair] - first_merge] >> 16;
+            int part2 = new_pairs[distID[pair] - first_merge] & ((1<<16)-1);
             assert(part1 != part2);
-            IntVector merged_set;
-            merged_set.insert(merged_set.end(), gene_sets[part1].begin(), gene_sets[part1].end());
-            merged_set.insert(merged_set.end(), gene_sets[part2].begin(), gene_sets[part2].end());
-            string set_name = "";
-            for (i = 0; i < merged_set.size(); i++) {
-                if (i > 0)
-                    set_name += "+";
-                set_name += in_tree->part_info[merged_set[i]].name;
-            }
-            string model = "";
-            double logl = 0.0;
-            int df = 0;
-            double treelen = 0.0;
-            bool done_before = false;
-            if (prev_part >= 0 && part1 != prev_part && part2 != prev_part) {
-                // if pairs previously examined, reuse the information
-                for (vector<ModelInfo>::iterator mit = model_info.begin(); mit != model_info.end(); mit++)
-                    if (mit->set_name == set_name) {
-                        model = mit->name;
-                        logl = mit->logl;
-                        df = mit->df;
-                        treelen = mit->tree_len;
-                        done_before = true;
-                        break;
-                    }
-            }
             vector<ModelInfo> part_model_info;
             stringstream this_fmodel;
-            if (!done_before) {
-                Alignment *aln = super_aln->concatenateAlignments(merged_set);
-                PhyloTree *tree = in_tree->extractSubtree(merged_set);
-                tree->setAlignment(aln);
-                extractModelInfo(set_name, model_info, part_model_info);
-//                TODO
-                tree->num_precision = in_tree->num_precision;
-                if (params.model_test_and_tree) {
-                    tree->setCheckpoint(new Checkpoint());
-                }
-//#ifdef _OPENMP
-                model = testModel(params, tree, part_model_info, this_fmodel, models_block, set_name);
-//#else
-//                model = testModel(params, tree, part_model_info, fmodel, set_name);
-//#endif
-                logl = part_model_info[0].logl;
-                df = part_model_info[0].df;
-                treelen = part_model_info[0].tree_len;
-                if (params.model_test_and_tree) {
-                    delete tree->getCheckpoint();
-                }
-                delete tree;
-                delete aln;
+            Alignment *aln = super_aln->concatenateAlignments(merge.merged_set);
+            PhyloTree *tree = in_tree->extractSubtree(merge.merged_set);
+            tree->setAlignment(aln);
+            extractModelInfo(merge.set_name, model_info, part_model_info);
+            tree->num_precision = in_tree->num_precision;
+            if (params.model_test_and_tree) {
+                tree->setCheckpoint(new Checkpoint());
             }
-            double lhnew = lhsum - lhvec[part1] - lhvec[part2] + logl;
-            int dfnew = dfsum - dfvec[part1] - dfvec[part2] + df;
+            merge.model = testModel(params, tree, part_model_info, this_fmodel, models_block, merge.set_name);
+            merge.logl = part_model_info[0].logl;
+            merge.df = part_model_info[0].df;
+            merge.tree_len = part_model_info[0].tree_len;
+            if (params.model_test_and_tree) {
+                delete tree->getCheckpoint();
+            }
+            delete tree;
+            delete aln;
+            merge.score_change = computeInformationScore(merge.logl - lhvec[part1] - lhvec[part2],
+                merge.df - dfvec[part1] - dfvec[part2], ssize, params.model_test_criterion);
+            double lhnew = lhsum - lhvec[part1] - lhvec[part2] + merge.logl;
+            int dfnew = dfsum - dfvec[part1] - dfvec[part2] + merge.df;
             double score = computeInformationScore(lhnew, dfnew, ssize, params.model_test_criterion);
 #ifdef _OPENMP
 #pragma omp critical
 #endif
 			{
-				if (!done_before) {
-//#ifdef _OPENMP
-                    fmodel << this_fmodel.str();
-//#endif
-					replaceModelInfo(model_info, part_model_info);
-                    num_model++;
-					cout.width(4);
-					cout << right << num_model << " ";
-					cout.width(12);
-					cout << left << model << " ";
-					cout.width(11);
-					cout << score << " " << set_name;
-                    if (num_model >= 10) {
-                        double remain_time = max(total_num_model-num_model, 0)*(getRealTime()-start_time)/num_model;
-                        cout << "\t" << convert_time(getRealTime()-start_time) << " (" 
-                            << convert_time(remain_time) << " left)";
-                    }
-                    cout << endl;
-				}
-				if (score < new_score) {
-					new_score = score;
-					opt_part1 = part1;
-					opt_part2 = part2;
-					opt_lh = logl;
-					opt_df = df;
-                    opt_treelen = treelen;
-					opt_merged_set = merged_set;
-					opt_set_name = set_name;
-					opt_model_name = model;
-				}
+                fmodel << this_fmodel.str();
+                replaceModelInfo(model_info, part_model_info);
+                num_model++;
+                cout.width(4);
+                cout << right << num_model << " ";
+                cout.width(12);
+                cout << left << merge.model << " ";
+                cout.width(11);
+                cout << score << " " << merge.set_name;
+                if (num_model >= 10) {
+                    double remain_time = max(total_num_model-num_model, 0)*(getRealTime()-start_time)/num_model;
+                    cout << "\t" << convert_time(getRealTime()-start_time) << " ("
+                        << convert_time(remain_time) << " left)";
+                }
+                cout << endl;
 			}
+        }
 
+        if (use_queue) {
+            for (i = first_merge; i < merges.size(); i++)
+                merge_queue.push(make_pair(merges[i].score_change, i));
+            // discard merges of sets that no longer exist
+            while (!merge_queue.empty() &&
+                (!set_alive[merges[merge_queue.top().second].set1] || !set_alive[merges[merge_queue.top().second].set2]))
+                merge_queue.pop();
+            if (!merge_queue.empty()) {
+                opt_merge = merge_queue.top().second;
+                opt_part1 = find(set_ids.begin(), set_ids.end(), merges[opt_merge].set1) - set_ids.begin();
+                opt_part2 = find(set_ids.begin(), set_ids.end(), merges[opt_merge].set2) - set_ids.begin();
+                new_score = computeInformationScore(lhsum - lhvec[opt_part1] - lhvec[opt_part2] + merges[opt_merge].logl,
+                    dfsum - dfvec[opt_part1] - dfvec[opt_part2] + merges[opt_merge].df, ssize, params.model_test_criterion);
+            }
+        } else {
+            // score the candidate pairs with the current totals
+            for (i = 0; i < cand_pairs.size(); i++) {
+                int part1 = cand_pairs[i] >> 16;
+                int part2 = cand_pairs[i] & ((1<<16)-1);
+                int merge_id = merge_index[make_pair(set_ids[part1], set_ids[part2])];
+                double score = computeInformationScore(lhsum - lhvec[part1] - lhvec[part2] + merges[merge_id].logl,
+                    dfsum - dfvec[part1] - dfvec[part2] + merges[merge_id].df, ssize, params.model_test_criterion);
+                if (score < new_score) {
+                    new_score = score;
+                    opt_merge = merge_id;
+                    opt_part1 = part1;
+                    opt_part2 = part2;
+                }
+            }
         }
 		if (new_score >= inf_score) break;
 		inf_score = new_score;
+		MergeCandidate &opt = merges[opt_merge];
 
-		lhsum = lhsum - lhvec[opt_part1] - lhvec[opt_part2] + opt_lh;
-		dfsum = dfsum - dfvec[opt_part1] - dfvec[opt_part2] + opt_df;
-		cout << "Merging " << opt_set_name << " with " << criterionName(params.model_test_criterion) << " score: " << new_score << " (lh=" << lhsum << "  df=" << dfsum << ")" << endl;
+		lhsum = lhsum - lhvec[opt_part1] - lhvec[opt_part2] + opt.logl;
+		dfsum = dfsum - dfvec[opt_part1] - dfvec[opt_part2] + opt.df;
+		cout << "Merging " << opt.set_name << " with " << criterionName(params.model_test_criterion) << " score: " << new_score << " (lh=" << lhsum << "  df=" << dfsum << ")" << endl;
 		// change entry opt_part1 to merged one
-		gene_sets[opt_part1] = opt_merged_set;
-		lhvec[opt_part1] = opt_lh;
-		dfvec[opt_part1] = opt_df;
-        lenvec[opt_part1] = opt_treelen;
-		model_names[opt_part1] = opt_model_name;
+		gene_sets[opt_part1] = opt.merged_set;
+		lhvec[opt_part1] = opt.logl;
+		dfvec[opt_part1] = opt.df;
+        lenvec[opt_part1] = opt.tree_len;
+		model_names[opt_part1] = opt.model;
 		greedy_model_trees[opt_part1] = "(" + greedy_model_trees[opt_part1] + "," + greedy_model_trees[opt_part2] + ")" +
 				convertIntToString(in_tree->size()-gene_sets.size()+1) + ":" + convertDoubleToString(inf_score);
 		prev_part = opt_part1;
+		set_alive[opt.set1] = false;
+		set_alive[opt.set2] = false;
+		set_ids[opt_part1] = set_alive.size();
+		set_alive.push_back(true);
 
 		// delete entry opt_part2
 		lhvec.erase(lhvec.begin() + opt_part2);
@@ -1256,6 +1300,7 @@ void testPartitionModel(Params &params, PhyloSuperTree* in_tree, vector<ModelInf
 		gene_sets.erase(gene_sets.begin() + opt_part2);
 		model_names.erase(model_names.begin() + opt_part2);
 		greedy_model_trees.erase(greedy_model_trees.begin() + opt_part2);
+		set_ids.erase(set_ids.begin() + opt_part2);
 	}
 
 	string final_model_tree;
@@ -1305,6 +1350,462 @@ bool isMixtureModel(ModelsBlock *models_block, string &model_str) {
     return false;
 }
 
+/**
+ * @return state frequency type given by the +F... token of model_name, FREQ_UNKNOWN if none
+ */
+StateFreqType getModelFreqType(string &model_name) {
+    if (model_name.find("+F1X4") != string::npos)
+        return FREQ_CODON_1x4;
+    if (model_name.find("+F3X4C") != string::npos)
+        return FREQ_CODON_3x4C;
+    if (model_name.find("+F3X4") != string::npos)
+        return FREQ_CODON_3x4;
+    if (model_name.find("+FQ") != string::npos)
+        return FREQ_EQUAL;
+    if (model_name.find("+FO") != string::npos)
+        return FREQ_ESTIMATE;
+    if (model_name.find("+FU") != string::npos)
+        return FREQ_USER_DEFINED;
+    if (model_name.find("+F") != string::npos)
+        return FREQ_EMPIRICAL;
+    return FREQ_UNKNOWN;
+}
+
+/**
+ * @return TRUE if info has a worse information criterion than prev, the stopping rule for +R models
+ */
+bool isWorseModel(ModelInfo &info, ModelInfo &prev, ModelTestCriterion mtc) {
+    switch (mtc) {
+    case MTC_ALL:
+        return info.AIC_score > prev.AIC_score && info.AICc_score > prev.AICc_score && info.BIC_score > prev.BIC_score;
+    case MTC_AIC:
+        return info.AIC_score > prev.AIC_score;
+    case MTC_AICC:
+        return info.AICc_score > prev.AICc_score;
+    case MTC_BIC:
+        return info.BIC_score > prev.BIC_score;
+    }
+    return false;
+}
+
+/**
+ * @param name model name, e.g. GTR+F+I+G4
+ * @return name without the rate heterogeneity (+I, +G, +R), e.g. GTR+F
+ */
+string getModelFamily(string name) {
+    size_t pos = name.find('+');
+    string family = name.substr(0, pos);
+    while (pos != string::npos) {
+        size_t next = name.find('+', pos+1);
+        string token = name.substr(pos+1, next == string::npos ? string::npos : next-pos-1);
+        bool rate_het = (token == "I");
+        if (!token.empty() && (token[0] == 'G' || token[0] == 'R')) {
+            rate_het = true;
+            for (int i = 1; i < token.length(); i++)
+                if (!isdigit(token[i])) rate_het = false;
+        }
+        if (!rate_het)
+            family += "+" + token;
+        pos = next;
+    }
+    return family;
+}
+
+/**
+ * substitution model and rate heterogeneity models shared by the models tested in a row on one tree:
+ * each model starts from the parameters left by the models tested before, as in the serial loop of testModel()
+ */
+class ModelTestObjects {
+
+public:
+
+    /**
+     * @param rstream random stream of the thread, NULL for the global stream
+     */
+    ModelTestObjects(Params &params, PhyloTree *tree, SeqType seq_type, int *rstream = NULL) {
+        max_rate_cats = params.max_rate_cats;
+        invar_family = gamma_family = "";
+        rate_class = new RateHeterogeneity*[4];
+        rate_class[0] = new RateHeterogeneity();
+        rate_class[1] = new RateInvar(-1, NULL);
+        rate_class[2] = new RateGamma(params.num_rate_cats, initialShape(params.gamma_shape, rstream), params.gamma_median, NULL);
+        rate_class[3] = new RateGammaInvar(params.num_rate_cats, initialShape(params.gamma_shape, rstream), params.gamma_median, -1, params.optimize_alg_gammai, NULL, false);
+        int cat;
+        rate_class_free = new RateFree*[max_rate_cats-1];
+        for (cat = 0; cat < max_rate_cats-1; cat++)
+            rate_class_free[cat] = new RateFree(cat+2, initialShape(params.gamma_shape, rstream), "", false, params.optimize_alg, NULL);
+        rate_class_freeinvar = new RateFreeInvar*[max_rate_cats-1];
+        for (cat = 0; cat < max_rate_cats-1; cat++) {
+            rate_class_freeinvar[cat] = new RateFreeInvar(cat+2, initialShape(params.gamma_shape, rstream), "", false, tree->aln->frac_const_sites/2.0, params.optimize_alg, NULL);
+            rate_class_freeinvar[cat]->setFixPInvar(false);
+        }
+        subst_model = NULL;
+        if (seq_type == SEQ_BINARY)
+            subst_model = new ModelBIN("JC2", "", FREQ_UNKNOWN, "", tree);
+        else if (seq_type == SEQ_DNA)
+            subst_model = new ModelDNA("JC", "", FREQ_UNKNOWN, "", tree);
+        else if (seq_type == SEQ_PROTEIN)
+            subst_model = new ModelProtein("WAG", "", FREQ_UNKNOWN, "", tree);
+        else if (seq_type == SEQ_MORPH)
+            subst_model = new ModelMorphology("MK", "", FREQ_UNKNOWN, "", tree);
+        else if (seq_type == SEQ_CODON)
+            subst_model = new ModelCodon("GY", "", FREQ_UNKNOWN, "", tree, false);
+        assert(subst_model);
+        model_fac = new ModelFactory();
+        model_fac->joint_optimize = params.optimize_model_rate_joint;
+        vector<RateHeterogeneity*> rates = getRates();
+        for (vector<RateHeterogeneity*>::iterator it = rates.begin(); it != rates.end(); it++)
+            (*it)->rstream = rstream;
+        subst_model->rstream = rstream;
+        model_fac->rstream = rstream;
+    }
+
+    ~ModelTestObjects() {
+        delete model_fac;
+        delete subst_model;
+        int rate_type;
+        for (rate_type = 3; rate_type >= 0; rate_type--)
+            delete rate_class[rate_type];
+        delete [] rate_class;
+        for (rate_type = max_rate_cats-2; rate_type >= 0; rate_type--)
+            delete rate_class_free[rate_type];
+        delete [] rate_class_free;
+        for (rate_type = max_rate_cats-2; rate_type >= 0; rate_type--)
+            delete rate_class_freeinvar[rate_type];
+        delete [] rate_class_freeinvar;
+    }
+
+    /**
+     * assign the substitution and rate heterogeneity model of model_name (neither mixture nor +ASC) to tree
+     * @return number of categories of +R, 0 otherwise
+     */
+    int setModel(Params &params, PhyloTree *tree, string model_name) {
+        int ncat = 0;
+        subst_model->setTree(tree);
+        StateFreqType freq_type = getModelFreqType(model_name);
+        subst_model->init(model_name.substr(0, model_name.find('+')).c_str(), "", freq_type, "");
+        tree->params = &params;
+
+        tree->setModel(subst_model);
+        // initialize rate
+        size_t pos;
+        if (model_name.find("+I") != string::npos && (pos = model_name.find("+R")) != string::npos) {
+            ncat = params.num_rate_cats;
+            if (model_name.length() > pos+2 && isdigit(model_name[pos+2])) {
+                ncat = convert_int(model_name.c_str() + pos+2);
+            }
+            if (ncat <= 1) outError("Number of rate categories for " + model_name + " is <= 1");
+            if (ncat > params.max_rate_cats)
+                outError("Number of rate categories for " + model_name + " exceeds " + convertIntToString(params.max_rate_cats));
+            tree->setRate(rate_class_freeinvar[ncat-2]);
+        } else if ((pos = model_name.find("+R")) != string::npos) {
+            ncat = params.num_rate_cats;
+            if (model_name.length() > pos+2 && isdigit(model_name[pos+2])) {
+                ncat = convert_int(model_name.c_str() + pos+2);
+            }
+            if (ncat <= 1) outError("Number of rate categories for " + model_name + " is <= 1");
+            if (ncat > params.max_rate_cats)
+                outError("Number of rate categories for " + model_name + " exceeds " + convertIntToString(params.max_rate_cats));
+            tree->setRate(rate_class_free[ncat-2]);
+        } else if (model_name.find("+I") != string::npos && (pos = model_name.find("+G")) != string::npos) {
+            tree->setRate(rate_class[3]);
+            if (model_name.length() > pos+2 && isdigit(model_name[pos+2])) {
+                int ncat = convert_int(model_name.c_str() + pos+2);
+                if (ncat < 1) outError("Wrong number of category for +G in " + model_name);
+                tree->getRate()->setNCategory(ncat);
+            }
+            if (invar_family == getModelFamily(model_name) && gamma_family == invar_family) {
+                // start from +I and +G of the same substitution model
+                rate_class[3]->setGammaShape(rate_class[2]->getGammaShape());
+                rate_class[3]->setPInvar(rate_class[1]->getPInvar());
+            }
+        } else if ((pos = model_name.find("+G")) != string::npos) {
+            tree->setRate(rate_class[2]);
+            if (model_name.length() > pos+2 && isdigit(model_name[pos+2])) {
+                ncat = convert_int(model_name.c_str() + pos+2);
+                if (ncat < 1) outError("Wrong number of category for +G in " + model_name);
+                tree->getRate()->setNCategory(ncat);
+            }
+        } else if (model_name.find("+I") != string::npos)
+            tree->setRate(rate_class[1]);
+        else
+            tree->setRate(rate_class[0]);
+
+        tree->getRate()->setTree(tree);
+
+        // initialize model factory
+        model_fac->model = subst_model;
+        model_fac->site_rate = tree->getRate();
+        tree->setModelFactory(model_fac);
+        return ncat;
+    }
+
+    /**
+     * record that the parameters of model_name are optimized, thus +I+G of the same substitution model
+     * starts from p_invar of +I and the shape of +G. The serial loop of testModel() does not call it:
+     * +I+G starts from the parameters of +I+G of the substitution model before, which can remain at p_invar close to 0
+     */
+    void setOptimized(PhyloTree *tree, string model_name) {
+        if (tree->getRate() == rate_class[1])
+            invar_family = getModelFamily(model_name);
+        else if (tree->getRate() == rate_class[2])
+            gamma_family = getModelFamily(model_name);
+    }
+
+    /**
+     * continue the optimization of a +R model, worse than the same model with one category less,
+     * from the rates and proportions of the latter
+     * @param ncat number of categories of the current model
+     */
+    void setRateFromPrevious(PhyloTree *tree, int ncat) {
+        assert(ncat >= 3);
+        if (tree->getRate()->getPInvar() != 0.0)
+            rate_class_freeinvar[ncat-2]->setRateAndProp(rate_class_freeinvar[ncat-3]);
+        else
+            rate_class_free[ncat-2]->setRateAndProp(rate_class_free[ncat-3]);
+    }
+
+    /**
+     * save the parameters of the rate heterogeneity models
+     * @param checkpoint checkpoint to save into
+     */
+    void saveRates(Checkpoint *checkpoint) {
+        vector<RateHeterogeneity*> rates = getRates();
+        for (int i = 0; i < rates.size(); i++) {
+            Checkpoint *rate_checkpoint = rates[i]->getCheckpoint();
+            rates[i]->setCheckpoint(checkpoint);
+            checkpoint->startStruct("Rate" + convertIntToString(i));
+            rates[i]->saveCheckpoint();
+            checkpoint->endStruct();
+            rates[i]->setCheckpoint(rate_checkpoint);
+        }
+    }
+
+    /**
+     * restore the parameters of the rate heterogeneity models, such that the next models start from them
+     * @param checkpoint checkpoint written by saveRates() of objects with the same max_rate_cats
+     */
+    void restoreRates(Checkpoint *checkpoint) {
+        vector<RateHeterogeneity*> rates = getRates();
+        for (int i = 0; i < rates.size(); i++) {
+            Checkpoint *rate_checkpoint = rates[i]->getCheckpoint();
+            rates[i]->setCheckpoint(checkpoint);
+            checkpoint->startStruct("Rate" + convertIntToString(i));
+            rates[i]->restoreCheckpoint();
+            checkpoint->endStruct();
+            rates[i]->setCheckpoint(rate_checkpoint);
+        }
+    }
+
+    ModelGTR *subst_model;
+    RateHeterogeneity **rate_class;
+    RateFree **rate_class_free;
+    RateFreeInvar **rate_class_freeinvar;
+    ModelFactory *model_fac;
+
+private:
+
+    /**
+     * @param shape gamma shape of the command line, 0 for a random initial shape
+     * @param rstream random stream of the thread, NULL for the global stream
+     * @return shape for the constructors of the rate heterogeneity models, which draw a random
+     * initial shape from the global stream for shape 0, thus drawn here from rstream
+     */
+    static double initialShape(double shape, int *rstream) {
+        if (shape != 0.0 || !rstream)
+            return shape;
+        // negative: initial shape, not fixed
+        return -max(MIN_GAMMA_SHAPE, random_double(rstream) * 10.0);
+    }
+
+    /** @return all rate heterogeneity models */
+    vector<RateHeterogeneity*> getRates() {
+        vector<RateHeterogeneity*> rates(rate_class, rate_class+4);
+        rates.insert(rates.end(), rate_class_free, rate_class_free+max_rate_cats-1);
+        rates.insert(rates.end(), rate_class_freeinvar, rate_class_freeinvar+max_rate_cats-1);
+        return rates;
+    }
+
+    int max_rate_cats;
+
+    /** substitution models of the last optimized +I and +G models */
+    string invar_family, gamma_family;
+};
+
+/**
+ * evaluate models first..last-1 of model_names concurrently, each thread on its own copy of in_tree
+ * with its own model and partial likelihoods. The models of one substitution model (e.g. GTR+F, GTR+F+I,
+ * GTR+F+G4, GTR+F+R2, ...) form a chain that is evaluated in the order of the serial loop by one thread,
+ * each model starting from the branch lengths of the previous one, and applying the same +R stopping
+ * rule as testModel(). If all models share the substitution model (rate heterogeneity stage), the
+ * models differing only by the number of +R categories form the chains, and the other models one chain.
+ * Every chain starts from the branch lengths of in_tree and from the rate heterogeneity parameters start_rates,
+ * which testModel() leaves after the models before first, thus the results do not depend on the number of threads.
+ * They may still differ from the serial loop, where the first model of a chain starts from the parameters of the
+ * last model of the chain before, mostly for the DNA models with free substitution rates (e.g. TVMe, SYM).
+ * +I+G starts from +I and +G of its chain (see ModelTestObjects::setOptimized()), thus it may find a higher
+ * log-likelihood than the serial loop.
+ * Models found in model_info, mixture models and +ASC models are left to the serial loop of testModel().
+ * @param start_rates rate heterogeneity parameters, see ModelTestObjects::saveRates()
+ * @param[out] results model information of each model, valid if done is 1
+ * @param[out] model_lines line of the .model file of each model
+ * @param[out] done 1 for each evaluated model
+ */
+void testModelsParallel(Params &params, PhyloTree *in_tree, StrVector &model_names, int first, int last,
+    vector<ModelInfo> &model_info, ModelsBlock *models_block, int ssize, Checkpoint &start_rates,
+    vector<ModelInfo> &results, StrVector &model_lines, IntVector &done)
+{
+    results.resize(model_names.size());
+    model_lines.resize(model_names.size());
+    done.resize(model_names.size(), 0);
+
+    // group the models into chains
+    IntVector models;
+    int model;
+    for (model = first; model < last; model++) {
+        string &name = model_names[model];
+        if (name.find("+ASC") != string::npos || isMixtureModel(models_block, name))
+            continue;
+        bool cached = false;
+        for (int i = 0; i < model_info.size() && !cached; i++)
+            cached = (model_info[i].name == name);
+        if (!cached)
+            models.push_back(model);
+    }
+    bool one_family = true;
+    for (IntVector::iterator it = models.begin(); it != models.end(); it++)
+        one_family &= (getModelFamily(model_names[*it]) == getModelFamily(model_names[models[0]]));
+    vector<IntVector> chains;
+    map<string, int> chain_of_key;
+    for (IntVector::iterator it = models.begin(); it != models.end(); it++) {
+        string &name = model_names[*it];
+        string key;
+        if (one_family && name.find("+R") != string::npos)
+            key = name.substr(0, name.find("+R")) + "+R";
+        else
+            key = getModelFamily(name);
+        if (chain_of_key.find(key) == chain_of_key.end()) {
+            chain_of_key[key] = chains.size();
+            chains.push_back(IntVector());
+        }
+        chains[chain_of_key[key]].push_back(*it);
+    }
+    if (chains.empty())
+        return;
+
+    if (verbose_mode >= VB_MED)
+        cout << "Evaluating " << chains.size() << " independent model chains in parallel" << endl;
+
+    bool use_cache = params.model_cache_file && !params.print_site_lh;
+    string data_key = "";
+    if (use_cache) {
+        ModelCache::getInstance().open(params.model_cache_file);
+        data_key = ModelCache::getDataKey(in_tree);
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+        Params thread_params = params;
+        string set_name = "";
+        PhyloTree *tree = new PhyloTree;
+        tree->setParams(&thread_params);
+        tree->optimize_by_newton = params.optimize_by_newton;
+        tree->num_precision = in_tree->num_precision;
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (int chain = 0; chain < chains.size(); chain++) {
+            tree->copyTreeStructure(in_tree);
+            tree->setAlignment(in_tree->aln);
+            // new objects and random stream for each chain, thus the results do not depend on the thread evaluating it
+            int *rstream;
+            init_random_task(params.ran_seed, chain, &rstream);
+            ModelTestObjects objects(thread_params, tree, in_tree->aln->seq_type, rstream);
+            Checkpoint rate_checkpoint;
+            rate_checkpoint.insert(start_rates.begin(), start_rates.end());
+            objects.restoreRates(&rate_checkpoint);
+            uint64_t RAM_requirement = 0;
+            string prev_tree_string = "";
+            int prev_model = -1;
+            for (IntVector::iterator it = chains[chain].begin(); it != chains[chain].end(); it++) {
+                int model_id = *it;
+                tree->setLikelihoodKernel(params.SSE);
+                int ncat = objects.setModel(thread_params, tree, model_names[model_id]);
+                tree->clearAllPartialLH();
+
+                ModelInfo info;
+                info.set_name = set_name;
+                info.IC_estimate = 0.0;
+                info.df = tree->getModelFactory()->getNParameters();
+                info.name = tree->getModelName();
+                ModelInfo cached_info;
+                string cache_key, cache_line;
+                bool cached = use_cache && ModelCache::getInstance().find(cache_key = ModelCache::getKey(data_key, info.name), cached_info, cache_line) &&
+                    cached_info.df == info.df;
+                // +R models of the same chain with one category less
+                bool prev_free = prev_model >= 0 && model_names[prev_model].find("+R") != string::npos &&
+                    model_names[model_id].find("+R") != string::npos &&
+                    model_names[prev_model].substr(0, model_names[prev_model].find("+R")) ==
+                    model_names[model_id].substr(0, model_names[model_id].find("+R"));
+                if (cached) {
+                    info.logl = cached_info.logl;
+                    info.tree_len = cached_info.tree_len;
+                    info.tree = cached_info.tree;
+                    prev_tree_string = cached_info.tree;
+                } else {
+                    if (tree->getMemoryRequired() > RAM_requirement) {
+                        tree->deleteAllPartialLh();
+                        RAM_requirement = tree->getMemoryRequired();
+                    }
+                    tree->initializeAllPartialLh();
+                    if (prev_tree_string != "")
+                        tree->readTreeString(prev_tree_string);
+                    prev_tree_string = "";
+                    info.logl = tree->getModelFactory()->optimizeParameters(false, false, TOL_LIKELIHOOD_MODELTEST, TOL_GRADIENT_MODELTEST);
+                    info.tree_len = tree->treeLength();
+                    if (prev_free && info.logl < results[prev_model].logl) {
+                        // reoptimize from the parameters with one category less
+                        objects.setRateFromPrevious(tree, ncat);
+                        info.logl = tree->getModelFactory()->optimizeParameters(false, false, TOL_LIKELIHOOD_MODELTEST, TOL_GRADIENT_MODELTEST);
+                        info.tree_len = tree->treeLength();
+                    }
+                    info.tree = tree->getTreeString();
+                    objects.setOptimized(tree, model_names[model_id]);
+                }
+                computeInformationScores(info.logl, info.df, ssize, info.AIC_score, info.AICc_score, info.BIC_score);
+                ostringstream line;
+                if (cached) {
+                    line << cache_line << endl;
+                } else {
+                    printModelFile(line, thread_params, tree, info, set_name);
+                    if (use_cache) {
+                        cache_line = line.str();
+                        cache_line.erase(cache_line.find_last_not_of('\n')+1);
+                        ModelCache::getInstance().add(cache_key, cache_line);
+                    }
+                }
+                results[model_id] = info;
+                model_lines[model_id] = line.str();
+                done[model_id] = 1;
+
+                // the serial loop skips the remaining +R models of the chain
+                if (prev_free && isWorseModel(info, results[prev_model], params.model_test_criterion))
+                    break;
+                prev_model = model_id;
+            }
+            tree->deleteAllPartialLh();
+            tree->setModelFactory(NULL);
+            tree->setModel(NULL);
+            tree->setRate(NULL);
+            finish_random(rstream);
+        }
+        delete tree;
+    }
+}
+
 string testModel(Params &params, PhyloTree* in_tree, vector<ModelInfo> &model_info, ostream &fmodel, ModelsBlock *models_block,
     string set_name, bool print_mem_usage) 
 {
@@ -1357,43 +1858,8 @@ string testModel(Params &params, PhyloTree* in_tree, vector<ModelInfo> &model_in
 	in_tree->optimize_by_newton = params.optimize_by_newton;
 	in_tree->setLikelihoodKernel(params.SSE);
 
-//    int num_rate_classes = 3 + params.max_rate_cats;
-
-	RateHeterogeneity ** rate_class = new RateHeterogeneity*[4];
-	rate_class[0] = new RateHeterogeneity();
-	rate_class[1] = new RateInvar(-1, NULL);
-	rate_class[2] = new RateGamma(params.num_rate_cats, params.gamma_shape, params.gamma_median, NULL);
-	rate_class[3] = new RateGammaInvar(params.num_rate_cats, params.gamma_shape, params.gamma_median, -1, params.optimize_alg_gammai, NULL, false);
-    
-    RateFree ** rate_class_free = new RateFree*[params.max_rate_cats-1];
-    
-    for (model = 0; model < params.max_rate_cats-1; model++)
-        rate_class_free[model] = new RateFree(model+2, params.gamma_shape, "", false, params.optimize_alg, NULL);
-
-    RateFreeInvar ** rate_class_freeinvar = new RateFreeInvar*[params.max_rate_cats-1];
-    
-    for (model = 0; model < params.max_rate_cats-1; model++) {
-        rate_class_freeinvar[model] = new RateFreeInvar(model+2, params.gamma_shape, "", false, in_tree->aln->frac_const_sites/2.0, params.optimize_alg, NULL);
-        rate_class_freeinvar[model]->setFixPInvar(false);
-    }
-        
-        
-	ModelGTR *subst_model = NULL;
-	if (seq_type == SEQ_BINARY)
-		subst_model = new ModelBIN("JC2", "", FREQ_UNKNOWN, "", in_tree);
-	else if (seq_type == SEQ_DNA)
-		subst_model = new ModelDNA("JC", "", FREQ_UNKNOWN, "", in_tree);
-	else if (seq_type == SEQ_PROTEIN)
-		subst_model = new ModelProtein("WAG", "", FREQ_UNKNOWN, "", in_tree);
-	else if (seq_type == SEQ_MORPH)
-		subst_model = new ModelMorphology("MK", "", FREQ_UNKNOWN, "", in_tree);
-	else if (seq_type == SEQ_CODON)
-		subst_model = new ModelCodon("GY", "", FREQ_UNKNOWN, "", in_tree, false);
-
-	assert(subst_model);
-
-	ModelFactory *model_fac = new ModelFactory();
-	model_fac->joint_optimize = params.optimize_model_rate_joint;
+    ModelTestObjects test_objects(params, in_tree, seq_type);
+	ModelFactory *model_fac = test_objects.model_fac;
 
 	int ssize = in_tree->aln->getNSite(); // sample size
 	if (params.model_test_sample_size)
@@ -1426,8 +1892,31 @@ string testModel(Params &params, PhyloTree* in_tree, vector<ModelInfo> &model_in
     int prev_model_id = -1;
     int skip_model = 0;
 
+    // models fitted by other runs to the same data and tree (-mcache)
+    bool use_cache = params.model_cache_file && !params.model_test_and_tree && !params.print_site_lh && !in_tree->isSuperTree();
+    string data_key = "";
+    if (use_cache) {
+        ModelCache::getInstance().open(params.model_cache_file);
+        data_key = ModelCache::getDataKey(in_tree);
+    }
+    // -mprune: largest log-likelihood gain of the full optimization over the first three rounds seen so far
+    double prune_gain = params.model_test_prune;
+
+    // models evaluated in parallel ahead of the serial loop
+    bool parallel_models = false;
+#ifdef _OPENMP
+    parallel_models = params.model_test_parallel && set_name == "" && !params.model_test_and_tree &&
+        !params.print_site_lh && omp_get_max_threads() > 1 && !omp_in_parallel();
+#endif
+    int parallel_begin = 0, parallel_end = 0;
+    bool parallel_pending = false;
+    vector<ModelInfo> parallel_info;
+    StrVector parallel_lines;
+    IntVector parallel_done(model_names.size(), 0);
+
 	for (model = 0; model < model_names.size(); model++) {
 		//cout << model_names[model] << endl;
+        bool rate_stage = (model_names[model][0] == '+');
         if (model_names[model][0] == '+') {
             // now switching to test rate heterogeneity
             if (best_model == "")
@@ -1444,6 +1933,25 @@ string testModel(Params &params, PhyloTree* in_tree, vector<ModelInfo> &model_in
                 default: assert(0);
                 }
             model_names[model] = best_model + model_names[model];
+        }
+        if (parallel_models && model >= parallel_end) {
+            // the rate heterogeneity models depend on the best model found so far, the others are independent
+            if (rate_stage) {
+                for (parallel_end = model+1; parallel_end < model_names.size(); parallel_end++)
+                    if (model_names[parallel_end][0] == '+')
+                        model_names[parallel_end] = best_model + model_names[parallel_end];
+            } else {
+                for (parallel_end = model+1; parallel_end < model_names.size(); parallel_end++)
+                    if (model_names[parallel_end][0] == '+')
+                        break;
+            }
+            // launched once the models of this substitution model (only this model in the rate heterogeneity stage)
+            // are evaluated, starting from their branch lengths and rate heterogeneity parameters
+            parallel_begin = model+1;
+            if (!rate_stage)
+                while (parallel_begin < parallel_end && getModelFamily(model_names[parallel_begin]) == getModelFamily(model_names[model]))
+                    parallel_begin++;
+            parallel_pending = true;
         }
 		PhyloTree *tree = in_tree;
         ModelFactory *this_model_fac = NULL;
@@ -1485,76 +1993,7 @@ string testModel(Params &params, PhyloTree* in_tree, vector<ModelInfo> &model_in
                 model_fac->unobserved_ptns = "";
                 tree->aln->buildSeqStates(false);
             }
-            // initialize tree
-            // initialize model
-            subst_model->setTree(tree);
-            StateFreqType freq_type = FREQ_UNKNOWN;
-            if (model_names[model].find("+F1X4") != string::npos)
-                freq_type = FREQ_CODON_1x4;
-            else if (model_names[model].find("+F3X4C") != string::npos)
-                freq_type = FREQ_CODON_3x4C;
-            else if (model_names[model].find("+F3X4") != string::npos)
-                freq_type = FREQ_CODON_3x4;
-            else if (model_names[model].find("+FQ") != string::npos)
-                freq_type = FREQ_EQUAL;
-            else if (model_names[model].find("+FO") != string::npos)
-                freq_type = FREQ_ESTIMATE;
-            else if (model_names[model].find("+FU") != string::npos)
-                freq_type = FREQ_USER_DEFINED;
-            else if (model_names[model].find("+F") != string::npos)
-                freq_type = FREQ_EMPIRICAL;
-                
-            subst_model->init(model_names[model].substr(0, model_names[model].find('+')).c_str(), "", freq_type, "");
-            tree->params = &params;
-
-            tree->setModel(subst_model);
-            // initialize rate
-            size_t pos;
-            if (model_names[model].find("+I") != string::npos && (pos = model_names[model].find("+R")) != string::npos) {
-                ncat = params.num_rate_cats;
-                if (model_names[model].length() > pos+2 && isdigit(model_names[model][pos+2])) {
-                    ncat = convert_int(model_names[model].c_str() + pos+2);
-    //                tree->getRate()->setNCategory(ncat);
-                }
-                if (ncat <= 1) outError("Number of rate categories for " + model_names[model] + " is <= 1");
-                if (ncat > params.max_rate_cats)
-                    outError("Number of rate categories for " + model_names[model] + " exceeds " + convertIntToString(params.max_rate_cats));
-                tree->setRate(rate_class_freeinvar[ncat-2]);
-            } else if ((pos = model_names[model].find("+R")) != string::npos) {
-                ncat = params.num_rate_cats;
-                if (model_names[model].length() > pos+2 && isdigit(model_names[model][pos+2])) {
-                    ncat = convert_int(model_names[model].c_str() + pos+2);
-    //                tree->getRate()->setNCategory(ncat);
-                }
-                if (ncat <= 1) outError("Number of rate categories for " + model_names[model] + " is <= 1");
-                if (ncat > params.max_rate_cats)
-                    outError("Number of rate categories for " + model_names[model] + " exceeds " + convertIntToString(params.max_rate_cats));
-                tree->setRate(rate_class_free[ncat-2]);
-            } else if (model_names[model].find("+I") != string::npos && (pos = model_names[model].find("+G")) != string::npos) {
-                tree->setRate(rate_class[3]);
-                if (model_names[model].length() > pos+2 && isdigit(model_names[model][pos+2])) {
-                    int ncat = convert_int(model_names[model].c_str() + pos+2);
-                    if (ncat < 1) outError("Wrong number of category for +G in " + model_names[model]);
-                    tree->getRate()->setNCategory(ncat);
-                }
-            } else if ((pos = model_names[model].find("+G")) != string::npos) {
-                tree->setRate(rate_class[2]);
-                if (model_names[model].length() > pos+2 && isdigit(model_names[model][pos+2])) {
-                    ncat = convert_int(model_names[model].c_str() + pos+2);
-                    if (ncat < 1) outError("Wrong number of category for +G in " + model_names[model]);
-                    tree->getRate()->setNCategory(ncat);
-                }
-            } else if (model_names[model].find("+I") != string::npos)
-                tree->setRate(rate_class[1]);
-            else
-                tree->setRate(rate_class[0]);
-
-            tree->getRate()->setTree(tree);
-
-            // initialize model factory
-            model_fac->model = subst_model;
-            model_fac->site_rate = tree->getRate();
-            tree->setModelFactory(model_fac);
+            ncat = test_objects.setModel(params, tree, model_names[model]);
         }
         
         tree->clearAllPartialLH();
@@ -1563,12 +2002,15 @@ string testModel(Params &params, PhyloTree* in_tree, vector<ModelInfo> &model_in
 		// optimize model parameters
 		ModelInfo info;        
 		info.set_name = set_name;
+		info.IC_estimate = 0.0;
 		info.df = tree->getModelFactory()->getNParameters();
         if (mixture_model)
             info.name = model_names[model];
         else
             info.name = tree->getModelName();
 		int model_id = -1;
+        ModelInfo cached_info;
+        string cache_key, cache_line;
         if (skip_model) {
             assert(prev_model_id>=0);
             size_t pos_r = info.name.find("+R");
@@ -1597,6 +2039,21 @@ string testModel(Params &params, PhyloTree* in_tree, vector<ModelInfo> &model_in
 //            prev_tree_string = model_info[prev_model_id].tree;
 //            cout << "Skipped " << info.name << endl;
             }
+        } else if (use_cache && ModelCache::getInstance().find(cache_key = ModelCache::getKey(data_key, info.name), cached_info, cache_line) &&
+            cached_info.df == info.df) {
+            info.logl = cached_info.logl;
+            info.tree_len = cached_info.tree_len;
+            info.tree = cached_info.tree;
+            prev_tree_string = cached_info.tree;
+            if (set_name != "")
+                fmodel << set_name << "\t";
+            fmodel << cache_line << endl;
+        } else if (parallel_models && parallel_done[model] && parallel_info[model].df == info.df) {
+            info.logl = parallel_info[model].logl;
+            info.tree_len = parallel_info[model].tree_len;
+            info.tree = parallel_info[model].tree;
+            fmodel << parallel_lines[model];
+            prev_tree_string = "";
 		} else {
             if (params.model_test_and_tree) {
                 string original_model = params.model_name;
@@ -1654,9 +2111,37 @@ string testModel(Params &params, PhyloTree* in_tree, vector<ModelInfo> &model_in
                     tree->fixNegativeBranch(true);
                     tree->clearAllPartialLH();
                 }
-                info.logl = tree->getModelFactory()->optimizeParameters(false, false, TOL_LIKELIHOOD_MODELTEST, TOL_GRADIENT_MODELTEST);
-                info.tree_len = tree->treeLength();
-                if (prev_model_id >= 0) {
+                double first_logl = 0.0;
+                if (params.model_test_prune > 0.0 && model_bic >= 0) {
+                    // staged evaluation: after three rounds of optimization, prune the model if even a gain
+                    // of prune_gain cannot make it better than the best model so far. This is a heuristic,
+                    // not a bound: the full optimization may well gain more than any model before
+                    int num_param_iterations = tree->params->num_param_iterations;
+                    tree->params->num_param_iterations = 3;
+                    first_logl = tree->getModelFactory()->optimizeParameters(false, false, TOL_LIKELIHOOD_MODELTEST, TOL_GRADIENT_MODELTEST);
+                    tree->params->num_param_iterations = num_param_iterations;
+                    ModelInfo estimate = info, best = info;
+                    computeInformationScores(first_logl + prune_gain, info.df, ssize, estimate.AIC_score, estimate.AICc_score, estimate.BIC_score);
+                    best.AIC_score = model_info[model_aic].AIC_score;
+                    best.AICc_score = model_info[model_aicc].AICc_score;
+                    best.BIC_score = model_info[model_bic].BIC_score;
+                    if (isWorseModel(estimate, best, params.model_test_criterion)) {
+                        info.logl = first_logl;
+                        info.tree_len = tree->treeLength();
+                        switch (params.model_test_criterion) {
+                        case MTC_AIC: info.IC_estimate = estimate.AIC_score; break;
+                        case MTC_AICC: info.IC_estimate = estimate.AICc_score; break;
+                        default: info.IC_estimate = estimate.BIC_score; break;
+                        }
+                    }
+                }
+                if (info.IC_estimate == 0.0) {
+                    info.logl = tree->getModelFactory()->optimizeParameters(false, false, TOL_LIKELIHOOD_MODELTEST, TOL_GRADIENT_MODELTEST);
+                    info.tree_len = tree->treeLength();
+                    if (first_logl != 0.0)
+                        prune_gain = max(prune_gain, info.logl - first_logl);
+                }
+                if (info.IC_estimate == 0.0 && prev_model_id >= 0) {
                     // check stop criterion for +R
                     size_t prev_pos_r = model_info[prev_model_id].name.find("+R");
                     size_t pos_r = info.name.find("+R");
@@ -1666,20 +2151,29 @@ string testModel(Params &params, PhyloTree* in_tree, vector<ModelInfo> &model_in
                     {
                         if (verbose_mode >= VB_MED)
                             cout << "reoptimizing from previous parameters of +R...." << endl;
-                        assert(ncat >= 3);
-                        if (tree->getRate()->getPInvar() != 0.0)                        
-                            rate_class_freeinvar[ncat-2]->setRateAndProp(rate_class_freeinvar[ncat-3]);
-                        else
-                            rate_class_free[ncat-2]->setRateAndProp(rate_class_free[ncat-3]);
+                        test_objects.setRateFromPrevious(tree, ncat);
                         info.logl = tree->getModelFactory()->optimizeParameters(false, false, TOL_LIKELIHOOD_MODELTEST, TOL_GRADIENT_MODELTEST);
                         info.tree_len = tree->treeLength();                        
                     }
                 }
 //                info.tree = tree->getTreeString();
             }
-			// print information to .model file
+			// print information to .model file, except for pruned models that are not fully optimized
             info.tree = tree->getTreeString();
-            printModelFile(fmodel, params, tree, info, set_name);
+            if (info.IC_estimate == 0.0 && use_cache) {
+                // also store the line in the cache
+                ostringstream line;
+                string no_set_name = "";
+                printModelFile(line, params, tree, info, no_set_name);
+                cache_line = line.str();
+                if (set_name != "")
+                    fmodel << set_name << "\t";
+                fmodel << cache_line;
+                cache_line.erase(cache_line.find_last_not_of('\n')+1);
+                cache_key = ModelCache::getKey(data_key, info.name);
+                ModelCache::getInstance().add(cache_key, cache_line);
+            } else if (info.IC_estimate == 0.0)
+                printModelFile(fmodel, params, tree, info, set_name);
 		}
 		computeInformationScores(info.logl, info.df, ssize, info.AIC_score, info.AICc_score, info.BIC_score);
         if (prev_model_id >= 0) {
@@ -1719,6 +2213,8 @@ string testModel(Params &params, PhyloTree* in_tree, vector<ModelInfo> &model_in
         }
         if (skip_model > 1)
             info.AIC_score = DBL_MAX;
+        if (info.IC_estimate != 0.0)
+            info.AIC_score = info.AICc_score = info.BIC_score = DBL_MAX;
         
 		if (model_id >= 0) {
 			model_info[model_id] = info;
@@ -1747,6 +2243,16 @@ string testModel(Params &params, PhyloTree* in_tree, vector<ModelInfo> &model_in
 
         prev_model_id = model_id;
 
+        if (parallel_pending && model+1 >= parallel_begin) {
+            parallel_pending = false;
+            if (model+1 < parallel_end) {
+                Checkpoint start_rates;
+                test_objects.saveRates(&start_rates);
+                testModelsParallel(params, in_tree, model_names, model+1, parallel_end, model_info, models_block, ssize,
+                    start_rates, parallel_info, parallel_lines, parallel_done);
+            }
+        }
+
 		if (set_name != "") continue;
 
 		cout.width(3);
@@ -1758,13 +2264,22 @@ string testModel(Params &params, PhyloTree* in_tree, vector<ModelInfo> &model_in
             cout << "Skipped " << endl;
             continue;
         }
-        
+
 		cout.precision(3);
 		cout << fixed;
 		cout.width(12);
 		cout << -info.logl << " ";
 		cout.width(3);
 		cout << info.df << " ";
+        if (info.IC_estimate != 0.0) {
+            // -mprune: log-likelihood after three rounds only, scores not computed
+            cout.width(12);
+            cout << "pruned" << " ";
+            cout.width(12);
+            cout << "pruned" << " " << "pruned";
+            cout << " (estimated " << criterionName(params.model_test_criterion) << ": " << info.IC_estimate << ")" << endl;
+            continue;
+        }
 		cout.width(12);
 		cout << info.AIC_score << " ";
 		cout.width(12);
@@ -1893,23 +2408,6 @@ string testModel(Params &params, PhyloTree* in_tree, vector<ModelInfo> &model_in
 	delete [] model_rank;
 	delete [] scores;
 
-	delete model_fac;
-	delete subst_model;
-    int rate_type;
-	for (rate_type = 3; rate_type >= 0; rate_type--) {
-		delete rate_class[rate_type];
-    }
-    delete [] rate_class;
-    
-	for (rate_type = params.max_rate_cats-2; rate_type >= 0; rate_type--) {
-		delete rate_class_free[rate_type];
-    }
-    delete [] rate_class_free;
-
-	for (rate_type = params.max_rate_cats-2; rate_type >= 0; rate_type--) {
-		delete rate_class_freeinvar[rate_type];
-    }
-    delete [] rate_class_freeinvar;
     
 //	delete tree_hetero;
 //	delete tree_homo;
@@ -2247,8 +2745,180 @@ int mlecoef(double *cnts, double *rr, double bb, int kk,
 
 /* END CODE WAS TAKEN FROM CONSEL PROGRAM */
 
+/** scale factors r of the multiscale bootstrap of the AU test, and sqrt(r), 1/sqrt(r) */
+const size_t AU_NSCALES = 10;
+static double au_r[] = {0.5, 0.6, 0.7, 0.8, 0.9, 1.0, 1.1, 1.2, 1.3, 1.4};
+static double au_rr[] = {sqrt(0.5), sqrt(0.6), sqrt(0.7), sqrt(0.8), sqrt(0.9), 1.0,
+    sqrt(1.1), sqrt(1.2), sqrt(1.3), sqrt(1.4)};
+static double au_rr_inv[] = {sqrt(1/0.5), sqrt(1/0.6), sqrt(1/0.7), sqrt(1/0.8), sqrt(1/0.9), 1.0,
+    sqrt(1/1.1), sqrt(1/1.2), sqrt(1/1.3), sqrt(1/1.4)};
+
 /**
-    @param tree_lhs RELL score matrix of size #trees x #replicates
+ * @param pattern_lh pattern log-likelihoods of a tree
+ * @param boot_sample_dbl pattern counts of a bootstrap replicate, padded with zeros to get_safe_upper_limit(nptn)
+ * @return log-likelihood of the tree on the replicate
+ */
+double computeAUBootLh(Params &params, PhyloTree *tree, double *pattern_lh, double *boot_sample_dbl, size_t nptn) {
+    double tree_lh;
+    if (params.SSE == LK_EIGEN) {
+        tree_lh = 0.0;
+        for (size_t ptn = 0; ptn < nptn; ptn++)
+            tree_lh += pattern_lh[ptn] * boot_sample_dbl[ptn];
+    } else {
+#ifdef BINARY32
+        tree_lh = tree->dotProductSIMD<double, Vec2d, 2>(pattern_lh, boot_sample_dbl, nptn);
+#else
+        if (instruction_set >= 7)
+            tree_lh = tree->dotProductSIMD<double, Vec4d, 4>(pattern_lh, boot_sample_dbl, nptn);
+        else
+            tree_lh = tree->dotProductSIMD<double, Vec2d, 2>(pattern_lh, boot_sample_dbl, nptn);
+#endif
+    }
+    return tree_lh;
+}
+
+/**
+ * weighted least square fit of the AU test for one tree, prints the result line of the tree
+ * @param this_stat AU_NSCALES x nboot statistics of the tree, sorted for each scale
+ * @param tid tree ID
+ * @param[out] info au_pvalue of the tree
+ */
+void computeAUPValue(double *this_stat, size_t nboot, size_t tid, TreeInfo &info) {
+    size_t nscales = AU_NSCALES, k;
+    double *rr = au_rr, *rr_inv = au_rr_inv;
+    double *cc = new double[nscales];
+    double *w = new double[nscales];
+    double *this_bp = new double[nscales];
+    double xn = this_stat[(nscales/2)*nboot + nboot/2], x;
+    double c, d; // c, d in original paper
+    int idf0 = -2;
+    double z = 0.0, z0 = 0.0, thp = 0.0, th = 0.0, ze = 0.0, ze0 = 0.0;
+    double pval, se;
+    int df;
+    double rss = 0.0;
+    int step;
+    const int max_step = 30;
+    bool failed = false;
+    for (step = 0; step < max_step; step++) {
+        x = xn;
+        int num_k = 0;
+        for (k = 0; k < nscales; k++) {
+            this_bp[k] = cntdist3(this_stat + k*nboot, nboot, x) / nboot;
+            if (this_bp[k] <= 0 || this_bp[k] >= 1) {
+                cc[k] = w[k] = 0.0;
+            } else {
+                double bp_val = this_bp[k];
+                cc[k] = -gsl_cdf_ugaussian_Pinv(bp_val);
+                double bp_pdf = gsl_ran_ugaussian_pdf(cc[k]);
+                w[k] = bp_pdf*bp_pdf*nboot / (bp_val*(1.0-bp_val));
+                num_k++;
+            }
+        }
+        df = num_k-2;
+        if (num_k >= 2) {
+            // first obtain d and c by weighted least square
+            doWeightedLeastSquare(nscales, w, rr, rr_inv, cc, d, c, se);
+            
+            se = gsl_ran_ugaussian_pdf(d-c)*sqrt(se);
+            
+            // second, perform MLE estimate of d and c
+//            OptimizationAUTest mle(d, c, nscales, this_bp, rr, rr_inv);
+//            mle.optimizeDC();
+//            d = mle.d;
+//            c = mle.c;
+
+            /* STEP 4: compute p-value according to Eq. 11 */
+            pval = 1.0 - gsl_cdf_ugaussian_P(d-c);
+            z = -pval;
+            ze = se;
+            // compute sum of squared difference
+            rss = 0.0;
+            for (k = 0; k < nscales; k++) {
+                double diff = cc[k] - (rr[k]*d + rr_inv[k]*c);
+                rss += w[k] * diff * diff;
+            }
+            
+        } else {
+            // not enough data for WLS
+            double sum = 0.0;
+            for (k = 0; k < nscales; k++)
+                sum += cc[k];
+            if (sum >= 0.0) 
+                pval = 0.0;
+            else
+                pval = 1.0;
+            se = 0.0;
+            d = c = 0.0;
+            rss = 0.0;
+            if (verbose_mode >= VB_MED)
+                cout << "   error in wls" << endl;
+        }
+
+        // maximum likelhood fit
+//            double coef0[2] = {d, c};
+//            double df;
+//            int mlefail = mlecoef(this_bp, r, nboot, nscales, coef0, &rss, &df, &se);
+//            
+//            if (!mlefail) {
+//                d = coef0[0];
+//                c = coef0[1];
+//                pval = 1.0 - gsl_cdf_ugaussian_P(d-c);
+//                z = -pval;
+//                ze = se;
+//            }
+        
+        if (verbose_mode >= VB_MED) {
+            cout.unsetf(ios::fixed);
+            cout << "\t" << step << "\t" << th << "\t" << x << "\t" << pval << "\t" << se << "\t" << nscales-2 << "\t" << d << "\t" << c << "\t" << z << "\t" << ze << "\t" << rss << endl;
+        }
+        
+        if(df < 0 && idf0 < 0) { failed = true; break;} /* degenerated */
+        
+        if ((df < 0) || (idf0 >= 0 && (z-z0)*(x-thp) > 0.0 && fabs(z-z0)>0.1*ze0)) {
+            if (verbose_mode >= VB_MED)
+                cout << "   non-monotone" << endl;
+            th=x;
+            xn=0.5*x+0.5*thp;
+            continue;
+        }
+        if(idf0 >= 0 && (fabs(z-z0)<0.01*ze0)) {
+            if(fabs(th)<1e-10) 
+                xn=th; 
+            else th=x;
+        } else 
+            xn=0.5*th+0.5*x;
+        info.au_pvalue = pval;
+        thp=x; 
+        z0=z;
+        ze0=ze;
+        idf0 = nscales-2;
+        if(fabs(x-th)<1e-10) break;
+    }
+    
+    if (failed && verbose_mode >= VB_MED)
+        cout << "   degenerated" << endl;
+    
+    if (step == max_step) {
+        if (verbose_mode >= VB_MED)
+            cout << "   non-convergence" << endl; 
+        failed = true;
+    }
+    
+    double pchi2 = (failed) ? 0.0 : computePValueChiSquare(rss, df);
+    cout << tid+1 << "\t" << info.au_pvalue << "\t" << rss << "\t" << d << "\t" << c;
+    
+    // warning if p-value of chi-square < 0.01 (rss too high)
+    if (pchi2 < 0.01) 
+        cout << " !!!";
+    cout << endl;
+
+    delete [] this_bp;
+    delete [] w;
+    delete [] cc;
+}
+
+/**
+    @param pattern_lhs pattern log-likelihoods of all trees, get_safe_upper_limit(nptn) per tree
 */
 void performAUTest(Params &params, PhyloTree *tree, double *pattern_lhs, vector<TreeInfo> &info) {
     
@@ -2256,12 +2926,8 @@ void performAUTest(Params &params, PhyloTree *tree, double *pattern_lhs, vector<
         outWarning("Too few replicates for AU test. At least -zb 10000 for reliable results!");
     
     /* STEP 1: specify scale factors */
-    size_t nscales = 10;
-    double r[] = {0.5, 0.6, 0.7, 0.8, 0.9, 1.0, 1.1, 1.2, 1.3, 1.4};
-    double rr[] = {sqrt(0.5), sqrt(0.6), sqrt(0.7), sqrt(0.8), sqrt(0.9), 1.0, 
-        sqrt(1.1), sqrt(1.2), sqrt(1.3), sqrt(1.4)};
-    double rr_inv[] = {sqrt(1/0.5), sqrt(1/0.6), sqrt(1/0.7), sqrt(1/0.8), sqrt(1/0.9), 1.0, 
-        sqrt(1/1.1), sqrt(1/1.2), sqrt(1/1.3), sqrt(1/1.4)};
+    size_t nscales = AU_NSCALES;
+    double *r = au_r;
         
     /* STEP 2: compute bootstrap proportion */
     size_t ntrees = info.size();
@@ -2289,10 +2955,6 @@ void performAUTest(Params &params, PhyloTree *tree, double *pattern_lhs, vector<
 #ifdef _OPENMP
     #pragma omp parallel private(k, tid, ptn)
     {
-    int *rstream;
-    init_random(params.ran_seed + omp_get_thread_num(), false, &rstream);
-#else
-    int *rstream = randstream;
 #endif
     size_t boot;
     int *boot_sample = aligned_alloc<int>(maxnptn);
@@ -2304,6 +2966,10 @@ void performAUTest(Params &params, PhyloTree *tree, double *pattern_lhs, vector<
     #pragma omp for schedule(dynamic)
 #endif
     for (k = 0; k < nscales; k++) {
+        // one random stream per scale as in performAUTestStream(), thus the same replicates
+        // for any number of threads and with -zmem
+        int *rstream;
+        init_random(params.ran_seed + k, false, &rstream);
         string str = "SCALE=" + convertDoubleToString(r[k]);    
 		for (boot = 0; boot < nboot; boot++) {
 			tree->aln->createBootstrapAlignment(boot_sample, str.c_str(), rstream);
@@ -2313,21 +2979,7 @@ void performAUTest(Params &params, PhyloTree *tree, double *pattern_lhs, vector<
             int max_tid = -1;
             for (tid = 0; tid < ntrees; tid++) {
                 double *pattern_lh = pattern_lhs + (tid*maxnptn);
-                double tree_lh;
-                if (params.SSE == LK_EIGEN) {
-                    tree_lh = 0.0;
-                    for (ptn = 0; ptn < nptn; ptn++)
-                        tree_lh += pattern_lh[ptn] * boot_sample_dbl[ptn];
-                } else {
-#ifdef BINARY32
-                    tree_lh = tree->dotProductSIMD<double, Vec2d, 2>(pattern_lh, boot_sample_dbl, nptn);
-#else
-                    if (instruction_set >= 7)
-                        tree_lh = tree->dotProductSIMD<double, Vec4d, 4>(pattern_lh, boot_sample_dbl, nptn);
-                    else
-                        tree_lh = tree->dotProductSIMD<double, Vec2d, 2>(pattern_lh, boot_sample_dbl, nptn);
-#endif
-                }
+                double tree_lh = computeAUBootLh(params, tree, pattern_lh, boot_sample_dbl, nptn);
                 // rescale lh
                 tree_lh /= r[k];
                 
@@ -2355,169 +3007,175 @@ void performAUTest(Params &params, PhyloTree *tree, double *pattern_lhs, vector<
         for (tid = 0; tid < ntrees; tid++) {
             quicksort<double,int>(treelhs + (tid*nscales+k)*nboot, 0, nboot-1);
         }
-        
+        finish_random(rstream);
     }
 
     aligned_free(boot_sample_dbl);
     aligned_free(boot_sample);
 
 #ifdef _OPENMP
-    finish_random(rstream);
     }
 #endif
 
-//    if (verbose_mode >= VB_MED) {
-//        cout << "scale";
-//        for (k = 0; k < nscales; k++)
-//            cout << "\t" << r[k];
-//        cout << endl;
-//        for (tid = 0; tid < ntrees; tid++) {
-//            cout << tid;
-//            for (k = 0; k < nscales; k++) {
-//                cout << "\t" << bp[tid+k*ntrees];
-//            }
-//            cout << endl;
-//        }
-//    }
-    
     cout << getRealTime() - start_time << " seconds" << endl;
     
     /* STEP 3: weighted least square fit */
     
-    double *cc = new double[nscales];
-    double *w = new double[nscales];
-    double *this_bp = new double[nscales];
     cout << "TreeID\tAU\tRSS\td\tc" << endl;
-    for (tid = 0; tid < ntrees; tid++) {
-        double *this_stat = treelhs + tid*nscales*nboot;
-        double xn = this_stat[(nscales/2)*nboot + nboot/2], x;
-        double c, d; // c, d in original paper
-        int idf0 = -2;
-        double z = 0.0, z0 = 0.0, thp = 0.0, th = 0.0, ze = 0.0, ze0 = 0.0;
-        double pval, se;
-        int df;
-        double rss = 0.0;
-        int step;
-        const int max_step = 30;
-        bool failed = false;
-        for (step = 0; step < max_step; step++) {
-            x = xn;
-            int num_k = 0;
-            for (k = 0; k < nscales; k++) {
-                this_bp[k] = cntdist3(this_stat + k*nboot, nboot, x) / nboot;
-                if (this_bp[k] <= 0 || this_bp[k] >= 1) {
-                    cc[k] = w[k] = 0.0;
-                } else {
-                    double bp_val = this_bp[k];
-                    cc[k] = -gsl_cdf_ugaussian_Pinv(bp_val);
-                    double bp_pdf = gsl_ran_ugaussian_pdf(cc[k]);
-                    w[k] = bp_pdf*bp_pdf*nboot / (bp_val*(1.0-bp_val));
-                    num_k++;
-                }
+    for (tid = 0; tid < ntrees; tid++)
+        computeAUPValue(treelhs + tid*nscales*nboot, nboot, tid, info[tid]);
+    
+    delete [] treelhs;
+//    delete [] bp;
+}
+
+/**
+ * AU test within the memory budget params.topotest_mem, for many trees. The pattern log-likelihoods
+ * of the trees are read in chunks from ptnlh_file. The first pass accumulates the maximum and second
+ * maximum log-likelihood of every replicate over all trees, the second pass computes and sorts the
+ * statistics of one chunk of trees at a time. The replicates are kept as one-byte pattern counts if they
+ * take at most half of the budget, otherwise they are regenerated from a fixed seed per scale for every chunk.
+ * @param ptnlh_file binary file of get_safe_upper_limit(nptn) pattern log-likelihoods per tree
+ */
+void performAUTestStream(Params &params, PhyloTree *tree, string ptnlh_file, vector<TreeInfo> &info) {
+
+    if (params.topotest_replicates < 10000)
+        outWarning("Too few replicates for AU test. At least -zb 10000 for reliable results!");
+
+    size_t nscales = AU_NSCALES;
+    size_t ntrees = info.size();
+    size_t nboot = params.topotest_replicates;
+    size_t nptn = tree->getAlnNPattern();
+    size_t maxnptn = get_safe_upper_limit(nptn);
+    size_t k, i, rep;
+
+    size_t budget = ((size_t)params.topotest_mem) << 20;
+    size_t fixed_mem = nscales*nboot*(2*sizeof(double) + sizeof(size_t));
+    size_t sample_mem = nscales*nboot*nptn;
+    bool keep_samples = (sample_mem <= budget/2);
+    if (keep_samples)
+        fixed_mem += sample_mem;
+    // number of trees per chunk
+    size_t tree_mem = (maxnptn + nscales*nboot)*sizeof(double);
+    size_t chunk = (budget > fixed_mem + tree_mem) ? (budget - fixed_mem) / tree_mem : 1;
+    chunk = min(chunk, ntrees);
+    cout << ((fixed_mem + chunk*tree_mem) >> 20) << " MB required for AU test, "
+        << (ntrees + chunk - 1) / chunk << " chunk(s) of " << chunk << " trees" << endl;
+
+    double *max_lh = new double[nscales*nboot];
+    double *second_max_lh = new double[nscales*nboot];
+    size_t *max_tid = new size_t[nscales*nboot];
+    for (rep = 0; rep < nscales*nboot; rep++) {
+        max_lh[rep] = second_max_lh[rep] = -DBL_MAX;
+        max_tid[rep] = ntrees;
+    }
+    double *pattern_lhs = aligned_alloc<double>(chunk*maxnptn);
+    double *treelhs = new double[chunk*nscales*nboot];
+    BootSampleMatrix samples;
+    if (keep_samples)
+        samples.init(nscales*nboot, nptn);
+
+    ifstream in;
+    in.open(ptnlh_file.c_str(), ios::in | ios::binary);
+    if (!in.is_open())
+        outError("Cannot read file ", ptnlh_file);
+
+    double start_time = getRealTime();
+
+    cout << "Generating " << nscales << " x " << nboot << " multiscale bootstrap replicates... ";
+
+    if (keep_samples) {
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic)
+#endif
+        for (k = 0; k < nscales; k++) {
+            int *rstream;
+            init_random(params.ran_seed + k, false, &rstream);
+            int *boot_sample = aligned_alloc<int>(maxnptn);
+            string str = "SCALE=" + convertDoubleToString(au_r[k]);
+            for (size_t boot = 0; boot < nboot; boot++) {
+                tree->aln->createBootstrapAlignment(boot_sample, str.c_str(), rstream);
+                samples.setSample(k*nboot + boot, boot_sample);
             }
-            df = num_k-2;
-            if (num_k >= 2) {
-                // first obtain d and c by weighted least square
-                doWeightedLeastSquare(nscales, w, rr, rr_inv, cc, d, c, se);
-                
-                se = gsl_ran_ugaussian_pdf(d-c)*sqrt(se);
-                
-                // second, perform MLE estimate of d and c
-    //            OptimizationAUTest mle(d, c, nscales, this_bp, rr, rr_inv);
-    //            mle.optimizeDC();
-    //            d = mle.d;
-    //            c = mle.c;
-
-                /* STEP 4: compute p-value according to Eq. 11 */
-                pval = 1.0 - gsl_cdf_ugaussian_P(d-c);
-                z = -pval;
-                ze = se;
-                // compute sum of squared difference
-                rss = 0.0;
-                for (k = 0; k < nscales; k++) {
-                    double diff = cc[k] - (rr[k]*d + rr_inv[k]*c);
-                    rss += w[k] * diff * diff;
+            aligned_free(boot_sample);
+            finish_random(rstream);
+        }
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        in.clear();
+        in.seekg(0, ios::beg);
+        for (size_t first = 0; first < ntrees; first += chunk) {
+            size_t nchunk = min(chunk, ntrees - first);
+            in.read((char*)pattern_lhs, nchunk*maxnptn*sizeof(double));
+            if (!in)
+                outError("Cannot read file ", ptnlh_file);
+
+#ifdef _OPENMP
+            #pragma omp parallel for private(i, rep) schedule(dynamic)
+#endif
+            for (k = 0; k < nscales; k++) {
+                // same replicates of this scale in every chunk and pass
+                int *rstream = NULL;
+                if (!keep_samples)
+                    init_random(params.ran_seed + k, false, &rstream);
+                int *boot_sample = aligned_alloc<int>(maxnptn);
+                memset(boot_sample, 0, maxnptn*sizeof(int));
+                double *boot_sample_dbl = aligned_alloc<double>(maxnptn);
+                memset(boot_sample_dbl, 0, maxnptn*sizeof(double));
+                string str = "SCALE=" + convertDoubleToString(au_r[k]);
+                for (size_t boot = 0; boot < nboot; boot++) {
+                    rep = k*nboot + boot;
+                    if (keep_samples) {
+                        samples.getCounts(rep, 0, nptn, boot_sample_dbl);
+                    } else {
+                        tree->aln->createBootstrapAlignment(boot_sample, str.c_str(), rstream);
+                        for (size_t ptn = 0; ptn < maxnptn; ptn++)
+                            boot_sample_dbl[ptn] = boot_sample[ptn];
+                    }
+                    for (i = 0; i < nchunk; i++) {
+                        double tree_lh = computeAUBootLh(params, tree, pattern_lhs + i*maxnptn, boot_sample_dbl, nptn) / au_r[k];
+                        if (pass == 0) {
+                            // find the max and second max
+                            if (tree_lh > max_lh[rep]) {
+                                second_max_lh[rep] = max_lh[rep];
+                                max_lh[rep] = tree_lh;
+                                max_tid[rep] = first + i;
+                            } else if (tree_lh > second_max_lh[rep])
+                                second_max_lh[rep] = tree_lh;
+                        } else {
+                            // difference from max_lh
+                            treelhs[(i*nscales+k)*nboot + boot] = (first + i != max_tid[rep]) ?
+                                max_lh[rep] - tree_lh : second_max_lh[rep] - max_lh[rep];
+                        }
+                    }
                 }
-                
-            } else {
-                // not enough data for WLS
-                double sum = 0.0;
-                for (k = 0; k < nscales; k++)
-                    sum += cc[k];
-                if (sum >= 0.0) 
-                    pval = 0.0;
-                else
-                    pval = 1.0;
-                se = 0.0;
-                d = c = 0.0;
-                rss = 0.0;
-                if (verbose_mode >= VB_MED)
-                    cout << "   error in wls" << endl;
+                if (pass == 1)
+                    for (i = 0; i < nchunk; i++)
+                        quicksort<double,int>(treelhs + (i*nscales+k)*nboot, 0, nboot-1);
+                aligned_free(boot_sample_dbl);
+                aligned_free(boot_sample);
+                if (rstream)
+                    finish_random(rstream);
             }
 
-            // maximum likelhood fit
-//            double coef0[2] = {d, c};
-//            double df;
-//            int mlefail = mlecoef(this_bp, r, nboot, nscales, coef0, &rss, &df, &se);
-//            
-//            if (!mlefail) {
-//                d = coef0[0];
-//                c = coef0[1];
-//                pval = 1.0 - gsl_cdf_ugaussian_P(d-c);
-//                z = -pval;
-//                ze = se;
-//            }
-            
-            if (verbose_mode >= VB_MED) {
-                cout.unsetf(ios::fixed);
-                cout << "\t" << step << "\t" << th << "\t" << x << "\t" << pval << "\t" << se << "\t" << nscales-2 << "\t" << d << "\t" << c << "\t" << z << "\t" << ze << "\t" << rss << endl;
-            }
-            
-            if(df < 0 && idf0 < 0) { failed = true; break;} /* degenerated */
-            
-            if ((df < 0) || (idf0 >= 0 && (z-z0)*(x-thp) > 0.0 && fabs(z-z0)>0.1*ze0)) {
-                if (verbose_mode >= VB_MED)
-                    cout << "   non-monotone" << endl;
-                th=x;
-                xn=0.5*x+0.5*thp;
-                continue;
-            }
-            if(idf0 >= 0 && (fabs(z-z0)<0.01*ze0)) {
-                if(fabs(th)<1e-10) 
-                    xn=th; 
-                else th=x;
-            } else 
-                xn=0.5*th+0.5*x;
-            info[tid].au_pvalue = pval;
-            thp=x; 
-            z0=z;
-            ze0=ze;
-            idf0 = nscales-2;
-            if(fabs(x-th)<1e-10) break;
+            if (pass == 1)
+                for (i = 0; i < nchunk; i++)
+                    computeAUPValue(treelhs + i*nscales*nboot, nboot, first + i, info[first + i]);
         }
-        
-        if (failed && verbose_mode >= VB_MED)
-            cout << "   degenerated" << endl;
-        
-        if (step == max_step) {
-            if (verbose_mode >= VB_MED)
-                cout << "   non-convergence" << endl; 
-            failed = true;
+        if (pass == 0) {
+            cout << getRealTime() - start_time << " seconds" << endl;
+            cout << "TreeID\tAU\tRSS\td\tc" << endl;
         }
-        
-        double pchi2 = (failed) ? 0.0 : computePValueChiSquare(rss, df);
-        cout << tid+1 << "\t" << info[tid].au_pvalue << "\t" << rss << "\t" << d << "\t" << c;
-        
-        // warning if p-value of chi-square < 0.01 (rss too high)
-        if (pchi2 < 0.01) 
-            cout << " !!!";
-        cout << endl;
     }
-    
-    delete [] this_bp;
-    delete [] w;
-    delete [] cc;
-//    delete [] bp;
+    in.close();
+
+    samples.clear();
+    delete [] treelhs;
+    aligned_free(pattern_lhs);
+    delete [] max_tid;
+    delete [] second_max_lh;
+    delete [] max_lh;
 }
 
 
@@ -2572,7 +3230,7 @@ void evaluateTrees(Params &params, IQTree *tree, vector<TreeInfo> &info, IntVect
 
 	double time_start = getRealTime();
 
-	int *boot_samples = NULL;
+	BootSampleMatrix boot_samples;
 	size_t boot;
 	//double *saved_tree_lhs = NULL;
 	double *tree_lhs = NULL; // RELL score matrix of size #trees x #replicates
@@ -2583,9 +3241,17 @@ void evaluateTrees(Params &params, IQTree *tree, vector<TreeInfo> &info, IntVect
 	double *lhdiff_weights = NULL;
 	size_t nptn = tree->getAlnNPattern();
     size_t maxnptn = get_safe_upper_limit(nptn);
+    // streaming AU test: pattern log-likelihoods of the trees are written to a temporary file
+    bool au_stream = params.do_au_test && params.topotest_mem > 0;
+    string ptnlh_file = string(params.out_prefix) + ".ptnlh.tmp";
+    ofstream ptnlh_out;
+    if (au_stream && params.do_weighted_test) {
+        outWarning("Streaming AU test (-zmem) is not supported with weighted tests (-zw), keeping all trees in RAM");
+        au_stream = false;
+    }
     
 	if (params.topotest_replicates && ntrees > 1) {
-		size_t mem_size = (size_t)params.topotest_replicates*nptn*sizeof(int) +
+		size_t mem_size = (size_t)params.topotest_replicates*nptn*sizeof(unsigned char) +
 				ntrees*params.topotest_replicates*sizeof(double) +
 				(nptn + ntrees*3 + params.topotest_replicates*2)*sizeof(double) +
 				ntrees*sizeof(TreeInfo) +
@@ -2594,35 +3260,27 @@ void evaluateTrees(Params &params, IQTree *tree, vector<TreeInfo> &info, IntVect
 		if (mem_size > getMemorySize()-100000)
 			outWarning("The required memory does not fit in RAM!");
 		cout << "Creating " << params.topotest_replicates << " bootstrap replicates..." << endl;
-		if (!(boot_samples = new int [params.topotest_replicates*nptn]))
-			outError(ERR_NO_MEMORY);
-#ifdef _OPENMP
-        #pragma omp parallel private(boot) if(nptn > 10000)
-        {
-        int *rstream;
-        init_random(params.ran_seed + omp_get_thread_num(), false, &rstream);
-        #pragma omp for schedule(static)
-#else
-        int *rstream = randstream;
-#endif
-		for (boot = 0; boot < params.topotest_replicates; boot++)
-			tree->aln->createBootstrapAlignment(boot_samples + (boot*nptn), params.bootstrap_spec, rstream);
-#ifdef _OPENMP
-        finish_random(rstream);
-        }
-#endif
+		boot_samples.init(params.topotest_replicates, nptn);
+		tree->aln->createBootstrapAlignments(boot_samples, params.bootstrap_spec, params.ran_seed);
         cout << "done" << endl;
 		//if (!(saved_tree_lhs = new double [ntrees * params.topotest_replicates]))
 		//	outError(ERR_NO_MEMORY);
 		if (!(tree_lhs = new double [ntrees * params.topotest_replicates]))
 			outError(ERR_NO_MEMORY);
-		if (params.do_weighted_test || params.do_au_test) {
+		if (params.do_weighted_test) {
 			if (!(lhdiff_weights = new double [ntrees * ntrees]))
 				outError(ERR_NO_MEMORY);
+		}
+		if (params.do_weighted_test || (params.do_au_test && !au_stream)) {
             pattern_lhs = aligned_alloc<double>(ntrees*maxnptn);
 //			if (!(pattern_lhs = new double[ntrees* nptn]))
 //				outError(ERR_NO_MEMORY);
 		}
+		if (au_stream) {
+			ptnlh_out.open(ptnlh_file.c_str(), ios::out | ios::binary | ios::trunc);
+			if (!ptnlh_out.is_open())
+				outError("Cannot write to file ", ptnlh_file);
+		}
         pattern_lh = aligned_alloc<double>(maxnptn);
 //		if (!(pattern_lh = new double[nptn]))
 //			outError(ERR_NO_MEMORY);
@@ -2679,8 +3337,10 @@ void evaluateTrees(Params &params, IQTree *tree, vector<TreeInfo> &info, IntVect
 			double curScore = tree->getCurScore();
             memset(pattern_lh, 0, maxnptn*sizeof(double));
 			tree->computePatternLikelihood(pattern_lh, &curScore);
-			if (params.do_weighted_test || params.do_au_test)
+			if (pattern_lhs)
 				memcpy(pattern_lhs + tid*maxnptn, pattern_lh, maxnptn*sizeof(double));
+			if (au_stream)
+				ptnlh_out.write((char*)pattern_lh, maxnptn*sizeof(double));
 		}
 		if (params.print_site_lh) {
 			string tree_name = "Tree" + convertIntToString(tree_index+1);
@@ -2699,17 +3359,17 @@ void evaluateTrees(Params &params, IQTree *tree, vector<TreeInfo> &info, IntVect
 		// now compute RELL scores
 		orig_tree_lh[tid] = tree->getCurScore();
 		double *tree_lhs_offset = tree_lhs + (tid*params.topotest_replicates);
-		for (boot = 0; boot < params.topotest_replicates; boot++) {
-			double lh = 0.0;
-			int *this_boot_sample = boot_samples + (boot*nptn);
-			for (size_t ptn = 0; ptn < nptn; ptn++)
-				lh += pattern_lh[ptn] * this_boot_sample[ptn];
-			tree_lhs_offset[boot] = lh;
-		}
+		for (boot = 0; boot < params.topotest_replicates; boot++)
+			tree_lhs_offset[boot] = boot_samples.dotProduct(boot, pattern_lh);
 		tid++;
 	}
 
 	assert(tid == ntrees);
+	if (ptnlh_out.is_open()) {
+		ptnlh_out.close();
+		if (ptnlh_out.fail())
+			outError("Cannot write to file ", ptnlh_file);
+	}
 
 	if (params.topotest_replicates && ntrees > 1) {
 		double *tree_probs = new double[ntrees];
@@ -2920,7 +3580,11 @@ void evaluateTrees(Params &params, IQTree *tree, vector<TreeInfo> &info, IntVect
 
         if (params.do_au_test) {
             cout << "Performing approximately unbiased (AU) test..." << endl;
-            performAUTest(params, tree, pattern_lhs, info);
+            if (au_stream) {
+                performAUTestStream(params, tree, ptnlh_file, info);
+                remove(ptnlh_file.c_str());
+            } else
+                performAUTest(params, tree, pattern_lhs, info);
         }
 
 		delete [] tree_ranks;
@@ -2941,8 +3605,7 @@ void evaluateTrees(Params &params, IQTree *tree, vector<TreeInfo> &info, IntVect
 		delete [] tree_lhs;
 	//if (saved_tree_lhs)
 	//	delete [] saved_tree_lhs;
-	if (boot_samples)
-		delete [] boot_samples;
+	boot_samples.clear();
 
 	if (params.print_tree_lh) {
 		scoreout.close();
@@ -24,6 +24,7 @@ struct ModelInfo {
 	double AIC_score, AICc_score, BIC_score;    // scores
 	double AIC_weight, AICc_weight, BIC_weight; // weights
 	bool AIC_conf, AICc_conf, BIC_conf;         // in confidence set?
+    double IC_estimate; // -mprune: heuristic estimate of the criterion score of a pruned model, 0.0 if fully optimized
 };
 
 
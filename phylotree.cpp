@@ -11,9 +11,10 @@
 //
 
 #include "phylotree.h"
-#include "bionj.h"
+#include "fastbionj.h"
 //#include "rateheterogeneity.h"
 #include "alignmentpairwise.h"
+#include "distengine.h"
 #include <algorithm>
 #include <limits>
 #include "timeutil.h"
@@ -61,6 +62,7 @@ void PhyloTree::init() {
     model = NULL;
     site_rate = NULL;
     optimize_by_newton = true;
+    worker_threads = 0;
     central_partial_lh = NULL;
     nni_partial_lh = NULL;
     tip_partial_lh = NULL;
@@ -89,6 +91,8 @@ void PhyloTree::init() {
     subTreeDistComputed = false;
     dist_matrix = NULL;
     var_matrix = NULL;
+    lk_vector_size = 1;
+    partial_lh_float = false;
     setLikelihoodKernel(LK_EIGEN_SSE);  // FOR TUNG: you forgot to initialize this variable!
     save_all_trees = 0;
     nodeBranchDists = NULL;
@@ -110,6 +114,9 @@ void PhyloTree::init() {
     current_scaling = 1.0;
     is_opt_scaling = false;
     num_partial_lh_computations = 0;
+    num_partial_lh_invalidated = 0;
+    site_repeats_clock = 0;
+    ptn_invar_version = 0;
 }
 
 PhyloTree::PhyloTree(Alignment *aln) : MTree(), CheckpointFactory() {
@@ -312,6 +319,26 @@ void PhyloTree::copyPhyloTree(PhyloTree *tree) {
     setAlignment(tree->aln);
 }
 
+void PhyloTree::copyTreeStructure(PhyloTree *tree) {
+    if (root) freeNode();
+    NodeVector nodes, new_nodes(tree->nodeNum, NULL);
+    NodeVector::iterator it;
+    nodes.push_back(tree->root);
+    tree->getAllNodesInSubtree(tree->root->neighbors[0]->node, tree->root, nodes);
+    for (it = nodes.begin(); it != nodes.end(); it++) {
+        assert((*it)->id >= 0 && (*it)->id < tree->nodeNum);
+        new_nodes[(*it)->id] = newNode((*it)->id, (*it)->name.c_str());
+    }
+    for (it = nodes.begin(); it != nodes.end(); it++)
+        for (NeighborVec::iterator nit = (*it)->neighbors.begin(); nit != (*it)->neighbors.end(); nit++)
+            new_nodes[(*it)->id]->addNeighbor(new_nodes[(*nit)->node->id], (*nit)->length, (*nit)->id);
+    leafNum = tree->leafNum;
+    nodeNum = tree->nodeNum;
+    branchNum = tree->branchNum;
+    rooted = tree->rooted;
+    root = new_nodes[tree->root->id];
+}
+
 void PhyloTree::setAlignment(Alignment *alignment) {
     aln = alignment;
     bool err = false;
@@ -468,7 +495,8 @@ void PhyloTree::setModel(ModelSubst *amodel) {
 
 void PhyloTree::setModelFactory(ModelFactory *model_fac) {
     model_factory = model_fac;
-    if (model_factory && (model_factory->model->isMixture() || model_factory->model->isSiteSpecificModel()))
+    if (model_factory && (model_factory->model->isMixture() || model_factory->model->isSiteSpecificModel()
+            || (params && params->lh_float)))
     	setLikelihoodKernel(sse);
 }
 
@@ -502,6 +530,63 @@ void PhyloTree::clearAllPartialLH(bool make_null) {
     tip_partial_lh_computed = false;
     // 2015-10-14: has to reset this pointer when read in
     current_it = current_it_back = NULL;
+    dirty_nodes1.clear();
+    dirty_nodes2.clear();
+}
+
+void PhyloTree::markDirtyBranch(PhyloNode *node1, PhyloNode *node2) {
+    dirty_nodes1.push_back(node1);
+    dirty_nodes2.push_back(node2);
+}
+
+void PhyloTree::markDirtyNNI(NNIMove &move) {
+    markDirtyBranch(move.node1, move.node2);
+    FOR_NEIGHBOR_IT(move.node1, move.node2, it)
+        markDirtyBranch(move.node1, (PhyloNode*)(*it)->node);
+    FOR_NEIGHBOR_IT(move.node2, move.node1, it)
+        markDirtyBranch(move.node2, (PhyloNode*)(*it)->node);
+}
+
+void PhyloTree::markDirtyBranchLengths(DoubleVector &lenvec, int startid, PhyloNode *node, PhyloNode *dad) {
+    if (!node) {
+        node = (PhyloNode*) root;
+        assert(!lenvec.empty());
+    }
+    FOR_NEIGHBOR_IT(node, dad, it){
+        if ((*it)->length != lenvec[(*it)->id + startid])
+            markDirtyBranch(node, (PhyloNode*)(*it)->node);
+        markDirtyBranchLengths(lenvec, startid, (PhyloNode*) (*it)->node, node);
+    }
+}
+
+/**
+    clear the partial likelihoods pointing towards node (except from dad) and further upwards,
+    stopping where an earlier call of the same round has been before
+*/
+static void clearDirtyPath(PhyloNode *node, PhyloNode *dad, set<PhyloNeighbor*> &cleared) {
+    FOR_NEIGHBOR_IT(node, dad, it) {
+        PhyloNeighbor *nei = (PhyloNeighbor*)(*it)->node->findNeighbor(node);
+        if (!cleared.insert(nei).second)
+            continue;
+        nei->clearPartialLh();
+        clearDirtyPath((PhyloNode*)(*it)->node, node, cleared);
+    }
+}
+
+size_t PhyloTree::clearDirtyPartialLh() {
+    set<PhyloNeighbor*> cleared;
+    for (int i = 0; i < dirty_nodes1.size(); i++) {
+        PhyloNode *node1 = (PhyloNode*)dirty_nodes1[i];
+        PhyloNode *node2 = (PhyloNode*)dirty_nodes2[i];
+        // a later NNI may have moved node2 away from node1, then clear everything around both
+        bool adjacent = node1->isNeighbor(node2);
+        clearDirtyPath(node1, adjacent ? node2 : NULL, cleared);
+        clearDirtyPath(node2, adjacent ? node1 : NULL, cleared);
+    }
+    dirty_nodes1.clear();
+    dirty_nodes2.clear();
+    num_partial_lh_invalidated += cleared.size();
+    return cleared.size();
 }
 
 void PhyloTree::computeAllPartialLh(PhyloNode *node, PhyloNode *dad) {
@@ -623,13 +708,14 @@ void PhyloTree::initializeAllPartialPars(int &index, PhyloNode *node, PhyloNode
     FOR_NEIGHBOR_IT(node, dad, it)initializeAllPartialPars(index, (PhyloNode*) (*it)->node, node);
 }
 
-#define SIMD_BITS 256
+// widest parsimony vector: Vec16ui (AVX-512)
+#define SIMD_BITS 512
 
 size_t PhyloTree::getBitsBlockSize() {
     // reserve the last entry for parsimony score
 //    return (aln->num_states * aln->size() + UINT_BITS - 1) / UINT_BITS + 1;
     size_t len = aln->getMaxNumStates() * ((max(aln->size(), (size_t)aln->num_informative_sites) + SIMD_BITS - 1) / UINT_BITS) + 4;
-    len = ((len+7)/8)*8;
+    len = ((len+15)/16)*16;
     return len;
 }
 
@@ -669,16 +755,18 @@ int PhyloTree::computeParsimony() {
 
 void PhyloTree::initializeAllPartialLh() {
     int index, indexlh;
+    if (partial_lh_float && !isBifurcating()) {
+        // e.g. a multifurcating user tree: go back to double precision
+        setLikelihoodKernel(sse);
+    }
     int numStates = model->num_states;
 	// Minh's question: why getAlnNSite() but not getAlnNPattern() ?
     //size_t mem_size = ((getAlnNSite() % 2) == 0) ? getAlnNSite() : (getAlnNSite() + 1);
     size_t nptn = getAlnNPattern() + numStates; // extra #numStates for ascertainment bias correction
 
     size_t mem_size;
-    if (instruction_set >= 7)
-    	mem_size = ((nptn +3)/4)*4;
-    else
-    	mem_size = ((nptn % 2) == 0) ? nptn : (nptn + 1);
+    // block size must be divisible by the SIMD vector size
+    mem_size = getSafeUpperLimit(nptn);
 
     size_t block_size = mem_size * numStates * site_rate->getNRate() * ((model_factory->fused_mix_rate)? 1 : model->getNMixtures());
     // make sure _pattern_lh size is divisible by 4 (e.g., 9->12, 14->16)
@@ -704,10 +792,14 @@ void PhyloTree::initializeAllPartialLh() {
     if (benchmark_mem) {
     	cout << "CPU time for initializeAllPartialLh: " << getCPUTime() - cpu_start_time << " sec" << endl;
     	cout << "Wall-clock time for initializeAllPartialLh: " << getRealTime() - wall_start_time << " sec" << endl;
+    	if (params->numa_first_touch)
+    		benchmarkPatternBlockBandwidth();
     }
     assert(index == (nodeNum - 1) * 2);
     if (sse == LK_EIGEN || sse == LK_EIGEN_SSE) {
-        if (params->lh_mem_save == LM_PER_NODE) {
+        if (!mem_slots.empty()) {
+            assert(indexlh == 0);
+        } else if (params->lh_mem_save == LM_PER_NODE) {
             assert(indexlh == nodeNum-leafNum);
         } else {
             assert(indexlh == (nodeNum-1)*2-leafNum);
@@ -718,6 +810,11 @@ void PhyloTree::initializeAllPartialLh() {
 
 }
 
+bool PhyloTree::isMemSaveSupported() {
+    return !params->partition_file && !model->isMixture() && !model->isSiteSpecificModel() &&
+            !params->upper_bound && !params->upper_bound_NNI && (sse == LK_EIGEN || sse == LK_EIGEN_SSE);
+}
+
 void PhyloTree::deleteAllPartialLh() {
 
 	if (central_partial_lh) {
@@ -750,6 +847,7 @@ void PhyloTree::deleteAllPartialLh() {
 	central_partial_lh = NULL;
 	central_scale_num = NULL;
 	central_partial_pars = NULL;
+	mem_slots.clear();
 
 	ptn_invar = NULL;
 	ptn_freq = NULL;
@@ -766,12 +864,8 @@ void PhyloTree::deleteAllPartialLh() {
 uint64_t PhyloTree::getMemoryRequired(size_t ncategory) {
 	size_t nptn = aln->getNPattern() + aln->num_states; // +num_states for ascertainment bias correction
 	uint64_t block_size;
-	if (instruction_set >= 7)
-		// block size must be divisible by 4
-		block_size = ((nptn+3)/4)*4;
-	else
-		// block size must be divisible by 2
-		block_size = ((nptn % 2) == 0) ? nptn : (nptn + 1);
+	// block size must be divisible by the SIMD vector size
+	block_size = getSafeUpperLimit(nptn);
     block_size = block_size * aln->num_states;
     if (site_rate)
     	block_size *= site_rate->getNRate();
@@ -779,13 +873,25 @@ uint64_t PhyloTree::getMemoryRequired(size_t ncategory) {
     	block_size *= ncategory;
     if (model && !model_factory->fused_mix_rate)
     	block_size *= model->getNMixtures();
-    uint64_t mem_size = ((uint64_t) leafNum*4) * block_size *sizeof(double) + 2 + (leafNum) * 4 * nptn * sizeof(UBYTE);
+    // -lhfloat is only an estimate here: it falls back to double for unsupported models
+    size_t lh_size = (params->lh_float && params->SSE == LK_EIGEN_SSE) ? sizeof(float) : sizeof(double);
+    uint64_t mem_size = ((uint64_t) leafNum*4) * block_size *lh_size + 2 + (leafNum) * 4 * nptn * sizeof(UBYTE);
     if (params->SSE == LK_EIGEN || params->SSE == LK_EIGEN_SSE) {
-    	mem_size -= ((uint64_t)leafNum) * ((uint64_t)block_size*sizeof(double) + nptn * sizeof(UBYTE));
+    	mem_size -= ((uint64_t)leafNum) * ((uint64_t)block_size*lh_size + nptn * sizeof(UBYTE));
         if (params->lh_mem_save == LM_PER_NODE) {
-            mem_size -= ((uint64_t)leafNum*2 - 4) * ((uint64_t)block_size*sizeof(double) + nptn * sizeof(UBYTE));
+            mem_size -= ((uint64_t)leafNum*2 - 4) * ((uint64_t)block_size*lh_size + nptn * sizeof(UBYTE));
         }
     }
+    uint64_t nni_mem_size = 0;
+#ifdef _OPENMP
+    // -pnni: the partial likelihoods of one NNI and of the four subtrees around it per thread
+    if (params->parallel_nni)
+        nni_mem_size = (uint64_t)omp_get_max_threads() * ((params->nni5 ? 6 : 2) + 4) * (block_size*lh_size + nptn * sizeof(UBYTE));
+#endif
+    // -mem limits the partial likelihoods of the tree and of the NNI workers together
+    if (params->lh_mem_save == LM_MEM_SAVE && model && isMemSaveSupported())
+        mem_size = min(mem_size, (params->lh_mem_budget > nni_mem_size) ? params->lh_mem_budget - nni_mem_size : 0);
+    mem_size += nni_mem_size;
 	uint64_t tip_partial_lh_size;
     if (model)
         tip_partial_lh_size = aln->num_states * (aln->STATE_UNKNOWN+1) * model->getNMixtures() * sizeof(double);
@@ -802,19 +908,16 @@ uint64_t PhyloTree::getMemoryRequired(size_t ncategory) {
 void PhyloTree::getMemoryRequired(uint64_t &partial_lh_entries, uint64_t &scale_num_entries, uint64_t &partial_pars_entries) {
 	size_t nptn = aln->getNPattern() + aln->num_states; // +num_states for ascertainment bias correction
 	uint64_t block_size;
-	if (instruction_set >= 7)
-		// block size must be divisible by 4
-		block_size = ((nptn+3)/4)*4;
-	else
-		// block size must be divisible by 2
-		block_size = ((nptn % 2) == 0) ? nptn : (nptn + 1);
+	// PhyloSuperTreePlen lays out the vectors of all partitions in one buffer:
+	// pad to the widest vector of the CPU to keep every partition aligned
+	block_size = get_safe_upper_limit(nptn);
     block_size = block_size * aln->num_states;
     if (site_rate)
     	block_size *= site_rate->getNRate();
     if (model && !model_factory->fused_mix_rate)
     	block_size *= model->getNMixtures();
 
-	uint64_t tip_partial_lh_size = aln->num_states * (aln->STATE_UNKNOWN+1) * model->getNMixtures();
+	uint64_t tip_partial_lh_size = get_safe_upper_limit(aln->num_states * (aln->STATE_UNKNOWN+1) * model->getNMixtures());
     if (sse == LK_EIGEN || sse == LK_EIGEN_SSE) {
         if (params->lh_mem_save == LM_PER_NODE)
             partial_lh_entries = ((uint64_t)leafNum - 2) * (uint64_t) block_size + 4 + tip_partial_lh_size;
@@ -840,17 +943,15 @@ void PhyloTree::initializeAllPartialLh(int &index, int &indexlh, PhyloNode *node
     size_t pars_block_size = getBitsBlockSize();
     size_t nptn = aln->size()+aln->num_states; // +num_states for ascertainment bias correction
     size_t block_size;
-    if (instruction_set >= 7)
-    	// block size must be divisible by 4
-    	nptn = ((nptn+3)/4)*4;
-	else
-		// block size must be divisible by 2
-		nptn = ((nptn % 2) == 0) ? nptn : (nptn + 1);
+    // block size must be divisible by the SIMD vector size
+    nptn = getSafeUpperLimit(nptn);
 
     size_t scale_block_size = nptn;
 //    size_t tip_block_size = nptn * model->num_states;
 
     block_size = nptn * model->num_states * site_rate->getNRate() * ((model_factory->fused_mix_rate)? 1 : model->getNMixtures());
+    if (partial_lh_float)
+        block_size /= 2; // measured in doubles, nptn is even
     if (!node) {
         node = (PhyloNode*) root;
         // allocate the big central partial likelihoods memory
@@ -862,13 +963,64 @@ void PhyloTree::initializeAllPartialLh(int &index, int &indexlh, PhyloNode *node
             size_t IT_NUM = (params->nni5) ? 6 : 2;
             nni_partial_lh = aligned_alloc<double>(IT_NUM*block_size);
             nni_scale_num = aligned_alloc<UBYTE>(IT_NUM*scale_block_size);
+            if (params->numa_first_touch) {
+                firstTouchPatternBlocks((char*)nni_partial_lh, IT_NUM, block_size * sizeof(double), block_size * sizeof(double) / nptn);
+                firstTouchPatternBlocks((char*)nni_scale_num, IT_NUM, scale_block_size, 1);
+            }
         }
 
+        if (mem_slots.size() > mem_slots.getInitSize()) {
+            // the pool grew beyond central_partial_lh: reallocate it with all slots
+            aligned_free(central_partial_lh);
+            central_partial_lh = NULL;
+            aligned_free(central_scale_num);
+            central_scale_num = NULL;
+        }
+        bool mem_save_supported = (params->lh_mem_save == LM_MEM_SAVE && isMemSaveSupported());
+        if (!mem_slots.empty() && !mem_save_supported) {
+            // e.g. a mixture model during model testing: keep all vectors in memory again
+            mem_slots.clear();
+            aligned_free(central_partial_lh);
+            central_partial_lh = NULL;
+            if (central_scale_num)
+                aligned_free(central_scale_num);
+            central_scale_num = NULL;
+        }
+        // a tree keeps its memory slots until central_partial_lh is deleted
+        bool mem_save = (mem_save_supported && !central_partial_lh) || !mem_slots.empty();
+        size_t nslots = mem_slots.getInitSize();
+        if (mem_save && !central_partial_lh) {
+            // as many partial likelihood vectors as fit into the memory budget
+            size_t max_slots = (nodeNum - 1)*2 - leafNum;
+            size_t min_slots = computeMemSlotsNeeded() + 2; // some room for topology changes
+            double mem_budget = params->lh_mem_budget;
+#ifdef _OPENMP
+            // -pnni: the buffers of the NNI workers count against the memory limit
+            if (params->parallel_nni)
+                mem_budget -= (double)omp_get_max_threads() * ((params->nni5 ? 6 : 2) + 4) *
+                        (block_size * sizeof(double) + scale_block_size * sizeof(UBYTE));
+#endif
+            nslots = max((size_t)(max(mem_budget, 0.0) / (block_size * sizeof(double) + scale_block_size * sizeof(UBYTE))),
+                    mem_slots.size());
+            if (nslots < min_slots) {
+                // warn only once, the memory is reallocated e.g. when switching -lhfloat off and on
+                if (mem_slots.misses == 0)
+                    outWarning("Memory limit (-mem) is too small, increased to " + convertIntToString(min_slots) + " partial likelihood vectors");
+                nslots = min_slots;
+            }
+            nslots = min(nslots, max_slots);
+            if (verbose_mode >= VB_MED)
+                cout << "Keeping " << nslots << " of " << max_slots << " partial likelihood vectors in memory" << endl;
+            // scale num vectors are allocated per slot as well
+            if (central_scale_num)
+                aligned_free(central_scale_num);
+            central_scale_num = NULL;
+        }
 
         if (!central_partial_lh) {
         	uint64_t tip_partial_lh_size = aln->num_states * (aln->STATE_UNKNOWN+1) * model->getNMixtures();
             if (model->isSiteSpecificModel() && (sse == LK_EIGEN || sse == LK_EIGEN_SSE))
-                tip_partial_lh_size = get_safe_upper_limit(aln->size()) * model->num_states * leafNum;
+                tip_partial_lh_size = getSafeUpperLimit(aln->size()) * model->num_states * leafNum;
             uint64_t mem_size = ((uint64_t)leafNum * 4 - 6) * (uint64_t) block_size + 2 + tip_partial_lh_size;
             if (sse == LK_EIGEN || sse == LK_EIGEN_SSE) {
                 if (params->lh_mem_save == LM_PER_NODE) {
@@ -877,6 +1029,8 @@ void PhyloTree::initializeAllPartialLh(int &index, int &indexlh, PhyloNode *node
                     mem_size -= (uint64_t)leafNum * (uint64_t)block_size;
                 }
             }
+            if (mem_save)
+                mem_size = (uint64_t)nslots * block_size + 2 + tip_partial_lh_size;
             if (verbose_mode >= VB_MED)
                 cout << "Allocating " << mem_size * sizeof(double) << " bytes for partial likelihood vectors" << endl;
             try {
@@ -886,10 +1040,15 @@ void PhyloTree::initializeAllPartialLh(int &index, int &indexlh, PhyloNode *node
             }
             if (!central_partial_lh)
                 outError("Not enough memory for partial likelihood vectors");
+            if (params->numa_first_touch)
+                firstTouchPatternBlocks((char*)central_partial_lh, (mem_size - tip_partial_lh_size) / block_size,
+                        block_size * sizeof(double), block_size * sizeof(double) / nptn);
         }
 
         // now always assign tip_partial_lh
-        if (sse == LK_EIGEN || sse == LK_EIGEN_SSE) {
+        if (mem_save) {
+            tip_partial_lh = central_partial_lh + (nslots*block_size);
+        } else if (sse == LK_EIGEN || sse == LK_EIGEN_SSE) {
             if (params->lh_mem_save == LM_PER_NODE) {
                 tip_partial_lh = central_partial_lh + ((nodeNum - leafNum)*block_size);
             } else {
@@ -907,6 +1066,8 @@ void PhyloTree::initializeAllPartialLh(int &index, int &indexlh, PhyloNode *node
                     mem_size -= (uint64_t)leafNum * (uint64_t) scale_block_size;
                 }
             }
+            if (mem_save)
+                mem_size = (uint64_t)nslots * scale_block_size;
             if (verbose_mode >= VB_MED)
                 cout << "Allocating " << mem_size * sizeof(UBYTE) << " bytes for scale num vectors" << endl;
             try {
@@ -916,6 +1077,8 @@ void PhyloTree::initializeAllPartialLh(int &index, int &indexlh, PhyloNode *node
             }
             if (!central_scale_num)
                 outError("Not enough memory for scale num vectors");
+            if (params->numa_first_touch)
+                firstTouchPatternBlocks((char*)central_scale_num, mem_size / scale_block_size, scale_block_size, 1);
         }
 
         if (!central_partial_pars) {
@@ -930,6 +1093,8 @@ void PhyloTree::initializeAllPartialLh(int &index, int &indexlh, PhyloNode *node
             if (!central_partial_pars)
                 outError("Not enough memory for partial parsimony vectors");
         }
+        if (mem_save)
+            mem_slots.init(central_partial_lh, central_scale_num, nslots, block_size, scale_block_size);
         index = 0;
         indexlh = 0;
     }
@@ -946,7 +1111,13 @@ void PhyloTree::initializeAllPartialLh(int &index, int &indexlh, PhyloNode *node
         assert(index < nodeNum * 2 - 1);
         
         // now initialize partial_lh and scale_num
-        if (params->lh_mem_save == LM_PER_NODE && (sse == LK_EIGEN || sse == LK_EIGEN_SSE)) {
+        if (!mem_slots.empty()) {
+            // partial_lh will be assigned on demand from mem_slots
+            nei->partial_lh = NULL;
+            nei->scale_num = NULL;
+            nei2->partial_lh = NULL;
+            nei2->scale_num = NULL;
+        } else if (params->lh_mem_save == LM_PER_NODE && (sse == LK_EIGEN || sse == LK_EIGEN_SSE)) {
             if (!node->isLeaf()) { // only allocate memory to internal node
                 nei->partial_lh = NULL; // do not allocate memory for tip, use tip_partial_lh instead
                 nei->scale_num = NULL;
@@ -991,31 +1162,292 @@ void PhyloTree::initializeAllPartialLh(int &index, int &indexlh, PhyloNode *node
     FOR_NEIGHBOR_IT(node, dad, it) initializeAllPartialLh(index, indexlh, (PhyloNode*) (*it)->node, node);
 }
 
+int PhyloTree::computeMemSlotsNeeded() {
+    NodeVector nodes1, nodes2;
+    getBranches(nodes1, nodes2);
+    map<PhyloNeighbor*, int> needed;
+    int max_needed = 1;
+    for (int i = 0; i < nodes1.size(); i++) {
+        PhyloNeighbor *nei1 = (PhyloNeighbor*)nodes2[i]->findNeighbor(nodes1[i]);
+        PhyloNeighbor *nei2 = (PhyloNeighbor*)nodes1[i]->findNeighbor(nodes2[i]);
+        int need1 = computeMemSlotsNeeded(nei1, (PhyloNode*)nodes2[i], needed);
+        int need2 = computeMemSlotsNeeded(nei2, (PhyloNode*)nodes1[i], needed);
+        // the likelihood kernels lock the first vector while computing the second one
+        int lock1 = nodes1[i]->isLeaf() ? 0 : 1;
+        int lock2 = nodes2[i]->isLeaf() ? 0 : 1;
+        max_needed = max(max_needed, max(max(need1, lock1 + need2), max(need2, lock2 + need1)));
+    }
+    return max_needed;
+}
+
+int PhyloTree::computeMemSlotsNeeded(PhyloNeighbor *dad_branch, PhyloNode *dad, map<PhyloNeighbor*, int> &needed) {
+    Node *node = dad_branch->node;
+    if (node->isLeaf())
+        return 0;
+    map<PhyloNeighbor*, int>::iterator it_needed = needed.find(dad_branch);
+    if (it_needed != needed.end())
+        return it_needed->second;
+    // children are computed one after another, each keeps its vector locked afterwards
+    int num_internal = 0, max_child = 0;
+    FOR_NEIGHBOR_IT(node, dad, it) {
+        if ((*it)->node->isLeaf())
+            continue;
+        num_internal++;
+        max_child = max(max_child, computeMemSlotsNeeded((PhyloNeighbor*)(*it), (PhyloNode*)node, needed));
+    }
+    // worst order: the most demanding child last, plus one vector for dad_branch itself
+    int need = max(max_child + num_internal - 1, num_internal + 1);
+    needed[dad_branch] = need;
+    return need;
+}
+
+void PhyloTree::computeSiteRepeats(PhyloNeighbor *dad_branch, PhyloNode *dad) {
+    PhyloNode *node = (PhyloNode*)dad_branch->node;
+    if (node->isLeaf())
+        return;
+    if (!dad_branch->site_repeats)
+        dad_branch->site_repeats = new SiteRepeats;
+    SiteRepeats *repeats = dad_branch->site_repeats;
+
+    // the classes only depend on the subtree topology and on which patterns are scaled,
+    // thus stay valid as long as the children and ptn_invar_version do
+    bool valid = (repeats->version > 0 && repeats->child.size() == node->degree()-1 &&
+            repeats->invar_version == ptn_invar_version);
+    int i = 0;
+    FOR_NEIGHBOR_IT(node, dad, it) {
+        PhyloNeighbor *nei = (PhyloNeighbor*)(*it);
+        // a child whose partial likelihoods were not recomputed may still have outdated classes
+        if (nei->site_repeats && nei->site_repeats->invar_version != ptn_invar_version)
+            computeSiteRepeats(nei, node);
+        uint64_t version = nei->site_repeats ? nei->site_repeats->version : 0;
+        if (valid && (repeats->child[i] != nei || repeats->child_version[i] != version))
+            valid = false;
+        i++;
+    }
+    if (valid)
+        return;
+
+    size_t nptn = aln->size(), ptn;
+    repeats->invar_version = ptn_invar_version;
+    repeats->child.clear();
+    repeats->child_version.clear();
+    vector<int> ptn_class, new_class(nptn), order(nptn), first, pair_class;
+    size_t nclass = 1; // all patterns in one class before the first child
+    // keeping the classes only pays off if they save at least 1/nstates of the patterns
+    size_t max_nclass = nptn - nptn / aln->num_states;
+    bool distinct = false;
+    FOR_NEIGHBOR_IT(node, dad, it) {
+        PhyloNeighbor *nei = (PhyloNeighbor*)(*it);
+        repeats->child.push_back(nei);
+        repeats->child_version.push_back(nei->site_repeats ? nei->site_repeats->version : 0);
+        if (distinct)
+            continue;
+        size_t nchild_class;
+        int *child_class = NULL;
+        if (nei->node->isLeaf()) {
+            // patterns with ptn_invar != 0 form their own classes, as the kernels never scale them
+            nchild_class = (aln->STATE_UNKNOWN+1) * 2;
+        } else if (nei->site_repeats && !nei->site_repeats->ptn_class.empty()) {
+            child_class = &nei->site_repeats->ptn_class[0];
+            nchild_class = nei->site_repeats->class_ptn.size();
+        } else {
+            // the subtree of nei has (almost) no repeats, neither does this one
+            distinct = true;
+            continue;
+        }
+        // bucket the patterns by their class so far, then number the classes of nei within each bucket
+        first.assign(nclass+1, 0);
+        for (ptn = 0; ptn < nptn; ptn++)
+            first[(ptn_class.empty() ? 0 : ptn_class[ptn]) + 1]++;
+        for (size_t c = 0; c < nclass; c++)
+            first[c+1] += first[c];
+        for (ptn = 0; ptn < nptn; ptn++)
+            order[first[ptn_class.empty() ? 0 : ptn_class[ptn]]++] = ptn;
+        pair_class.assign(nchild_class, -1);
+        int new_nclass = 0;
+        size_t start = 0, end;
+        for (size_t c = 0; c < nclass; start = end, c++) {
+            end = first[c];
+            for (size_t i = start; i < end; i++) {
+                ptn = order[i];
+                int &id = pair_class[child_class ? child_class[ptn] :
+                    (int)aln->at(ptn)[nei->node->id] * 2 + ((ptn_invar[ptn] == 0.0) ? 0 : 1)];
+                if (id < 0)
+                    id = new_nclass++;
+                new_class[ptn] = id;
+            }
+            for (size_t i = start; i < end; i++) {
+                ptn = order[i];
+                pair_class[child_class ? child_class[ptn] :
+                    (int)aln->at(ptn)[nei->node->id] * 2 + ((ptn_invar[ptn] == 0.0) ? 0 : 1)] = -1;
+            }
+        }
+        ptn_class.swap(new_class);
+        new_class.resize(nptn);
+        nclass = new_nclass;
+        if (nclass > max_nclass)
+            distinct = true;
+    }
+    if (distinct)
+        ptn_class.clear();
+
+    // parents only need to be updated if the classes really changed
+    if (repeats->version > 0 && ptn_class == repeats->ptn_class)
+        return;
+    repeats->version = ++site_repeats_clock;
+    vector<int>().swap(repeats->ptn_class);
+    vector<int>().swap(repeats->class_ptn);
+    if (distinct)
+        return;
+    repeats->ptn_class.swap(ptn_class);
+    repeats->class_ptn.resize(nclass, -1);
+    for (ptn = 0; ptn < nptn; ptn++)
+        if (repeats->class_ptn[repeats->ptn_class[ptn]] < 0)
+            repeats->class_ptn[repeats->ptn_class[ptn]] = ptn;
+}
+
 double *PhyloTree::newPartialLh() {
-    double *ret = aligned_alloc<double>((aln->size()+aln->num_states+3) * aln->num_states * site_rate->getNRate() *
+    double *ret = aligned_alloc<double>(getSafeUpperLimit(aln->size()+aln->num_states) * aln->num_states * site_rate->getNRate() *
                              ((model_factory->fused_mix_rate)? 1 : model->getNMixtures()));
     return ret;
 }
 
+size_t PhyloTree::getKernelVectorSize() {
+    // same choice as setLikelihoodKernelAVX512() and setLikelihoodKernelAVX()
+    int nstates = aln->num_states;
+    if (instruction_set >= 9 && (nstates == 8 || nstates == 16 || nstates == 24 || nstates == 32 || nstates == 64))
+        return 8;
+    if (instruction_set >= 7 && nstates % 4 == 0 && (nstates <= 32 || nstates == 64))
+        return 4;
+    // Vec2d of setLikelihoodKernelSSE(), also for the Eigen kernels, as -lhfloat needs an even number of patterns
+    return 2;
+}
+
 size_t PhyloTree::getPartialLhBytes() {
     size_t nptn = aln->size()+aln->num_states; // +num_states for ascertainment bias correction
     size_t block_size;
-    if (instruction_set >= 7)
-    	// block size must be divisible by 4
-    	block_size = ((nptn+3)/4)*4;
-	else
-		// block size must be divisible by 2
-		block_size = ((nptn % 2) == 0) ? nptn : (nptn + 1);
+    // block size must be divisible by the SIMD vector size
+    block_size = getSafeUpperLimit(nptn);
 
     block_size = block_size * model->num_states * site_rate->getNRate() * ((model_factory->fused_mix_rate)? 1 : model->getNMixtures());
 
-	return block_size * sizeof(double);
+	return block_size * (partial_lh_float ? sizeof(float) : sizeof(double));
+}
+
+bool PhyloTree::isPartialLhFloatSupported() {
+    // mixture and site-specific models keep their own kernels
+    if (!model_factory || model_factory->model->isMixture() || model_factory->model->isSiteSpecificModel())
+        return false;
+    // ascertainment bias correction rescales unobserved patterns by SCALING_THRESHOLD
+    if (!model_factory->unobserved_ptns.empty())
+        return false;
+    // joint/proportional partition models lay out all partitions in one memory block
+    if (params->partition_file && params->partition_type)
+        return false;
+    // upper bounds read partial likelihoods directly
+    if (params->upper_bound || params->upper_bound_NNI)
+        return false;
+    // multifurcating nodes are computed by the non-SIMD kernel
+    if (root && !isBifurcating())
+        return false;
+    return true;
 }
 
 size_t PhyloTree::getScaleNumBytes() {
 	return (aln->size()+aln->num_states) * sizeof(UBYTE);
 }
 
+int PhyloTree::computePatternBlocks(size_t ptn_work) {
+    size_t nptn = aln->size();
+    size_t nthreads = 1;
+#ifdef _OPENMP
+    // nested parallelism is disabled, e.g. when partitions are computed in parallel,
+    // except for the trees of search workers (-sw)
+    if (worker_threads > 0)
+        nthreads = worker_threads;
+    else if (!omp_in_parallel())
+        nthreads = omp_get_max_threads();
+#endif
+    size_t nblocks = min(nthreads, max((size_t)1, nptn * ptn_work / MIN_PATTERN_BLOCK_WORK));
+    if (ptn_limits.size() == nblocks+1 && ptn_limits.back() == nptn)
+        return nblocks;
+    // block boundaries must be divisible by the SIMD vector size
+    size_t block_size = getSafeUpperLimit((nptn + nblocks - 1) / nblocks);
+    ptn_limits.resize(nblocks+1);
+    for (size_t b = 0; b <= nblocks; b++)
+        ptn_limits[b] = min(b * block_size, nptn);
+    return nblocks;
+}
+
+void PhyloTree::firstTouchPatternBlocks(char *mem, size_t nvec, size_t vec_bytes, size_t ptn_bytes) {
+    int nblocks = computePatternBlocks(model->num_states * model->num_states * site_rate->getNRate());
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1) num_threads(nblocks) if(nblocks > 1)
+#endif
+    for (int b = 0; b < nblocks; b++) {
+        // the last block also owns the unobserved patterns and the padding
+        size_t start = ptn_limits[b] * ptn_bytes;
+        size_t end = (b+1 < nblocks) ? ptn_limits[b+1] * ptn_bytes : vec_bytes;
+        for (size_t vec = 0; vec < nvec; vec++)
+            memset(mem + vec*vec_bytes + start, 0, end - start);
+    }
+}
+
+void PhyloTree::benchmarkPatternBlockBandwidth() {
+    int nblocks = computePatternBlocks(model->num_states * model->num_states * site_rate->getNRate());
+    if (nblocks < 2) {
+        cout << "Pattern blocks: 1, local vs remote memory bandwidth not measured" << endl;
+        return;
+    }
+#if defined(_OPENMP) && _OPENMP >= 201307
+    // unbound threads may migrate away from the memory they touched first, then both figures are meaningless
+    if (omp_get_proc_bind() == omp_proc_bind_false) {
+        cout << "Threads are not bound to cores (e.g. OMP_PROC_BIND=true OMP_PLACES=cores), "
+             << "local vs remote memory bandwidth not measured" << endl;
+        return;
+    }
+#else
+    cout << "Thread binding cannot be checked, the bandwidth figures below assume bound threads" << endl;
+#endif
+    size_t nptn = getSafeUpperLimit(aln->size()+aln->num_states);
+    size_t vec_bytes = getPartialLhBytes();
+    size_t ptn_bytes = vec_bytes / nptn;
+    size_t nvec = (params->lh_mem_save == LM_PER_NODE) ? nodeNum - leafNum : (nodeNum-1)*2 - leafNum;
+    if (!mem_slots.empty())
+        nvec = mem_slots.getInitSize();
+    const int NUM_ROUNDS = 5;
+    double checksum = 0.0;
+    // threads are placed in order, thus those of the other half usually run on another socket
+    int remote_shift = nblocks / 2;
+    for (int shift = 0; shift <= remote_shift; shift += remote_shift) {
+        double start_time = getRealTime();
+        size_t nbytes = 0;
+        for (int round = 0; round < NUM_ROUNDS; round++) {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1) num_threads(nblocks) reduction(+: checksum, nbytes)
+#endif
+            for (int b = 0; b < nblocks; b++) {
+                // shift 0: read own block (local); otherwise the block of a thread half the threads away (remote)
+                int blk = (b + shift) % nblocks;
+                size_t start = ptn_limits[blk] * ptn_bytes;
+                size_t end = ptn_limits[blk+1] * ptn_bytes;
+                for (size_t vec = 0; vec < nvec; vec++) {
+                    double *p = (double*)((char*)central_partial_lh + vec*vec_bytes + start);
+                    size_t n = (end - start) / sizeof(double);
+                    for (size_t i = 0; i < n; i++)
+                        checksum += p[i];
+                    nbytes += end - start;
+                }
+            }
+        }
+        double elapsed = max(getRealTime() - start_time, 1e-9);
+        cout << ((shift == 0) ? "Local" : "Remote") << " partial likelihood bandwidth with " << nblocks
+             << " pattern blocks: " << nbytes / elapsed / 1e9 << " GB/s" << endl;
+    }
+    if (checksum != 0.0 && verbose_mode >= VB_DEBUG)
+        cout << "Checksum: " << checksum << endl;
+}
+
 UBYTE *PhyloTree::newScaleNum() {
     return aligned_alloc<UBYTE>(aln->size()+aln->num_states);
 }
@@ -1064,7 +1496,7 @@ double PhyloTree::computeLikelihood(double *pattern_lh) {
         int nptn = aln->getNPattern();
         //double check_score = 0.0;
         for (int i = 0; i < nptn; i++) {
-            pattern_lh[i] += max(current_it->scale_num[i], UBYTE(0)) * LOG_SCALING_THRESHOLD;
+            pattern_lh[i] += max(current_it->scale_num[i], UBYTE(0)) * getLogScalingThreshold();
             //check_score += (pattern_lh[i] * (aln->at(i).frequency));
         }
         /*       if (fabs(score - check_score) > 1e-6) {
@@ -1245,16 +1677,16 @@ void PhyloTree::computePatternLikelihood(double *ptn_lh, double *cur_logl, doubl
     if (sum_scaling < 0.0) {
     	if (current_it->lh_scale_factor == 0.0) {
 			for (i = 0; i < nptn; i++) {
-				ptn_lh[i] = _pattern_lh[i] + (max(UBYTE(0), current_it_back->scale_num[i])) * LOG_SCALING_THRESHOLD;
+				ptn_lh[i] = _pattern_lh[i] + (max(UBYTE(0), current_it_back->scale_num[i])) * getLogScalingThreshold();
 			}
     	} else if (current_it_back->lh_scale_factor == 0.0){
 			for (i = 0; i < nptn; i++) {
-				ptn_lh[i] = _pattern_lh[i] + (max(UBYTE(0), current_it->scale_num[i])) * LOG_SCALING_THRESHOLD;
+				ptn_lh[i] = _pattern_lh[i] + (max(UBYTE(0), current_it->scale_num[i])) * getLogScalingThreshold();
 			}
     	} else {
 			for (i = 0; i < nptn; i++) {
 				ptn_lh[i] = _pattern_lh[i] + (max(UBYTE(0), current_it->scale_num[i]) +
-					max(UBYTE(0), current_it_back->scale_num[i])) * LOG_SCALING_THRESHOLD;
+					max(UBYTE(0), current_it_back->scale_num[i])) * getLogScalingThreshold();
 			}
     	}
     } else {
@@ -1269,20 +1701,20 @@ void PhyloTree::computePatternLikelihood(double *ptn_lh, double *cur_logl, doubl
             }
     	} else if (current_it->lh_scale_factor == 0.0) {
 			for (i = 0; i < nptn; i++) {
-				double scale = (max(UBYTE(0), current_it_back->scale_num[i])) * LOG_SCALING_THRESHOLD;
+				double scale = (max(UBYTE(0), current_it_back->scale_num[i])) * getLogScalingThreshold();
 				for (int j = 0; j < ncat; j++, offset++)
 					ptn_lh_cat[offset] = log(_pattern_lh_cat[offset]) + scale;
 			}
     	} else if (current_it_back->lh_scale_factor == 0.0) {
 			for (i = 0; i < nptn; i++) {
-				double scale = (max(UBYTE(0), current_it->scale_num[i])) * LOG_SCALING_THRESHOLD;
+				double scale = (max(UBYTE(0), current_it->scale_num[i])) * getLogScalingThreshold();
 				for (int j = 0; j < ncat; j++, offset++)
 					ptn_lh_cat[offset] = log(_pattern_lh_cat[offset]) + scale;
 			}
     	} else {
 			for (i = 0; i < nptn; i++) {
 				double scale = (max(UBYTE(0), current_it->scale_num[i]) +
-						max(UBYTE(0), current_it_back->scale_num[i])) * LOG_SCALING_THRESHOLD;
+						max(UBYTE(0), current_it_back->scale_num[i])) * getLogScalingThreshold();
 				for (int j = 0; j < ncat; j++, offset++)
 					ptn_lh_cat[offset] = log(_pattern_lh_cat[offset]) + scale;
 			}
@@ -2017,8 +2449,10 @@ double PhyloTree::computeBayesianBranchLength(PhyloNeighbor *dad_branch, PhyloNo
      }*/
     if ((dad_branch->partial_lh_computed & 1) == 0)
         computePartialLikelihood(dad_branch, dad);
+    mem_slots.lock(dad_branch);
     if ((node_branch->partial_lh_computed & 1) == 0)
         computePartialLikelihood(node_branch, node);
+    mem_slots.lock(node_branch);
     // now combine likelihood at the branch
     int nstates = aln->num_states;
     int numCat = site_rate->getNRate();
@@ -2037,13 +2471,14 @@ double PhyloTree::computeBayesianBranchLength(PhyloNeighbor *dad_branch, PhyloNo
     //cout << "sum_rates = " << sum_rates << endl;
 
     model->getStateFrequency(tmp_state_freq);
+    // -lhfloat: buffer to widen the partial likelihoods of one pattern
+    double *lh_buf = partial_lh_float ? new double[2*block] : NULL;
 
     for (ptn = 0; ptn < nptn; ptn++) {
         // Compute the probability of each state for the current site
         double sum_prob1 = 0.0, sum_prob2 = 0.0;
-        size_t offset = ptn * block;
-        double *partial_lh_site = node_branch->partial_lh + (offset);
-        double *partial_lh_child = dad_branch->partial_lh + (offset);
+        double *partial_lh_site = getPartialLhPattern(node_branch, ptn, block, lh_buf);
+        double *partial_lh_child = getPartialLhPattern(dad_branch, ptn, block, lh_buf + block);
         for (state = 0; state < nstates; state++) {
             tmp_anscentral_state_prob1[state] = 0.0;
             tmp_anscentral_state_prob2[state] = 0.0;
@@ -2075,6 +2510,10 @@ double PhyloTree::computeBayesianBranchLength(PhyloNeighbor *dad_branch, PhyloNo
         }
 
     }
+    if (lh_buf)
+        delete [] lh_buf;
+    mem_slots.unlock(node_branch);
+    mem_slots.unlock(dad_branch);
     obsLen /= getAlnNSite();
     if (obsLen < params->min_branch_length)
         obsLen = params->min_branch_length;
@@ -2569,17 +3008,28 @@ double PhyloTree::computeDist(double *dist_mat, double *var_mat) {
             col_id[pos] = row_id[pos] + 1;
         }
     }
-    // compute the upper-triangle of distance matrix
+    // initial distances from the bit-packed sequences
+    aln->buildPackedSeqs();
+    // compute the upper-triangle of distance matrix, with the second derivatives in var_mat
+    if (!params->compute_obs_dist && !params->compute_pairwise_dist && !isSuperTree() && DistEngine::isSupported(this)) {
+        DistEngine engine(this);
+        engine.computeDist(dist_mat, var_mat);
+    } else {
 #ifdef _OPENMP
 #pragma omp parallel for private(pos)
 #endif
+        for (pos = 0; pos < num_pairs; pos++) {
+            int seq1 = row_id[pos];
+            int seq2 = col_id[pos];
+            int sym_pos = seq1 * nseqs + seq2;
+            dist_mat[sym_pos] = computeDist(seq1, seq2, dist_mat[sym_pos], var_mat[sym_pos]);
+        }
+    }
+    aln->clearPackedSeqs();
 
     for (pos = 0; pos < num_pairs; pos++) {
-        int seq1 = row_id[pos];
-        int seq2 = col_id[pos];
-        double d2l; // moved here for thread-safe (OpenMP)
-        int sym_pos = seq1 * nseqs + seq2;
-        dist_mat[sym_pos] = computeDist(seq1, seq2, dist_mat[sym_pos], d2l);
+        int sym_pos = row_id[pos] * nseqs + col_id[pos];
+        double d2l = var_mat[sym_pos];
         if (params->ls_var_type == OLS)
             var_mat[sym_pos] = 1.0;
         else if (params->ls_var_type == WLS_PAUPLIN)
@@ -2658,13 +3108,20 @@ double PhyloTree::computeObsDist(double *dist_mat) {
     int nseqs = aln->getNSeq();
     int pos = 0;
     double longest_dist = 0.0;
+    aln->buildPackedSeqs();
+    // compute the upper-triangle of distance matrix
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int seq1 = 0; seq1 < nseqs; seq1++)
+        for (int seq2 = seq1+1; seq2 < nseqs; seq2++)
+            dist_mat[seq1 * nseqs + seq2] = aln->computeObsDist(seq1, seq2);
+    aln->clearPackedSeqs();
     for (int seq1 = 0; seq1 < nseqs; seq1++)
         for (int seq2 = 0; seq2 < nseqs; seq2++, pos++) {
             if (seq1 == seq2)
                 dist_mat[pos] = 0.0;
-            else if (seq2 > seq1) {
-                dist_mat[pos] = aln->computeObsDist(seq1, seq2);
-            } else
+            else if (seq2 < seq1)
                 dist_mat[pos] = dist_mat[seq2 * nseqs + seq1];
 
             if (dist_mat[pos] > longest_dist)
@@ -2698,8 +3155,28 @@ void PhyloTree::computeBioNJ(Params &params, Alignment *alignment, string &dist_
     string bionj_file = params.out_prefix;
     bionj_file += ".bionj";
     cout << "Computing BIONJ tree..." << endl;
-    BioNj bionj;
-    bionj.create(dist_file.c_str(), bionj_file.c_str());
+    int nseqs = alignment->getNSeq();
+    // use the distance matrix in memory, otherwise read the distance file
+    double *dist_mat = dist_matrix;
+    if (!dist_mat) {
+        dist_mat = new double[nseqs * nseqs];
+        alignment->readDist(dist_file.c_str(), dist_mat);
+    }
+    StrVector names;
+    for (int seq = 0; seq < nseqs; seq++)
+        names.push_back(alignment->getSeqName(seq));
+    try {
+        ofstream out;
+        out.exceptions(ios::failbit | ios::badbit);
+        out.open(bionj_file.c_str());
+        FastBioNj bionj;
+        bionj.create(names, dist_mat, out);
+        out.close();
+    } catch (ios::failure) {
+        outError(ERR_WRITE_OUTPUT, bionj_file);
+    }
+    if (dist_mat != dist_matrix)
+        delete [] dist_mat;
 //    bool my_rooted = false;
     bool non_empty_tree = (root != NULL);
 //    if (root)
@@ -3156,6 +3633,91 @@ NNIMove PhyloTree::getBestNNIForBran(PhyloNode *node1, PhyloNode *node2, NNIMove
 }
 
 
+void PhyloTree::initializeNNIWorker(PhyloTree *tree) {
+    params = tree->params;
+    aln = tree->aln;
+    model = tree->model;
+    site_rate = tree->site_rate;
+    model_factory = tree->model_factory;
+    optimize_by_newton = tree->optimize_by_newton;
+    setLikelihoodKernel(tree->sse);
+    assert(partial_lh_float == tree->partial_lh_float);
+
+    size_t nptn = getSafeUpperLimit(aln->size()+aln->num_states);
+    size_t nmix = (model_factory->fused_mix_rate) ? 1 : model->getNMixtures();
+    size_t block_size = getPartialLhBytes()/sizeof(double);
+    _pattern_lh = aligned_alloc<double>(nptn);
+    _pattern_lh_cat = aligned_alloc<double>(nptn * site_rate->getNDiscreteRate() * nmix);
+    theta_all = aligned_alloc<double>(nptn * model->num_states * site_rate->getNRate() * nmix);
+    ptn_freq = aligned_alloc<double>(nptn);
+    ptn_invar = aligned_alloc<double>(nptn);
+    size_t IT_NUM = (params->nni5) ? 6 : 2;
+    nni_partial_lh = aligned_alloc<double>(IT_NUM*block_size);
+    nni_scale_num = aligned_alloc<UBYTE>(IT_NUM*nptn);
+    // the four subtrees
+    central_partial_lh = aligned_alloc<double>(4*block_size);
+    central_scale_num = aligned_alloc<UBYTE>(4*nptn);
+}
+
+PhyloNode *PhyloTree::copyNNIBranches(PhyloTree *tree, PhyloNode *node1, PhyloNode *node2) {
+    deleteNNIBranches();
+    size_t nptn = getSafeUpperLimit(aln->size()+aln->num_states);
+    size_t block_size = getPartialLhBytes()/sizeof(double);
+    if (!tree->tip_partial_lh_computed)
+        tree->computeTipPartialLikelihood();
+    tip_partial_lh = tree->tip_partial_lh;
+    tip_partial_lh_computed = true;
+    memcpy(ptn_freq, tree->ptn_freq, nptn*sizeof(double));
+    ptn_freq_computed = true;
+    memcpy(ptn_invar, tree->ptn_invar, nptn*sizeof(double));
+    // the site-repeat classes copied below belong to these ptn_invar
+    ptn_invar_version = tree->ptn_invar_version;
+    curScore = tree->curScore;
+
+    PhyloNode *node[2] = {node1, node2};
+    PhyloNode *copy[2];
+    copy[0] = (PhyloNode*)newNode(node1->id, node1->name.c_str());
+    copy[1] = (PhyloNode*)newNode(node2->id, node2->name.c_str());
+    root = copy[0];
+    int nsubtrees = 0;
+    for (int i = 0; i < 2; i++)
+        for (NeighborVec::iterator it = node[i]->neighbors.begin(); it != node[i]->neighbors.end(); it++) {
+            if ((*it)->node == node[1-i]) {
+                copy[i]->addNeighbor(copy[1-i], (*it)->length, (*it)->id);
+                continue;
+            }
+            PhyloNeighbor *nei = (PhyloNeighbor*)(*it);
+            Neighbor *back = nei->node->findNeighbor(node[i]);
+            PhyloNode *stub = (PhyloNode*)newNode(nei->node->id, nei->node->name.c_str());
+            copy[i]->addNeighbor(stub, nei->length, nei->id);
+            stub->addNeighbor(copy[i], back->length, back->id);
+            if (nei->node->isLeaf())
+                continue;
+            // the subtree below stub is replaced by a dummy leaf that is never visited
+            stub->addNeighbor(newNode(), 0.0);
+            if ((nei->partial_lh_computed & 1) == 0)
+                tree->computePartialLikelihood(nei, node[i]);
+            PhyloNeighbor *copy_nei = (PhyloNeighbor*)copy[i]->neighbors.back();
+            copy_nei->partial_lh = central_partial_lh + nsubtrees*block_size;
+            copy_nei->scale_num = central_scale_num + nsubtrees*nptn;
+            memcpy(copy_nei->partial_lh, nei->partial_lh, block_size*sizeof(double));
+            memcpy(copy_nei->scale_num, nei->scale_num, getScaleNumBytes());
+            copy_nei->lh_scale_factor = nei->lh_scale_factor;
+            copy_nei->partial_lh_computed = 1;
+            if (nei->site_repeats)
+                copy_nei->site_repeats = new SiteRepeats(*nei->site_repeats);
+            nsubtrees++;
+        }
+    return copy[0];
+}
+
+void PhyloTree::deleteNNIBranches() {
+    if (root)
+        freeNode();
+    root = NULL;
+    current_it = current_it_back = NULL;
+}
+
 /****************************************************************************
  Subtree Pruning and Regrafting by maximum likelihood
  ****************************************************************************/
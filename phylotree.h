@@ -33,6 +33,7 @@
 #include "pll/pll.h"
 #include "checkpoint.h"
 #include "constrainttree.h"
+#include "memslot.h"
 
 #define BOOT_VAL_FLOAT
 #define BootValType float
@@ -53,13 +54,23 @@ const double TOL_LIKELIHOOD_PARAMOPT = 0.001; // BQM: newly introduced for Model
 #define SCALING_THRESHOLD_INVER 115792089237316195423570985008687907853269984665640564039457584007913129639936.0
 #define SCALING_THRESHOLD (1.0/SCALING_THRESHOLD_INVER)
 #define LOG_SCALING_THRESHOLD log(SCALING_THRESHOLD)
+// 2^64, scaling unit when partial likelihoods are stored in single precision (-lhfloat)
+#define SCALING_THRESHOLD_FLOAT_INVER 18446744073709551616.0
+#define SCALING_THRESHOLD_FLOAT (1.0/SCALING_THRESHOLD_FLOAT_INVER)
+#define LOG_SCALING_THRESHOLD_FLOAT log(SCALING_THRESHOLD_FLOAT)
 
 const int SPR_DEPTH = 2;
 
+// minimal number of flops per thread before a likelihood kernel is run in parallel
+const size_t MIN_PATTERN_BLOCK_WORK = 32768;
+
 //using namespace Eigen;
 
 inline size_t get_safe_upper_limit(size_t cur_limit) {
-	if (instruction_set >= 7)
+	if (instruction_set >= 9)
+		// AVX-512
+		return ((cur_limit+7)/8)*8;
+	else if (instruction_set >= 7)
 		// AVX
 		return ((cur_limit+3)/4)*4;
 	else
@@ -68,7 +79,10 @@ inline size_t get_safe_upper_limit(size_t cur_limit) {
 }
 
 inline size_t get_safe_upper_limit_float(size_t cur_limit) {
-	if (instruction_set >= 7)
+	if (instruction_set >= 9)
+		// AVX-512
+		return ((cur_limit+15)/16)*16;
+	else if (instruction_set >= 7)
 		// AVX
 		return ((cur_limit+7)/8)*8;
 	else
@@ -90,7 +104,7 @@ inline size_t get_safe_upper_limit_float(size_t cur_limit) {
 
 template< class T>
 inline T *aligned_alloc(size_t size) {
-	size_t MEM_ALIGNMENT = (instruction_set >= 7) ? 32 : 16;
+	size_t MEM_ALIGNMENT = (instruction_set >= 9) ? 64 : ((instruction_set >= 7) ? 32 : 16);
     void *mem;
 
 #if defined WIN32 || defined _WIN32 || defined __WIN32__
@@ -382,6 +396,13 @@ public:
      */
     void copyPhyloTree(PhyloTree *tree);
 
+    /**
+            copy the tree with identical node IDs, neighbor order and branch lengths,
+            such that nodes and NNI moves can be translated between both trees
+            @param tree the tree to copy
+     */
+    void copyTreeStructure(PhyloTree *tree);
+
 
     /**
             Set the alignment, important to compute parsimony or likelihood score
@@ -498,6 +519,12 @@ public:
 #else
     void setDotProductAVX();
 #endif
+
+#if defined(BINARY32) || defined(__NOAVX__) || defined(__NOAVX512__)
+    void setDotProductAVX512() { setDotProductAVX(); }
+#else
+    void setDotProductAVX512();
+#endif
     /**
             this function return the parsimony or likelihood score of the tree. Default is
             to compute the parsimony score. Override this function if you define a new
@@ -568,6 +595,26 @@ public:
     template<class VectorClass>
     int computeParsimonyBranchFastSIMD(PhyloNeighbor *dad_branch, PhyloNode *dad, int *branch_subst = NULL);
 
+    typedef int (PhyloTree::*ComputeParsimonyInsertType)(UINT *, UINT *, UINT *, UINT *, int);
+    ComputeParsimonyInsertType computeParsimonyInsertPointer;
+
+    /**
+            compute the tree parsimony score after inserting a subtree in the middle of a branch,
+            without changing the tree, used by the stepwise addition to score all branches in parallel
+            @param node_pars partial_pars of the subtree at one end of the branch
+            @param dad_pars partial_pars of the subtree at the other end of the branch
+            @param insert_pars partial_pars of the inserted subtree
+            @param new_pars (OUT) if not NULL, partial_pars of the two branch subtrees joined by the new internal node
+            @param upper_bound stop as soon as the score reaches this bound (ignored if new_pars is given)
+            @return parsimony score of the tree, a score >= upper_bound means that the computation stopped early
+     */
+    int computeParsimonyInsert(UINT *node_pars, UINT *dad_pars, UINT *insert_pars, UINT *new_pars = NULL, int upper_bound = INT_MAX) {
+        return (this->*computeParsimonyInsertPointer)(node_pars, dad_pars, insert_pars, new_pars, upper_bound);
+    }
+    int computeParsimonyInsertFast(UINT *node_pars, UINT *dad_pars, UINT *insert_pars, UINT *new_pars, int upper_bound);
+    template<class VectorClass>
+    int computeParsimonyInsertFastSIMD(UINT *node_pars, UINT *dad_pars, UINT *insert_pars, UINT *new_pars, int upper_bound);
+
 
 //    void printParsimonyStates(PhyloNeighbor *dad_branch = NULL, PhyloNode *dad = NULL);
 
@@ -577,16 +624,28 @@ public:
 #else
     virtual void setParsimonyKernelAVX();
 #endif
+#if defined(BINARY32) || defined(__NOAVX__) || defined(__NOAVX512__)
+    virtual void setParsimonyKernelAVX512() { setParsimonyKernelAVX(); }
+#else
+    virtual void setParsimonyKernelAVX512();
+#endif
 
     /****************************************************************************
             likelihood function
      ****************************************************************************/
 
     /**
-            initialize partial_lh vector of all PhyloNeighbors, allocating central_partial_lh
+            initialize partial_lh vector of all PhyloNeighbors, allocating central_partial_lh.
+            If -mem is not supported for the current model (see isMemSaveSupported()),
+            all partial likelihood vectors are kept in memory
      */
     virtual void initializeAllPartialLh();
 
+    /**
+            @return TRUE if the memory limit (-mem, LM_MEM_SAVE) can be used with the current model and kernel
+     */
+    bool isMemSaveSupported();
+
     /**
             de-allocate central_partial_lh
      */
@@ -600,6 +659,21 @@ public:
      */
     virtual void initializeAllPartialLh(int &index, int &indexlh, PhyloNode *node = NULL, PhyloNode *dad = NULL);
 
+    /**
+            LM_MEM_SAVE: compute the number of partial likelihood vectors that must be kept in memory
+            at the same time by the likelihood kernels, for the worst order of the subtrees
+            @return minimal number of memory slots for the current tree
+     */
+    int computeMemSlotsNeeded();
+
+    /**
+            @param dad_branch branch leading to the subtree
+            @param dad dad of dad_branch
+            @param needed already computed values
+            @return number of partial likelihood vectors needed at the same time to compute dad_branch
+     */
+    int computeMemSlotsNeeded(PhyloNeighbor *dad_branch, PhyloNode *dad, map<PhyloNeighbor*, int> &needed);
+
 
     /**
             clear all partial likelihood for a clean computation again
@@ -607,6 +681,30 @@ public:
      */
     virtual void clearAllPartialLH(bool make_null = false);
 
+    /**
+            record that the length of branch node1-node2 changed, or the subtrees attached to it.
+            Partial likelihoods are only cleared by the next clearDirtyPartialLh()
+     */
+    void markDirtyBranch(PhyloNode *node1, PhyloNode *node2);
+
+    /**
+            record the 5 branches around an NNI move (after or before it was done)
+     */
+    void markDirtyNNI(NNIMove &move);
+
+    /**
+            record the branches whose length differs from the one in lenvec
+            @param lenvec branch lengths previously saved with saveBranchLengths
+     */
+    void markDirtyBranchLengths(DoubleVector &lenvec, int startid = 0, PhyloNode *node = NULL, PhyloNode *dad = NULL);
+
+    /**
+            clear exactly the partial likelihoods whose subtree contains a branch recorded by
+            markDirtyBranch(), with a single traversal for all recorded branches
+            @return number of partial likelihoods cleared
+     */
+    size_t clearDirtyPartialLh();
+
     /**
      * compute all partial likelihoods if not computed before
      */
@@ -625,6 +723,52 @@ public:
     /** get the number of bytes occupied by partial_lh */
     size_t getPartialLhBytes();
 
+    /**
+            @return number of doubles per SIMD vector of the widest likelihood kernel that
+            setLikelihoodKernel() selects for the number of states, i.e. lk_vector_size of the
+            SIMD kernels, but fixed for the alignment even if the kernel is switched
+     */
+    size_t getKernelVectorSize();
+
+    /**
+            @param cur_limit number of patterns
+            @return cur_limit rounded up to a multiple of getKernelVectorSize(), for the
+            pattern-indexed vectors of the likelihood kernels (get_safe_upper_limit() pads
+            to the widest vector of the CPU)
+     */
+    size_t getSafeUpperLimit(size_t cur_limit) {
+        size_t vsize = getKernelVectorSize();
+        return ((cur_limit+vsize-1)/vsize)*vsize;
+    }
+
+    /**
+            @param nei a neighbor with computed partial likelihoods
+            @param ptn pattern index
+            @param block number of partial likelihoods per pattern
+            @param buffer at least block doubles, receives the widened values under -lhfloat
+            @return partial likelihoods of pattern ptn of nei in double precision: pointing into
+            nei->partial_lh itself, or buffer if they are stored in single precision
+     */
+    inline double *getPartialLhPattern(PhyloNeighbor *nei, size_t ptn, size_t block, double *buffer) {
+        if (!partial_lh_float)
+            return nei->partial_lh + ptn*block;
+        float *partial_lh = (float*)nei->partial_lh + ptn*block;
+        for (size_t i = 0; i < block; i++)
+            buffer[i] = partial_lh[i];
+        return buffer;
+    }
+
+    /**
+            @return TRUE if partial likelihoods can be stored in single precision (-lhfloat)
+            for the current model, data and tree
+     */
+    bool isPartialLhFloatSupported();
+
+    /** @return log of the scaling factor that one unit of scale_num stands for */
+    double getLogScalingThreshold() {
+        return partial_lh_float ? LOG_SCALING_THRESHOLD_FLOAT : LOG_SCALING_THRESHOLD;
+    }
+
     /**
             allocate memory for a scale num vector
      */
@@ -633,6 +777,30 @@ public:
     /** get the number of bytes occupied by scale_num */
     size_t getScaleNumBytes();
 
+    /**
+            split the observed patterns into ptn_limits, one contiguous block per thread.
+            The SIMD kernels always give block b to thread b, thus every thread keeps
+            working on the same slice of the partial likelihood vectors across calls
+            @param ptn_work approximate number of flops per pattern
+            @return number of pattern blocks, 1 if the alignment is too short to run in parallel
+     */
+    int computePatternBlocks(size_t ptn_work);
+
+    /**
+            NUMA first-touch: every thread zeroes its pattern block of nvec consecutive vectors,
+            so that these memory pages are placed on the node of the thread computing them
+            @param mem start of the vectors
+            @param vec_bytes number of bytes per vector
+            @param ptn_bytes number of bytes per pattern within a vector
+     */
+    void firstTouchPatternBlocks(char *mem, size_t nvec, size_t vec_bytes, size_t ptn_bytes);
+
+    /**
+            benchmark for -numa: measure the bandwidth of reading the partial likelihood vectors
+            when every thread reads its own pattern block (local) or that of the next thread (remote)
+     */
+    void benchmarkPatternBlockBandwidth();
+
     /**
      * this stores partial_lh for each state at the leaves of the tree because they are the same between leaves
      * e.g. (1,0,0,0) for A,  (0,0,0,1) for T
@@ -671,9 +839,28 @@ public:
 
     void computeSitemodelPartialLikelihoodEigen(PhyloNeighbor *dad_branch, PhyloNode *dad = NULL);
 
-    template <class VectorClass, const int VCSIZE, const int nstates>
+    template <class VectorClass, const int VCSIZE, const int nstates, class LhType>
     void computePartialLikelihoodEigenSIMD(PhyloNeighbor *dad_branch, PhyloNode *dad = NULL);
 
+    /**
+            -srep: compute the site-repeat classes of the subtree below dad_branch from those of its
+            children, unless they are still valid for the current children
+            @param dad_branch the branch leading to the subtree
+            @param dad its dad, used to direct the tranversal
+     */
+    void computeSiteRepeats(PhyloNeighbor *dad_branch, PhyloNode *dad);
+
+    /**
+            -srep: copy the partial likelihoods and scale numbers of the first pattern of each
+            site-repeat class to the other patterns of the class
+            @param dad_branch the branch whose partial likelihoods were computed for the first patterns only
+            @param dad its dad, used to direct the tranversal
+            @param nblocks number of pattern blocks from computePatternBlocks()
+            @return the log scaling factors of the copied patterns
+     */
+    template <class LhType>
+    double copySiteRepeats(PhyloNeighbor *dad_branch, PhyloNode *dad, int nblocks);
+
     template <class VectorClass, const int VCSIZE, const int nstates>
     void computeMixratePartialLikelihoodEigenSIMD(PhyloNeighbor *dad_branch, PhyloNode *dad = NULL);
 
@@ -716,7 +903,7 @@ public:
 
     double computeSitemodelLikelihoodBranchEigen(PhyloNeighbor *dad_branch, PhyloNode *dad);
 
-    template <class VectorClass, const int VCSIZE, const int nstates>
+    template <class VectorClass, const int VCSIZE, const int nstates, class LhType>
     double computeLikelihoodBranchEigenSIMD(PhyloNeighbor *dad_branch, PhyloNode *dad);
 
     template <class VectorClass, const int VCSIZE, const int nstates>
@@ -962,7 +1149,7 @@ public:
 
     void computeSitemodelLikelihoodDervEigen(PhyloNeighbor *dad_branch, PhyloNode *dad, double &df, double &ddf);
 
-    template <class VectorClass, const int VCSIZE, const int nstates>
+    template <class VectorClass, const int VCSIZE, const int nstates, class LhType>
     void computeLikelihoodDervEigenSIMD(PhyloNeighbor *dad_branch, PhyloNode *dad, double &df, double &ddf);
 
     template <class VectorClass, const int VCSIZE, const int nstates>
@@ -1015,6 +1202,41 @@ public:
      */
     int computeParsimonyTree(const char *out_prefix, Alignment *alignment);
 
+    /**
+     * improve the tree by parsimony SPR moves: every subtree is pruned in turn and regrafted
+     * on the best branch within the radius, if this reduces the parsimony score.
+     * Regrafts are scored by computeParsimonyInsert without changing the tree,
+     * only partial_pars outdated by an applied move are recomputed. Rounds are repeated until no move is applied.
+     * @param radius maximal number of branches between the old and the new place of a subtree
+     * @return parsimony score
+     */
+    int optimizeSPRParsimony(int radius);
+
+    /**
+     * used by optimizeSPRParsimony() to score the regrafts of a pruned subtree on the branches below node
+     * @param insert_pars partial_pars of the pruned subtree
+     * @param up_pars partial_pars of the pruned tree on the side of dad of the branch node-dad
+     * @param node the current node
+     * @param dad dad of the node, towards the place of the pruned subtree
+     * @param depth number of branches between the branch node-dad and the place of the pruned subtree
+     * @param radius maximal depth
+     * @param up_buffers radius bit blocks for the up_pars of deeper branches
+     * @param best_score (IN/OUT) best score so far
+     * @param best_node (OUT) one end of the best branch found
+     * @param best_dad (OUT) the other end of the best branch found
+     */
+    void searchSPRParsimony(UINT *insert_pars, UINT *up_pars, PhyloNode *node, PhyloNode *dad, int depth,
+        int radius, UINT **up_buffers, int &best_score, PhyloNode *&best_node, PhyloNode *&best_dad);
+
+    /**
+     * move a subtree to the middle of a branch and clear the outdated partial_pars
+     * @param node root of the subtree
+     * @param dad attachment node of the subtree, moved along with it
+     * @param target_node one end of the target branch
+     * @param target_dad the other end of the target branch
+     */
+    void moveSubtreeParsimony(PhyloNode *node, PhyloNode *dad, PhyloNode *target_node, PhyloNode *target_dad);
+
 
     /****************************************************************************
             Branch length optimization by maximum likelihood
@@ -1176,6 +1398,28 @@ public:
      */
     virtual NNIMove getBestNNIForBran(PhyloNode *node1, PhyloNode *node2, NNIMove *nniMoves = NULL);
 
+    /**
+            set up this tree as a thread-private worker evaluating NNIs of tree (-pnni, see IQTree::evalNNIsParallel).
+            Alignment, model and parameters are shared with tree and only read. The worker only owns the
+            partial likelihoods of one NNI (see getBestNNIForBran) and of the four subtrees around it.
+            @param tree the tree whose NNIs are evaluated
+     */
+    void initializeNNIWorker(PhyloTree *tree);
+
+    /**
+            copy the five branches around the inner branch (node1, node2) of tree into this worker tree,
+            together with the partial likelihoods of the four subtrees, which are computed in tree if needed.
+            Must be called serially, as tree may reuse the memory of these vectors afterwards.
+            @param tree the tree containing node1 and node2
+            @return copy of node1, its neighbors are in the same order as those of node1 (the same for node2)
+     */
+    PhyloNode *copyNNIBranches(PhyloTree *tree, PhyloNode *node1, PhyloNode *node2);
+
+    /**
+            delete the branches created by copyNNIBranches()
+     */
+    void deleteNNIBranches();
+
     /**
             Do an NNI
             @param move reference to an NNI move object containing information about the move
@@ -1470,11 +1714,41 @@ public:
 
     virtual void setLikelihoodKernel(LikelihoodKernel lk);
 
+    /** set the non-vectorized Eigen kernels */
+    void setLikelihoodKernelEigen();
+
+    /** set SSE kernels (Vec2d) for even number of states, otherwise fall back to Eigen kernels */
+    void setLikelihoodKernelSSE();
+
+    /**
+        assign all likelihood function pointers to the SIMD kernel family matching the model
+        (site-specific, mixture or plain) for a fixed vector class and number of states
+    */
+    template <class VectorClass, const int VCSIZE, const int nstates>
+    void setLikelihoodKernelSIMD();
+
+    /**
+        @return human-readable name of the likelihood kernel currently in use
+    */
+    string getLikelihoodKernelName();
+
+    /**
+        set AVX kernels (Vec4d) for state counts divisible by 4, otherwise fall back to SSE
+    */
 #if defined(BINARY32) || defined(__NOAVX__)
-    virtual void setLikelihoodKernelAVX() {}
+    virtual void setLikelihoodKernelAVX() { setLikelihoodKernelSSE(); }
 #else
     virtual void setLikelihoodKernelAVX();
 #endif
+
+    /**
+        set AVX-512 kernels (Vec8d) for state counts divisible by 8, otherwise fall back to AVX
+    */
+#if defined(BINARY32) || defined(__NOAVX__) || defined(__NOAVX512__)
+    virtual void setLikelihoodKernelAVX512() { setLikelihoodKernelAVX(); }
+#else
+    virtual void setLikelihoodKernelAVX512();
+#endif
     /****************************************************************************
             Public variables
      ****************************************************************************/
@@ -1504,6 +1778,33 @@ public:
      */
     LikelihoodKernel sse;
 
+    /**
+     *      number of doubles per SIMD vector of the current likelihood kernel (1 for no SIMD)
+     */
+    int lk_vector_size;
+
+    /**
+     *      TRUE if partial likelihoods are stored in single precision (-lhfloat), computation is still in double
+     */
+    bool partial_lh_float;
+
+    /**
+     *      boundaries of the pattern blocks of the likelihood kernels: block b covers
+     *      patterns ptn_limits[b] to ptn_limits[b+1]-1, see computePatternBlocks()
+     */
+    vector<size_t> ptn_limits;
+
+    /**
+     *      -sw: number of threads for the likelihood kernels of a search worker tree,
+     *      which runs inside a parallel region; 0 for all other trees
+     */
+    int worker_threads;
+
+    /**
+     *      LM_MEM_SAVE (-mem): pool of partial likelihood vectors in central_partial_lh, empty otherwise
+     */
+    MemSlotVector mem_slots;
+
     /**
      * for UpperBounds: Initial tree log-likelihood
      */
@@ -1556,6 +1857,21 @@ public:
 
 	size_t num_partial_lh_computations;
 
+	/** number of partial likelihoods cleared by clearDirtyPartialLh() */
+	size_t num_partial_lh_invalidated;
+
+	/** branches recorded by markDirtyBranch(), as pairs (dirty_nodes1[i], dirty_nodes2[i]) */
+	NodeVector dirty_nodes1, dirty_nodes2;
+
+	/** -srep: clock for the time stamps of the site-repeat classes */
+	uint64_t site_repeats_clock;
+
+	/** -srep: incremented whenever the patterns with ptn_invar[ptn] == 0, which the kernels scale, change */
+	uint64_t ptn_invar_version;
+
+	/** -srep: ptn_invar[ptn] == 0.0 for each pattern at the last computePtnInvar() */
+	vector<bool> ptn_invar_zero;
+
 	/** remove identical sequences from the tree */
     virtual void removeIdenticalSeqs(Params &params);
 
@@ -0,0 +1,55 @@
+/*
+ * phylotreeavx512.cpp
+ *
+ *  AVX-512 (Vec8d) instantiation of the Eigen SIMD likelihood kernels.
+ *  Only state counts divisible by 8 can use 8-wide vectors; all other
+ *  data fall back to the AVX kernels. The parsimony kernels (Vec16ui)
+ *  work for any number of states.
+ */
+
+
+#include "phylokernel.h"
+#include "phylokernelmixture.h"
+#include "phylokernelmixrate.h"
+#include "phylokernelsitemodel.h"
+#include "vectorclass/vectorclass.h"
+
+#ifndef __AVX512F__
+#error "You must compile this file with AVX-512 enabled!"
+#endif
+
+#if MAX_VECTOR_SIZE < 512
+#error "You must compile this file with MAX_VECTOR_SIZE=512!"
+#endif
+
+void PhyloTree::setDotProductAVX512() {
+#ifdef BOOT_VAL_FLOAT
+		dotProduct = &PhyloTree::dotProductSIMD<float, Vec16f, 16>;
+#else
+		dotProduct = &PhyloTree::dotProductSIMD<double, Vec8d, 8>;
+#endif
+
+        dotProductDouble = &PhyloTree::dotProductSIMD<double, Vec8d, 8>;
+}
+
+void PhyloTree::setParsimonyKernelAVX512() {
+    computeParsimonyBranchPointer = &PhyloTree::computeParsimonyBranchFastSIMD<Vec16ui>;
+    computePartialParsimonyPointer = &PhyloTree::computePartialParsimonyFastSIMD<Vec16ui>;
+    computeParsimonyInsertPointer = &PhyloTree::computeParsimonyInsertFastSIMD<Vec16ui>;
+}
+
+void PhyloTree::setLikelihoodKernelAVX512() {
+	switch(aln->num_states) {
+	case 8: setLikelihoodKernelSIMD<Vec8d, 8, 8>(); break;
+	case 16: setLikelihoodKernelSIMD<Vec8d, 8, 16>(); break;
+	case 24: setLikelihoodKernelSIMD<Vec8d, 8, 24>(); break;
+	case 32: setLikelihoodKernelSIMD<Vec8d, 8, 32>(); break;
+	case 64: setLikelihoodKernelSIMD<Vec8d, 8, 64>(); break;
+	default:
+		// Vec8d requires nstates divisible by 8
+		setLikelihoodKernelAVX();
+		break;
+	}
+    // the parsimony kernels do not depend on the number of states
+    setParsimonyKernelAVX512();
+}
@@ -280,6 +280,41 @@ int PhyloTree::computeParsimonyBranchFast(PhyloNeighbor *dad_branch, PhyloNode *
     return score;
 }
 
+int PhyloTree::computeParsimonyInsertFast(UINT *node_pars, UINT *dad_pars, UINT *insert_pars, UINT *new_pars, int upper_bound) {
+    int site;
+    int nsites = (aln->num_informative_sites + UINT_BITS-1) / UINT_BITS;
+    int nstates = aln->getMaxNumStates();
+    int scoreid = nsites*nstates;
+    UINT join_score = node_pars[scoreid] + dad_pars[scoreid];
+    UINT score = join_score + insert_pars[scoreid];
+
+    for (site = 0; site < nsites; site++) {
+        size_t offset = nstates*site;
+        UINT *x = node_pars + offset;
+        UINT *y = dad_pars + offset;
+        UINT *t = insert_pars + offset;
+        int i;
+        UINT w = 0, v = 0;
+        for (i = 0; i < nstates; i++)
+            w |= x[i] & y[i];
+        w = ~w;
+        // Fitch state set of the new internal node, intersected with the new taxon
+        for (i = 0; i < nstates; i++) {
+            UINT z = (x[i] & y[i]) | (w & (x[i] | y[i]));
+            if (new_pars)
+                new_pars[offset+i] = z;
+            v |= z & t[i];
+        }
+        join_score += vml_popcnt(w);
+        score += vml_popcnt(w) + vml_popcnt(~v);
+        if (!new_pars && score >= (UINT)upper_bound)
+            break;
+    }
+    if (new_pars)
+        new_pars[scoreid] = join_score;
+    return score;
+}
+
 void PhyloTree::computeAllPartialPars(PhyloNode *node, PhyloNode *dad) {
 	if (!node) node = (PhyloNode*)root;
 	FOR_NEIGHBOR_IT(node, dad, it) {
@@ -403,15 +438,60 @@ int PhyloTree::computeParsimonyTree(const char *out_prefix, Alignment *alignment
         added_node->addNeighbor((Node*) 1, -1.0);
         added_node->addNeighbor((Node*) 2, -1.0);
 
-        for (int nodeid = 0; nodeid < nodes1.size(); nodeid++) {
-        
-            int score = addTaxonMPFast(new_taxon, added_node, nodes1[nodeid], nodes2[nodeid]);
-            if (score < best_pars_score) {
-                best_pars_score = score;
-                target_node = (PhyloNode*)nodes1[nodeid];
-                target_dad = (PhyloNode*)nodes2[nodeid];
-                memcpy(new_taxon_partial_pars, tmp_partial_pars, pars_block_size*sizeof(UINT));
+        if (leafNum < constraintTree.leafNum) {
+            // the compatibility with the constraint tree is checked on the tree with the taxon inserted
+            for (int nodeid = 0; nodeid < nodes1.size(); nodeid++) {
+
+                int score = addTaxonMPFast(new_taxon, added_node, nodes1[nodeid], nodes2[nodeid]);
+                if (score < best_pars_score) {
+                    best_pars_score = score;
+                    target_node = (PhyloNode*)nodes1[nodeid];
+                    target_dad = (PhyloNode*)nodes2[nodeid];
+                    memcpy(new_taxon_partial_pars, tmp_partial_pars, pars_block_size*sizeof(UINT));
+                }
             }
+        } else {
+            // partial_pars on both sides of every branch, only those cleared by the last insertion are recomputed
+            PhyloNeighbor *root_nei = (PhyloNeighbor*)root->neighbors[0];
+            computePartialParsimony(root_nei, (PhyloNode*)root);
+            computeReversePartialParsimony((PhyloNode*)root_nei->node, (PhyloNode*)root);
+            PhyloNeighbor *insert_nei = (PhyloNeighbor*)added_node->findNeighbor(new_taxon);
+            computePartialParsimony(insert_nei, added_node);
+
+            // score all branches in parallel without touching the tree,
+            // ties go to the first branch as in the serial addition
+            int num_branches = nodes1.size();
+            int best_branch = -1;
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+            {
+                int thread_score = INT_MAX, thread_branch = -1;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 16) nowait
+#endif
+                for (int nodeid = 0; nodeid < num_branches; nodeid++) {
+                    UINT *node_pars = ((PhyloNeighbor*)nodes2[nodeid]->findNeighbor(nodes1[nodeid]))->partial_pars;
+                    UINT *dad_pars = ((PhyloNeighbor*)nodes1[nodeid]->findNeighbor(nodes2[nodeid]))->partial_pars;
+                    int score = computeParsimonyInsert(node_pars, dad_pars, insert_nei->partial_pars, NULL, thread_score);
+                    if (score < thread_score) {
+                        thread_score = score;
+                        thread_branch = nodeid;
+                    }
+                }
+#ifdef _OPENMP
+#pragma omp critical(pars_best_branch)
+#endif
+                if (thread_branch >= 0 && (thread_score < best_pars_score || (thread_score == best_pars_score && thread_branch < best_branch))) {
+                    best_pars_score = thread_score;
+                    best_branch = thread_branch;
+                }
+            }
+            target_node = (PhyloNode*)nodes1[best_branch];
+            target_dad = (PhyloNode*)nodes2[best_branch];
+            computeParsimonyInsert(((PhyloNeighbor*)target_dad->findNeighbor(target_node))->partial_pars,
+                ((PhyloNeighbor*)target_node->findNeighbor(target_dad))->partial_pars,
+                insert_nei->partial_pars, new_taxon_partial_pars);
         }
         
         if (verbose_mode >= VB_MAX)
@@ -448,6 +528,10 @@ int PhyloTree::computeParsimonyTree(const char *out_prefix, Alignment *alignment
     
     assert(index == 4*leafNum-6);
 
+    // refine the tree by SPR moves within the parsimony SPR radius
+    if (params && params->sprDist > 0)
+        best_pars_score = optimizeSPRParsimony(params->sprDist);
+
     nodeNum = 2 * leafNum - 2;
     initializeTree();
 
@@ -509,3 +593,129 @@ int PhyloTree::addTaxonMPFast(Node *added_taxon, Node* added_node, Node* node, N
     return score;
 
 }
+
+void PhyloTree::searchSPRParsimony(UINT *insert_pars, UINT *up_pars, PhyloNode *node, PhyloNode *dad, int depth,
+    int radius, UINT **up_buffers, int &best_score, PhyloNode *&best_node, PhyloNode *&best_dad)
+{
+    PhyloNeighbor *dad_nei = (PhyloNeighbor*)dad->findNeighbor(node);
+    computePartialParsimony(dad_nei, dad);
+    if (depth > 0) {
+        int score = computeParsimonyInsert(up_pars, dad_nei->partial_pars, insert_pars, NULL, best_score);
+        if (score < best_score) {
+            best_score = score;
+            best_node = node;
+            best_dad = dad;
+        }
+    }
+    if (depth >= radius || node->isLeaf())
+        return;
+    PhyloNode *child[2];
+    int nchild = 0;
+    FOR_NEIGHBOR_IT(node, dad, it)
+        child[nchild++] = (PhyloNode*)(*it)->node;
+    assert(nchild == 2);
+    for (int i = 0; i < 2; i++) {
+        // the pruned tree seen from the branch node-child[i]: everything above node joined with the other child
+        PhyloNeighbor *sibling_nei = (PhyloNeighbor*)node->findNeighbor(child[1-i]);
+        computePartialParsimony(sibling_nei, node);
+        computeParsimonyInsert(up_pars, sibling_nei->partial_pars, insert_pars, up_buffers[depth]);
+        searchSPRParsimony(insert_pars, up_buffers[depth], child[i], node, depth+1, radius, up_buffers,
+            best_score, best_node, best_dad);
+    }
+}
+
+void PhyloTree::moveSubtreeParsimony(PhyloNode *node, PhyloNode *dad, PhyloNode *target_node, PhyloNode *target_dad) {
+    PhyloNode *left = NULL, *right = NULL;
+    FOR_NEIGHBOR_IT(dad, node, it) {
+        if (!left) left = (PhyloNode*)(*it)->node; else right = (PhyloNode*)(*it)->node;
+    }
+    // prune: join the two other neighbors of dad
+    double len = dad->findNeighbor(left)->length + dad->findNeighbor(right)->length;
+    left->updateNeighbor(dad, right, len);
+    right->updateNeighbor(dad, left, len);
+    // regraft dad in the middle of the target branch
+    len = target_node->findNeighbor(target_dad)->length;
+    target_node->updateNeighbor(target_dad, dad, len/2.0);
+    target_dad->updateNeighbor(target_node, dad, len/2.0);
+    dad->updateNeighbor(left, target_node, len/2.0);
+    dad->updateNeighbor(right, target_dad, len/2.0);
+
+    // partial_pars towards the old and the new place of the subtree are outdated
+    ((PhyloNeighbor*)dad->findNeighbor(target_node))->clearPartialLh();
+    ((PhyloNeighbor*)dad->findNeighbor(target_dad))->clearPartialLh();
+    dad->clearReversePartialLh(NULL);
+    left->clearReversePartialLh(NULL);
+    right->clearReversePartialLh(NULL);
+}
+
+int PhyloTree::optimizeSPRParsimony(int radius) {
+    best_pars_score = INT_MAX;
+    int cur_score = computeParsimony();
+    if (leafNum < 5 || radius < 1)
+        return cur_score;
+    UINT **up_buffers = new UINT*[radius];
+    for (int i = 0; i < radius; i++)
+        up_buffers[i] = newBitsBlock();
+
+    bool improved = true;
+    while (improved) {
+        improved = false;
+        // every subtree is pruned once per round, as seen from its attachment node
+        NodeVector nodes1, nodes2, prune_nodes, prune_dads;
+        getBranches(nodes1, nodes2);
+        for (int i = 0; i < nodes1.size(); i++) {
+            if (!nodes2[i]->isLeaf()) {
+                prune_nodes.push_back(nodes1[i]);
+                prune_dads.push_back(nodes2[i]);
+            }
+            if (!nodes1[i]->isLeaf()) {
+                prune_nodes.push_back(nodes2[i]);
+                prune_dads.push_back(nodes1[i]);
+            }
+        }
+        for (int i = 0; i < prune_nodes.size(); i++) {
+            PhyloNode *node = (PhyloNode*)prune_nodes[i];
+            PhyloNode *dad = (PhyloNode*)prune_dads[i];
+            // an earlier move in this round may have split the pair
+            if (!dad->isNeighbor(node))
+                continue;
+            PhyloNode *left = NULL, *right = NULL;
+            FOR_NEIGHBOR_IT(dad, node, it) {
+                if (!left) left = (PhyloNode*)(*it)->node; else right = (PhyloNode*)(*it)->node;
+            }
+            if (left->isLeaf() && right->isLeaf())
+                continue;
+            PhyloNeighbor *insert_nei = (PhyloNeighbor*)dad->findNeighbor(node);
+            PhyloNeighbor *left_nei = (PhyloNeighbor*)dad->findNeighbor(left);
+            PhyloNeighbor *right_nei = (PhyloNeighbor*)dad->findNeighbor(right);
+            computePartialParsimony(insert_nei, dad);
+            computePartialParsimony(left_nei, dad);
+            computePartialParsimony(right_nei, dad);
+
+            // regrafts within radius on both sides, the tree is not changed while scoring
+            int best_score = cur_score;
+            PhyloNode *target_node = NULL, *target_dad = NULL;
+            searchSPRParsimony(insert_nei->partial_pars, right_nei->partial_pars, left, dad, 0, radius, up_buffers,
+                best_score, target_node, target_dad);
+            searchSPRParsimony(insert_nei->partial_pars, left_nei->partial_pars, right, dad, 0, radius, up_buffers,
+                best_score, target_node, target_dad);
+            if (!target_node)
+                continue;
+            moveSubtreeParsimony(node, dad, target_node, target_dad);
+            if (!constraintTree.empty() && !constraintTree.isCompatible(this)) {
+                // move back between left and right
+                moveSubtreeParsimony(node, dad, left, right);
+                continue;
+            }
+            if (verbose_mode >= VB_MAX)
+                cout << "Parsimony SPR: " << cur_score << " -> " << best_score << endl;
+            cur_score = best_score;
+            improved = true;
+        }
+    }
+
+    for (int i = radius-1; i >= 0; i--)
+        aligned_free(up_buffers[i]);
+    delete [] up_buffers;
+    return cur_score;
+}
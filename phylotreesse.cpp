@@ -41,13 +41,17 @@ void PhyloTree::setParsimonyKernel(LikelihoodKernel lk) {
     case LK_EIGEN:
         computeParsimonyBranchPointer = &PhyloTree::computeParsimonyBranchFast;
         computePartialParsimonyPointer = &PhyloTree::computePartialParsimonyFast;
+        computeParsimonyInsertPointer = &PhyloTree::computeParsimonyInsertFast;
     	break;
     case LK_EIGEN_SSE:
-		if (instruction_set >= 7)
+		if (instruction_set >= 9)
+			setParsimonyKernelAVX512();
+		else if (instruction_set >= 7)
 			setParsimonyKernelAVX();
 		else {
 			computeParsimonyBranchPointer = &PhyloTree::computeParsimonyBranchFastSIMD<Vec4ui>;
             computePartialParsimonyPointer = &PhyloTree::computePartialParsimonyFastSIMD<Vec4ui>;
+            computeParsimonyInsertPointer = &PhyloTree::computeParsimonyInsertFastSIMD<Vec4ui>;
         }
     	break;
 //    default:
@@ -60,7 +64,9 @@ void PhyloTree::setParsimonyKernel(LikelihoodKernel lk) {
 void PhyloTree::setLikelihoodKernel(LikelihoodKernel lk) {
     setParsimonyKernel(lk);
 
-	if (instruction_set >= 7) {
+	if (instruction_set >= 9) {
+		setDotProductAVX512();
+	} else if (instruction_set >= 7) {
 		setDotProductAVX();
 	} else {
 #ifdef BOOT_VAL_FLOAT
@@ -71,245 +77,108 @@ void PhyloTree::setLikelihoodKernel(LikelihoodKernel lk) {
 		dotProductDouble = &PhyloTree::dotProductSIMD<double, Vec2d, 2>;
 	}
 	sse = lk;
+	bool old_partial_lh_float = partial_lh_float;
+	partial_lh_float = false; // only set by single-precision SIMD kernels
     if (!aln) {
         computeLikelihoodBranchPointer = &PhyloTree::computeLikelihoodBranchEigen;
         computeLikelihoodDervPointer = &PhyloTree::computeLikelihoodDervEigen;
         computePartialLikelihoodPointer = &PhyloTree::computePartialLikelihoodEigen;
         computeLikelihoodFromBufferPointer = NULL;
+        lk_vector_size = 1;
         sse = LK_EIGEN;
-        return;
+    } else if (sse == LK_EIGEN) {
+        setLikelihoodKernelEigen();
+    } else if (instruction_set >= 9) {
+        // LK_EIGEN_SSE: pick the widest vector whose size divides the number of states,
+        // each setLikelihoodKernelXXX falls back to the next narrower one
+        setLikelihoodKernelAVX512();
+    } else if (instruction_set >= 7) {
+        setLikelihoodKernelAVX();
+    } else {
+        setLikelihoodKernelSSE();
     }
-    
+
+    if (partial_lh_float != old_partial_lh_float && central_partial_lh) {
+        // layout of partial likelihood vectors changed: reallocate them
+        aligned_free(central_partial_lh);
+        central_partial_lh = NULL;
+        if (nni_partial_lh)
+            aligned_free(nni_partial_lh);
+        nni_partial_lh = NULL;
+        initializeAllPartialLh();
+    }
+}
+
+void PhyloTree::setLikelihoodKernelEigen() {
+    lk_vector_size = 1;
     if (model_factory && model_factory->model->isSiteSpecificModel()) {
-        if (sse == LK_EIGEN) {
-            computeLikelihoodBranchPointer = &PhyloTree::computeSitemodelLikelihoodBranchEigen;
-            computeLikelihoodDervPointer = &PhyloTree::computeSitemodelLikelihoodDervEigen;
-            computePartialLikelihoodPointer = &PhyloTree::computeSitemodelPartialLikelihoodEigen;
-            computeLikelihoodFromBufferPointer = &PhyloTree::computeSitemodelLikelihoodFromBufferEigen;
-            return;        
-        }
-        // LK_EIGEN_SSE
-        if (instruction_set >= 7) {
-            // CPU supports AVX
-            setLikelihoodKernelAVX();
-            return;
-        }
-        switch (aln->num_states) {
-        case 4:
-            computeLikelihoodBranchPointer = &PhyloTree::computeSitemodelLikelihoodBranchEigenSIMD<Vec2d, 2, 4>;
-            computeLikelihoodDervPointer = &PhyloTree::computeSitemodelLikelihoodDervEigenSIMD<Vec2d, 2, 4>;
-            computePartialLikelihoodPointer = &PhyloTree::computeSitemodelPartialLikelihoodEigenSIMD<Vec2d, 2, 4>;
-            computeLikelihoodFromBufferPointer = &PhyloTree::computeSitemodelLikelihoodFromBufferEigenSIMD<Vec2d, 2, 4>;
-            break;
-        case 20:
-            computeLikelihoodBranchPointer = &PhyloTree::computeSitemodelLikelihoodBranchEigenSIMD<Vec2d, 2, 20>;
-            computeLikelihoodDervPointer = &PhyloTree::computeSitemodelLikelihoodDervEigenSIMD<Vec2d, 2, 20>;
-            computePartialLikelihoodPointer = &PhyloTree::computeSitemodelPartialLikelihoodEigenSIMD<Vec2d, 2, 20>;
-            computeLikelihoodFromBufferPointer = &PhyloTree::computeSitemodelLikelihoodFromBufferEigenSIMD<Vec2d, 2, 20>;
-            break;
-        default:
-            computeLikelihoodBranchPointer = &PhyloTree::computeSitemodelLikelihoodBranchEigen;
-            computeLikelihoodDervPointer = &PhyloTree::computeSitemodelLikelihoodDervEigen;
-            computePartialLikelihoodPointer = &PhyloTree::computeSitemodelPartialLikelihoodEigen;
-            computeLikelihoodFromBufferPointer = &PhyloTree::computeSitemodelLikelihoodFromBufferEigen;
-            break;
-        }
+        computeLikelihoodBranchPointer = &PhyloTree::computeSitemodelLikelihoodBranchEigen;
+        computeLikelihoodDervPointer = &PhyloTree::computeSitemodelLikelihoodDervEigen;
+        computePartialLikelihoodPointer = &PhyloTree::computeSitemodelPartialLikelihoodEigen;
+        computeLikelihoodFromBufferPointer = &PhyloTree::computeSitemodelLikelihoodFromBufferEigen;
         return;
     }
-    
-    if (sse == LK_EIGEN) {
-        if (model_factory && model_factory->model->isMixture()) {
-            if (model_factory->fused_mix_rate) {
-                computeLikelihoodBranchPointer = &PhyloTree::computeMixrateLikelihoodBranchEigen;
-                computeLikelihoodDervPointer = &PhyloTree::computeMixrateLikelihoodDervEigen;
-                computePartialLikelihoodPointer = &PhyloTree::computeMixratePartialLikelihoodEigen;
-                computeLikelihoodFromBufferPointer = NULL;
-            } else {
-                computeLikelihoodBranchPointer = &PhyloTree::computeMixtureLikelihoodBranchEigen;
-                computeLikelihoodDervPointer = &PhyloTree::computeMixtureLikelihoodDervEigen;
-                computePartialLikelihoodPointer = &PhyloTree::computeMixturePartialLikelihoodEigen;
-                computeLikelihoodFromBufferPointer = NULL;
-            }
+    if (model_factory && model_factory->model->isMixture()) {
+        if (model_factory->fused_mix_rate) {
+            computeLikelihoodBranchPointer = &PhyloTree::computeMixrateLikelihoodBranchEigen;
+            computeLikelihoodDervPointer = &PhyloTree::computeMixrateLikelihoodDervEigen;
+            computePartialLikelihoodPointer = &PhyloTree::computeMixratePartialLikelihoodEigen;
+            computeLikelihoodFromBufferPointer = NULL;
         } else {
-            computeLikelihoodBranchPointer = &PhyloTree::computeLikelihoodBranchEigen;
-            computeLikelihoodDervPointer = &PhyloTree::computeLikelihoodDervEigen;
-            computePartialLikelihoodPointer = &PhyloTree::computePartialLikelihoodEigen;
+            computeLikelihoodBranchPointer = &PhyloTree::computeMixtureLikelihoodBranchEigen;
+            computeLikelihoodDervPointer = &PhyloTree::computeMixtureLikelihoodDervEigen;
+            computePartialLikelihoodPointer = &PhyloTree::computeMixturePartialLikelihoodEigen;
             computeLikelihoodFromBufferPointer = NULL;
         }
-        return;
+    } else {
+        computeLikelihoodBranchPointer = &PhyloTree::computeLikelihoodBranchEigen;
+        computeLikelihoodDervPointer = &PhyloTree::computeLikelihoodDervEigen;
+        computePartialLikelihoodPointer = &PhyloTree::computePartialLikelihoodEigen;
+        computeLikelihoodFromBufferPointer = NULL;
     }
+}
 
-//    cout << "Likelihood kernel: ";
-        
-    // set likelihood kernel
+void PhyloTree::setLikelihoodKernelSSE() {
 	switch(aln->num_states) {
-	case 4:
-		switch(sse) {
-//		case LK_SSE:
-//			computeLikelihoodBranchPointer = &PhyloTree::computeLikelihoodBranchSSE<4>;
-//			computeLikelihoodDervPointer = &PhyloTree::computeLikelihoodDervSSE<4>;
-//			computePartialLikelihoodPointer = &PhyloTree::computePartialLikelihoodSSE<4>;
-//	        computeLikelihoodFromBufferPointer = NULL;
-//			break;
-		case LK_EIGEN_SSE:
-			if (instruction_set >= 7) {
-				// CPU supports AVX
-				setLikelihoodKernelAVX();
-			} else {
-				// CPU does not support AVX
-				if (model_factory && model_factory->model->isMixture()) {
-					if (model_factory->fused_mix_rate) {
-						computeLikelihoodBranchPointer = &PhyloTree::computeMixrateLikelihoodBranchEigenSIMD<Vec2d, 2, 4>;
-						computeLikelihoodDervPointer = &PhyloTree::computeMixrateLikelihoodDervEigenSIMD<Vec2d, 2, 4>;
-						computePartialLikelihoodPointer = &PhyloTree::computeMixratePartialLikelihoodEigenSIMD<Vec2d, 2, 4>;
-						computeLikelihoodFromBufferPointer = &PhyloTree::computeMixrateLikelihoodFromBufferEigenSIMD<Vec2d, 2, 4>;
-					} else {
-						computeLikelihoodBranchPointer = &PhyloTree::computeMixtureLikelihoodBranchEigenSIMD<Vec2d, 2, 4>;
-						computeLikelihoodDervPointer = &PhyloTree::computeMixtureLikelihoodDervEigenSIMD<Vec2d, 2, 4>;
-						computePartialLikelihoodPointer = &PhyloTree::computeMixturePartialLikelihoodEigenSIMD<Vec2d, 2, 4>;
-						computeLikelihoodFromBufferPointer = &PhyloTree::computeMixtureLikelihoodFromBufferEigenSIMD<Vec2d, 2, 4>;
-					}
-				} else {
-					computeLikelihoodBranchPointer = &PhyloTree::computeLikelihoodBranchEigenSIMD<Vec2d, 2, 4>;
-					computeLikelihoodDervPointer = &PhyloTree::computeLikelihoodDervEigenSIMD<Vec2d, 2, 4>;
-					computePartialLikelihoodPointer = &PhyloTree::computePartialLikelihoodEigenSIMD<Vec2d, 2, 4>;
-					computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferEigenSIMD<Vec2d, 2, 4>;
-				}
-			}
-			break;
-		default:
-			break;
-		}
-		break;
-	case 20:
-		switch(sse) {
-//		case LK_SSE:
-//			computeLikelihoodBranchPointer = &PhyloTree::computeLikelihoodBranchSSE<20>;
-//			computeLikelihoodDervPointer = &PhyloTree::computeLikelihoodDervSSE<20>;
-//			computePartialLikelihoodPointer = &PhyloTree::computePartialLikelihoodSSE<20>;
-//	        computeLikelihoodFromBufferPointer = NULL;
-//			break;
-		case LK_EIGEN_SSE:
-			if (instruction_set >= 7) {
-				setLikelihoodKernelAVX();
-			} else {
-				if (model_factory && model_factory->model->isMixture()) {
-					if (model_factory->fused_mix_rate) {
-						computeLikelihoodBranchPointer = &PhyloTree::computeMixrateLikelihoodBranchEigenSIMD<Vec2d, 2, 20>;
-						computeLikelihoodDervPointer = &PhyloTree::computeMixrateLikelihoodDervEigenSIMD<Vec2d, 2, 20>;
-						computePartialLikelihoodPointer = &PhyloTree::computeMixratePartialLikelihoodEigenSIMD<Vec2d, 2, 20>;
-						computeLikelihoodFromBufferPointer = &PhyloTree::computeMixrateLikelihoodFromBufferEigenSIMD<Vec2d, 2, 20>;
-					} else {
-						computeLikelihoodBranchPointer = &PhyloTree::computeMixtureLikelihoodBranchEigenSIMD<Vec2d, 2, 20>;
-						computeLikelihoodDervPointer = &PhyloTree::computeMixtureLikelihoodDervEigenSIMD<Vec2d, 2, 20>;
-						computePartialLikelihoodPointer = &PhyloTree::computeMixturePartialLikelihoodEigenSIMD<Vec2d, 2, 20>;
-						computeLikelihoodFromBufferPointer = &PhyloTree::computeMixtureLikelihoodFromBufferEigenSIMD<Vec2d, 2, 20>;
-					}
-				} else {
-					computeLikelihoodBranchPointer = &PhyloTree::computeLikelihoodBranchEigenSIMD<Vec2d, 2, 20>;
-					computeLikelihoodDervPointer = &PhyloTree::computeLikelihoodDervEigenSIMD<Vec2d, 2, 20>;
-					computePartialLikelihoodPointer = &PhyloTree::computePartialLikelihoodEigenSIMD<Vec2d, 2, 20>;
-					computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferEigenSIMD<Vec2d, 2, 20>;
-				}
-			}
-			break;
-		default:
-			break;
-		}
-		break;
-
-	case 64: // CODON
-		switch(sse) {
-//		case LK_SSE:
-//			computeLikelihoodBranchPointer = &PhyloTree::computeLikelihoodBranchSSE<64>;
-//			computeLikelihoodDervPointer = &PhyloTree::computeLikelihoodDervSSE<64>;
-//			computePartialLikelihoodPointer = &PhyloTree::computePartialLikelihoodSSE<64>;
-//			computeLikelihoodFromBufferPointer = NULL;
-//			break;
-		case LK_EIGEN_SSE:
-			if (instruction_set >= 7) {
-				setLikelihoodKernelAVX();
-			} else {
-				if (model_factory && model_factory->model->isMixture()) {
-					if (model_factory->fused_mix_rate) {
-						computeLikelihoodBranchPointer = &PhyloTree::computeMixrateLikelihoodBranchEigenSIMD<Vec2d, 2, 64>;
-						computeLikelihoodDervPointer = &PhyloTree::computeMixrateLikelihoodDervEigenSIMD<Vec2d, 2, 64>;
-						computePartialLikelihoodPointer = &PhyloTree::computeMixratePartialLikelihoodEigenSIMD<Vec2d, 2, 64>;
-						computeLikelihoodFromBufferPointer = &PhyloTree::computeMixrateLikelihoodFromBufferEigenSIMD<Vec2d, 2, 64>;
-//						cout << "Fast-SSE-semi-mixture" << endl;
-					} else {
-						computeLikelihoodBranchPointer = &PhyloTree::computeMixtureLikelihoodBranchEigenSIMD<Vec2d, 2, 64>;
-						computeLikelihoodDervPointer = &PhyloTree::computeMixtureLikelihoodDervEigenSIMD<Vec2d, 2, 64>;
-						computePartialLikelihoodPointer = &PhyloTree::computeMixturePartialLikelihoodEigenSIMD<Vec2d, 2, 64>;
-						computeLikelihoodFromBufferPointer = &PhyloTree::computeMixtureLikelihoodFromBufferEigenSIMD<Vec2d, 2, 64>;
-//						cout << "Fast-SSE-mixture" << endl;
-					}
-				} else {
-					computeLikelihoodBranchPointer = &PhyloTree::computeLikelihoodBranchEigenSIMD<Vec2d, 2, 64>;
-					computeLikelihoodDervPointer = &PhyloTree::computeLikelihoodDervEigenSIMD<Vec2d, 2, 64>;
-					computePartialLikelihoodPointer = &PhyloTree::computePartialLikelihoodEigenSIMD<Vec2d, 2, 64>;
-					computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferEigenSIMD<Vec2d, 2, 64>;
-//					cout << "Fast-SSE" << endl;
-				}
-			}
-			break;
-		default:
-			break;
-		}
-		break;
-
-
-	case 2:
-		switch(sse) {
-//		case LK_SSE:
-//			computeLikelihoodBranchPointer = &PhyloTree::computeLikelihoodBranchSSE<2>;
-//			computeLikelihoodDervPointer = &PhyloTree::computeLikelihoodDervSSE<2>;
-//			computePartialLikelihoodPointer = &PhyloTree::computePartialLikelihoodSSE<2>;
-//	        computeLikelihoodFromBufferPointer = NULL;
-//			break;
-		case LK_EIGEN_SSE:
-			computeLikelihoodBranchPointer = &PhyloTree::computeLikelihoodBranchEigenSIMD<Vec2d, 2, 2>;
-			computeLikelihoodDervPointer = &PhyloTree::computeLikelihoodDervEigenSIMD<Vec2d, 2, 2>;
-			computePartialLikelihoodPointer = &PhyloTree::computePartialLikelihoodEigenSIMD<Vec2d, 2, 2>;
-	        computeLikelihoodFromBufferPointer = &PhyloTree::computeLikelihoodFromBufferEigenSIMD<Vec2d, 2, 2>;
-			break;
-		default:
-			break;
-		}
-		break;
-
+	case 2: setLikelihoodKernelSIMD<Vec2d, 2, 2>(); break;
+	case 4: setLikelihoodKernelSIMD<Vec2d, 2, 4>(); break;
+	case 6: setLikelihoodKernelSIMD<Vec2d, 2, 6>(); break;
+	case 8: setLikelihoodKernelSIMD<Vec2d, 2, 8>(); break;
+	case 10: setLikelihoodKernelSIMD<Vec2d, 2, 10>(); break;
+	case 12: setLikelihoodKernelSIMD<Vec2d, 2, 12>(); break;
+	case 14: setLikelihoodKernelSIMD<Vec2d, 2, 14>(); break;
+	case 16: setLikelihoodKernelSIMD<Vec2d, 2, 16>(); break;
+	case 18: setLikelihoodKernelSIMD<Vec2d, 2, 18>(); break;
+	case 20: setLikelihoodKernelSIMD<Vec2d, 2, 20>(); break;
+	case 22: setLikelihoodKernelSIMD<Vec2d, 2, 22>(); break;
+	case 24: setLikelihoodKernelSIMD<Vec2d, 2, 24>(); break;
+	case 26: setLikelihoodKernelSIMD<Vec2d, 2, 26>(); break;
+	case 28: setLikelihoodKernelSIMD<Vec2d, 2, 28>(); break;
+	case 30: setLikelihoodKernelSIMD<Vec2d, 2, 30>(); break;
+	case 32: setLikelihoodKernelSIMD<Vec2d, 2, 32>(); break;
+	case 64: setLikelihoodKernelSIMD<Vec2d, 2, 64>(); break; // CODON
 	default:
-        if (sse == LK_EIGEN_SSE) {
-            if (model_factory && model_factory->model->isMixture()) {
-                if (model_factory->fused_mix_rate) {
-                    computeLikelihoodBranchPointer = &PhyloTree::computeMixrateLikelihoodBranchEigen;
-                    computeLikelihoodDervPointer = &PhyloTree::computeMixrateLikelihoodDervEigen;
-                    computePartialLikelihoodPointer = &PhyloTree::computeMixratePartialLikelihoodEigen;
-                    computeLikelihoodFromBufferPointer = NULL;
-                } else {
-                    computeLikelihoodBranchPointer = &PhyloTree::computeMixtureLikelihoodBranchEigen;
-                    computeLikelihoodDervPointer = &PhyloTree::computeMixtureLikelihoodDervEigen;
-                    computePartialLikelihoodPointer = &PhyloTree::computeMixturePartialLikelihoodEigen;
-                    computeLikelihoodFromBufferPointer = NULL;
-                }
-            } else {
-                computeLikelihoodBranchPointer = &PhyloTree::computeLikelihoodBranchEigen;
-                computeLikelihoodDervPointer = &PhyloTree::computeLikelihoodDervEigen;
-                computePartialLikelihoodPointer = &PhyloTree::computePartialLikelihoodEigen;
-                computeLikelihoodFromBufferPointer = NULL;
-            }
-            sse = LK_EIGEN;
-//        } else {
-//            computeLikelihoodBranchPointer = &PhyloTree::computeLikelihoodBranchNaive;
-//            computeLikelihoodDervPointer = &PhyloTree::computeLikelihoodDervNaive;
-//            computePartialLikelihoodPointer = &PhyloTree::computePartialLikelihoodNaive;
-//            computeLikelihoodFromBufferPointer = NULL;
-//            sse = LK_NORMAL;
-        }
+		// odd number of states: no vectorized kernel
+		setLikelihoodKernelEigen();
+		sse = LK_EIGEN;
 		break;
 	}
 }
 
+string PhyloTree::getLikelihoodKernelName() {
+    string name;
+    switch (lk_vector_size) {
+    case 1: name = "Eigen (no SIMD)"; break;
+    case 2: name = "SSE3 (2-wide)"; break;
+    case 4: name = "AVX (4-wide)"; break;
+    case 8: name = "AVX-512 (8-wide)"; break;
+    default: name = "unknown"; break;
+    }
+    if (partial_lh_float)
+        name += ", single-precision partial likelihoods";
+    return name;
+}
+
 void PhyloTree::changeLikelihoodKernel(LikelihoodKernel lk) {
 	if (sse == lk) return;
 //	if ((sse == LK_EIGEN || sse == LK_EIGEN_SSE) && (lk == LK_NORMAL || lk == LK_SSE)) {
@@ -372,7 +241,7 @@ void PhyloTree::computeTipPartialLikelihood() {
 
     if (getModel()->isSiteSpecificModel()) {
         ModelSet *models = (ModelSet*)model;
-        size_t nptn = aln->getNPattern(), max_nptn = get_safe_upper_limit(nptn), tip_block_size = max_nptn * aln->num_states;
+        size_t nptn = aln->getNPattern(), max_nptn = getSafeUpperLimit(nptn), tip_block_size = max_nptn * aln->num_states;
         int nstates = aln->num_states;
         int nseq = aln->getNSeq();
 #ifdef _OPENMP
@@ -532,7 +401,7 @@ void PhyloTree::computePtnFreq() {
 	if (ptn_freq_computed) return;
 	ptn_freq_computed = true;
 	size_t nptn = aln->getNPattern();
-	size_t maxptn = get_safe_upper_limit(nptn+model_factory->unobserved_ptns.size());
+	size_t maxptn = getSafeUpperLimit(nptn+model_factory->unobserved_ptns.size());
 	int ptn;
 	for (ptn = 0; ptn < nptn; ptn++)
 		ptn_freq[ptn] = (*aln)[ptn].frequency;
@@ -542,7 +411,7 @@ void PhyloTree::computePtnFreq() {
 
 void PhyloTree::computePtnInvar() {
 	size_t nptn = aln->getNPattern(), ptn;
-	size_t maxptn = get_safe_upper_limit(nptn+model_factory->unobserved_ptns.size());
+	size_t maxptn = getSafeUpperLimit(nptn+model_factory->unobserved_ptns.size());
 	int nstates = aln->num_states;
 
     double *state_freq = aligned_alloc<double>(nstates);
@@ -566,6 +435,18 @@ void PhyloTree::computePtnInvar() {
 			ptn_invar[ptn] = ptn_invar[ptn-1];
 	}
 	aligned_free(state_freq);
+	if (params->site_repeats) {
+		// the site-repeat classes separate the patterns that are scaled from those that are not
+		bool changed = (ptn_invar_zero.size() != nptn);
+		ptn_invar_zero.resize(nptn);
+		for (ptn = 0; ptn < nptn; ptn++)
+			if (ptn_invar_zero[ptn] != (ptn_invar[ptn] == 0.0)) {
+				ptn_invar_zero[ptn] = (ptn_invar[ptn] == 0.0);
+				changed = true;
+			}
+		if (changed)
+			ptn_invar_version++;
+	}
 }
 
 /*******************************************************
@@ -615,15 +496,21 @@ void PhyloTree::computePartialLikelihoodEigen(PhyloNeighbor *dad_branch, PhyloNo
 
 	// internal node
 	PhyloNeighbor *left = NULL, *right = NULL; // left & right are two neighbors leading to 2 subtrees
+    bool cherry = true;
 	FOR_NEIGHBOR_IT(node, dad, it) {
         PhyloNeighbor *nei = (PhyloNeighbor*)*it;
 		if (!left) left = (PhyloNeighbor*)(*it); else right = (PhyloNeighbor*)(*it);
         if ((nei->partial_lh_computed & 1) == 0)
             computePartialLikelihood(nei, node);
+        mem_slots.lock(nei);
+        if (!nei->node->isLeaf())
+            cherry = false;
         dad_branch->lh_scale_factor += nei->lh_scale_factor;
 	}
 
-    if (params->lh_mem_save == LM_PER_NODE && !dad_branch->partial_lh) {
+    if (!mem_slots.empty() && !dad_branch->partial_lh) {
+        mem_slots.acquire(dad_branch, cherry);
+    } else if (params->lh_mem_save == LM_PER_NODE && !dad_branch->partial_lh) {
         // re-orient partial_lh
         bool done = false;
         FOR_NEIGHBOR_IT(node, dad, it2) {
@@ -1008,6 +895,8 @@ void PhyloTree::computePartialLikelihoodEigen(PhyloNeighbor *dad_branch, PhyloNo
 
 	}
 
+    FOR_NEIGHBOR_IT(node, dad, it)
+        mem_slots.unlock((PhyloNeighbor*)*it);
     delete [] partial_lh_leaves;
     delete [] echildren;
 }
@@ -1028,8 +917,10 @@ void PhyloTree::computeLikelihoodDervEigen(PhyloNeighbor *dad_branch, PhyloNode
     }
     if ((dad_branch->partial_lh_computed & 1) == 0)
         computePartialLikelihoodEigen(dad_branch, dad);
+    mem_slots.lock(dad_branch);
     if ((node_branch->partial_lh_computed & 1) == 0)
         computePartialLikelihoodEigen(node_branch, node);
+    mem_slots.lock(node_branch);
         
     size_t nstates = aln->num_states;
     size_t ncat = site_rate->getNRate();
@@ -1152,6 +1043,8 @@ void PhyloTree::computeLikelihoodDervEigen(PhyloNeighbor *dad_branch, PhyloNode
     }
 
 
+    mem_slots.unlock(node_branch);
+    mem_slots.unlock(dad_branch);
     delete [] val2;
     delete [] val1;
     delete [] val0;
@@ -1174,9 +1067,11 @@ double PhyloTree::computeLikelihoodBranchEigen(PhyloNeighbor *dad_branch, PhyloN
     if ((dad_branch->partial_lh_computed & 1) == 0)
 //        computePartialLikelihoodEigen(dad_branch, dad);
         computePartialLikelihood(dad_branch, dad);
+    mem_slots.lock(dad_branch);
     if ((node_branch->partial_lh_computed & 1) == 0)
 //        computePartialLikelihoodEigen(node_branch, node);
         computePartialLikelihood(node_branch, node);
+    mem_slots.lock(node_branch);
     double tree_lh = node_branch->lh_scale_factor + dad_branch->lh_scale_factor;
     size_t nstates = aln->num_states;
     size_t ncat = site_rate->getNRate();
@@ -1199,6 +1094,8 @@ double PhyloTree::computeLikelihoodBranchEigen(PhyloNeighbor *dad_branch, PhyloN
 
 	double prob_const = 0.0;
 	memset(_pattern_lh_cat, 0, nptn*ncat*sizeof(double));
+	// -lhfloat: this kernel (used for _pattern_lh_cat) widens one pattern at a time into a per-thread buffer
+	double *lh_scratch = newPartialLhScratch(partial_lh_float, 2*block);
 
     if (dad->isLeaf()) {
     	// special treatment for TIP-INTERNAL NODE case
@@ -1226,7 +1123,7 @@ double PhyloTree::computeLikelihoodBranchEigen(PhyloNeighbor *dad_branch, PhyloN
     	for (ptn = 0; ptn < nptn; ptn++) {
 			double lh_ptn = ptn_invar[ptn];
             double *lh_cat = _pattern_lh_cat + ptn*ncat;
-            double *partial_lh_dad = dad_branch->partial_lh + ptn*block;
+            double *partial_lh_dad = getPartialLhPattern(dad_branch, ptn, block, getPartialLhScratch(lh_scratch, 2*block, NULL));
             int state_dad = (ptn < orig_nptn) ? (aln->at(ptn))[dad->id] : model_factory->unobserved_ptns[ptn-orig_nptn];
             double *lh_node = partial_lh_node + state_dad*block;
             for (c = 0; c < ncat; c++) {
@@ -1260,8 +1157,9 @@ double PhyloTree::computeLikelihoodBranchEigen(PhyloNeighbor *dad_branch, PhyloN
     	for (ptn = 0; ptn < nptn; ptn++) {
 			double lh_ptn = ptn_invar[ptn];
             double *lh_cat = _pattern_lh_cat + ptn*ncat;
-            double *partial_lh_dad = dad_branch->partial_lh + ptn*block;
-            double *partial_lh_node = node_branch->partial_lh + ptn*block;
+            double *lh_buf = getPartialLhScratch(lh_scratch, 2*block, NULL);
+            double *partial_lh_dad = getPartialLhPattern(dad_branch, ptn, block, lh_buf);
+            double *partial_lh_node = getPartialLhPattern(node_branch, ptn, block, lh_buf + block);
             double *val_tmp = val;
             for (c = 0; c < ncat; c++) {
                 for (i = 0; i < nstates; i++) {
@@ -1337,6 +1235,10 @@ double PhyloTree::computeLikelihoodBranchEigen(PhyloNeighbor *dad_branch, PhyloN
 
 	assert(!isnan(tree_lh) && !isinf(tree_lh));
 
+    if (lh_scratch)
+        aligned_free(lh_scratch);
+    mem_slots.unlock(node_branch);
+    mem_slots.unlock(dad_branch);
     delete [] val;
     return tree_lh;
 }
@@ -371,6 +371,13 @@ void SuperAlignment::createBootstrapAlignment(int *pattern_freq, const char *spe
 	}
 }
 
+size_t SuperAlignment::getNBootPattern() {
+	size_t nptn = 0;
+	for (vector<Alignment*>::iterator it = partitions.begin(); it != partitions.end(); it++)
+		nptn += (*it)->getNPattern();
+	return nptn;
+}
+
 /**
  * shuffle alignment by randomizing the order of sites
  */
@@ -389,13 +396,10 @@ double SuperAlignment::computeObsDist(int seq1, int seq2) {
 		int id1 = taxa_index[seq1][site];
 		int id2 = taxa_index[seq2][site];
 		if (id1 < 0 || id2 < 0) continue;
-		int num_states = partitions[site]->num_states;
-		for (Alignment::iterator it = partitions[site]->begin(); it != partitions[site]->end(); it++) 
-			if  ((*it)[id1] < num_states && (*it)[id2] < num_states) {
-				total_pos += (*it).frequency;
-				if ((*it)[id1] != (*it)[id2] )
-					diff_pos += (*it).frequency;
-			}
+		int part_diff, part_total;
+		partitions[site]->countObsDiff(id1, id2, part_diff, part_total);
+		diff_pos += part_diff;
+		total_pos += part_total;
 	}
 	if (!total_pos) 
 		return MAX_GENETIC_DIST; // return +INF if no overlap between two sequences
@@ -403,6 +407,16 @@ double SuperAlignment::computeObsDist(int seq1, int seq2) {
 }
 
 
+void SuperAlignment::buildPackedSeqs() {
+	for (vector<Alignment*>::iterator it = partitions.begin(); it != partitions.end(); it++)
+		(*it)->buildPackedSeqs();
+}
+
+void SuperAlignment::clearPackedSeqs() {
+	for (vector<Alignment*>::iterator it = partitions.begin(); it != partitions.end(); it++)
+		(*it)->clearPackedSeqs();
+}
+
 double SuperAlignment::computeDist(int seq1, int seq2) {
 	if (partitions.empty()) return 0.0;
 	double obs_dist = computeObsDist(seq1, seq2);
@@ -155,6 +155,11 @@ public:
 	*/
 	virtual void createBootstrapAlignment(int *pattern_freq, const char *spec = NULL, int *rstream = NULL);
 
+	/**
+		@return total number of patterns over all partitions
+	*/
+	virtual size_t getNBootPattern();
+
 	/**
 	 * shuffle alignment by randomizing the order of sites over all sub-alignments
 	 */
@@ -169,6 +174,16 @@ public:
 	*/
 	virtual double computeObsDist(int seq1, int seq2);
 
+	/**
+		build the bit-packed sequences of all partitions
+	*/
+	virtual void buildPackedSeqs();
+
+	/**
+		free the bit-packed sequences of all partitions
+	*/
+	virtual void clearPackedSeqs();
+
 	/**
 		compute the Juke-Cantor corrected distance between 2 sequences over all partitions
 		@param seq1 index of sequence 1
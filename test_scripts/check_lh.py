@@ -0,0 +1,196 @@
+#!/usr/bin/env python
+'''
+Log-likelihood regression checks: runs each alignment of the LH_CHECKS section of the
+test configuration with and without an option that must not change the likelihood
+(e.g. -lhfloat, -srep, -pnni) and compares the best log-likelihoods or, with the optional
+fifth field 'models', the log-likelihood of every model tested by ModelFinder, with 'au' the
+p-values of the AU test of the user trees and with 'mldist' the ML distance matrix.
+'''
+from __future__ import print_function
+import sys, os, shutil, tempfile, optparse
+import subprocess
+
+def parse_lh_checks(config_file):
+  ''' Returns a list of (alignment options, baseline options, compared options, max difference, kind)
+  '''
+  checks = []
+  with open(config_file) as f:
+    lines = [line.strip() for line in f if line.strip()]
+  readChecks = False
+  for line in lines:
+    if line == 'START_LH_CHECKS':
+      readChecks = True
+      continue
+    if line == 'END_LH_CHECKS':
+      readChecks = False
+      continue
+    if readChecks and not line.startswith('#'):
+      fields = [field.strip() for field in line.split('|')]
+      if len(fields) == 4:
+        fields.append('best')
+      if len(fields) != 5 or fields[4] not in ('best', 'models', 'au', 'mldist'):
+        print('Malformed line in ' + config_file + ': ' + line)
+        sys.exit(1)
+      checks.append((fields[0], fields[1], fields[2], float(fields[3]), fields[4]))
+  return checks
+
+def run_iqtree(iqtree_bin, aln_dir, out_dir, prefix, options):
+  ''' Runs IQ-TREE in aln_dir and returns the best log-likelihood, None if the run failed
+  '''
+  cmd = [iqtree_bin] + options.split() + ['-redo', '-pre', os.path.join(out_dir, prefix)]
+  with open(os.path.join(out_dir, prefix + '.stdout'), 'w') as out:
+    if subprocess.call(cmd, cwd=aln_dir, stdout=out, stderr=subprocess.STDOUT) != 0:
+      return None
+  with open(os.path.join(out_dir, prefix + '.log')) as f:
+    for line in f:
+      if line.startswith('BEST SCORE FOUND'):
+        return float(line.split(':')[1])
+  return None
+
+def read_model_lh(out_dir, prefix):
+  ''' Returns a dictionary from model name to log-likelihood of the .model file written by ModelFinder
+  '''
+  models = {}
+  with open(os.path.join(out_dir, prefix + '.model')) as f:
+    header = f.readline().split()
+    column = header.index('LnL')
+    for line in f:
+      fields = line.split()
+      if len(fields) > column:
+        models[fields[0]] = float(fields[column])
+  return models
+
+def read_au_pvalues(out_dir, prefix):
+  ''' Returns the list of p-AU values of the USER TREES table of the .iqtree report, None for a tree
+  identical to an earlier one
+  '''
+  pvalues = []
+  with open(os.path.join(out_dir, prefix + '.iqtree')) as f:
+    lines = [line.rstrip() for line in f]
+  start = lines.index('USER TREES')
+  for i in range(start, len(lines)):
+    if 'p-AU' in lines[i]:
+      break
+  # the table starts after the dashed line and ends with an empty line
+  for line in lines[i+2:]:
+    if not line:
+      break
+    fields = line.split()
+    if '=' in fields:
+      pvalues.append(None)
+    else:
+      pvalues.append(float(fields[-2]))
+  return pvalues
+
+def compare_au(basePvalues, testPvalues, maxDiff):
+  ''' Returns the error message if the trees differ or a p-AU value differs by more than maxDiff, None otherwise
+  '''
+  if len(basePvalues) != len(testPvalues) or [p is None for p in basePvalues] != [p is None for p in testPvalues]:
+    return 'different user trees'
+  for tree in range(len(basePvalues)):
+    if basePvalues[tree] is not None and abs(basePvalues[tree] - testPvalues[tree]) > maxDiff:
+      return 'tree %d p-AU %.4f vs %.4f (max difference %g)' % (tree+1, basePvalues[tree], testPvalues[tree], maxDiff)
+  return None
+
+def read_mldist(out_dir, prefix):
+  ''' Returns a dictionary from sequence name to its row of the .mldist file
+  '''
+  rows = {}
+  with open(os.path.join(out_dir, prefix + '.mldist')) as f:
+    nseq = int(f.readline())
+    for i in range(nseq):
+      fields = f.readline().split()
+      rows[fields[0]] = [float(dist) for dist in fields[1:]]
+  return rows
+
+def compare_mldist(baseRows, testRows, maxDiff):
+  ''' Returns the error message if the sequences differ or a distance differs by more than maxDiff, None otherwise
+  '''
+  if sorted(baseRows) != sorted(testRows):
+    return 'different sequences'
+  for name in sorted(baseRows):
+    for (i, (baseDist, testDist)) in enumerate(zip(baseRows[name], testRows[name])):
+      if abs(baseDist - testDist) > maxDiff:
+        return 'distance %s - seq %d %.7f vs %.7f (max difference %g)' % (name, i+1, baseDist, testDist, maxDiff)
+  return None
+
+def compare_models(baseModels, testModels, maxDiff):
+  ''' Returns the error message if a model is missing or has a log-likelihood lower by more than maxDiff
+  under the compared option, None otherwise
+  '''
+  for name in sorted(baseModels):
+    if name not in testModels:
+      return 'model ' + name + ' not tested'
+    if baseModels[name] - testModels[name] > maxDiff:
+      return 'model %s logL %.3f vs %.3f (max difference %g)' % (name, baseModels[name], testModels[name], maxDiff)
+  return None
+
+if __name__ == '__main__':
+  usage = "USAGE: %prog [options]"
+  parser = optparse.OptionParser(usage=usage)
+  parser.add_option('-b','--binary', dest="iqtree_bin", help='Path to your IQ-TREE binary')
+  parser.add_option('-c','--config', dest="config_file", help='Path to test configuration file')
+  parser.add_option('-d','--data', dest="aln_dir", default=os.path.join(os.path.dirname(os.path.abspath(__file__)), 'test_data'),
+                    help='Directory of the test alignments (default: test_data)')
+  parser.add_option('-t','--threads', dest="threads", help='Number of threads for all runs (default: 2, at most #cores)')
+  parser.add_option('-k','--keep', dest="keep", action="store_true", default=False, help='Keep the output files')
+  (options, args) = parser.parse_args()
+  if not options.iqtree_bin or not options.config_file:
+    parser.print_help()
+    exit(0)
+  iqtree_bin = os.path.abspath(options.iqtree_bin)
+  if not options.threads:
+    # IQ-TREE refuses more threads than cores
+    try:
+      options.threads = str(max(1, min(2, os.sysconf('SC_NPROCESSORS_ONLN'))))
+    except (ValueError, OSError, AttributeError):
+      options.threads = '1'
+  checks = parse_lh_checks(options.config_file)
+  out_dir = tempfile.mkdtemp(prefix='iqtree_lh_checks_')
+  common = ' -seed 12345 -nt ' + options.threads
+  failed = 0
+  testNr = 1
+  for (aln, baseOpts, testOpts, maxDiff, kind) in checks:
+    prefix = 'LH_CHECK_' + str(testNr)
+    testNr = testNr + 1
+    baseLh = run_iqtree(iqtree_bin, options.aln_dir, out_dir, prefix + '_base', '-s ' + aln + ' ' + baseOpts + common)
+    testLh = run_iqtree(iqtree_bin, options.aln_dir, out_dir, prefix + '_test', '-s ' + aln + ' ' + baseOpts + ' ' + testOpts + common)
+    desc = '-s ' + aln + ' ' + baseOpts + ' [' + testOpts + ']'
+    if baseLh is None or testLh is None:
+      print('ERROR  ' + desc + ': run failed, see ' + os.path.join(out_dir, prefix) + '_*.stdout')
+      failed = failed + 1
+    elif kind == 'best' and abs(baseLh - testLh) > maxDiff:
+      print('ERROR  ' + desc + ': logL %.3f vs %.3f (max difference %g)' % (baseLh, testLh, maxDiff))
+      failed = failed + 1
+    elif kind == 'models':
+      baseModels = read_model_lh(out_dir, prefix + '_base')
+      error = compare_models(baseModels, read_model_lh(out_dir, prefix + '_test'), maxDiff)
+      if error:
+        print('ERROR  ' + desc + ': ' + error)
+        failed = failed + 1
+      else:
+        print('OK     ' + desc + ': %d models, best logL %.3f vs %.3f' % (len(baseModels), baseLh, testLh))
+    elif kind == 'au':
+      basePvalues = read_au_pvalues(out_dir, prefix + '_base')
+      error = compare_au(basePvalues, read_au_pvalues(out_dir, prefix + '_test'), maxDiff)
+      if error:
+        print('ERROR  ' + desc + ': ' + error)
+        failed = failed + 1
+      else:
+        print('OK     ' + desc + ': p-AU of %d trees' % len(basePvalues))
+    elif kind == 'mldist':
+      baseRows = read_mldist(out_dir, prefix + '_base')
+      error = compare_mldist(baseRows, read_mldist(out_dir, prefix + '_test'), maxDiff)
+      if error:
+        print('ERROR  ' + desc + ': ' + error)
+        failed = failed + 1
+      else:
+        print('OK     ' + desc + ': %d x %d distances' % (len(baseRows), len(baseRows)))
+    else:
+      print('OK     ' + desc + ': logL %.3f vs %.3f' % (baseLh, testLh))
+  if failed == 0 and not options.keep:
+    shutil.rmtree(out_dir)
+  else:
+    print('Output files: ' + out_dir)
+  print(str(len(checks) - failed) + ' of ' + str(len(checks)) + ' log-likelihood checks passed')
+  sys.exit(1 if failed else 0)
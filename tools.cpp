@@ -668,6 +668,7 @@ void parseArg(int argc, char *argv[], Params &params) {
     params.boundary_modifier = 1.0;
     params.dist_file = NULL;
     params.compute_obs_dist = false;
+    params.compute_pairwise_dist = false;
     params.compute_jc_dist = true;
     params.compute_ml_dist = true;
     params.compute_ml_tree = true;
@@ -715,6 +716,10 @@ void parseArg(int argc, char *argv[], Params &params) {
     params.gurobi_format = true;
     params.gurobi_threads = 1;
     params.num_bootstrap_samples = 0;
+    params.boot_workers = 1;
+    params.boot_worker_sample = -1;
+    params.argc = argc;
+    params.argv = argv;
     params.bootstrap_spec = NULL;
 
     params.aln_file = NULL;
@@ -723,6 +728,7 @@ void parseArg(int argc, char *argv[], Params &params) {
     params.topotest_replicates = 0;
     params.do_weighted_test = false;
     params.do_au_test = false;
+    params.topotest_mem = 0;
     params.siteLL_file = NULL; //added by MA
     params.partition_file = NULL;
     params.partition_type = 0;
@@ -769,6 +775,9 @@ void parseArg(int argc, char *argv[], Params &params) {
     params.model_test_again = false;
     params.model_test_and_tree = 0;
     params.model_test_separate_rate = false;
+    params.model_test_parallel = false;
+    params.model_test_prune = 0.0;
+    params.model_cache_file = NULL;
     params.optimize_mixmodel_weight = false;
     params.optimize_rate_matrix = false;
     params.store_trans_matrix = false;
@@ -803,6 +812,7 @@ void parseArg(int argc, char *argv[], Params &params) {
     params.localbp_replicates = 0;
     params.SSE = LK_EIGEN_SSE;
     params.lk_no_avx = false;
+    params.lk_no_avx512 = false;
     params.print_site_lh = WSL_NONE;
     params.print_partition_lh = false;
     params.print_site_prob = WSL_NONE;
@@ -844,6 +854,7 @@ void parseArg(int argc, char *argv[], Params &params) {
 
     params.gbo_replicates = 0;
 	params.ufboot_epsilon = 0.5;
+	params.ufboot_rell_batch = 16;
     params.check_gbo_sample_size = 0;
     params.use_rell_method = true;
     params.use_elw_method = false;
@@ -911,6 +922,12 @@ void parseArg(int argc, char *argv[], Params &params) {
 	params.count_trees = false;
 	params.print_branch_lengths = false;
 	params.lh_mem_save = LM_PER_NODE; // auto detect
+	params.lh_mem_budget = 0;
+	params.lh_float = false;
+	params.numa_first_touch = false;
+	params.site_repeats = false;
+	params.parallel_nni = false;
+	params.search_workers = 1;
 	params.start_tree = STT_PLL_PARSIMONY;
 	params.print_splits_file = false;
     params.ignore_identical_seqs = true;
@@ -1156,6 +1173,10 @@ void parseArg(int argc, char *argv[], Params &params) {
 				params.compute_obs_dist = true;
 				continue;
 			}
+			if (strcmp(argv[cnt], "-dpair") == 0) {
+				params.compute_pairwise_dist = true;
+				continue;
+			}
 			if (strcmp(argv[cnt], "-r") == 0) {
 				cnt++;
 				if (cnt >= argc)
@@ -1549,6 +1570,15 @@ void parseArg(int argc, char *argv[], Params &params) {
 				params.do_au_test = true;
 				continue;
 			}
+			if (strcmp(argv[cnt], "-zmem") == 0) {
+				cnt++;
+				if (cnt >= argc)
+					throw "Use -zmem <MB>";
+				params.topotest_mem = convert_int(argv[cnt]);
+				if (params.topotest_mem < 1)
+					throw "Memory for -zmem must be at least 1 MB";
+				continue;
+			}
 			if (strcmp(argv[cnt], "-sp") == 0) {
 				cnt++;
 				if (cnt >= argc)
@@ -1825,6 +1855,26 @@ void parseArg(int argc, char *argv[], Params &params) {
 				params.model_test_separate_rate = true;
 				continue;
 			}
+			if (strcmp(argv[cnt], "-mpar") == 0) {
+				params.model_test_parallel = true;
+				continue;
+			}
+			if (strcmp(argv[cnt], "-mprune") == 0) {
+				cnt++;
+				if (cnt >= argc)
+					throw "Use -mprune <logl_margin>";
+				params.model_test_prune = convert_double(argv[cnt]);
+				if (params.model_test_prune <= 0.0)
+					throw "Log-likelihood margin of -mprune must be positive";
+				continue;
+			}
+			if (strcmp(argv[cnt], "-mcache") == 0) {
+				cnt++;
+				if (cnt >= argc)
+					throw "Use -mcache <cache_file>";
+				params.model_cache_file = argv[cnt];
+				continue;
+			}
 			if (strcmp(argv[cnt], "-mwopt") == 0) {
 				params.optimize_mixmodel_weight = true;
 				continue;
@@ -1894,6 +1944,10 @@ void parseArg(int argc, char *argv[], Params &params) {
 				params.lk_no_avx = true;
 				continue;
 			}
+			if (strcmp(argv[cnt], "-noavx512") == 0) {
+				params.lk_no_avx512 = true;
+				continue;
+			}
 			if (strcmp(argv[cnt], "-f") == 0) {
 				cnt++;
 				if (cnt >= argc)
@@ -2127,6 +2181,24 @@ void parseArg(int argc, char *argv[], Params &params) {
 					params.consensus_type = CT_CONSENSUS_TREE;
 				continue;
 			}
+			if (strcmp(argv[cnt], "-bw") == 0) {
+				cnt++;
+				if (cnt >= argc)
+					throw "Use -bw <number_of_bootstrap_workers>";
+				params.boot_workers = convert_int(argv[cnt]);
+				if (params.boot_workers < 1)
+					throw "Number of bootstrap workers must be positive";
+				continue;
+			}
+			if (strcmp(argv[cnt], "-bwsample") == 0) {
+				cnt++;
+				if (cnt >= argc)
+					throw "Use -bwsample <replicate_ID>";
+				params.boot_worker_sample = convert_int(argv[cnt]);
+				if (params.boot_worker_sample < 0)
+					throw "Wrong bootstrap replicate ID";
+				continue;
+			}
 			if (strcmp(argv[cnt], "-iqppars") == 0) {
 				params.iqp_assess_quartet = IQP_PARSIMONY;
 				continue;
@@ -2482,6 +2554,15 @@ void parseArg(int argc, char *argv[], Params &params) {
 					throw "Epsilon must be positive";
 				continue;
 			}
+			if (strcmp(argv[cnt], "-brell") == 0) {
+				cnt++;
+				if (cnt >= argc)
+					throw "Use -brell <#trees>";
+				params.ufboot_rell_batch = convert_int(argv[cnt]);
+				if (params.ufboot_rell_batch < 1)
+					throw "Number of trees must be positive";
+				continue;
+			}
 			if (strcmp(argv[cnt], "-wbt") == 0) {
 				params.print_ufboot_trees = 1;
 				continue;
@@ -2540,6 +2621,48 @@ void parseArg(int argc, char *argv[], Params &params) {
 				params.lh_mem_save = LM_ALL_BRANCH;
 				continue;
 			}
+			if (strcmp(argv[cnt], "-mem") == 0) {
+				cnt++;
+				if (cnt >= argc)
+					throw "Use -mem <max_memory>[G|M|K]";
+				int end_pos;
+				double mem = convert_double(argv[cnt], end_pos);
+				switch (toupper(argv[cnt][end_pos])) {
+				case 'G': mem *= 1073741824.0; end_pos++; break;
+				case 'M': mem *= 1048576.0; end_pos++; break;
+				case 'K': mem *= 1024.0; end_pos++; break;
+				}
+				if (argv[cnt][end_pos] != 0 || mem < 1.0)
+					throw "Use -mem <max_memory>[G|M|K]";
+				params.lh_mem_budget = mem;
+				params.lh_mem_save = LM_MEM_SAVE;
+				continue;
+			}
+			if (strcmp(argv[cnt], "-lhfloat") == 0) {
+				params.lh_float = true;
+				continue;
+			}
+			if (strcmp(argv[cnt], "-numa") == 0) {
+				params.numa_first_touch = true;
+				continue;
+			}
+			if (strcmp(argv[cnt], "-srep") == 0) {
+				params.site_repeats = true;
+				continue;
+			}
+			if (strcmp(argv[cnt], "-pnni") == 0) {
+				params.parallel_nni = true;
+				continue;
+			}
+			if (strcmp(argv[cnt], "-sw") == 0) {
+				cnt++;
+				if (cnt >= argc)
+					throw "Use -sw <number_of_search_workers>";
+				params.search_workers = convert_int(argv[cnt]);
+				if (params.search_workers < 1)
+					throw "Number of search workers must be positive";
+				continue;
+			}
 //			if (strcmp(argv[cnt], "-storetrees") == 0) {
 //				params.store_candidate_trees = true;
 //				continue;
@@ -3070,6 +3193,15 @@ void parseArg(int argc, char *argv[], Params &params) {
     
     if (params.do_au_test && params.topotest_replicates == 0)
         outError("For AU test please please specify number of bootstrap replicates via -zb option");
+
+    if (params.parallel_nni && params.search_workers > 1)
+        outError("-pnni and -sw cannot be combined, both divide the threads among tree copies");
+
+    // the model dependent cases are checked by PhyloTree::isMemSaveSupported() when the model is known
+    if (params.lh_mem_save == LM_MEM_SAVE && (params.partition_file || params.upper_bound || params.upper_bound_NNI)) {
+        outWarning("Memory limit (-mem) is not supported for partition models and -ub, storing one partial likelihood vector per node");
+        params.lh_mem_save = LM_PER_NODE;
+    }
     
     if (!params.out_prefix) {
     	if (params.eco_dag_file)
@@ -3176,6 +3308,7 @@ void usage_iqtree(char* argv[], bool full_command) {
             << "  -pre <PREFIX>        Using <PREFIX> for output files (default: aln/partition)" << endl
 #ifdef _OPENMP
             << "  -nt <#cpu_cores>     Number of cores/threads to use (REQUIRED)" << endl
+            << "  -numa                First-touch partial likelihoods by the threads using them" << endl
 #endif
             << "  -seed <number>       Random seed number, normally used for debugging purpose" << endl
             << "  -v, -vv, -vvv        Verbose mode, printing more messages to screen" << endl
@@ -3199,6 +3332,10 @@ void usage_iqtree(char* argv[], bool full_command) {
             << "  -numstop <number>    Number of unsuccessful iterations to stop (default: 100)" << endl
             << "  -n <#iterations>     Fix number of iterations to <#iterations> (default: auto)" << endl
             << "  -g <constraint_tree> (Multifurcating) topological constraint tree file" << endl
+#ifdef _OPENMP
+            << "  -pnni                Evaluate NNIs of different branches in parallel" << endl
+            << "  -sw <#workers>       Number of perturbation+NNI descents run at the same time" << endl
+#endif
 //            << "  -iqp                 Use the IQP tree perturbation (default: randomized NNI)" << endl
 //            << "  -iqpnni              Switch back to the old IQPNNI tree search algorithm" << endl
             << endl << "ULTRAFAST BOOTSTRAP:" << endl
@@ -3210,10 +3347,12 @@ void usage_iqtree(char* argv[], bool full_command) {
 			<< "  -nstep <#iterations> #Iterations for UFBoot stopping rule (default: 100)" << endl
             << "  -bcor <min_corr>     Minimum correlation coefficient (default: 0.99)" << endl
 			<< "  -beps <epsilon>      RELL epsilon to break tie (default: 0.5)" << endl
+			<< "  -brell <#trees>      #Trees scored together against UFBoot replicates (default: 16)" << endl
             << endl << "STANDARD NON-PARAMETRIC BOOTSTRAP:" << endl
             << "  -b <#replicates>     Bootstrap + ML tree + consensus tree (>=100)" << endl
             << "  -bc <#replicates>    Bootstrap + consensus tree" << endl
             << "  -bo <#replicates>    Bootstrap only" << endl
+            << "  -bw <#workers>       Number of bootstrap replicates run at the same time" << endl
 //            << "  -t <threshold>       Minimum bootstrap support [0...1) for consensus tree" << endl
             << endl << "SINGLE BRANCH TEST:" << endl
             << "  -alrt <#replicates>  SH-like approximate likelihood ratio test (SH-aLRT)" << endl
@@ -3246,6 +3385,10 @@ void usage_iqtree(char* argv[], bool full_command) {
 //            << "  -msep                Perform model selection and then rate selection" << endl
             << "  -mtree               Performing full tree search for each model considered" << endl
             << "  -mredo               Ignoring model results computed earlier (default: no)" << endl
+            << "  -mpar                Test models in parallel instead of parallel likelihoods" << endl
+            << "  -mprune <margin>     Prune models whose logL after 3 optimization rounds plus" << endl
+            << "                       margin cannot beat the best model (heuristic, default: off)" << endl
+            << "  -mcache <file>       Reuse and store fitted models in a cache shared by runs" << endl
             << "  -madd mx1,...,mxk    List of mixture models to also consider" << endl
             << "  -mdef <nexus_file>   A model definition NEXUS file (see Manual)" << endl
 
@@ -3330,6 +3473,7 @@ void usage_iqtree(char* argv[], bool full_command) {
             << "  -zb <#replicates>    Performing BP,KH,SH,ELW tests for trees passed via -z" << endl
             << "  -zw                  Also performing weighted-KH and weighted-SH tests" << endl
             << "  -au                  Also performing approximately unbiased (AU) test" << endl
+            << "  -zmem <MB>           Streaming AU test for many trees within the memory limit" << endl
             << endl;
 
 			cout << "GENERATING RANDOM TREES:" << endl;
@@ -3358,6 +3502,10 @@ void usage_iqtree(char* argv[], bool full_command) {
 			<< "  -wpl                 Write partition log-likelihoods to .partlh file" << endl
             << "  -fconst f1,...,fN    Add constant patterns into alignment (N=#nstates)" << endl
             << "  -me <epsilon>        Logl epsilon for model parameter optimization (default 0.01)" << endl
+            << "  -noavx512            Use AVX instead of AVX-512 likelihood kernels" << endl
+            << "  -lhfloat             Store partial likelihoods in single precision" << endl
+            << "  -mem <n>[G|M|K]      Memory limit for partial likelihoods (default: none)" << endl
+            << "  -srep                Compute partial likelihoods once per repeated site pattern" << endl
             << "  --no-outfiles        Suppress printing output files" << endl;
 //            << "  -d <file>            Reading genetic distances from file (default: JC)" << endl
 //			<< "  -d <outfile>         Calculate the distance matrix inferred from tree" << endl
@@ -3666,6 +3814,15 @@ int init_random(int seed, bool write_info, int** rstream) {
     return (seed);
 } /* initrandom */
 
+int init_random_task(int seed, int task, int **rstream) {
+    // mix seed and task (splitmix64 finalizer) so that streams of consecutive tasks are unrelated
+    uint64_t x = ((uint64_t)(unsigned int)seed << 32) | (unsigned int)task;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x = x ^ (x >> 31);
+    return init_random((int)(x & 0x7fffffff), false, rstream);
+}
+
 int finish_random(int *rstream) {
     if (rstream)
         return free_sprng(rstream);
@@ -414,7 +414,7 @@ enum LikelihoodKernel {
 };
 
 enum LhMemSave {
-	LM_DETECT, LM_ALL_BRANCH, LM_PER_NODE
+	LM_DETECT, LM_ALL_BRANCH, LM_PER_NODE, LM_MEM_SAVE
 };
 
 enum SiteLoglType {
@@ -702,6 +702,10 @@ public:
     /** true to do the approximately unbiased (AU) test */
     bool do_au_test;
 
+    /** memory budget in MB of the streaming AU test, which keeps the pattern likelihoods of the trees
+        in a temporary file and processes the trees in chunks (-zmem), 0 to keep everything in RAM */
+    int topotest_mem;
+
     /**
             file specifying partition model
      */
@@ -907,6 +911,12 @@ public:
      */
     bool compute_ml_dist;
 
+    /**
+            TRUE to compute the maximum-likelihood distances pair by pair (AlignmentPairwise)
+            instead of with DistEngine, default: FALSE
+     */
+    bool compute_pairwise_dist;
+
     /**
             TRUE to compute the maximum-likelihood tree
      */
@@ -1192,6 +1202,17 @@ public:
     /** true to fist test equal rate model, then test rate heterogeneity (default: false) */
     bool model_test_separate_rate;
 
+    /** TRUE to evaluate independent candidate models concurrently, each thread on its own tree copy (-mpar) */
+    bool model_test_parallel;
+
+    /** staged model evaluation (-mprune), a heuristic: prune a model after three rounds of optimization
+        if its log-likelihood plus the largest gain of the full optimization seen so far, but at least
+        this margin, cannot beat the best model so far. 0 (default) to optimize all models fully */
+    double model_test_prune;
+
+    /** file of model test results shared across runs, keyed by data, tree and model (-mcache), NULL if none */
+    char *model_cache_file;
+
     /** TRUE to optimize mixture model weights */
     bool optimize_mixmodel_weight;
 
@@ -1301,6 +1322,19 @@ public:
     */
     char *bootstrap_spec;
 
+    /**
+        number of standard bootstrap replicates run at the same time, each in its own worker process
+        with num_threads/boot_workers threads (-bw)
+    */
+    int boot_workers;
+
+    /** ID of the only standard bootstrap replicate run by a worker process, -1 for a normal run */
+    int boot_worker_sample;
+
+    /** command line arguments of this run, passed on to the bootstrap worker processes */
+    int argc;
+    char **argv;
+
     /**
             1 if output all intermediate trees from every IQPNNI iteration
             2 if output all intermediate trees + 1-NNI-away trees
@@ -1373,6 +1407,9 @@ public:
     /** TRUE to not use AVX even available in CPU, default: FALSE */
     bool lk_no_avx;
 
+    /** TRUE to not use AVX-512 even available in CPU, default: FALSE */
+    bool lk_no_avx512;
+
     /**
      	 	WSL_NONE: do not print anything
             WSL_SITE: print site log-likelihood
@@ -1579,6 +1616,9 @@ public:
 	 */
 	double ufboot_epsilon;
 
+	/* number of candidate trees whose RELL scores are computed together against all UFBoot replicates (-brell) */
+	int ufboot_rell_batch;
+
     /**
             TRUE to check with different max_candidate_trees
      */
@@ -1725,9 +1765,28 @@ public:
 
 	/* -1 (auto-detect): will be set to 0 if there is enough memory, 1 otherwise
 	 * 0: store all partial likelihood vectors
-	 * 1: only store 1 partial likelihood vector per node */
+	 * 1: only store 1 partial likelihood vector per node
+	 * 2: keep as many partial likelihood vectors as fit into lh_mem_budget (-mem) */
 	LhMemSave lh_mem_save;
 
+	/* memory budget in bytes for partial likelihood vectors with LM_MEM_SAVE */
+	uint64_t lh_mem_budget;
+
+	/* TRUE to store partial likelihood vectors in single precision (computation stays in double) */
+	bool lh_float;
+
+	/* TRUE to let every thread first-touch the pattern blocks of the partial likelihood vectors it computes (NUMA) */
+	bool numa_first_touch;
+
+	/* TRUE to compute partial likelihoods once per site-repeat class of each subtree (-srep) */
+	bool site_repeats;
+
+	/* TRUE to evaluate the NNIs of different branches in parallel, each thread on its own tree copy (-pnni) */
+	bool parallel_nni;
+
+	/* number of perturbation + NNI descents run concurrently by the tree search, 1 for the serial search (-sw) */
+	int search_workers;
+
 	/* TRUE to print .splits file in star-dot format */
 	bool print_splits_file;
     
@@ -2188,6 +2247,16 @@ extern int *randstream;
  */
 int init_random(int seed, bool write_info = false, int** rstream = NULL);
 
+/**
+ * initialize the random stream of one of many independent tasks (e.g. bootstrap replicates),
+ * that may be run by any thread in any order
+ * @param seed seed common to all tasks
+ * @param task task ID, the stream is seeded by a hash of seed and task
+ * @param rstream (OUT) new random stream, to be freed by finish_random(rstream)
+ * @return seed of the stream
+ */
+int init_random_task(int seed, int task, int **rstream);
+
 /**
  * finalize random number generator (e.g. free memory
  */
@@ -0,0 +1,106 @@
+//
+// C++ Implementation: topologytable.cpp
+//
+// Description: TopologyTable, table of distinct tree topologies
+//
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+
+#include "topologytable.h"
+
+size_t TopologyTable::hashTopology(const string &topology) {
+    size_t sum = 0;
+    for (string::const_iterator it = topology.begin(); it != topology.end(); it++)
+        sum = (*it) + (sum << 6) + (sum << 16) - sum;
+    return sum;
+}
+
+int TopologyTable::findTopology(const string &topology, size_t hash_value) {
+    unordered_map<size_t, int>::iterator it = first_ids.find(hash_value);
+    if (it == first_ids.end())
+        return -1;
+    // resolve collisions of the hash value against the stored strings
+    for (int id = it->second; id >= 0; id = next_ids[id])
+        if (topologies[id] == topology)
+            return id;
+    return -1;
+}
+
+void TopologyTable::linkTopology(int id, size_t hash_value) {
+    unordered_map<size_t, int>::iterator it = first_ids.find(hash_value);
+    if (it == first_ids.end()) {
+        next_ids.push_back(-1);
+        first_ids[hash_value] = id;
+    } else {
+        next_ids.push_back(it->second);
+        it->second = id;
+    }
+}
+
+int TopologyTable::findTopology(const string &topology) {
+    return findTopology(topology, hashTopology(topology));
+}
+
+int TopologyTable::addTopology(const string &topology) {
+    size_t hash_value = hashTopology(topology);
+    int id = findTopology(topology, hash_value);
+    if (id >= 0)
+        return id;
+    id = topologies.size();
+    topologies.push_back(topology);
+    linkTopology(id, hash_value);
+    return id;
+}
+
+void TopologyTable::clear() {
+    topologies.clear();
+    first_ids.clear();
+    next_ids.clear();
+}
+
+void TopologyTable::compact(IntVector &ids) {
+    IntVector new_id;
+    new_id.resize(topologies.size(), -1);
+    IntVector::iterator it;
+    int count = 0;
+    for (it = ids.begin(); it != ids.end(); it++)
+        if (*it >= 0 && new_id[*it] < 0)
+            new_id[*it] = count++;
+    StrVector new_topologies;
+    new_topologies.resize(count);
+    for (int id = 0; id < topologies.size(); id++)
+        if (new_id[id] >= 0)
+            new_topologies[new_id[id]].swap(topologies[id]);
+    topologies.swap(new_topologies);
+    first_ids.clear();
+    next_ids.clear();
+    for (int id = 0; id < count; id++)
+        linkTopology(id, hashTopology(topologies[id]));
+    for (it = ids.begin(); it != ids.end(); it++)
+        if (*it >= 0)
+            *it = new_id[*it];
+}
+
+void TopologyTable::getDistinctTopologies(IntVector &ids, StrVector &trees, IntVector &weights, IntVector &index) {
+    IntVector pos;
+    pos.resize(topologies.size(), -1);
+    trees.clear();
+    weights.clear();
+    index.resize(ids.size());
+    for (int i = 0; i < ids.size(); i++) {
+        int id = ids[i];
+        if (id < 0) {
+            index[i] = -1;
+            continue;
+        }
+        if (pos[id] < 0) {
+            pos[id] = trees.size();
+            trees.push_back(topologies[id]);
+            weights.push_back(0);
+        }
+        weights[pos[id]]++;
+        index[i] = pos[id];
+    }
+}
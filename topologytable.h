@@ -0,0 +1,101 @@
+//
+// C++ Interface: topologytable.h
+//
+// Description: table of distinct tree topologies
+//
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+//
+
+#ifndef TOPOLOGYTABLE_H
+#define TOPOLOGYTABLE_H
+
+#include "alignment.h"
+
+/**
+    Table of distinct tree topologies, each stored once as a unique Newick string
+    (taxon IDs, sorted taxa, no branch lengths, see PhyloTree::getTopology()).
+    Users, e.g. the UFBoot replicates, refer to a topology by its integer ID,
+    so that identical trees are neither copied nor parsed more than once.
+    The strings are only kept in topologies, the lookup goes through their hash values.
+*/
+class TopologyTable {
+public:
+
+    /**
+        @param topology unique Newick string of a tree topology
+        @return ID of the topology, a new ID if it is not in the table yet
+    */
+    int addTopology(const string &topology);
+
+    /**
+        @param topology unique Newick string of a tree topology
+        @return ID of the topology, -1 if it is not in the table
+    */
+    int findTopology(const string &topology);
+
+    /**
+        @param id topology ID
+        @return unique Newick string of the topology
+    */
+    const string &getTopology(int id) {
+        return topologies[id];
+    }
+
+    /** @return number of topologies */
+    size_t size() {
+        return topologies.size();
+    }
+
+    /** remove all topologies */
+    void clear();
+
+    /**
+        remove the topologies not referred to by ids any more and renumber the others
+        @param[in,out] ids topology IDs in use, -1 for none
+    */
+    void compact(IntVector &ids);
+
+    /**
+        @param ids topology IDs in use, -1 for none
+        @param[out] trees unique Newick strings of the distinct topologies in ids, in order of their first occurrence
+        @param[out] weights number of occurrences of each topology in ids
+        @param[out] index position in trees of each entry of ids, -1 for none
+    */
+    void getDistinctTopologies(IntVector &ids, StrVector &trees, IntVector &weights, IntVector &index);
+
+protected:
+
+    /** unique Newick string of each topology */
+    StrVector topologies;
+
+    /** map from the hash value of the Newick string to the first topology ID with this hash value */
+    unordered_map<size_t, int> first_ids;
+
+    /** next topology ID with the same hash value, -1 for none */
+    IntVector next_ids;
+
+    /**
+        @param topology unique Newick string of a tree topology
+        @return hash value of topology, as hashfunc_Split
+    */
+    static size_t hashTopology(const string &topology);
+
+    /**
+        @param topology unique Newick string of a tree topology
+        @param hash_value hash value of topology
+        @return ID of the topology, -1 if it is not in the table
+    */
+    int findTopology(const string &topology, size_t hash_value);
+
+    /**
+        add a topology ID to the hash lookup, IDs must be linked in increasing order
+        @param id topology ID
+        @param hash_value hash value of the Newick string of the topology
+    */
+    void linkTopology(int id, size_t hash_value);
+
+};
+
+#endif
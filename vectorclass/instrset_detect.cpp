@@ -122,9 +122,9 @@ int instrset_detect(void) {
     cpuid(abcd, 7);                                        // call cpuid leaf 7 for feature flags
     if ((abcd[1] & (1 <<  5)) == 0) return iset;           // no AVX2
     iset = 8;                                              // 8: AVX2 supported
-    cpuid(abcd, 0xD);                                      // call cpuid leaf 0xD for feature flags
-    if ((abcd[0] & 0x60) != 0x60)   return iset;           // no AVX512
-    iset = 9;                                              // 8: AVX512F supported
+    if ((abcd[1] & (1 << 16)) == 0) return iset;           // no AVX512F
+    if ((xgetbv(0) & 0xE0) != 0xE0) return iset;           // AVX512 (opmask, ZMM) not enabled in O.S.
+    iset = 9;                                              // 9: AVX512F supported
     return iset;
 }
 
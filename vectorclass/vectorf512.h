@@ -1438,7 +1438,7 @@ static inline Vec8d ceil(Vec8d const & a) {
 // function round_to_int: round to nearest integer (even). (result as integer vector)
 static inline Vec8i round_to_int(Vec8d const & a) {
     //return _mm512_cvtpd_epi32(a);
-    return _mm512_cvt_roundpd_epi32(a, __MM_FROUND_NO_EXC);
+    return _mm512_cvt_roundpd_epi32(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
 }
 
 // function truncate_to_int: round towards zero. (result as integer vector)
@@ -1473,7 +1473,7 @@ static inline Vec8q round_to_int64(Vec8d const & a) {
 // result as 64-bit integer vector, but with limited range
 static inline Vec8q round_to_int64_limited(Vec8d const & a) {
     //Vec4q   b = _mm512_cvtpd_epi32(a);                             // round to 32-bit integers
-    Vec4q   b = _mm512_cvt_roundpd_epi32(a, __MM_FROUND_NO_EXC);     // round to 32-bit integers   
+    Vec4q   b = _mm512_cvt_roundpd_epi32(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);     // round to 32-bit integers   
     __m512i c = permute8q<0,-256,1,-256,2,-256,3,-256>(Vec8q(b,b));  // get bits 64-127 to position 128-191, etc.
     __m512i s = _mm512_srai_epi32(c, 31);                            // sign extension bits
     return      _mm512_unpacklo_epi32(c, s);                         // interleave with sign extensions